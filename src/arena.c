@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "arena.h"
+
+#define ALIGN(n) (((n) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+static struct arena_block *arena_block_new(struct arena_block *prev, size_t size) {
+    struct arena_block *b = malloc(sizeof *b + size);
+    if (!b) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+
+    b->prev = prev;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+void *arena_alloc(struct arena *a, size_t size) {
+    size = ALIGN(size);
+    struct arena_block *b = a->block;
+    if (b == NULL || b->size - b->used < size) {
+        // allocations that do not fit a regular block get a block of their own
+        b = a->block = arena_block_new(b, size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+    }
+
+    void *ptr = b->data + b->used;
+    b->used += size;
+    a->last = ptr;
+    return ptr;
+}
+
+/* grows (or shrinks) ptr, in place if it is the last allocation and the block has room for it */
+void *arena_realloc(struct arena *a, void *ptr, size_t old_size, size_t size) {
+    struct arena_block *b = a->block;
+    if (ptr != NULL && ptr == a->last && (char *) ptr - b->data + ALIGN(size) <= b->size) {
+        b->used = (char *) ptr - b->data + ALIGN(size);
+        return ptr;
+    }
+
+    void *new_ptr = arena_alloc(a, size);
+    if (ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    }
+    return new_ptr;
+}
+
+void arena_free(struct arena *a) {
+    struct arena_block *b = a->block;
+    while (b != NULL) {
+        struct arena_block *prev = b->prev;
+        free(b);
+        b = prev;
+    }
+
+    a->block = NULL;
+    a->last = NULL;
+}
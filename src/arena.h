@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+Bump pointer allocator. Allocations are carved out of large blocks and can not be freed one by one,
+arena_free releases all of them at once.
+*/
+struct arena {
+    struct arena_block *block;
+
+    // allocation at the top of the current block, the only one arena_realloc can grow in place
+    void *last;
+};
+
+struct arena_block {
+    struct arena_block *prev;
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) char data[];
+};
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+void *arena_alloc(struct arena *a, size_t size);
+void *arena_realloc(struct arena *a, void *ptr, size_t old_size, size_t size);
+void arena_free(struct arena *a);
+
+#endif
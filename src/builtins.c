@@ -7,24 +7,25 @@
 struct object *builtin_len(struct object_list * args);
 struct object *builtin_puts(struct object_list * args);
 
-struct object *get_builtin(char *name) {
-    static struct object len = {
-        .type = OBJ_BUILTIN,
-        .value = { .builtin = &builtin_len }
-    };
-
-    static struct object puts = {
-        .type = OBJ_BUILTIN,
-        .value = { .builtin = &builtin_puts }
-    };
-
-    if (strcmp(name, "len") == 0) {
-        return &len;
-    } else if (strcmp(name, "puts") == 0) {
-        return &puts;
+struct object builtins[BUILTINS_SIZE] = {
+    { .type = OBJ_BUILTIN, .value = { .builtin = &builtin_len } },
+    { .type = OBJ_BUILTIN, .value = { .builtin = &builtin_puts } },
+};
+
+static char *builtin_names[BUILTINS_SIZE] = {
+    "len",
+    "puts",
+};
+
+/* returns the index in builtins of the builtin with the given name, or -1 if there is none */
+int builtin_index(char *name) {
+    for (int i = 0; i < BUILTINS_SIZE; i++) {
+        if (strcmp(name, builtin_names[i]) == 0) {
+            return i;
+        }
     }
 
-    return NULL;
+    return -1;
 }
 
 struct object *builtin_len(struct object_list * args) {
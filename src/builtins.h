@@ -1,6 +1,13 @@
 #ifndef BUILTINS_H
 #define BUILTINS_H
 
-struct object *get_builtin(char *name);
+#include "object.h"
 
-#endif
\ No newline at end of file
+#define BUILTINS_SIZE 2
+
+// the builtin functions, identifiers naming one refer to it by its index, see builtin_index
+extern struct object builtins[BUILTINS_SIZE];
+
+int builtin_index(char *name);
+
+#endif
@@ -0,0 +1,299 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include "bytecode.h"
+
+// magic followed by 11 numbers, see bytecode_write for their order
+#define HEADER_SIZE (4 + 11 * 4)
+
+// a type followed by up to 4 numbers
+#define CONSTANT_SIZE (5 * 4)
+
+#define CONSTANT_INT 1
+#define CONSTANT_STRING 2
+#define CONSTANT_FUNCTION 3
+
+static uint8_t *put_u32(uint8_t *dest, uint32_t value) {
+    write_operand(dest, 4, value);
+    return dest + 4;
+}
+
+int bytecode_write(struct bytecode *bc, FILE *f) {
+    struct object_list *constants = bc->constants;
+
+    // lay out the code and string sections
+    uint32_t code_size = bc->instructions->size;
+    uint32_t strings_size = 0;
+    for (unsigned int i = 0; i < constants->size; i++) {
+        struct object *obj = constants->values[i];
+        switch (obj->type) {
+            case OBJ_INT:
+            break;
+
+            case OBJ_STRING:
+                strings_size += strlen(obj->value.string) + 1;
+            break;
+
+            case OBJ_COMPILED_FUNCTION:
+                if (is_function_stub(&obj->value.compiled_function)) {
+                    return BYTECODE_ERR_UNSUPPORTED_CONSTANT;
+                }
+                code_size += obj->value.compiled_function.instructions.size;
+            break;
+
+            default:
+                return BYTECODE_ERR_UNSUPPORTED_CONSTANT;
+        }
+    }
+
+    uint32_t constants_offset = HEADER_SIZE;
+    uint32_t code_offset = constants_offset + constants->size * CONSTANT_SIZE;
+    uint32_t strings_offset = code_offset + code_size;
+    size_t size = strings_offset + strings_size;
+    uint8_t *buf = calloc(size, 1);
+    if (!buf) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+
+    uint8_t *dest = buf;
+    memcpy(dest, BYTECODE_MAGIC, 4);
+    dest = put_u32(dest + 4, BYTECODE_VERSION);
+    dest = put_u32(dest, bc->num_globals);
+    dest = put_u32(dest, bc->call_sites);
+    dest = put_u32(dest, constants->size);
+    dest = put_u32(dest, constants_offset);
+    dest = put_u32(dest, 0);
+    dest = put_u32(dest, bc->instructions->size);
+    dest = put_u32(dest, code_offset);
+    dest = put_u32(dest, code_size);
+    dest = put_u32(dest, strings_offset);
+    dest = put_u32(dest, strings_size);
+
+    memcpy(buf + code_offset, bc->instructions->bytes, bc->instructions->size);
+    uint32_t code_pos = bc->instructions->size;
+    uint32_t string_pos = 0;
+    for (unsigned int i = 0; i < constants->size; i++) {
+        struct object *obj = constants->values[i];
+        dest = buf + constants_offset + i * CONSTANT_SIZE;
+
+        switch (obj->type) {
+            case OBJ_INT:
+                dest = put_u32(dest, CONSTANT_INT);
+                dest = put_u32(dest, (uint64_t) obj->value.integer >> 32);
+                dest = put_u32(dest, (uint64_t) obj->value.integer & 0xffffffff);
+            break;
+
+            case OBJ_STRING: {
+                size_t len = strlen(obj->value.string) + 1;
+                dest = put_u32(dest, CONSTANT_STRING);
+                dest = put_u32(dest, string_pos);
+                memcpy(buf + strings_offset + string_pos, obj->value.string, len);
+                string_pos += len;
+            }
+            break;
+
+            default: {
+                struct compiled_function *fn = &obj->value.compiled_function;
+                dest = put_u32(dest, CONSTANT_FUNCTION);
+                dest = put_u32(dest, code_pos);
+                dest = put_u32(dest, fn->instructions.size);
+                dest = put_u32(dest, fn->num_locals);
+                dest = put_u32(dest, fn->num_parameters);
+                memcpy(buf + code_offset + code_pos, fn->instructions.bytes, fn->instructions.size);
+                code_pos += fn->instructions.size;
+            }
+            break;
+        }
+    }
+
+    size_t written = fwrite(buf, 1, size, f);
+    free(buf);
+    return written == size && fflush(f) == 0 ? 0 : BYTECODE_ERR_IO;
+}
+
+bool bytecode_is_file(char *path) {
+    char magic[4];
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    bool is_bytecode = fread(magic, 1, 4, f) == 4 && memcmp(magic, BYTECODE_MAGIC, 4) == 0;
+    fclose(f);
+    return is_bytecode;
+}
+
+// whether the range [offset, offset + size) lies within a section of the given size
+static bool in_range(uint64_t offset, uint64_t size, uint64_t section_size) {
+    return offset <= section_size && size <= section_size - offset;
+}
+
+/*
+Maps a bytecode file into memory. Code and strings are used right where they are in the mapping,
+only the constant pool itself is decoded. The bytecode is not verified here, vm_new takes care of that.
+Returns NULL and sets error if the file can not be read or is not valid bytecode.
+*/
+struct bytecode *bytecode_map(char *path, int *error) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        *error = BYTECODE_ERR_IO;
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        *error = BYTECODE_ERR_IO;
+        return NULL;
+    }
+    if (st.st_size < HEADER_SIZE) {
+        close(fd);
+        *error = BYTECODE_ERR_CORRUPT;
+        return NULL;
+    }
+
+    size_t size = st.st_size;
+    uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        *error = BYTECODE_ERR_IO;
+        return NULL;
+    }
+
+    if (memcmp(data, BYTECODE_MAGIC, 4) != 0) {
+        *error = BYTECODE_ERR_BAD_MAGIC;
+        goto fail;
+    }
+    if (read_uint32(data + 4) != BYTECODE_VERSION) {
+        *error = BYTECODE_ERR_VERSION;
+        goto fail;
+    }
+
+    uint32_t num_globals = read_uint32(data + 8);
+    uint32_t call_sites = read_uint32(data + 12);
+    uint32_t num_constants = read_uint32(data + 16);
+    uint32_t constants_offset = read_uint32(data + 20);
+    uint32_t main_offset = read_uint32(data + 24);
+    uint32_t main_size = read_uint32(data + 28);
+    uint32_t code_offset = read_uint32(data + 32);
+    uint32_t code_size = read_uint32(data + 36);
+    uint32_t strings_offset = read_uint32(data + 40);
+    uint32_t strings_size = read_uint32(data + 44);
+
+    // every string has to end within the string table, so it is enough for the table to end with a NUL
+    *error = BYTECODE_ERR_CORRUPT;
+    if (!in_range(constants_offset, (uint64_t) num_constants * CONSTANT_SIZE, size)
+        || !in_range(code_offset, code_size, size)
+        || !in_range(main_offset, main_size, code_size)
+        || !in_range(strings_offset, strings_size, size)
+        || (strings_size > 0 && data[strings_offset + strings_size - 1] != '\0')) {
+        goto fail;
+    }
+
+    struct bytecode *bc = malloc(sizeof *bc);
+    struct instruction *ins = malloc(sizeof *ins);
+    struct object_list *constants = malloc(sizeof *constants);
+
+    // the constants are stored right behind the list of pointers to them
+    struct object **values = malloc(num_constants * (sizeof *values + sizeof (struct object)) + 1);
+    if (!bc || !ins || !constants || !values) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    struct object *objects = (struct object *) (values + num_constants);
+
+    for (uint32_t i = 0; i < num_constants; i++) {
+        uint8_t *record = data + constants_offset + i * CONSTANT_SIZE;
+        struct object *obj = &objects[i];
+        memset(obj, 0, sizeof *obj);
+        values[i] = obj;
+
+        switch (read_uint32(record)) {
+            case CONSTANT_INT:
+                obj->type = OBJ_INT;
+                obj->value.integer = (long) ((uint64_t) read_uint32(record + 4) << 32 | read_uint32(record + 8));
+            break;
+
+            case CONSTANT_STRING:
+                if (read_uint32(record + 4) >= strings_size) {
+                    goto fail_constants;
+                }
+                obj->type = OBJ_STRING;
+                obj->value.string = (char *) data + strings_offset + read_uint32(record + 4);
+            break;
+
+            case CONSTANT_FUNCTION: {
+                uint32_t offset = read_uint32(record + 4);
+                uint32_t fn_size = read_uint32(record + 8);
+                // only stubs have no code, and those are never written
+                if (fn_size == 0 || !in_range(offset, fn_size, code_size)) {
+                    goto fail_constants;
+                }
+                obj->type = OBJ_COMPILED_FUNCTION;
+                obj->value.compiled_function.instructions.bytes = data + code_offset + offset;
+                obj->value.compiled_function.instructions.size = fn_size;
+                obj->value.compiled_function.instructions.cap = fn_size;
+                obj->value.compiled_function.num_locals = read_uint32(record + 12);
+                obj->value.compiled_function.num_parameters = read_uint32(record + 16);
+            }
+            break;
+
+            default:
+                goto fail_constants;
+        }
+    }
+
+    ins->bytes = data + code_offset + main_offset;
+    ins->size = main_size;
+    ins->cap = main_size;
+    constants->values = values;
+    constants->size = num_constants;
+    constants->cap = num_constants;
+    constants->next = NULL;
+
+    bc->instructions = ins;
+    bc->constants = constants;
+    bc->call_sites = call_sites;
+    bc->num_globals = num_globals;
+    bc->compiler = NULL;
+    bc->mapping = data;
+    bc->mapping_size = size;
+    *error = 0;
+    return bc;
+
+    fail_constants:
+    free(values);
+    free(constants);
+    free(ins);
+    free(bc);
+
+    fail:
+    munmap(data, size);
+    return NULL;
+}
+
+void bytecode_unmap(struct bytecode *bc) {
+    munmap(bc->mapping, bc->mapping_size);
+    free(bc->constants->values);
+    free(bc->constants);
+    free(bc->instructions);
+    free(bc);
+}
+
+char *bytecode_error_str(int err) {
+    static char *messages[] = {
+        "Success",
+        "Could not read or write bytecode file",
+        "Not a bytecode file",
+        "Unsupported bytecode version",
+        "Corrupt bytecode file",
+        "Constant can not be stored in a bytecode file",
+    };
+    return messages[err];
+}
@@ -0,0 +1,36 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "opcode.h"
+#include "object.h"
+
+/*
+On-disk bytecode format. All numbers are big-endian, like instruction operands.
+
+    header          magic, version and the offset and size of each section below
+    constants       one fixed-size record per constant: its type and either an integer value,
+                    a string (offset in the string table) or a function (offset and size of its
+                    code in the code section, number of locals and parameters)
+    code            the main program followed by the code of every function
+    strings         NUL-terminated strings
+
+Every function has to be compiled before its bytecode can be written, see compile_function_stubs.
+*/
+#define BYTECODE_MAGIC "MKBC"
+#define BYTECODE_VERSION 1
+
+#define BYTECODE_ERR_IO 1
+#define BYTECODE_ERR_BAD_MAGIC 2
+#define BYTECODE_ERR_VERSION 3
+#define BYTECODE_ERR_CORRUPT 4
+#define BYTECODE_ERR_UNSUPPORTED_CONSTANT 5
+
+int bytecode_write(struct bytecode *bc, FILE *f);
+bool bytecode_is_file(char *path);
+struct bytecode *bytecode_map(char *path, int *error);
+void bytecode_unmap(struct bytecode *bc);
+char *bytecode_error_str(int err);
+
+#endif
@@ -1,11 +1,20 @@
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h> 
 #include <stdarg.h>
 #include <assert.h>
+#include <err.h>
 #include "compiler.h"
+#include "fold.h"
+#include "module.h"
 
-int compile_statement(struct compiler *compiler, struct statement *statement);
-int compile_expression(struct compiler *compiler, struct expression *expression);
+int compile_statement(struct compiler *compiler, struct ast *ast, uint32_t statement);
+int compile_expression(struct compiler *compiler, struct ast *ast, uint32_t expression);
+int compile_block_statement(struct compiler *compiler, struct ast *ast, uint32_t block);
+void compiler_set_global_function(struct compiler *c, unsigned int global, int constant);
+static void compiler_set_function_stub(struct compiler *c, unsigned int constant, struct ast *ast, uint32_t literal, int globals);
+static int single_pass_function_body(struct compiler *c, struct ast *ast, uint32_t fn);
+static int compiler_import(struct compiler *c, char *name);
 
 struct compiler *compiler_new() {
     struct compiler *c = malloc(sizeof *c);
@@ -18,6 +27,30 @@ struct compiler *compiler_new() {
     c->symbol_table = symbol_table_new();
     c->scopes[0] = scope;
     c->scope_index = 0;
+    c->global_functions = NULL;
+    c->global_functions_cap = 0;
+    c->unfoldable = NULL;
+    c->unfoldable_cap = 0;
+    c->stubs = NULL;
+    c->stubs_cap = 0;
+    c->visible_globals = -1;
+    c->call_sites = 0;
+    c->constant_slots = NULL;
+    c->constant_slots_cap = 0;
+    c->unit = false;
+    c->unit_globals = NULL;
+    c->unit_globals_cap = 0;
+    c->module_cache = NULL;
+    c->path = NULL;
+    c->modules = NULL;
+    c->modules_size = 0;
+    c->modules_cap = 0;
+    return c;
+}
+
+struct compiler *compiler_new_unit() {
+    struct compiler *c = compiler_new();
+    c->unit = true;
     return c;
 }
 
@@ -34,6 +67,12 @@ void compiler_free(struct compiler *c) {
     free_instruction(c->scopes[0].instructions);
     free_object_list(c->constants);
     symbol_table_free(c->symbol_table);
+    free(c->global_functions);
+    free(c->unfoldable);
+    free(c->stubs);
+    free(c->constant_slots);
+    free(c->unit_globals);
+    free(c->modules);
     free(c);
 }
 
@@ -43,6 +82,11 @@ char *compiler_error_str(int err) {
         "Success",
         "Unknown operator",
         "Unknown expression type",
+        "Unknown identifier",
+        "Functions nested too deeply",
+        "Syntax error in function body",
+        "Could not import module",
+        "Modules import each other",
     };
     return messages[err];
 }
@@ -57,29 +101,269 @@ struct instruction *compiler_current_instructions(struct compiler *c) {
 }
 
 unsigned int 
-add_instruction(struct compiler *c, struct instruction *ins) {
-    struct instruction *cins = compiler_current_instructions(c);
-    unsigned int pos = cins->size;
+add_constant(struct compiler *c, struct object *obj) {
+    // TODO: Dereference here?
+    return object_list_append(c->constants, obj);
+}
 
-    unsigned int new_size = cins->size + ins->size;
-    if (new_size >= cins->cap) {
-        cins->cap *= 2;
-        cins->bytes = realloc(cins->bytes, cins->cap * sizeof(*cins->bytes));
+static bool compiler_constant_is_shared(struct object *obj) {
+    return obj->type == OBJ_INT || obj->type == OBJ_STRING;
+}
+
+static unsigned long compiler_constant_hash(struct object *obj) {
+    if (obj->type == OBJ_INT) {
+        return (unsigned long) obj->value.integer * 0x9E3779B97F4A7C15ul;
     }
 
-    for (int i=0; i < ins->size; i++) {
-        cins->bytes[cins->size++] = ins->bytes[i];
+    // FNV-1a
+    unsigned long hash = 14695981039346656037ul;
+    for (char *ch = obj->value.string; *ch != '\0'; ch++) {
+        hash ^= (unsigned char) *ch;
+        hash *= 1099511628211ul;
     }
+    return hash;
+}
 
-    free_instruction(ins);
-    return pos;
+static bool compiler_constant_equals(struct object *a, struct object *b) {
+    if (a->type != b->type) {
+        return false;
+    }
+
+    return a->type == OBJ_INT ? a->value.integer == b->value.integer : strcmp(a->value.string, b->value.string) == 0;
 }
 
-unsigned int 
-add_constant(struct compiler *c, struct object *obj) {
-    // TODO: Dereference here?
-    c->constants->values[c->constants->size++] = obj;
-    return c->constants->size - 1;
+/* returns the slot holding a constant equal to obj, or the empty slot it would go in */
+static unsigned int *compiler_constant_slot(struct compiler *c, struct object *obj) {
+    unsigned int mask = c->constant_slots_cap - 1;
+    unsigned int i = compiler_constant_hash(obj) & mask;
+    while (c->constant_slots[i] != 0 && !compiler_constant_equals(c->constants->values[c->constant_slots[i] - 1], obj)) {
+        i = (i + 1) & mask;
+    }
+    return &c->constant_slots[i];
+}
+
+/* keeps the table at most half full, (re)building it from the constant pool when it grows */
+static void compiler_reserve_constant_slots(struct compiler *c) {
+    if (c->constants->size * 2 < c->constant_slots_cap) {
+        return;
+    }
+
+    unsigned int cap = c->constant_slots_cap ? c->constant_slots_cap : 64;
+    while (c->constants->size * 2 >= cap) {
+        cap *= 2;
+    }
+
+    free(c->constant_slots);
+    c->constant_slots = calloc(cap, sizeof *c->constant_slots);
+    if (!c->constant_slots) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    c->constant_slots_cap = cap;
+
+    for (unsigned int i = 0; i < c->constants->size; i++) {
+        if (compiler_constant_is_shared(c->constants->values[i])) {
+            unsigned int *slot = compiler_constant_slot(c, c->constants->values[i]);
+            if (*slot == 0) {
+                *slot = i + 1;
+            }
+        }
+    }
+}
+
+/* adds obj to the constant pool unless an equal integer or string is in there already, in which case obj is freed */
+static unsigned int add_shared_constant(struct compiler *c, struct object *obj) {
+    compiler_reserve_constant_slots(c);
+    unsigned int *slot = compiler_constant_slot(c, obj);
+    if (*slot != 0) {
+        free_object(obj);
+        return *slot - 1;
+    }
+
+    unsigned int idx = add_constant(c, obj);
+    *slot = idx + 1;
+    return idx;
+}
+
+/* integers that fit a byte are pushed with an immediate operand instead of going through the constant pool */
+static unsigned int compiler_emit_integer(struct compiler *c, long value) {
+    if (value >= 0 && value <= SHORT_OPERAND_MAX) {
+        return compiler_emit(c, OPCODE_SMALL_INT, value);
+    }
+
+    return compiler_emit(c, OPCODE_CONST, add_shared_constant(c, make_integer_object(value)));
+}
+
+/*
+The emitters below are shared by the compiler walking the AST and the single-pass compiler at the end of
+this file, which emits code for the same constructs as the parser reads them.
+*/
+static int compiler_emit_infix(struct compiler *c, enum operator operator) {
+    switch (operator) {
+        case OP_ADD:
+            compiler_emit(c, OPCODE_ADD);
+        break;
+
+        case OP_SUBTRACT:
+            compiler_emit(c, OPCODE_SUBTRACT);
+        break;
+
+        case OP_MULTIPLY: 
+            compiler_emit(c, OPCODE_MULTIPLY);
+        break;
+
+        case OP_DIVIDE: 
+            compiler_emit(c, OPCODE_DIVIDE);
+        break;
+
+        case OP_GT:
+            compiler_emit(c, OPCODE_GREATER_THAN);
+        break;
+
+        case OP_EQ: 
+            compiler_emit(c, OPCODE_EQUAL);
+        break;
+
+        case OP_NOT_EQ:
+            compiler_emit(c, OPCODE_NOT_EQUAL);
+        break;
+
+        case OP_LT:
+            compiler_emit(c, OPCODE_LESS_THAN);
+        break;
+
+        default: 
+            return COMPILE_ERR_UNKNOWN_OPERATOR;
+        break;
+    }
+
+    return 0;
+}
+
+static int compiler_emit_prefix(struct compiler *c, enum operator operator) {
+    switch (operator) {
+        case OP_NEGATE: 
+            compiler_emit(c, OPCODE_BANG);
+        break;
+
+        case OP_SUBTRACT: 
+            compiler_emit(c, OPCODE_MINUS);
+        break;
+
+        default: 
+            return COMPILE_ERR_UNKNOWN_OPERATOR;
+        break;
+    }   
+
+    return 0;
+}
+
+/* defines name in the current scope, units also keep track of the globals they define or refer to */
+static struct symbol *compiler_define(struct compiler *c, char *name, bool external) {
+    struct symbol *s = symbol_table_define(c->symbol_table, name);
+    if (!c->unit || s->scope != SCOPE_GLOBAL) {
+        return s;
+    }
+
+    if (s->index >= c->unit_globals_cap) {
+        c->unit_globals_cap = c->unit_globals_cap ? c->unit_globals_cap * 2 : 64;
+        c->unit_globals = realloc(c->unit_globals, c->unit_globals_cap * sizeof *c->unit_globals);
+        if (!c->unit_globals) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+    c->unit_globals[s->index] = (struct unit_global) { name, external };
+    return s;
+}
+
+static struct symbol_table *compiler_globals(struct compiler *c) {
+    struct symbol_table *t = c->symbol_table;
+    while (t->outer != NULL) {
+        t = t->outer;
+    }
+    return t;
+}
+
+static int compiler_visible_globals(struct compiler *c) {
+    return c->visible_globals >= 0 ? c->visible_globals : compiler_globals(c)->size;
+}
+
+/*
+Resolves name like symbol_table_resolve, into s. Function bodies see the globals as they were at their literal:
+a name bound again after that resolves to the global it was bound to there. Names that were not bound there at all
+resolve to the global defined under that name since, so functions can call the ones defined after them.
+*/
+struct symbol *compiler_resolve(struct compiler *c, char *name, struct symbol *s) {
+    struct symbol *found = symbol_table_resolve(c->symbol_table, name);
+    if (found == NULL) {
+        return NULL;
+    }
+
+    *s = *found;
+    if (s->scope == SCOPE_GLOBAL) {
+        struct symbol_table *globals = compiler_globals(c);
+        int visible = compiler_visible_globals(c);
+        int index = s->index;
+        while (index >= visible) {
+            index = symbol_table_replaced(globals, index);
+        }
+        if (index >= 0) {
+            s->index = index;
+        }
+    }
+    return s;
+}
+
+/*
+Reports names that function bodies use but that are not defined anywhere in the program, which would otherwise
+only come up once such a function is first called. For units they are external globals, like those of top-level code.
+*/
+int compiler_check_free_names(struct compiler *c, struct ast *ast, uint32_t *names, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        struct lexer lexer = new_lexer(ast->source);
+        struct token t;
+        lexer.pos = names[i];
+        gettoken(&lexer, &t);
+        char *name = ast_string(ast, ast_intern(ast, t.start, t.length));
+        if (symbol_table_resolve(c->symbol_table, name) != NULL) {
+            continue;
+        }
+        if (!c->unit) {
+            return COMPILE_ERR_UNKNOWN_IDENTIFIER;
+        }
+        compiler_define(c, name, true);
+    }
+
+    return 0;
+}
+
+static int compiler_emit_identifier(struct compiler *c, char *name) {
+    struct symbol resolved;
+    struct symbol *s = compiler_resolve(c, name, &resolved);
+
+    // function bodies are left to be compiled once linked, when the globals of every unit are known
+    if (s == NULL && c->unit && c->scope_index == 0) {
+        s = compiler_define(c, name, true);
+    }
+    if (s == NULL) {
+        return COMPILE_ERR_UNKNOWN_IDENTIFIER;
+    }
+
+    compiler_emit(c, s->scope == SCOPE_GLOBAL ? OPCODE_GET_GLOBAL : OPCODE_GET_LOCAL, s->index);
+    return 0;
+}
+
+static void compiler_emit_string(struct compiler *c, char *value) {
+    // FIXME: Copy string here
+    struct object *obj = make_string_object(value, NULL);
+    compiler_emit(c, OPCODE_CONST, add_shared_constant(c, obj));
+}
+
+/* the body is compiled by compile_function_stub once the function is first called */
+static void compiler_emit_function_stub(struct compiler *c, struct ast *ast, uint32_t fn) {
+    unsigned int idx = add_constant(c, object_null);
+    c->constants->values[idx] = make_function_stub_object(ast_list_size(ast, ast_function_parameters(ast, fn)), idx);
+    compiler_set_function_stub(c, idx, ast, fn, compiler_visible_globals(c));
+    compiler_emit(c, OPCODE_CONST, idx);
 }
 
 void compiler_set_last_instruction(struct compiler *c, enum opcode opcode, unsigned int pos) {
@@ -98,18 +382,11 @@ void compiler_remove_last_instruction(struct compiler *c) {
     c->scopes[c->scope_index].last_instruction = c->scopes[c->scope_index].previous_instruction;
 }
 
-void compiler_replace_instruction(struct compiler *c, unsigned int pos, struct instruction *ins) {
-    for (int i=0; i < ins->size; i++) {
-        c->scopes[c->scope_index].instructions->bytes[pos + i] = ins->bytes[i];
-    }
-
-    free_instruction(ins);
-}
-
-void compiler_replace_last_instruction(struct compiler *c, struct instruction *ins) {
+/* replaces the last instruction, which must have no operands, by another one without operands */
+void compiler_replace_last_instruction(struct compiler *c, enum opcode opcode) {
     int pos = compiler_current_scope(c).last_instruction.position;
-    compiler_replace_instruction(c, pos, ins);
-    compiler_set_last_instruction(c, ins->bytes[0], pos);
+    c->scopes[c->scope_index].instructions->bytes[pos] = opcode;
+    compiler_set_last_instruction(c, opcode, pos);
 }
 
 bool compiler_last_instruction_is(struct compiler *c, enum opcode opcode) {
@@ -120,38 +397,340 @@ bool compiler_last_instruction_is(struct compiler *c, enum opcode opcode) {
     return c->scopes[c->scope_index].last_instruction.opcode == opcode;
 }
 
+/* patches the operand of the instruction at pos in place, only used for jump targets since jumps are always emitted long */
 void compiler_change_operand(struct compiler *c, unsigned int pos, int operand) {
-    enum opcode opcode = c->scopes[c->scope_index].instructions->bytes[pos];
-    struct instruction *new = make_instruction(opcode, operand);
-    compiler_replace_instruction(c, pos, new);
+    uint8_t *bytes = c->scopes[c->scope_index].instructions->bytes + pos;
+    write_operand(bytes + 1, lookup(bytes[0]).operand_widths[0], operand);
 }
 
+/* encodes the instruction straight into the current scope, growing its buffer if there may not be room */
 unsigned int compiler_emit(struct compiler *c, enum opcode opcode, ...) {
+    struct instruction *cins = compiler_current_instructions(c);
+    if (cins->size + MAX_INSTRUCTION_LENGTH > cins->cap) {
+        cins->cap *= 2;
+        cins->bytes = realloc(cins->bytes, cins->cap * sizeof(*cins->bytes));
+        if (!cins->bytes) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+
     va_list args;
     va_start(args, opcode);
-    struct instruction *ins = make_instruction_va(opcode, args);
+    unsigned int pos = cins->size;
+    cins->size += write_instruction_va(cins->bytes + pos, opcode, args);
     va_end(args);
-    unsigned int pos = add_instruction(c, ins);
     compiler_set_last_instruction(c, opcode, pos);
     return pos;
 }
 
+/*
+Jump relaxation: jumps are emitted in their long form because their targets are not known yet.
+Once a function is complete, every forward jump whose distance fits a single byte is turned into its short form.
+Shrinking a jump only brings other jump targets closer, so we repeat until nothing changes.
+*/
+static void compiler_relax_jumps(struct instruction *ins) {
+    enum opcode opcode;
+    int operands[MAX_OP_SIZE];
+    unsigned int n = 0;
+    bool has_jumps = false;
+
+    for (unsigned int pos = 0; pos < ins->size; n++) {
+        pos += read_instruction(ins->bytes + pos, &opcode, operands);
+        has_jumps = has_jumps || opcode_is_jump(opcode);
+    }
+    if (!has_jumps) {
+        return;
+    }
+
+    // old and new offset of every instruction (plus the end of the function), its new length and for jumps the index of the target
+    unsigned int *old_offsets = malloc(sizeof *old_offsets * (n + 1));
+    unsigned int *new_offsets = malloc(sizeof *new_offsets * (n + 1));
+    unsigned int *lengths = malloc(sizeof *lengths * n);
+    unsigned int *targets = malloc(sizeof *targets * n);
+    unsigned int *index_at = malloc(sizeof *index_at * (ins->size + 1));
+    if (!old_offsets || !new_offsets || !lengths || !targets || !index_at) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+
+    unsigned int pos = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        lengths[i] = read_instruction(ins->bytes + pos, &opcode, operands);
+        targets[i] = opcode_is_jump(opcode) ? jump_target(opcode, pos, lengths[i], operands[0]) : 0;
+        old_offsets[i] = pos;
+        index_at[pos] = i;
+        pos += lengths[i];
+    }
+    old_offsets[n] = pos;
+    index_at[pos] = n;
+
+    // start out with every jump in its long form
+    for (unsigned int i = 0; i < n; i++) {
+        if (opcode_is_jump(ins->bytes[old_offsets[i]])) {
+            targets[i] = index_at[targets[i]];
+            lengths[i] = 1 + lookup(OPCODE_JUMP).operand_widths[0];
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        new_offsets[0] = 0;
+        for (unsigned int i = 0; i < n; i++) {
+            new_offsets[i + 1] = new_offsets[i] + lengths[i];
+        }
+
+        for (unsigned int i = 0; i < n; i++) {
+            if (!opcode_is_jump(ins->bytes[old_offsets[i]]) || lengths[i] == 2) {
+                continue;
+            }
+
+            // backward jumps keep their long form
+            unsigned int next = new_offsets[i] + 2;
+            if (new_offsets[targets[i]] >= next && new_offsets[targets[i]] - next <= SHORT_OPERAND_MAX) {
+                lengths[i] = 2;
+                changed = true;
+            }
+        }
+    }
+
+    if (new_offsets[n] > ins->cap) {
+        ins->cap = new_offsets[n];
+    }
+    uint8_t *bytes = malloc(sizeof *bytes * ins->cap);
+    if (!bytes) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    for (unsigned int i = 0; i < n; i++) {
+        uint8_t *src = ins->bytes + old_offsets[i];
+        uint8_t *dst = bytes + new_offsets[i];
+        if (!opcode_is_jump(src[0])) {
+            memcpy(dst, src, lengths[i]);
+            continue;
+        }
+
+        bool conditional = src[0] == OPCODE_JUMP_NOT_TRUE || src[0] == OPCODE_JUMP_NOT_TRUE_SHORT;
+        unsigned int target = new_offsets[targets[i]];
+        if (lengths[i] == 2) {
+            dst[0] = conditional ? OPCODE_JUMP_NOT_TRUE_SHORT : OPCODE_JUMP_SHORT;
+            dst[1] = target - (new_offsets[i] + 2);
+        } else {
+            dst[0] = conditional ? OPCODE_JUMP_NOT_TRUE : OPCODE_JUMP;
+            write_operand(dst + 1, lengths[i] - 1, target);
+        }
+    }
+
+    free(ins->bytes);
+    ins->bytes = bytes;
+    ins->size = new_offsets[n];
+
+    free(old_offsets);
+    free(new_offsets);
+    free(lengths);
+    free(targets);
+    free(index_at);
+}
+
+/* functions bound to globals the code being compiled does not see yet are left out, see compiler_resolve */
+int compiler_global_function(struct compiler *c, unsigned int global) {
+    if (global >= c->global_functions_cap || global >= compiler_visible_globals(c)) {
+        return -1;
+    }
+
+    return c->global_functions[global];
+}
+
+void compiler_set_global_function(struct compiler *c, unsigned int global, int constant) {
+    if (global >= c->global_functions_cap) {
+        unsigned int cap = c->global_functions_cap ? c->global_functions_cap : 64;
+        while (cap <= global) {
+            cap *= 2;
+        }
+
+        c->global_functions = realloc(c->global_functions, cap * sizeof *c->global_functions);
+        if (!c->global_functions) err(EXIT_FAILURE, "out of memory");
+        for (int i = c->global_functions_cap; i < cap; i++) {
+            c->global_functions[i] = -1;
+        }
+        c->global_functions_cap = cap;
+    }
+
+    c->global_functions[global] = constant;
+}
+
+bool compiler_function_unfoldable(struct compiler *c, unsigned int constant) {
+    return constant < c->unfoldable_cap && c->unfoldable[constant];
+}
+
+void compiler_set_function_unfoldable(struct compiler *c, unsigned int constant) {
+    if (constant >= c->unfoldable_cap) {
+        unsigned int cap = c->unfoldable_cap ? c->unfoldable_cap : 64;
+        while (cap <= constant) {
+            cap *= 2;
+        }
+
+        c->unfoldable = realloc(c->unfoldable, cap * sizeof *c->unfoldable);
+        if (!c->unfoldable) err(EXIT_FAILURE, "out of memory");
+        for (int i = c->unfoldable_cap; i < cap; i++) {
+            c->unfoldable[i] = false;
+        }
+        c->unfoldable_cap = cap;
+    }
+
+    c->unfoldable[constant] = true;
+}
+
+/* returns where the literal of the function stub at the given constant index is, or NULL if it is not a stub */
+struct function_stub *compiler_function_stub(struct compiler *c, unsigned int constant) {
+    if (constant >= c->stubs_cap || c->stubs[constant].ast == NULL) {
+        return NULL;
+    }
+
+    return &c->stubs[constant];
+}
+
+static void compiler_set_function_stub(struct compiler *c, unsigned int constant, struct ast *ast, uint32_t literal, int globals) {
+    if (constant >= c->stubs_cap) {
+        unsigned int cap = c->stubs_cap ? c->stubs_cap : 64;
+        while (cap <= constant) {
+            cap *= 2;
+        }
+
+        c->stubs = realloc(c->stubs, cap * sizeof *c->stubs);
+        if (!c->stubs) err(EXIT_FAILURE, "out of memory");
+        for (int i = c->stubs_cap; i < cap; i++) {
+            c->stubs[i].ast = NULL;
+        }
+        c->stubs_cap = cap;
+    }
+
+    c->stubs[constant].ast = ast;
+    c->stubs[constant].literal = literal;
+    c->stubs[constant].globals = globals;
+}
+
 int
 compile_program(struct compiler *compiler, struct program *program) {
     int err;
-    for (int i=0; i < program->size; i++) {
-        err = compile_statement(compiler, &program->statements[i]);
+    struct ast *ast = &program->ast;
+    uint32_t statements = ast->nodes[program->statements].lhs;
+    for (int i=0; i < ast_list_size(ast, statements); i++) {
+        uint32_t stmt = ast_list_item(ast, statements, i);
+        if (ast->nodes[stmt].type == STMT_IMPORT) {
+            err = compiler_import(compiler, ast_string(ast, ast->nodes[stmt].lhs));
+        } else {
+            err = compile_statement(compiler, ast, stmt);
+        }
         if (err) return err;
+
+        /* 
+        A top-level let statement is the only place a global slot is ever assigned, 
+        so a slot bound to a function literal here holds that function for the rest of the program.
+        */
+        if (ast->nodes[stmt].type == STMT_LET && ast->nodes[ast->nodes[stmt].rhs].type == EXPR_FUNCTION) {
+            uint32_t name = ast->nodes[ast->nodes[stmt].lhs].lhs;
+            struct symbol *s = symbol_table_resolve(compiler->symbol_table, ast_string(ast, name));
+            struct emitted_instruction ins = compiler_current_scope(compiler).previous_instruction;
+            enum opcode opcode;
+            int operands[MAX_OP_SIZE];
+            read_instruction(compiler_current_instructions(compiler)->bytes + ins.position, &opcode, operands);
+            assert(opcode == OPCODE_CONST || opcode == OPCODE_CONST_SHORT);
+            compiler_set_global_function(compiler, s->index, operands[0]);
+        }
     }
 
+    // units leave this to the program they are linked into, whose later units can define the names
+    if (!compiler->unit) {
+        err = compiler_check_free_names(compiler, ast, ast->free_names, ast->free_names_size);
+        if (err) return err;
+    }
+
+    compiler_relax_jumps(compiler_current_instructions(compiler));
     return 0;
 }
 
 int
-compile_block_statement(struct compiler *compiler, struct block_statement *block) {
+compile_function_literal(struct compiler *c, struct ast *ast, uint32_t fn, struct object **obj) {
     int err;
-    for (int i=0; i < block->size; i++) {
-        err = compile_statement(compiler, &block->statements[i]);
+    if (!ast->single_pass && parse_function_body(ast, fn) != 0) {
+        return COMPILE_ERR_SYNTAX;
+    }
+
+    compiler_enter_scope(c);
+
+    uint32_t parameters = ast_function_parameters(ast, fn);
+    for (int i=0; i < ast_list_size(ast, parameters); i++) {
+        symbol_table_define(c->symbol_table, ast_string(ast, ast_list_item(ast, parameters, i)));
+    }
+
+    if (ast->single_pass) {
+        err = single_pass_function_body(c, ast, fn);
+    } else {
+        err = compile_block_statement(c, ast, ast->nodes[fn].rhs);
+    }
+    if (err) return err;
+
+    if (compiler_last_instruction_is(c, OPCODE_POP)) {
+        compiler_replace_last_instruction(c, OPCODE_RETURN_VALUE);
+    } else if (!compiler_last_instruction_is(c, OPCODE_RETURN_VALUE)) {
+        compiler_emit(c, OPCODE_RETURN);
+    }
+
+    unsigned int num_locals = c->symbol_table->size;
+    struct instruction *ins = compiler_leave_scope(c);
+    compiler_relax_jumps(ins);
+    *obj = make_compiled_function_object(ins, num_locals);
+    (*obj)->value.compiled_function.num_parameters = ast_list_size(ast, parameters);
+    return 0;
+}
+
+/*
+Compiles the body of the function stub at the given constant index and replaces the stub in the pool.
+Bodies are compiled as if they appeared at the top level, against the globals that were defined at their
+literal (see compiler_resolve), and only calls to the functions bound to those are folded or made direct.
+Does nothing if the function was compiled before.
+*/
+int
+compile_function_stub(struct compiler *c, unsigned int constant) {
+    struct function_stub *stub = compiler_function_stub(c, constant);
+    if (stub == NULL) {
+        return 0;
+    }
+    if (c->scope_index + 1 >= sizeof c->scopes / sizeof c->scopes[0]) {
+        return COMPILE_ERR_NESTING_TOO_DEEP;
+    }
+
+    struct symbol_table *symbol_table = c->symbol_table;
+    unsigned int scope_index = c->scope_index;
+    int visible_globals = c->visible_globals;
+    c->symbol_table = compiler_globals(c);
+    c->visible_globals = stub->globals;
+
+    // the constant reads as null while compiling, so folding a recursive call does not try to compile it again
+    struct object *obj;
+    struct object *stub_obj = c->constants->values[constant];
+    c->constants->values[constant] = object_null;
+    int err = compile_function_literal(c, stub->ast, stub->literal, &obj);
+    if (err) {
+        while (c->scope_index > scope_index) {
+            free_instruction(compiler_leave_scope(c));
+        }
+        c->constants->values[constant] = stub_obj;
+    } else {
+        c->constants->values[constant] = obj;
+        c->stubs[constant].ast = NULL;
+        free_object(stub_obj);
+    }
+
+    c->symbol_table = symbol_table;
+    c->visible_globals = visible_globals;
+    return err;
+}
+
+/* compiles every function that is still a stub, including ones that only show up while compiling others */
+int
+compile_function_stubs(struct compiler *c) {
+    for (unsigned int i = 0; i < c->constants->size; i++) {
+        int err = compile_function_stub(c, i);
         if (err) return err;
     }
 
@@ -159,116 +738,95 @@ compile_block_statement(struct compiler *compiler, struct block_statement *block
 }
 
 int
-compile_statement(struct compiler *c, struct statement *stmt) {
+compile_block_statement(struct compiler *compiler, struct ast *ast, uint32_t block) {
     int err;
-    switch (stmt->type) {
-        case STMT_EXPR: {
-            err = compile_expression(c, stmt->value);
-            if (err) return err;
+    uint32_t statements = ast->nodes[block].lhs;
+    for (int i=0; i < ast_list_size(ast, statements); i++) {
+        err = compile_statement(compiler, ast, ast_list_item(ast, statements, i));
+        if (err) return err;
+    }
 
-            compiler_emit(c, OPCODE_POP);
-        }
-        break;
+    return 0;
+}
 
+int
+compile_statement(struct compiler *c, struct ast *ast, uint32_t stmt) {
+    int err;
+    struct node n = ast->nodes[stmt];
+    switch (n.type) {
         case STMT_LET: {
-            struct symbol *s = symbol_table_define(c->symbol_table, stmt->name.value);
-            err = compile_expression(c, stmt->value);
+            // copied, as compiling the value can define the globals it refers to in the same table
+            struct symbol s = *compiler_define(c, ast_string(ast, ast->nodes[n.lhs].lhs), false);
+            err = compile_expression(c, ast, n.rhs);
             if (err) return err;
-            compiler_emit(c, s->scope == SCOPE_GLOBAL ? OPCODE_SET_GLOBAL : OPCODE_SET_LOCAL, s->index);
+            compiler_emit(c, s.scope == SCOPE_GLOBAL ? OPCODE_SET_GLOBAL : OPCODE_SET_LOCAL, s.index);
         }
         break;
 
         case STMT_RETURN: {
-            err = compile_expression(c, stmt->value);
+            err = compile_expression(c, ast, n.lhs);
             if (err) return err;
             compiler_emit(c, OPCODE_RETURN_VALUE);
         }
         break;
+
+        // modules can only be imported by top-level statements, see compile_program
+        case STMT_IMPORT:
+            return COMPILE_ERR_SYNTAX;
+        break;
+
+        // anything else is an expression statement
+        default: {
+            err = compile_expression(c, ast, stmt);
+            if (err) return err;
+
+            compiler_emit(c, OPCODE_POP);
+        }
+        break;
     }
 
     return 0;
 }
 
 
+/*
+Nodes are copied out of the AST before compiling their children: compiling a call can parse the body of a
+function that was pre-parsed, which adds nodes to the AST and may move them.
+*/
 int 
-compile_expression(struct compiler *c, struct expression *expr) {
+compile_expression(struct compiler *c, struct ast *ast, uint32_t expr) {
     int err;
-    switch (expr->type) {
+    struct node n = ast->nodes[expr];
+    switch (n.type) {
         case EXPR_INFIX: {
-            err = compile_expression(c, expr->infix.left);
+            err = compile_expression(c, ast, n.lhs);
             if (err) return err;
 
-            err = compile_expression(c, expr->infix.right);
+            err = compile_expression(c, ast, n.rhs);
             if (err) return err;
 
-            switch (expr->infix.operator) {
-                case OP_ADD:
-                    compiler_emit(c, OPCODE_ADD);
-                break;
-
-                case OP_SUBTRACT:
-                    compiler_emit(c, OPCODE_SUBTRACT);
-                break;
-
-                case OP_MULTIPLY: 
-                    compiler_emit(c, OPCODE_MULTIPLY);
-                break;
-
-                case OP_DIVIDE: 
-                    compiler_emit(c, OPCODE_DIVIDE);
-                break;
-
-                case OP_GT:
-                    compiler_emit(c, OPCODE_GREATER_THAN);
-                break;
-
-                case OP_EQ: 
-                    compiler_emit(c, OPCODE_EQUAL);
-                break;
-
-                case OP_NOT_EQ:
-                    compiler_emit(c, OPCODE_NOT_EQUAL);
-                break;
-
-                case OP_LT:
-                    compiler_emit(c, OPCODE_LESS_THAN);
-                break;
-
-                default: 
-                    return COMPILE_ERR_UNKNOWN_OPERATOR;
-                break;
-            }
+            err = compiler_emit_infix(c, n.operator);
+            if (err) return err;
         }
         break;   
 
         case EXPR_PREFIX: {
-            err = compile_expression(c, expr->prefix.right);
+            err = compile_expression(c, ast, n.lhs);
             if (err) return err;
 
-            switch (expr->prefix.operator) {
-                case OP_NEGATE: 
-                    compiler_emit(c, OPCODE_BANG);
-                break;
-
-                case OP_SUBTRACT: 
-                    compiler_emit(c, OPCODE_MINUS);
-                break;
-
-                default: 
-                    return COMPILE_ERR_UNKNOWN_OPERATOR;
-                break;
-            }   
+            err = compiler_emit_prefix(c, n.operator);
+            if (err) return err;
         }
         break;
 
         case EXPR_IF: {
-            err = compile_expression(c, expr->ifelse.condition);
+            err = compile_expression(c, ast, n.lhs);
             if (err) return err;
 
             /* we don't know where to jump yet, so we use 9999 as placeholder */
             unsigned int jump_if_not_true_pos = compiler_emit(c, OPCODE_JUMP_NOT_TRUE, 9999);
 
-            err = compile_block_statement(c, expr->ifelse.consequence);
+            err = compile_block_statement(c, ast, ast_if_consequence(ast, expr));
             if (err) { return err; }
 
             if (compiler_last_instruction_is(c, OPCODE_POP)) {
@@ -279,8 +837,8 @@ compile_expression(struct compiler *c, struct expression *expr) {
             unsigned int after_conseq_pos = c->scopes[c->scope_index].instructions->size;
             compiler_change_operand(c, jump_if_not_true_pos, after_conseq_pos);
 
-            if (expr->ifelse.alternative) {
-                err = compile_block_statement(c, expr->ifelse.alternative);
+            if (ast_if_alternative(ast, expr) != AST_NONE) {
+                err = compile_block_statement(c, ast, ast_if_alternative(ast, expr));
                 if (err) return err; 
 
                 if (compiler_last_instruction_is(c, OPCODE_POP)) {
@@ -296,13 +854,12 @@ compile_expression(struct compiler *c, struct expression *expr) {
         break;
 
         case EXPR_INT: {
-            struct object *obj = make_integer_object(expr->integer);
-            compiler_emit(c,  OPCODE_CONST, add_constant(c, obj));
+            compiler_emit_integer(c, (int) n.lhs);
             break;
         }
 
         case EXPR_BOOL: {
-            if (expr->boolean) {
+            if (n.lhs) {
                 compiler_emit(c, OPCODE_TRUE);
             } else {
                 compiler_emit(c, OPCODE_FALSE);
@@ -310,54 +867,62 @@ compile_expression(struct compiler *c, struct expression *expr) {
         }
         break;
 
-        case EXPR_STRING: {
-            // FIXME: Copy string here
-            struct object *obj = make_string_object(expr->string, NULL);
-            compiler_emit(c, OPCODE_CONST, add_constant(c, obj));
-        }
+        case EXPR_STRING:
+            compiler_emit_string(c, ast_string(ast, n.lhs));
         break;
 
-        case EXPR_IDENT: {
-            struct symbol *s = symbol_table_resolve(c->symbol_table, expr->ident.value);
-            assert(s != NULL);
-            compiler_emit(c, s->scope == SCOPE_GLOBAL ? OPCODE_GET_GLOBAL : OPCODE_GET_LOCAL, s->index);
-        }
+        case EXPR_IDENT:
+            err = compiler_emit_identifier(c, ast_string(ast, n.lhs));
+            if (err) return err;
         break;
 
-        case EXPR_FUNCTION: {
-            compiler_enter_scope(c);
+        case EXPR_FUNCTION:
+            compiler_emit_function_stub(c, ast, expr);
+        break;
 
-            for (int i=0; i < expr->function.parameters.size; i++) {
-                symbol_table_define(c->symbol_table, expr->function.parameters.values[i].value);
+        case EXPR_CALL: {
+            struct object result;
+            if (fold_call_expression(c, ast, expr, &result)) {
+                switch (result.type) {
+                    case OBJ_INT:
+                        compiler_emit_integer(c, result.value.integer);
+                    break;
+                    case OBJ_BOOL:
+                        compiler_emit(c, result.value.boolean ? OPCODE_TRUE : OPCODE_FALSE);
+                    break;
+                    default:
+                        compiler_emit(c, OPCODE_NULL);
+                    break;
+                }
+                break;
             }
 
-            err = compile_block_statement(c, expr->function.body);
-            if (err) return err;
-
-            if (compiler_last_instruction_is(c, OPCODE_POP)) {
-                compiler_replace_last_instruction(c, make_instruction(OPCODE_RETURN_VALUE));
-            } else if (!compiler_last_instruction_is(c, OPCODE_RETURN_VALUE)) {
-                compiler_emit(c, OPCODE_RETURN);
+            /* calls to a known global function skip loading the global and refer to its constant directly */
+            int fn = -1;
+            if (ast->nodes[n.lhs].type == EXPR_IDENT) {
+                struct symbol resolved;
+                struct symbol *s = compiler_resolve(c, ast_string(ast, ast->nodes[n.lhs].lhs), &resolved);
+                if (s != NULL && s->scope == SCOPE_GLOBAL) {
+                    fn = compiler_global_function(c, s->index);
+                }
             }
 
-            unsigned int num_locals = c->symbol_table->size;
-            struct instruction *ins = compiler_leave_scope(c);
-            struct object *obj = make_compiled_function_object(ins, num_locals);
-            compiler_emit(c, OPCODE_CONST, add_constant(c, obj));
-        }
-        break;
-
-        case EXPR_CALL: {
-            err = compile_expression(c, expr->call.function);
-            if (err) return err;
+            if (fn < 0) {
+                err = compile_expression(c, ast, n.lhs);
+                if (err) return err;
+            }
 
             int i = 0;
-            for (; i < expr->call.arguments.size; i++) {
-                err = compile_expression(c, expr->call.arguments.values[i]);
+            for (; i < ast_list_size(ast, n.rhs); i++) {
+                err = compile_expression(c, ast, ast_list_item(ast, n.rhs, i));
                 if (err) return err;
             }
 
-            compiler_emit(c, OPCODE_CALL, i);
+            if (fn < 0) {
+                compiler_emit(c, OPCODE_CALL, i, c->call_sites++);
+            } else {
+                compiler_emit(c, OPCODE_CALL_CONST, fn, i);
+            }
         }
         break;
 
@@ -374,6 +939,11 @@ get_bytecode(struct compiler *c) {
     struct bytecode *b = malloc(sizeof *b);
     b->instructions = compiler_current_instructions(c);
     b->constants = c->constants;
+    b->call_sites = c->call_sites;
+    b->num_globals = c->symbol_table->size;
+    b->compiler = c;
+    b->mapping = NULL;
+    b->mapping_size = 0;
     return b;
 }
 
@@ -404,3 +974,640 @@ compiler_leave_scope(struct compiler *c) {
     c->scope_index--;
     return ins;
 }
+
+/* where the constants, globals and call sites of a unit end up in the compiler it is linked into */
+struct link_map {
+    unsigned int *constants;
+    unsigned int *globals;
+    unsigned int call_sites;
+
+    // number of c's globals that code seeing the first i globals of the unit sees, see compiler_resolve
+    int *visible;
+};
+
+/*
+Emits the instructions of ins into the current scope, with their constants, globals and call sites moved according to map.
+Operands may need a different encoding afterwards, so jumps are emitted long and pointed at the new offsets of their targets;
+the caller relaxes them again.
+*/
+static void compiler_emit_relocated(struct compiler *c, struct instruction *ins, struct link_map *map) {
+    unsigned int *moved = malloc(sizeof *moved * (ins->size + 1));
+    unsigned int *jumps = malloc(sizeof *jumps * (ins->size + 1));
+    if (!moved || !jumps) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+
+    enum opcode opcode;
+    int operands[MAX_OP_SIZE];
+    unsigned int num_jumps = 0;
+    for (unsigned int pos = 0; pos < ins->size;) {
+        unsigned int length = read_instruction(ins->bytes + pos, &opcode, operands);
+        if (opcode_is_jump(opcode)) {
+            operands[0] = jump_target(opcode, pos, length, operands[0]);
+        }
+
+        opcode = opcode_long_form(opcode);
+        switch (opcode) {
+            case OPCODE_CONST:
+            case OPCODE_CALL_CONST:
+                operands[0] = map->constants[operands[0]];
+            break;
+            case OPCODE_GET_GLOBAL:
+            case OPCODE_SET_GLOBAL:
+                operands[0] = map->globals[operands[0]];
+            break;
+            case OPCODE_CALL:
+                operands[1] += map->call_sites;
+            break;
+            default:
+            break;
+        }
+
+        moved[pos] = compiler_emit(c, opcode, operands[0], operands[1]);
+        if (opcode_is_jump(opcode)) {
+            jumps[num_jumps++] = moved[pos];
+        }
+        pos += length;
+    }
+    moved[ins->size] = compiler_current_instructions(c)->size;
+
+    // jumps still hold their old target
+    for (unsigned int i = 0; i < num_jumps; i++) {
+        read_instruction(compiler_current_instructions(c)->bytes + jumps[i], &opcode, operands);
+        compiler_change_operand(c, jumps[i], moved[operands[0]]);
+    }
+
+    free(moved);
+    free(jumps);
+}
+
+/* appends ins to the current scope, long jumps in ins are absolute and have to move along with it */
+static void compiler_append(struct compiler *c, struct instruction *ins) {
+    struct instruction *cins = compiler_current_instructions(c);
+    if (cins->size + ins->size > cins->cap) {
+        cins->cap = cins->size + ins->size;
+        cins->bytes = realloc(cins->bytes, cins->cap * sizeof(*cins->bytes));
+        if (!cins->bytes) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+
+    unsigned int base = cins->size;
+    memcpy(cins->bytes + base, ins->bytes, ins->size);
+    cins->size += ins->size;
+
+    enum opcode opcode;
+    int operands[MAX_OP_SIZE];
+    for (unsigned int pos = 0; pos < ins->size;) {
+        unsigned int length = read_instruction(ins->bytes + pos, &opcode, operands);
+        if (opcode == OPCODE_JUMP || opcode == OPCODE_JUMP_NOT_TRUE) {
+            compiler_change_operand(c, base + pos, base + operands[0]);
+        }
+        if (length > 0 && pos + length == ins->size) {
+            compiler_set_last_instruction(c, opcode, base + pos);
+        }
+        pos += length;
+    }
+}
+
+static void compiler_add_module(struct compiler *c, struct module *m) {
+    if (c->modules_size == c->modules_cap) {
+        c->modules_cap = c->modules_cap ? c->modules_cap * 2 : 8;
+        c->modules = realloc(c->modules, c->modules_cap * sizeof *c->modules);
+        if (!c->modules) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+    c->modules[c->modules_size++] = m;
+}
+
+/*
+Links a unit into c, after the modules it imports: its constants go to the end of c's pool (or to integers and strings
+c already has), its globals get slots after c's, with external ones resolving to the global of that name c has, and its
+top-level code is appended to c's. Functions that were not compiled yet are compiled by c when first called, against
+the globals of c that their literal sees. Unless copy is set, the unit's constants and code are moved rather than copied.
+*/
+static int compiler_link_unit(struct compiler *c, struct compiler *unit, bool copy) {
+    for (unsigned int i = 0; i < unit->modules_size; i++) {
+        int error = compiler_link_module(c, unit->modules[i]);
+        if (error) return error;
+    }
+
+    struct link_map map = {
+        .constants = malloc(sizeof *map.constants * (unit->constants->size + 1)),
+        .globals = malloc(sizeof *map.globals * (unit->symbol_table->size + 1)),
+        .call_sites = c->call_sites,
+        .visible = malloc(sizeof *map.visible * (unit->symbol_table->size + 1)),
+    };
+    if (!map.constants || !map.globals || !map.visible) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+
+    int error = 0;
+    map.visible[0] = c->symbol_table->size;
+    for (unsigned int i = 0; i < unit->symbol_table->size; i++) {
+        struct unit_global g = unit->unit_globals[i];
+        if (g.external) {
+            struct symbol *s = symbol_table_resolve(c->symbol_table, g.name);
+            if (s == NULL) {
+                error = COMPILE_ERR_UNKNOWN_IDENTIFIER;
+                goto out;
+            }
+            map.globals[i] = s->index;
+        } else {
+            map.globals[i] = symbol_table_define(c->symbol_table, g.name)->index;
+        }
+        map.visible[i + 1] = map.visible[i] > map.globals[i] ? map.visible[i] : map.globals[i] + 1;
+    }
+
+    // functions get their place in the pool now, so that calls to them can be relocated, and are filled in below
+    unsigned int num_constants = unit->constants->size;
+    for (unsigned int i = 0; i < num_constants; i++) {
+        struct object *obj = unit->constants->values[i];
+        if (compiler_constant_is_shared(obj)) {
+            map.constants[i] = add_shared_constant(c, copy ? copy_object(obj) : obj);
+        } else {
+            map.constants[i] = add_constant(c, obj);
+        }
+    }
+    if (!copy) {
+        unit->constants->size = 0;
+    }
+    c->call_sites += unit->call_sites;
+
+    // stubs keep their own index, code compiled while folding calls in the unit is relocated like the top-level code
+    for (unsigned int i = 0; i < num_constants; i++) {
+        struct object *obj = c->constants->values[map.constants[i]];
+        if (obj->type != OBJ_COMPILED_FUNCTION) {
+            continue;
+        }
+        struct function_stub *stub = compiler_function_stub(unit, i);
+        if (stub != NULL) {
+            if (copy) {
+                obj = make_function_stub_object(obj->value.compiled_function.num_parameters, map.constants[i]);
+                c->constants->values[map.constants[i]] = obj;
+            }
+            obj->value.compiled_function.constant = map.constants[i];
+            compiler_set_function_stub(c, map.constants[i], stub->ast, stub->literal, map.visible[stub->globals]);
+            continue;
+        }
+
+        compiler_enter_scope(c);
+        compiler_emit_relocated(c, &obj->value.compiled_function.instructions, &map);
+        struct instruction *ins = compiler_leave_scope(c);
+        compiler_relax_jumps(ins);
+        if (copy) {
+            struct object *fn = make_compiled_function_object(ins, obj->value.compiled_function.num_locals);
+            fn->value.compiled_function.num_parameters = obj->value.compiled_function.num_parameters;
+            c->constants->values[map.constants[i]] = fn;
+        } else {
+            free(obj->value.compiled_function.instructions.bytes);
+            obj->value.compiled_function.instructions = *ins;
+        }
+        free(ins);
+    }
+
+    for (unsigned int i = 0; i < unit->symbol_table->size && i < unit->global_functions_cap; i++) {
+        if (unit->global_functions[i] >= 0 && !unit->unit_globals[i].external) {
+            compiler_set_global_function(c, map.globals[i], map.constants[unit->global_functions[i]]);
+            if (compiler_function_unfoldable(unit, unit->global_functions[i])) {
+                compiler_set_function_unfoldable(c, map.constants[unit->global_functions[i]]);
+            }
+        }
+    }
+
+    // the top-level code is relocated and relaxed on its own, so linking many units does not go over c's code every time
+    compiler_enter_scope(c);
+    compiler_emit_relocated(c, unit->scopes[0].instructions, &map);
+    struct instruction *ins = compiler_leave_scope(c);
+    compiler_relax_jumps(ins);
+    compiler_append(c, ins);
+    free_instruction(ins);
+    if (!copy) {
+        unit->scopes[0].instructions->size = 0;
+    }
+
+out:
+    free(map.constants);
+    free(map.globals);
+    free(map.visible);
+    return error;
+}
+
+/*
+Links a unit into c, see compiler_link_unit. Returns COMPILE_ERR_UNKNOWN_IDENTIFIER if an external global is not
+defined in c. The unit is left empty either way.
+*/
+int compiler_link(struct compiler *c, struct compiler *unit) {
+    return compiler_link_unit(c, unit, false);
+}
+
+/* links a copy of the module into c, unless c has it already; modules are shared, so they are left as they are */
+int compiler_link_module(struct compiler *c, struct module *m) {
+    for (unsigned int i = 0; i < c->modules_size; i++) {
+        if (c->modules[i] == m) {
+            return 0;
+        }
+    }
+
+    compiler_add_module(c, m);
+    return compiler_link_unit(c, m->unit, true);
+}
+
+/*
+Imports the module at path name. Compilers link it in right away, units instead declare every global the module has
+as an external one of their own and leave the module to be linked ahead of them.
+*/
+static int compiler_import(struct compiler *c, char *name) {
+    struct module *m;
+    int error = module_load(c->module_cache, c->path, name, &m);
+    if (error) return error;
+    if (!c->unit) {
+        return compiler_link_module(c, m);
+    }
+
+    for (unsigned int i = 0; i < c->modules_size; i++) {
+        if (c->modules[i] == m) {
+            return 0;
+        }
+    }
+    compiler_add_module(c, m);
+
+    for (unsigned int i = 0; i < m->unit->symbol_table->size; i++) {
+        char *global = m->unit->unit_globals[i].name;
+        if (symbol_table_resolve(c->symbol_table, global) == NULL) {
+            compiler_define(c, global, true);
+        }
+    }
+
+    return 0;
+}
+
+/*
+Single-pass compilation: instead of building an AST and walking it, the functions below drive the parser
+through the tokens and emit code for each construct as soon as it is read, in the same order and with the
+same instructions compile_expression would. Function literals are the exception: their bodies are skipped
+like the pre-parser does and only the parameters and the offset of the body are kept in the program's AST,
+so that the body can be compiled from the source when the function is first called.
+
+Parse errors stop compilation at the first statement that has one. Calls are never folded, since that
+needs the arguments as nodes before any code is emitted for them.
+*/
+static int single_pass_expression(struct compiler *c, struct parser *p, int precedence);
+static int single_pass_statement(struct compiler *c, struct parser *p, bool top_level);
+
+/* returns the constant index of the function literal if that is all the code emitted from start on, or -1 */
+static int single_pass_function_literal(struct compiler *c, unsigned int start) {
+    struct emitted_instruction last = compiler_current_scope(c).last_instruction;
+    if (last.position != start || last.opcode != OPCODE_CONST) {
+        return -1;
+    }
+
+    enum opcode opcode;
+    int operands[MAX_OP_SIZE];
+    read_instruction(compiler_current_instructions(c)->bytes + start, &opcode, operands);
+    if (compiler_function_stub(c, operands[0]) == NULL) {
+        return -1;
+    }
+
+    return operands[0];
+}
+
+static int single_pass_block_statement(struct compiler *c, struct parser *p) {
+    int err;
+    next_token(p);
+
+    while (!current_token_is(p, TOKEN_RBRACE) && !current_token_is(p, TOKEN_EOF)) {
+        err = single_pass_statement(c, p, false);
+        if (err) return err;
+        next_token(p);
+    }
+
+    return 0;
+}
+
+static int single_pass_if_expression(struct compiler *c, struct parser *p) {
+    int err;
+    if (!expect_next_token(p, TOKEN_LPAREN)) {
+        return COMPILE_ERR_SYNTAX;
+    }
+
+    next_token(p);
+    err = single_pass_expression(c, p, LOWEST);
+    if (err) return err;
+
+    if (!expect_next_token(p, TOKEN_RPAREN) || !expect_next_token(p, TOKEN_LBRACE)) {
+        return COMPILE_ERR_SYNTAX;
+    }
+
+    unsigned int jump_if_not_true_pos = compiler_emit(c, OPCODE_JUMP_NOT_TRUE, 9999);
+    err = single_pass_block_statement(c, p);
+    if (err) return err;
+
+    if (compiler_last_instruction_is(c, OPCODE_POP)) {
+        compiler_remove_last_instruction(c);
+    }
+
+    unsigned int jump_pos = compiler_emit(c, OPCODE_JUMP, 9999);
+    compiler_change_operand(c, jump_if_not_true_pos, compiler_current_instructions(c)->size);
+
+    if (next_token_is(p, TOKEN_ELSE)) {
+        next_token(p);
+        if (!expect_next_token(p, TOKEN_LBRACE)) {
+            return COMPILE_ERR_SYNTAX;
+        }
+
+        err = single_pass_block_statement(c, p);
+        if (err) return err;
+
+        if (compiler_last_instruction_is(c, OPCODE_POP)) {
+            compiler_remove_last_instruction(c);
+        }
+    } else {
+        compiler_emit(c, OPCODE_NULL);
+    }
+
+    compiler_change_operand(c, jump_pos, compiler_current_instructions(c)->size);
+    return 0;
+}
+
+/* compiles the arguments and the call itself, the callee was emitted starting at start */
+static int single_pass_call_expression(struct compiler *c, struct parser *p, unsigned int start) {
+    int err;
+
+    // calls to a known global function refer to its constant instead of loading the global
+    int fn = -1;
+    struct emitted_instruction last = compiler_current_scope(c).last_instruction;
+    if (last.position == start && last.opcode == OPCODE_GET_GLOBAL) {
+        enum opcode opcode;
+        int operands[MAX_OP_SIZE];
+        read_instruction(compiler_current_instructions(c)->bytes + start, &opcode, operands);
+        fn = compiler_global_function(c, operands[0]);
+        if (fn >= 0) {
+            compiler_remove_last_instruction(c);
+        }
+    }
+
+    int i = 0;
+    if (next_token_is(p, TOKEN_RPAREN)) {
+        next_token(p);
+    } else {
+        next_token(p);
+        err = single_pass_expression(c, p, LOWEST);
+        if (err) return err;
+        i++;
+
+        while (next_token_is(p, TOKEN_COMMA)) {
+            next_token(p);
+            next_token(p);
+            err = single_pass_expression(c, p, LOWEST);
+            if (err) return err;
+            i++;
+        }
+
+        if (!expect_next_token(p, TOKEN_RPAREN)) {
+            return COMPILE_ERR_SYNTAX;
+        }
+    }
+
+    if (fn < 0) {
+        compiler_emit(c, OPCODE_CALL, i, c->call_sites++);
+    } else {
+        compiler_emit(c, OPCODE_CALL_CONST, fn, i);
+    }
+    return 0;
+}
+
+static int single_pass_expression(struct compiler *c, struct parser *p, int precedence) {
+    int err;
+    unsigned int start = compiler_current_instructions(c)->size;
+    switch (p->current_token.type) {
+        case TOKEN_IDENT:
+            err = compiler_emit_identifier(c, ast_string(p->ast, current_token_string(p)));
+            if (err) return err;
+        break;
+
+        case TOKEN_INT:
+            // the digits are followed by something that is not a digit, which is where atoi stops
+            compiler_emit_integer(c, atoi(p->current_token.start));
+        break;
+
+        case TOKEN_BANG:
+        case TOKEN_MINUS: {
+            enum operator operator = parse_operator(p->current_token.type);
+            next_token(p);
+            err = single_pass_expression(c, p, PREFIX);
+            if (err) return err;
+
+            err = compiler_emit_prefix(c, operator);
+            if (err) return err;
+        }
+        break;
+
+        case TOKEN_TRUE:
+            compiler_emit(c, OPCODE_TRUE);
+        break;
+
+        case TOKEN_FALSE:
+            compiler_emit(c, OPCODE_FALSE);
+        break;
+
+        case TOKEN_LPAREN:
+            next_token(p);
+            err = single_pass_expression(c, p, LOWEST);
+            if (err) return err;
+
+            if (!expect_next_token(p, TOKEN_RPAREN)) {
+                return COMPILE_ERR_SYNTAX;
+            }
+        break;
+
+        case TOKEN_IF:
+            err = single_pass_if_expression(c, p);
+            if (err) return err;
+        break;
+
+        case TOKEN_FUNCTION: {
+            uint32_t fn = parse_function_literal(p);
+            if (fn == AST_NONE) {
+                return COMPILE_ERR_SYNTAX;
+            }
+            compiler_emit_function_stub(c, p->ast, fn);
+        }
+        break;
+
+        case TOKEN_STRING:
+            compiler_emit_string(c, ast_string(p->ast, current_token_string(p)));
+        break;
+
+        // while loops and arrays parse, but the compiler does not support them
+        case TOKEN_WHILE:
+        case TOKEN_LBRACKET:
+            return COMPILE_ERR_UNKNOWN_EXPR_TYPE;
+        break;
+
+        default:
+            if (p->errors < 8) {
+                sprintf(p->error_messages[p->errors++], "no prefix parse function found for %s", token_type_to_str(p->current_token.type));
+            }
+            return COMPILE_ERR_SYNTAX;
+        break;
+    }
+
+    while (!next_token_is(p, TOKEN_SEMICOLON) && precedence < get_token_precedence(p->next_token)) {
+        switch (p->next_token.type) {
+            case TOKEN_PLUS:
+            case TOKEN_MINUS:
+            case TOKEN_ASTERISK:
+            case TOKEN_SLASH:
+            case TOKEN_EQ:
+            case TOKEN_NOT_EQ:
+            case TOKEN_LT:
+            case TOKEN_GT: {
+                next_token(p);
+                enum operator operator = parse_operator(p->current_token.type);
+                int infix_precedence = get_token_precedence(p->current_token);
+                next_token(p);
+                err = single_pass_expression(c, p, infix_precedence);
+                if (err) return err;
+
+                err = compiler_emit_infix(c, operator);
+                if (err) return err;
+            }
+            break;
+
+            case TOKEN_LPAREN:
+                next_token(p);
+                err = single_pass_call_expression(c, p, start);
+                if (err) return err;
+            break;
+
+            case TOKEN_LBRACKET:
+                return COMPILE_ERR_UNKNOWN_EXPR_TYPE;
+            break;
+
+            default:
+                return 0;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+Like compile_program, registers the global of a top-level let statement whose value is a function literal,
+which is all the top_level flag is for.
+*/
+static int single_pass_statement(struct compiler *c, struct parser *p, bool top_level) {
+    int err;
+    switch (p->current_token.type) {
+        case TOKEN_LET: {
+            if (!expect_next_token(p, TOKEN_IDENT)) {
+                return COMPILE_ERR_SYNTAX;
+            }
+
+            uint32_t name = current_token_string(p);
+            if (!expect_next_token(p, TOKEN_ASSIGN)) {
+                return COMPILE_ERR_SYNTAX;
+            }
+
+            next_token(p);
+            struct symbol s = *compiler_define(c, ast_string(p->ast, name), false);
+            unsigned int start = compiler_current_instructions(c)->size;
+            err = single_pass_expression(c, p, LOWEST);
+            if (err) return err;
+
+            int fn = single_pass_function_literal(c, start);
+            if (fn >= 0) {
+                ast_function_name(p->ast, c->stubs[fn].literal) = name;
+            }
+
+            compiler_emit(c, s.scope == SCOPE_GLOBAL ? OPCODE_SET_GLOBAL : OPCODE_SET_LOCAL, s.index);
+            if (fn >= 0 && top_level) {
+                compiler_set_global_function(c, s.index, fn);
+            }
+        }
+        break;
+
+        case TOKEN_RETURN:
+            next_token(p);
+            err = single_pass_expression(c, p, LOWEST);
+            if (err) return err;
+
+            compiler_emit(c, OPCODE_RETURN_VALUE);
+        break;
+
+        case TOKEN_IMPORT:
+            if (!top_level || !expect_next_token(p, TOKEN_STRING)) {
+                return COMPILE_ERR_SYNTAX;
+            }
+
+            err = compiler_import(c, ast_string(p->ast, current_token_string(p)));
+            if (err) return err;
+        break;
+
+        default:
+            err = single_pass_expression(c, p, LOWEST);
+            if (err) return err;
+
+            compiler_emit(c, OPCODE_POP);
+        break;
+    }
+
+    if (next_token_is(p, TOKEN_SEMICOLON)) {
+        next_token(p);
+    }
+
+    return p->errors > 0 ? COMPILE_ERR_SYNTAX : 0;
+}
+
+/* compiles the body of a function literal from a single-pass program, see compile_function_literal */
+static int single_pass_function_body(struct compiler *c, struct ast *ast, uint32_t fn) {
+    struct lexer lexer = new_lexer(ast->source);
+    lexer.pos = ast_function_body_start(ast, fn);
+    struct parser parser = new_parser(&lexer);
+    parser.pre_parse = true;
+    parser.ast = ast;
+    int err = single_pass_block_statement(c, &parser);
+    parser_free(&parser);
+    return err;
+}
+
+/*
+Compiles the parser's input without building an AST for it. The returned program holds the names and the
+function literals the code refers to, so it has to outlive the compiler, and is returned even if compiling
+fails, with error set. Parse errors are left in the parser, error is COMPILE_ERR_SYNTAX for those.
+*/
+struct program *
+compile_single_pass(struct compiler *c, struct parser *p, int *error) {
+    struct program *program = malloc(sizeof *program);
+    if (!program) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+
+    ast_init(&program->ast, p->lexer->input);
+    program->ast.single_pass = true;
+    p->ast = &program->ast;
+    p->pre_parse = true;
+
+    *error = 0;
+    while (!current_token_is(p, TOKEN_EOF)) {
+        *error = single_pass_statement(c, p, true);
+        if (*error) break;
+        next_token(p);
+    }
+
+    // there are no statements to keep, the program prints as an empty one
+    uint32_t statements = ast_add_extra(&program->ast, (uint32_t[]) { 0 }, 1);
+    program->statements = ast_add_node(&program->ast, (struct node) { .type = STMT_BLOCK, .lhs = statements });
+    if (*error == 0) {
+        *error = compiler_check_free_names(c, &program->ast, p->free_names, p->free_names_size);
+    }
+    parser_free(p);
+
+    if (*error == 0) {
+        compiler_relax_jumps(compiler_current_instructions(c));
+    }
+    return program;
+}
@@ -7,6 +7,11 @@
 
 #define COMPILE_ERR_UNKNOWN_OPERATOR 1
 #define COMPILE_ERR_UNKNOWN_EXPR_TYPE 2
+#define COMPILE_ERR_UNKNOWN_IDENTIFIER 3
+#define COMPILE_ERR_NESTING_TOO_DEEP 4
+#define COMPILE_ERR_SYNTAX 5
+#define COMPILE_ERR_IMPORT 6
+#define COMPILE_ERR_IMPORT_CYCLE 7
 
 struct emitted_instruction {
     enum opcode opcode;
@@ -19,17 +24,80 @@ struct compiler_scope {
     struct emitted_instruction previous_instruction;
 };
 
+/* where the function literal of a stub is and how many globals were defined there, see compile_function_stub */
+struct function_stub {
+    struct ast *ast;
+    uint32_t literal;
+    int globals;
+};
+
+struct module;
+struct module_cache;
+
+struct unit_global {
+    char *name;
+    bool external;
+};
+
 struct compiler {
     struct object_list *constants;
     struct symbol_table *symbol_table;
     unsigned int scope_index;
     struct compiler_scope scopes[64];
+
+    // constant index of the function literal each global is bound to, or -1 if unknown
+    int *global_functions;
+    unsigned int global_functions_cap;
+
+    // function constants a call could not be folded into a constant for, later call sites leave them to the VM right away
+    bool *unfoldable;
+    unsigned int unfoldable_cap;
+
+    // function stubs by constant index, ast is NULL for constants that are not (or no longer) stubs
+    struct function_stub *stubs;
+    unsigned int stubs_cap;
+
+    // number of globals the code being compiled sees, -1 for all of them (top-level code)
+    int visible_globals;
+
+    // number of OPCODE_CALL sites emitted so far, each gets its own inline cache slot in the VM
+    unsigned int call_sites;
+
+    // open addressing table of integer and string constants by value, each slot holds a constant index + 1 or 0 if empty
+    unsigned int *constant_slots;
+    unsigned int constant_slots_cap;
+
+    /*
+    Units are compiled on their own and linked into another compiler afterwards, see compiler_link.
+    They record every global they define by index, and treat names their top-level code uses without
+    defining them as external globals, which are looked up among the globals of the units linked before.
+    */
+    bool unit;
+    struct unit_global *unit_globals;
+    unsigned int unit_globals_cap;
+
+    /*
+    Where import statements get their modules from (imports fail without one), relative to the directory of path,
+    the file being compiled. modules holds the modules linked in so far, each one is linked only once; for units
+    the ones they import, which compiler_link links ahead of them.
+    */
+    struct module_cache *module_cache;
+    char *path;
+    struct module **modules;
+    unsigned int modules_size;
+    unsigned int modules_cap;
 };
 
 struct compiler *compiler_new();
 struct compiler *compiler_new_with_state(struct symbol_table *t, struct object_list *constants);
+struct compiler *compiler_new_unit();
+int compiler_link(struct compiler *c, struct compiler *unit);
+int compiler_link_module(struct compiler *c, struct module *m);
 void compiler_free(struct compiler *c);
 int compile_program(struct compiler *compiler, struct program *program);
+struct program *compile_single_pass(struct compiler *c, struct parser *p, int *error);
+int compile_function_stub(struct compiler *c, unsigned int constant);
+int compile_function_stubs(struct compiler *c);
 struct bytecode *get_bytecode(struct compiler *c);
 void concat_instructions(struct instruction *ins1, struct instruction *ins2);
 char *compiler_error_str(int err);
@@ -37,5 +105,11 @@ unsigned int compiler_emit(struct compiler *c, enum opcode opcode, ...);
 void compiler_enter_scope(struct compiler *c);
 struct instruction *compiler_leave_scope(struct compiler *c);
 struct compiler_scope compiler_current_scope(struct compiler *c);
+int compiler_global_function(struct compiler *c, unsigned int global);
+struct symbol *compiler_resolve(struct compiler *c, char *name, struct symbol *s);
+int compiler_check_free_names(struct compiler *c, struct ast *ast, uint32_t *names, uint32_t size);
+bool compiler_function_unfoldable(struct compiler *c, unsigned int constant);
+struct function_stub *compiler_function_stub(struct compiler *c, unsigned int constant);
+void compiler_set_function_unfoldable(struct compiler *c, unsigned int constant);
 
 #endif
\ No newline at end of file
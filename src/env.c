@@ -4,13 +4,28 @@
 
 #include "object.h"
 #include "env.h"
-
-#define hash(s) (s[0] - 'a')
-#define ENV_TABLE_SIZE 26
+#include "resolver.h"
 
 struct environment *env_pool_head;
 
-struct environment *make_environment() {
+static void environment_reserve(struct environment *env, unsigned int size) {
+    if (size <= env->cap) {
+        return;
+    }
+
+    unsigned int cap = env->cap ? env->cap : 8;
+    while (cap < size) {
+        cap *= 2;
+    }
+    env->slots = realloc(env->slots, cap * sizeof *env->slots);
+    if (!env->slots) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    env->cap = cap;
+}
+
+/* an environment with size empty slots */
+static struct environment *environment_new(unsigned int size) {
     struct environment *env;
 
     // try to get pre-allocated object from pool
@@ -20,95 +35,105 @@ struct environment *make_environment() {
             err(EXIT_FAILURE, "out of memory");
         }
 
-        for (int i = 0; i < ENV_TABLE_SIZE; i++) {
-            env->table[i] = NULL;
-        }
+        env->slots = NULL;
+        env->cap = 0;
     } else {
         env = env_pool_head;
         env_pool_head = env->next;
     }
 
+    environment_reserve(env, size);
+    for (unsigned int i = 0; i < size; i++) {
+        env->slots[i] = NULL;
+    }
+    env->size = size;
     env->next = NULL;
     env->outer = NULL;
     return env;
 }
 
-struct environment *make_closed_environment(struct environment *parent) {
-    struct environment *env = make_environment();
-    env->outer = parent;
+/* the global environment, its slots are added as the programs evaluated in it define globals */
+struct environment *make_environment() {
+    struct environment *env = environment_new(0);
+    env->resolver = resolver_new();
+    env->scope = env->resolver->globals;
     return env;
 }
 
-struct object *environment_get(struct environment *env, char *key) {
-    unsigned int pos = hash(key) % ENV_TABLE_SIZE;
-    struct object *node = env->table[pos];
-
-    while (node) {
-        if (memcmp(node->name, key, MAX_KEY_LENGTH) == 0) {
-            return node;
-        }
+/* an environment for a call of a function with the given scope, which is enclosed by that of parent */
+struct environment *make_closed_environment(struct environment *parent, struct symbol_table *scope) {
+    struct environment *env = environment_new(scope->size);
+    env->scope = scope;
+    env->resolver = parent->resolver;
+    env->outer = parent;
+    return env;
+}
 
-        node = node->next;
+/*
+Returns the value in the slot of the environment depth levels out, or NULL if it is not set. If that is the slot
+of an enclosing function whose let did not run yet, the name may still be bound further out, as it would be when
+looked up by name.
+*/
+struct object *environment_get(struct environment *env, uint32_t depth, uint32_t slot, char *name) {
+    bool enclosing = depth > 0;
+    for (; depth > 0; depth--) {
+        env = env->outer;
     }
 
-    // try parent environment (bubble up scope)
-    if (env->outer) {
-        return environment_get(env->outer, key);
+    if (slot < env->size && env->slots[slot] != NULL) {
+        return env->slots[slot];
+    }
+    if (!enclosing) {
+        return NULL;
     }
 
+    for (env = env->outer; env != NULL; env = env->outer) {
+        struct symbol *s = symbol_table_lookup(env->scope, name);
+        if (s != NULL && (unsigned int) s->index < env->size && env->slots[s->index] != NULL) {
+            return env->slots[s->index];
+        }
+    }
     return NULL;
 }
 
-void environment_set(struct environment *env, char *key, struct object *value) {
-    unsigned int pos = hash(key) % ENV_TABLE_SIZE;
-    struct object *node = env->table[pos];
-    struct object *prev = NULL;
+/* sets a copy of value to the slot, which the environment owns: it is kept from being freed by its name */
+void environment_set(struct environment *env, uint32_t slot, char *name, struct object *value) {
+    // the global scope may have grown since the slots were allocated
+    if (slot >= env->size) {
+        environment_reserve(env, slot + 1);
+        for (unsigned int i = env->size; i <= slot; i++) {
+            env->slots[i] = NULL;
+        }
+        env->size = slot + 1;
+    }
 
+    // copied first, value could be the object in the slot
     value = copy_object(value);
-    value->name = key;
-
-    // find existing node with that key
-    while (node) {
-        if (memcmp(node->name, key, MAX_KEY_LENGTH) == 0) {
-            if (prev) {
-                prev->next = value;
-            } else {
-                env->table[pos] = value;
-            }
-            value->next = node->next;
-
-            // free old object
-            node->name = NULL;
-            free_object(node);
-            return;
-        }      
-
-        node = node->next;
-        prev = node;
+    struct object *old = env->slots[slot];
+    if (old) {
+        old->name = NULL;
+        free_object(old);
     }
 
-    // insert node at head of table
-    value->next = env->table[pos];
-    env->table[pos] = value;
+    value->name = name;
+    env->slots[slot] = value;
 }
 
 void free_environment(struct environment *env) {
-    struct object *node;
-    struct object *next;
-
     // free all objects in env
-    for (int i=0; i < ENV_TABLE_SIZE; i++) {
-        node = env->table[i];
-
-        while (node) {
-            next = node->next;
-            node->name = NULL;
-            free_object(node);
-            node = next;
+    for (unsigned int i = 0; i < env->size; i++) {
+        if (env->slots[i]) {
+            env->slots[i]->name = NULL;
+            free_object(env->slots[i]);
+            env->slots[i] = NULL;
         }
+    }
 
-         env->table[i] = NULL;
+    if (!env->outer) {
+        resolver_free(env->resolver);
     }
+    env->resolver = NULL;
+    env->scope = NULL;
 
     // return env to pool
     env->next = env_pool_head;
@@ -122,9 +147,10 @@ void free_env_pool() {
 
     while (node) {
         next = node->next;
+        free(node->slots);
         free(node);
         node = next;
     }
 
     env_pool_head = NULL;
-}
\ No newline at end of file
+}
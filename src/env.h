@@ -1,12 +1,28 @@
 #ifndef ENV_H 
 #define ENV_H 
 
+#include <stdint.h>
 #include "object.h"
 
-#define MAX_KEY_LENGTH 32
+struct resolver;
+struct symbol_table;
 
+/*
+Environments are flat arrays of values, one slot for every name in the scope they are for: the globals, or the
+parameters and lets of the function they are a call of. The resolver tells which slot an identifier is in and how
+many environments out from the current one, see resolver.h. Slots are NULL until their name is set.
+*/
 struct environment {
-    struct object *table[26];
+    struct object **slots;
+    unsigned int size;
+    unsigned int cap;
+
+    // names of the slots
+    struct symbol_table *scope;
+
+    // the programs evaluated in the global environment (the outermost) are resolved with, owned by it
+    struct resolver *resolver;
+
     struct environment *outer;
 
     // for linking in env_pool
@@ -14,10 +30,10 @@ struct environment {
 };
 
 struct environment *make_environment();
-struct environment *make_closed_environment(struct environment *parent);
-struct object *environment_get(struct environment *env, char *key);
-void environment_set(struct environment *env, char *key, struct object *value);
+struct environment *make_closed_environment(struct environment *parent, struct symbol_table *scope);
+struct object *environment_get(struct environment *env, uint32_t depth, uint32_t slot, char *name);
+void environment_set(struct environment *env, uint32_t slot, char *name, struct object *value);
 void free_environment(struct environment *env);
 void free_env_pool();
 
-#endif
\ No newline at end of file
+#endif
@@ -7,10 +7,11 @@
 #include <err.h>
 
 #include "builtins.h"
+#include "resolver.h"
 #include "eval.h"
 
-struct object *eval_expression(struct expression *expr, struct environment *env);
-struct object *eval_block_statement(struct block_statement *block, struct environment *env);
+struct object *eval_expression(struct ast *ast, uint32_t expr, struct environment *env);
+struct object *eval_block_statement(struct ast *ast, uint32_t block, struct environment *env);
 
 struct object *eval_bang_operator_expression(struct object *obj)
 {
@@ -132,9 +133,9 @@ struct object *eval_infix_expression(enum operator operator, struct object *left
 }
 
 
-struct object *eval_if_expression(struct if_expression *expr, struct environment *env)
+struct object *eval_if_expression(struct ast *ast, uint32_t expr, struct environment *env)
 {
-    struct object *obj = eval_expression(expr->condition, env);
+    struct object *obj = eval_expression(ast, ast->nodes[expr].lhs, env);
     if (is_object_error(obj->type)) {
         return obj;
     }
@@ -143,22 +144,22 @@ struct object *eval_if_expression(struct if_expression *expr, struct environment
     free_object(obj);
 
     if (truthy) {
-        return eval_block_statement(expr->consequence, env);
-    } else if (expr->alternative) {
-        return eval_block_statement(expr->alternative, env);
+        return eval_block_statement(ast, ast_if_consequence(ast, expr), env);
+    } else if (ast_if_alternative(ast, expr) != AST_NONE) {
+        return eval_block_statement(ast, ast_if_alternative(ast, expr), env);
     }
 
     return object_null;
 }
 
 
-struct object *eval_while_expression(struct while_expression *expr, struct environment *env)
+struct object *eval_while_expression(struct ast *ast, uint32_t expr, struct environment *env)
 {
     struct object *obj = NULL;
     struct object *result = NULL;
     
     while (1) {
-        obj = eval_expression(expr->condition, env);
+        obj = eval_expression(ast, ast->nodes[expr].lhs, env);
         if (is_object_error(obj->type)) {
             return obj;
         }
@@ -173,7 +174,7 @@ struct object *eval_while_expression(struct while_expression *expr, struct envir
             free_object(result);
         }
 
-        result = eval_block_statement(expr->body, env);
+        result = eval_block_statement(ast, ast->nodes[expr].rhs, env);
         if (result->return_value) {
             return result;
         }
@@ -183,26 +184,45 @@ struct object *eval_while_expression(struct while_expression *expr, struct envir
 }
 
 
-struct object *eval_identifier(struct identifier *ident, struct environment *env) {
-    struct object *obj = environment_get(env, ident->value);
-    if (obj) {
-        return obj;
+struct object *eval_identifier(struct ast *ast, uint32_t ident, struct environment *env) {
+    struct node n = ast->nodes[ident];
+    if (n.operator == RESOLVED_BUILTIN) {
+        uint32_t global = env->resolver->builtin_globals[n.rhs];
+        if (global == 0) {
+            return &builtins[n.rhs];
+        }
+
+        // a global of the same name shadows the builtin once it is set, the identifier is resolved to it from then on
+        uint32_t depth = 0;
+        struct environment *globals = env;
+        for (; globals->outer != NULL; globals = globals->outer) {
+            depth++;
+        }
+        if (global - 1 >= globals->size || globals->slots[global - 1] == NULL) {
+            return &builtins[n.rhs];
+        }
+        if (depth <= RESOLVER_MAX_DEPTH) {
+            ast->nodes[ident].operator = depth + 1;
+            ast->nodes[ident].rhs = global - 1;
+        }
+        return globals->slots[global - 1];
     }
 
-    obj = get_builtin(ident->value);
+    struct object *obj = environment_get(env, n.operator - 1, n.rhs, ast_string(ast, n.lhs));
     if (obj) {
         return obj;
     }
 
-    return make_error_object("identifier not found: %s", ident->value);
+    return make_error_object("identifier not found: %s", ast_string(ast, n.lhs));
 }
 
 
-struct object_list *eval_expression_list(struct expression_list *list, struct environment *env) {
-    struct object_list *result = make_object_list(list->size);
+struct object_list *eval_expression_list(struct ast *ast, uint32_t list, struct environment *env) {
+    uint32_t size = ast_list_size(ast, list);
+    struct object_list *result = make_object_list(size);
     
-    for (int i = 0; i < list->size; i++) {
-        struct object *obj = eval_expression(list->values[i], env);
+    for (int i = 0; i < size; i++) {
+        struct object *obj = eval_expression(ast, ast_list_item(ast, list, i), env);
         result->values[result->size++] = obj;
 
         if (is_object_error(obj->type)) {
@@ -234,15 +254,18 @@ struct object *apply_function(struct object *obj, struct object_list *args) {
         break;
 
         case OBJ_FUNCTION: {
-            if (args->size != obj->value.function.parameters->size) {
-                return make_error_object("invalid function call: expected %d arguments, got %d", obj->value.function.parameters->size, args->size);
+            struct ast *ast = obj->value.function.ast;
+            uint32_t parameters = ast_function_parameters(ast, obj->value.function.literal);
+            if (args->size != ast_list_size(ast, parameters)) {
+                return make_error_object("invalid function call: expected %d arguments, got %d", ast_list_size(ast, parameters), args->size);
             }
             
-            struct environment *env = make_closed_environment(obj->value.function.env); 
-            for (int i=0; i < obj->value.function.parameters->size; i++) {
-                environment_set(env, obj->value.function.parameters->values[i].value, args->values[i]);
+            struct environment *outer = obj->value.function.env;
+            struct environment *env = make_closed_environment(outer, resolver_function_scope(outer->resolver, ast, obj->value.function.literal));
+            for (int i=0; i < ast_list_size(ast, parameters); i++) {
+                environment_set(env, i, ast_string(ast, ast_list_item(ast, parameters, i)), args->values[i]);
             }
-            struct object *result = eval_block_statement(obj->value.function.body, env);
+            struct object *result = eval_block_statement(ast, ast->nodes[obj->value.function.literal].rhs, env);
             free_environment(env);
             result->return_value = false;
             return result;
@@ -269,66 +292,76 @@ struct object *eval_index_expression(struct object *left, struct object *index)
     return copy_object(left->value.array->values[index->value.integer]);
 }
 
-struct object *eval_expression(struct expression *expr, struct environment *env)
+struct object *eval_expression(struct ast *ast, uint32_t expr, struct environment *env)
 {
-    switch (expr->type)
+    // copied, because parsing a function body while evaluating the children can move the nodes
+    struct node n = ast->nodes[expr];
+    switch (n.type)
     {
         case EXPR_INT:
-            return make_integer_object(expr->integer);
+            return make_integer_object((int32_t) n.lhs);
             break;
         case EXPR_BOOL:
-            return make_boolean_object(expr->boolean);
+            return make_boolean_object(n.lhs);
             break;
         case EXPR_STRING: 
-            return make_string_object(expr->string, NULL);
+            return make_string_object(ast_string(ast, n.lhs), NULL);
             break;
         case EXPR_PREFIX: {
-            struct object *right = eval_expression(expr->prefix.right, env);
+            struct object *right = eval_expression(ast, n.lhs, env);
             if (is_object_error(right->type)) {
                 return right;
             }
-            struct object *result = eval_prefix_expression(expr->prefix.operator, right);
+            struct object *result = eval_prefix_expression(n.operator, right);
             free_object(right);
             return result;
             break;
         }
         case EXPR_INFIX: {
-            struct object *left = eval_expression(expr->infix.left, env);
+            struct object *left = eval_expression(ast, n.lhs, env);
             if (is_object_error(left->type)) {
                 return left;
             }
 
-            struct object *right = eval_expression(expr->infix.right, env);
+            struct object *right = eval_expression(ast, n.rhs, env);
             if (is_object_error(right->type)) {
                 free_object(left);
                 return right;
             }
 
-            struct object *result = eval_infix_expression(expr->infix.operator, left, right);
+            struct object *result = eval_infix_expression(n.operator, left, right);
             free_object(left);
             free_object(right);
             return result;
             break;
         }
         case EXPR_IF:
-            return eval_if_expression(&expr->ifelse, env);
+            return eval_if_expression(ast, expr, env);
             break;
         case EXPR_WHILE: 
-            return eval_while_expression(&expr->whilst, env);
+            return eval_while_expression(ast, expr, env);
         break;    
         case EXPR_IDENT: 
-            return eval_identifier(&expr->ident, env);
+            return eval_identifier(ast, expr, env);
             break;
-        case EXPR_FUNCTION: 
-            return make_function_object(&expr->function.parameters, expr->function.body, env);
+        case EXPR_FUNCTION: {
+            if (parse_function_body(ast, expr) != 0) {
+                return make_error_object("syntax error in function body");
+            }
+            int err = resolve_function(env->resolver, ast, expr, env->scope);
+            if (err) {
+                return make_error_object(resolver_error_str(err));
+            }
+            return make_function_object(ast, expr, env);
             break;
+        }
         case EXPR_CALL: {
-            struct object *left = eval_expression(expr->call.function, env);
+            struct object *left = eval_expression(ast, n.lhs, env);
             if (is_object_error(left->type)) {
                 return left;
             }
 
-            struct object_list *args = eval_expression_list(&(expr->call.arguments), env);
+            struct object_list *args = eval_expression_list(ast, n.rhs, env);
             if (args->size >= 1 && is_object_error(args->values[0]->type)) {
                 free_object(left);
                 return args->values[0];
@@ -342,7 +375,7 @@ struct object *eval_expression(struct expression *expr, struct environment *env)
         }
 
         case EXPR_ARRAY: {
-            struct object_list *elements = eval_expression_list(&expr->array, env);
+            struct object_list *elements = eval_expression_list(ast, n.lhs, env);
             if (elements->size >= 1 && is_object_error(elements->values[0]->type)) {
                 return elements->values[0];
             }
@@ -353,12 +386,12 @@ struct object *eval_expression(struct expression *expr, struct environment *env)
         }
 
         case EXPR_INDEX: {
-            struct object *left = eval_expression(expr->index.left, env);
+            struct object *left = eval_expression(ast, n.lhs, env);
             if (is_object_error(left->type)) {
                 return left;
             }
 
-            struct object *index = eval_expression(expr->index.index, env);
+            struct object *index = eval_expression(ast, n.rhs, env);
             if (is_object_error(index->type)) {
                 free_object(left);
                 return index;
@@ -407,42 +440,51 @@ struct object *make_return_object(struct object *obj)
 }
 
 
-struct object *eval_statement(struct statement *stmt, struct environment *env)
+struct object *eval_statement(struct ast *ast, uint32_t stmt, struct environment *env)
 {
-    switch (stmt->type)
+    struct node n = ast->nodes[stmt];
+    switch (n.type)
     {
-    case STMT_EXPR:
-        return eval_expression(stmt->value, env);
-    break;
     case STMT_LET: {
-        struct object *result = eval_expression(stmt->value, env);
-        environment_set(env, stmt->name.value, result);
+        // the name is always in the current environment
+        struct object *result = eval_expression(ast, n.rhs, env);
+        struct node name = ast->nodes[n.lhs];
+        environment_set(env, name.rhs, ast_string(ast, name.lhs), result);
         return result;
     }
     break;
     case STMT_RETURN: {
-        struct object *result = eval_expression(stmt->value, env);
+        struct object *result = eval_expression(ast, n.lhs, env);
         result = make_return_object(result);
         return result;
     }
     break;
+
+    // modules are linked by the compiler, see module.h
+    case STMT_IMPORT:
+        return make_error_object("import is not supported by the evaluator: \"%s\"", ast_string(ast, n.lhs));
+    break;
+    default:
+        return eval_expression(ast, stmt, env);
+    break;
     }
 
     return object_null;
 }
 
 
-struct object *eval_block_statement(struct block_statement *block, struct environment *env)
+struct object *eval_block_statement(struct ast *ast, uint32_t block, struct environment *env)
 {
     struct object *obj = NULL;
-    int size = block->size;
+    uint32_t statements = ast->nodes[block].lhs;
+    int size = ast_list_size(ast, statements);
     for (int i = 0; i < size; i++)
     {
         if (obj) {
             free_object(obj);
         }
 
-        obj = eval_statement(&block->statements[i], env);
+        obj = eval_statement(ast, ast_list_item(ast, statements, i), env);
         if (obj->return_value) {
             break;
         }
@@ -456,17 +498,25 @@ struct object *eval_block_statement(struct block_statement *block, struct enviro
     return copy;
 }
 
+/* env is the global environment, which the program is resolved with before it is evaluated */
 struct object *eval_program(struct program *prog, struct environment *env)
 {
     struct object *obj = NULL;
 
-    for (int i = 0; i < prog->size; i++)
+    int err = resolve_program(env->resolver, prog);
+    if (err) {
+        return make_error_object(resolver_error_str(err));
+    }
+
+    struct ast *ast = &prog->ast;
+    uint32_t statements = ast->nodes[prog->statements].lhs;
+    for (int i = 0; i < ast_list_size(ast, statements); i++)
     {
         if (obj) {
             free_object(obj);
         }
 
-        obj = eval_statement(&prog->statements[i], env);
+        obj = eval_statement(ast, ast_list_item(ast, statements, i), env);
         if (obj->return_value) {
            break;
         }
@@ -0,0 +1,408 @@
+#include <stdlib.h>
+#include <limits.h>
+
+#include "fold.h"
+
+/*
+Compile-time evaluation of calls to known global functions.
+
+A call is folded when its callee is a global bound exactly once to a function literal
+and all of its arguments are constants. The callee's bytecode is then run by the small
+interpreter below, which mirrors the VM but only knows about integers, booleans and null.
+Anything else (strings, globals that are not known functions, reading a local before it
+is assigned, running out of steps or stack) makes the function impure for our purposes
+and we leave the call to the VM. Such a function is remembered on the compiler and calls to it
+are not tried again, so a program calling it from many sites does not pay for the failed run each time.
+*/
+
+struct fold_frame {
+    struct compiled_function *fn;
+    unsigned int ip;
+    unsigned int base_pointer;
+    unsigned int return_pointer;
+};
+
+// marks local slots that have not been assigned to yet
+static const struct object fold_undefined = {
+    .type = OBJ_ERROR,
+};
+
+static struct object fold_integer(long value) {
+    struct object obj = {
+        .type = OBJ_INT,
+        .value = { .integer = value },
+    };
+    return obj;
+}
+
+static struct object fold_boolean(bool value) {
+    struct object obj = {
+        .type = OBJ_BOOL,
+        .value = { .boolean = value },
+    };
+    return obj;
+}
+
+static struct object fold_null() {
+    struct object obj = {
+        .type = OBJ_NULL,
+    };
+    return obj;
+}
+
+static bool fold_is_truthy(struct object obj) {
+    return !(obj.type == OBJ_NULL || (obj.type == OBJ_BOOL && obj.value.boolean == false));
+}
+
+static bool fold_binary_operation(enum opcode opcode, struct object left, struct object right, struct object *result) {
+    if (left.type != right.type) {
+        return false;
+    }
+
+    if (left.type == OBJ_BOOL) {
+        switch (opcode) {
+            case OPCODE_EQUAL:
+                *result = fold_boolean(left.value.boolean == right.value.boolean);
+                return true;
+            case OPCODE_NOT_EQUAL:
+                *result = fold_boolean(left.value.boolean != right.value.boolean);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    if (left.type != OBJ_INT) {
+        return false;
+    }
+
+    long l = left.value.integer;
+    long r = right.value.integer;
+    long value;
+    switch (opcode) {
+        case OPCODE_ADD: value = l + r; break;
+        case OPCODE_SUBTRACT: value = l - r; break;
+        case OPCODE_MULTIPLY: value = l * r; break;
+        case OPCODE_DIVIDE:
+            if (r == 0) return false;
+            value = l / r;
+        break;
+        case OPCODE_EQUAL: *result = fold_boolean(l == r); return true;
+        case OPCODE_NOT_EQUAL: *result = fold_boolean(l != r); return true;
+        case OPCODE_GREATER_THAN: *result = fold_boolean(l > r); return true;
+        case OPCODE_LESS_THAN: *result = fold_boolean(l < r); return true;
+        default: return false;
+    }
+
+    // the VM does integer arithmetic on C ints, so leave overflowing results to the runtime
+    if (value < INT_MIN || value > INT_MAX) {
+        return false;
+    }
+
+    *result = fold_integer(value);
+    return true;
+}
+
+static bool fold_minus_operation(struct object right, struct object *result) {
+    if (right.type != OBJ_INT || right.value.integer == INT_MIN) {
+        return false;
+    }
+
+    *result = fold_integer(-right.value.integer);
+    return true;
+}
+
+static bool fold_constant(struct compiler *c, unsigned int idx, struct object *result) {
+    if (idx >= c->constants->size) {
+        return false;
+    }
+
+    // functions that have not been called yet are compiled now, if that fails the call is left to the VM
+    if (compile_function_stub(c, idx) != 0) {
+        return false;
+    }
+
+    struct object *obj = c->constants->values[idx];
+    switch (obj->type) {
+        case OBJ_INT:
+        case OBJ_BOOL:
+        case OBJ_NULL:
+        case OBJ_COMPILED_FUNCTION:
+            *result = *obj;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// sets up a frame for calling fn with the arguments at the top of the stack
+static bool fold_enter_frame(struct fold_frame *frames, int *frame_index, struct object *stack, unsigned int *stack_pointer, struct object *fn, unsigned int num_args, unsigned int return_pointer) {
+    if (fn->type != OBJ_COMPILED_FUNCTION || fn->value.compiled_function.num_parameters != num_args || *frame_index + 1 >= FOLD_MAX_FRAMES) {
+        return false;
+    }
+
+    struct fold_frame *frame = &frames[++(*frame_index)];
+    frame->fn = &fn->value.compiled_function;
+    frame->ip = 0;
+    frame->base_pointer = *stack_pointer - num_args;
+    frame->return_pointer = return_pointer;
+    if (frame->base_pointer + frame->fn->num_locals >= FOLD_STACK_SIZE) {
+        return false;
+    }
+
+    for (unsigned int i = *stack_pointer; i < frame->base_pointer + frame->fn->num_locals; i++) {
+        stack[i] = fold_undefined;
+    }
+    *stack_pointer = frame->base_pointer + frame->fn->num_locals;
+    return true;
+}
+
+static bool fold_run(struct compiler *c, struct object *stack, unsigned int stack_pointer, unsigned int num_args, struct object *result) {
+    struct fold_frame frames[FOLD_MAX_FRAMES];
+    struct fold_frame *frame;
+    int frame_index = -1;
+    unsigned int steps = 0;
+    struct object left, right, obj;
+    enum opcode opcode;
+    int operands[MAX_OP_SIZE];
+    unsigned int length;
+    int idx;
+
+    #define fold_push(v) if (stack_pointer >= FOLD_STACK_SIZE) { return false; } stack[stack_pointer++] = v
+    #define fold_pop() stack[--stack_pointer]
+
+    if (!fold_enter_frame(frames, &frame_index, stack, &stack_pointer, &stack[stack_pointer - 1 - num_args], num_args, stack_pointer - 1 - num_args)) {
+        return false;
+    }
+    frame = &frames[frame_index];
+
+    while (1) {
+        if (++steps > FOLD_MAX_STEPS || frame->ip >= frame->fn->instructions.size) {
+            return false;
+        }
+
+        length = read_instruction(frame->fn->instructions.bytes + frame->ip, &opcode, operands);
+        switch (opcode) {
+            case OPCODE_CONST:
+            case OPCODE_CONST_SHORT:
+                if (!fold_constant(c, operands[0], &obj)) return false;
+                fold_push(obj);
+                frame->ip += length;
+            break;
+
+            case OPCODE_POP:
+                stack_pointer--;
+                frame->ip += length;
+            break;
+
+            case OPCODE_SMALL_INT:
+                fold_push(fold_integer(operands[0]));
+                frame->ip += length;
+            break;
+
+            case OPCODE_TRUE:
+                fold_push(fold_boolean(true));
+                frame->ip += length;
+            break;
+
+            case OPCODE_FALSE:
+                fold_push(fold_boolean(false));
+                frame->ip += length;
+            break;
+
+            case OPCODE_NULL:
+                fold_push(fold_null());
+                frame->ip += length;
+            break;
+
+            case OPCODE_ADD:
+            case OPCODE_SUBTRACT:
+            case OPCODE_MULTIPLY:
+            case OPCODE_DIVIDE:
+            case OPCODE_EQUAL:
+            case OPCODE_NOT_EQUAL:
+            case OPCODE_GREATER_THAN:
+            case OPCODE_LESS_THAN:
+                right = fold_pop();
+                left = fold_pop();
+                if (!fold_binary_operation(opcode, left, right, &obj)) return false;
+                fold_push(obj);
+                frame->ip += length;
+            break;
+
+            case OPCODE_MINUS:
+                if (!fold_minus_operation(fold_pop(), &obj)) return false;
+                fold_push(obj);
+                frame->ip += length;
+            break;
+
+            case OPCODE_BANG:
+                obj = fold_boolean(!fold_is_truthy(fold_pop()));
+                fold_push(obj);
+                frame->ip += length;
+            break;
+
+            case OPCODE_JUMP:
+            case OPCODE_JUMP_SHORT:
+                frame->ip = jump_target(opcode, frame->ip, length, operands[0]);
+            break;
+
+            case OPCODE_JUMP_NOT_TRUE:
+            case OPCODE_JUMP_NOT_TRUE_SHORT:
+                if (fold_is_truthy(fold_pop())) {
+                    frame->ip += length;
+                } else {
+                    frame->ip = jump_target(opcode, frame->ip, length, operands[0]);
+                }
+            break;
+
+            case OPCODE_GET_GLOBAL:
+            case OPCODE_GET_GLOBAL_SHORT:
+                idx = compiler_global_function(c, operands[0]);
+                if (idx < 0 || !fold_constant(c, idx, &obj)) return false;
+                fold_push(obj);
+                frame->ip += length;
+            break;
+
+            case OPCODE_GET_LOCAL:
+                if (operands[0] >= frame->fn->num_locals) return false;
+                obj = stack[frame->base_pointer + operands[0]];
+                if (obj.type == fold_undefined.type) return false;
+                fold_push(obj);
+                frame->ip += length;
+            break;
+
+            case OPCODE_SET_LOCAL:
+                if (operands[0] >= frame->fn->num_locals) return false;
+                stack[frame->base_pointer + operands[0]] = fold_pop();
+                frame->ip += length;
+            break;
+
+            case OPCODE_CALL:
+                idx = operands[0];
+                frame->ip += length;
+                if (idx >= stack_pointer) return false;
+                if (!fold_enter_frame(frames, &frame_index, stack, &stack_pointer, &stack[stack_pointer - 1 - idx], idx, stack_pointer - 1 - idx)) return false;
+                frame = &frames[frame_index];
+            break;
+
+            case OPCODE_CALL_CONST:
+                if (operands[0] >= c->constants->size || operands[1] > stack_pointer || compile_function_stub(c, operands[0]) != 0) return false;
+                frame->ip += length;
+                if (!fold_enter_frame(frames, &frame_index, stack, &stack_pointer, c->constants->values[operands[0]], operands[1], stack_pointer - operands[1])) return false;
+                frame = &frames[frame_index];
+            break;
+
+            case OPCODE_RETURN_VALUE:
+            case OPCODE_RETURN:
+                obj = opcode == OPCODE_RETURN ? fold_null() : fold_pop();
+                stack_pointer = frame->return_pointer;
+                if (--frame_index < 0) {
+                    *result = obj;
+                    return true;
+                }
+                frame = &frames[frame_index];
+                fold_push(obj);
+            break;
+
+            default:
+                return false;
+            break;
+        }
+    }
+
+    #undef fold_push
+    #undef fold_pop
+}
+
+static enum opcode fold_infix_opcode(enum operator operator) {
+    switch (operator) {
+        case OP_ADD: return OPCODE_ADD;
+        case OP_SUBTRACT: return OPCODE_SUBTRACT;
+        case OP_MULTIPLY: return OPCODE_MULTIPLY;
+        case OP_DIVIDE: return OPCODE_DIVIDE;
+        case OP_GT: return OPCODE_GREATER_THAN;
+        case OP_LT: return OPCODE_LESS_THAN;
+        case OP_EQ: return OPCODE_EQUAL;
+        case OP_NOT_EQ: return OPCODE_NOT_EQUAL;
+        default: return OPCODE_NULL;
+    }
+}
+
+static bool fold_constant_expression(struct compiler *c, struct ast *ast, uint32_t expr, struct object *result) {
+    struct object left, right;
+    struct node n = ast->nodes[expr];
+
+    switch (n.type) {
+        case EXPR_INT:
+            *result = fold_integer((int) n.lhs);
+            return true;
+
+        case EXPR_BOOL:
+            *result = fold_boolean(n.lhs);
+            return true;
+
+        case EXPR_PREFIX:
+            if (!fold_constant_expression(c, ast, n.lhs, &right)) return false;
+            switch (n.operator) {
+                case OP_NEGATE:
+                    *result = fold_boolean(!fold_is_truthy(right));
+                    return true;
+                case OP_SUBTRACT:
+                    return fold_minus_operation(right, result);
+                default:
+                    return false;
+            }
+
+        case EXPR_INFIX:
+            if (!fold_constant_expression(c, ast, n.lhs, &left)) return false;
+            if (!fold_constant_expression(c, ast, n.rhs, &right)) return false;
+            return fold_binary_operation(fold_infix_opcode(n.operator), left, right, result);
+
+        case EXPR_CALL:
+            return fold_call_expression(c, ast, expr, result);
+
+        default:
+            return false;
+    }
+}
+
+bool fold_call_expression(struct compiler *c, struct ast *ast, uint32_t call, struct object *result) {
+    struct node n = ast->nodes[call];
+    if (ast->nodes[n.lhs].type != EXPR_IDENT) {
+        return false;
+    }
+
+    struct symbol resolved;
+    struct symbol *s = compiler_resolve(c, ast_string(ast, ast->nodes[n.lhs].lhs), &resolved);
+    if (s == NULL || s->scope != SCOPE_GLOBAL) {
+        return false;
+    }
+
+    int fn = compiler_global_function(c, s->index);
+    if (fn < 0 || compiler_function_unfoldable(c, fn)) {
+        return false;
+    }
+
+    struct object stack[FOLD_STACK_SIZE];
+    unsigned int stack_pointer = 0;
+    uint32_t num_args = ast_list_size(ast, n.rhs);
+    if (!fold_constant(c, fn, &stack[stack_pointer++]) || num_args >= FOLD_STACK_SIZE) {
+        return false;
+    }
+
+    for (int i=0; i < num_args; i++) {
+        if (!fold_constant_expression(c, ast, ast_list_item(ast, n.rhs, i), &stack[stack_pointer++])) {
+            return false;
+        }
+    }
+
+    // whatever made this call fail (most often the step budget) is likely to make the next one fail too
+    if (!fold_run(c, stack, stack_pointer, num_args, result)) {
+        compiler_set_function_unfoldable(c, fn);
+        return false;
+    }
+
+    // functions can not be turned back into a single constant yet
+    return result->type == OBJ_INT || result->type == OBJ_BOOL || result->type == OBJ_NULL;
+}
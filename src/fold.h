@@ -0,0 +1,15 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stdbool.h>
+#include "compiler.h"
+#include "parser.h"
+
+/* Upper bound on the number of instructions a single compile-time call may execute */
+#define FOLD_MAX_STEPS 1000000
+#define FOLD_STACK_SIZE 1024
+#define FOLD_MAX_FRAMES 256
+
+bool fold_call_expression(struct compiler *c, struct ast *ast, uint32_t call, struct object *result);
+
+#endif
@@ -0,0 +1,370 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include "image.h"
+
+struct image_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t object_size;
+    uint32_t num_globals;
+    uint32_t num_constants;
+    uint32_t call_sites;
+    uint64_t globals_offset;
+    uint64_t constants_offset;
+    uint64_t code_offset;
+    uint64_t code_size;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+
+    // offset of the first global's name within the strings section
+    uint64_t names_offset;
+};
+
+struct image_buffer {
+    uint8_t *bytes;
+    size_t size;
+    size_t cap;
+};
+
+// appends data to the buffer and returns its offset
+static size_t image_buffer_append(struct image_buffer *buf, void *data, size_t size) {
+    if (size == 0) {
+        return buf->size;
+    }
+
+    if (buf->size + size > buf->cap) {
+        buf->cap = buf->cap > 0 ? buf->cap : 1024;
+        while (buf->size + size > buf->cap) {
+            buf->cap *= 2;
+        }
+        buf->bytes = realloc(buf->bytes, buf->cap);
+        if (!buf->bytes) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+
+    memcpy(buf->bytes + buf->size, data, size);
+    buf->size += size;
+    return buf->size - size;
+}
+
+static size_t align_object(size_t offset) {
+    return (offset + alignof(struct object) - 1) / alignof(struct object) * alignof(struct object);
+}
+
+/*
+Copies obj to dest with its string or code replaced by an offset into the strings or code section.
+code_offsets holds the offset of each constant's code, which functions held in globals share.
+*/
+static int image_store_object(struct compiler *c, struct object *obj, struct object *dest, size_t *code_offsets, struct image_buffer *code, struct image_buffer *strings) {
+    memset(dest, 0, sizeof *dest);
+    dest->type = obj->type;
+
+    switch (obj->type) {
+        case OBJ_NULL:
+        break;
+
+        case OBJ_BOOL:
+            dest->value.boolean = obj->value.boolean;
+        break;
+
+        case OBJ_INT:
+            dest->value.integer = obj->value.integer;
+        break;
+
+        case OBJ_STRING:
+            dest->value.string = (char *) (uintptr_t) image_buffer_append(strings, obj->value.string, strlen(obj->value.string) + 1);
+        break;
+
+        case OBJ_COMPILED_FUNCTION: {
+            // values copied from a stub before it was compiled still refer to the stub
+            struct compiled_function *fn = &obj->value.compiled_function;
+            if (is_function_stub(fn)) {
+                fn = &c->constants->values[fn->constant]->value.compiled_function;
+                if (is_function_stub(fn)) {
+                    return IMAGE_ERR_UNSUPPORTED_VALUE;
+                }
+            }
+
+            size_t offset = SIZE_MAX;
+            for (unsigned int i = 0; i < c->constants->size && offset == SIZE_MAX; i++) {
+                if (c->constants->values[i]->type == OBJ_COMPILED_FUNCTION && c->constants->values[i]->value.compiled_function.instructions.bytes == fn->instructions.bytes) {
+                    offset = code_offsets[i];
+                }
+            }
+            if (offset == SIZE_MAX) {
+                offset = image_buffer_append(code, fn->instructions.bytes, fn->instructions.size);
+            }
+
+            dest->value.compiled_function = *fn;
+            dest->value.compiled_function.instructions.bytes = (uint8_t *) (uintptr_t) offset;
+            dest->value.compiled_function.instructions.cap = fn->instructions.size;
+        }
+        break;
+
+        default:
+            return IMAGE_ERR_UNSUPPORTED_VALUE;
+    }
+
+    return 0;
+}
+
+/*
+Writes the state of a VM that ran the compiler's program. Every function has to be compiled first,
+see compile_function_stubs.
+*/
+int image_write(struct compiler *c, struct vm *vm, FILE *f) {
+    struct object_list *constants = c->constants;
+    struct image_buffer code = { NULL, 0, 0 };
+    struct image_buffer strings = { NULL, 0, 0 };
+
+    size_t *code_offsets = malloc((constants->size + 1) * sizeof *code_offsets);
+    struct object *objects = malloc((vm->num_globals + constants->size + 1) * sizeof *objects);
+    char **names = calloc(vm->num_globals + 1, sizeof *names);
+    if (!code_offsets || !objects || !names) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    int err = 0;
+
+    for (unsigned int i = 0; i < constants->size; i++) {
+        struct object *obj = constants->values[i];
+        if (obj->type == OBJ_COMPILED_FUNCTION && !is_function_stub(&obj->value.compiled_function)) {
+            code_offsets[i] = image_buffer_append(&code, obj->value.compiled_function.instructions.bytes, obj->value.compiled_function.instructions.size);
+        }
+    }
+
+    for (unsigned int i = 0; i < vm->num_globals && !err; i++) {
+        err = image_store_object(c, &vm->globals[i], &objects[i], code_offsets, &code, &strings);
+    }
+    for (unsigned int i = 0; i < constants->size && !err; i++) {
+        err = image_store_object(c, constants->values[i], &objects[vm->num_globals + i], code_offsets, &code, &strings);
+    }
+    if (err) {
+        goto done;
+    }
+
+    // the names of the globals, in order of their index
+    for (unsigned int i = 0; i < c->symbol_table->slots_cap; i++) {
+        struct symbol *s = &c->symbol_table->slots[i].symbol;
+        if (s->name != NULL && s->scope == SCOPE_GLOBAL && (unsigned int) s->index < vm->num_globals) {
+            names[s->index] = s->name;
+        }
+    }
+    size_t names_offset = strings.size;
+    for (unsigned int i = 0; i < vm->num_globals; i++) {
+        char *name = names[i] != NULL ? names[i] : "";
+        image_buffer_append(&strings, name, strlen(name) + 1);
+    }
+
+    struct image_header header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, IMAGE_MAGIC, 4);
+    header.version = IMAGE_VERSION;
+    header.object_size = sizeof(struct object);
+    header.num_globals = vm->num_globals;
+    header.num_constants = constants->size;
+    header.call_sites = c->call_sites;
+    header.globals_offset = align_object(sizeof header);
+    header.constants_offset = header.globals_offset + vm->num_globals * sizeof(struct object);
+    header.code_offset = header.constants_offset + constants->size * sizeof(struct object);
+    header.code_size = code.size;
+    header.strings_offset = header.code_offset + code.size;
+    header.strings_size = strings.size;
+    header.names_offset = names_offset;
+
+    static const uint8_t padding[alignof(struct object)];
+    size_t objects_size = (vm->num_globals + constants->size) * sizeof(struct object);
+    if (fwrite(&header, sizeof header, 1, f) != 1
+        || fwrite(padding, 1, header.globals_offset - sizeof header, f) != header.globals_offset - sizeof header
+        || fwrite(objects, 1, objects_size, f) != objects_size
+        || fwrite(code.bytes, 1, code.size, f) != code.size
+        || fwrite(strings.bytes, 1, strings.size, f) != strings.size
+        || fflush(f) != 0) {
+        err = IMAGE_ERR_IO;
+    }
+
+    done:
+    free(code.bytes);
+    free(strings.bytes);
+    free(code_offsets);
+    free(objects);
+    free(names);
+    return err;
+}
+
+// whether the range [offset, offset + size) lies within a section of the given size
+static bool in_range(uint64_t offset, uint64_t size, uint64_t section_size) {
+    return offset <= section_size && size <= section_size - offset;
+}
+
+// turns the offsets image_store_object left in obj back into pointers into the mapping
+static bool image_load_object(struct object *obj, uint8_t *code, uint64_t code_size, char *strings, uint64_t strings_size) {
+    obj->name = NULL;
+    obj->next = NULL;
+
+    switch (obj->type) {
+        case OBJ_NULL:
+        case OBJ_BOOL:
+        case OBJ_INT:
+            return true;
+
+        case OBJ_STRING: {
+            uintptr_t offset = (uintptr_t) obj->value.string;
+            if (offset >= strings_size) {
+                return false;
+            }
+            obj->value.string = strings + offset;
+            return true;
+        }
+
+        case OBJ_COMPILED_FUNCTION: {
+            struct compiled_function *fn = &obj->value.compiled_function;
+            uintptr_t offset = (uintptr_t) fn->instructions.bytes;
+            // images hold no stubs, so every function has code
+            if (fn->instructions.size == 0 || !in_range(offset, fn->instructions.size, code_size)) {
+                return false;
+            }
+            fn->instructions.bytes = code + offset;
+            fn->instructions.cap = fn->instructions.size;
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+/*
+Maps an image into memory. The mapping is private and writable, so fixing up pointers only copies the
+pages holding objects, while code and strings are shared with the file.
+Returns NULL and sets error if the file can not be read or is not a valid image.
+*/
+struct image *image_map(char *path, int *error) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        *error = IMAGE_ERR_IO;
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        *error = IMAGE_ERR_IO;
+        return NULL;
+    }
+    if ((size_t) st.st_size < sizeof(struct image_header)) {
+        close(fd);
+        *error = IMAGE_ERR_CORRUPT;
+        return NULL;
+    }
+
+    size_t size = st.st_size;
+    uint8_t *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        *error = IMAGE_ERR_IO;
+        return NULL;
+    }
+
+    struct image_header *header = (struct image_header *) data;
+    if (memcmp(header->magic, IMAGE_MAGIC, 4) != 0) {
+        *error = IMAGE_ERR_BAD_MAGIC;
+        goto fail;
+    }
+    if (header->version != IMAGE_VERSION || header->object_size != sizeof(struct object)) {
+        *error = IMAGE_ERR_VERSION;
+        goto fail;
+    }
+
+    // every string has to end within the strings section, so it is enough for the section to end with a NUL
+    *error = IMAGE_ERR_CORRUPT;
+    if (header->globals_offset % alignof(struct object) != 0
+        || header->constants_offset % alignof(struct object) != 0
+        || !in_range(header->globals_offset, (uint64_t) header->num_globals * sizeof(struct object), size)
+        || !in_range(header->constants_offset, (uint64_t) header->num_constants * sizeof(struct object), size)
+        || !in_range(header->code_offset, header->code_size, size)
+        || !in_range(header->strings_offset, header->strings_size, size)
+        || header->names_offset > header->strings_size
+        || (header->strings_size > 0 && data[header->strings_offset + header->strings_size - 1] != '\0')) {
+        goto fail;
+    }
+
+    uint8_t *code = data + header->code_offset;
+    char *strings = (char *) data + header->strings_offset;
+    struct object *globals = (struct object *) (data + header->globals_offset);
+    struct object *constants = (struct object *) (data + header->constants_offset);
+    for (uint32_t i = 0; i < header->num_globals; i++) {
+        if (!image_load_object(&globals[i], code, header->code_size, strings, header->strings_size)) {
+            goto fail;
+        }
+    }
+    for (uint32_t i = 0; i < header->num_constants; i++) {
+        if (!image_load_object(&constants[i], code, header->code_size, strings, header->strings_size)) {
+            goto fail;
+        }
+    }
+
+    struct image *img = malloc(sizeof *img);
+    if (!img) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    img->globals = globals;
+    img->num_globals = header->num_globals;
+    img->call_sites = header->call_sites;
+    img->mapping = data;
+    img->mapping_size = size;
+
+    img->symbol_table = symbol_table_new();
+    uint64_t pos = header->names_offset;
+    for (uint32_t i = 0; i < header->num_globals; i++) {
+        if (pos >= header->strings_size) {
+            symbol_table_free(img->symbol_table);
+            free(img);
+            goto fail;
+        }
+        symbol_table_define(img->symbol_table, strings + pos);
+        pos += strlen(strings + pos) + 1;
+    }
+
+    // the list itself is not part of the image, since compiling against the image appends to it
+    img->constants = make_object_list(header->num_constants + 64);
+    for (uint32_t i = 0; i < header->num_constants; i++) {
+        object_list_append(img->constants, &constants[i]);
+    }
+
+    *error = 0;
+    return img;
+
+    fail:
+    munmap(data, size);
+    return NULL;
+}
+
+void image_unmap(struct image *img) {
+    munmap(img->mapping, img->mapping_size);
+    symbol_table_free(img->symbol_table);
+    free(img->constants->values);
+    free(img->constants);
+    free(img);
+}
+
+char *image_error_str(int err) {
+    static char *messages[] = {
+        "Success",
+        "Could not read or write image file",
+        "Not an image file",
+        "Image was written by a different version or build",
+        "Corrupt image file",
+        "Value can not be stored in an image",
+    };
+    return messages[err];
+}
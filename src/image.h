@@ -0,0 +1,52 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include "compiler.h"
+#include "vm.h"
+
+/*
+Snapshot of a program after it ran: its globals, constants, the code of every function and all strings
+they refer to, plus the names of the globals so that other scripts can be compiled against them.
+
+Unlike bytecode files, images hold objects in the VM's own in-memory layout, so loading one takes a
+single mmap and a pass that turns the section offsets stored in string and code pointers back into
+pointers. The flip side is that images only load in builds with the same object layout.
+
+    header          magic, version, sizeof(struct object) and the offset and size of each section below
+    globals         struct object[num_globals]
+    constants       struct object[num_constants]
+    code            the instructions of every function
+    strings         NUL-terminated strings, first the values of string objects, then the names of the globals
+*/
+#define IMAGE_MAGIC "MKIM"
+#define IMAGE_VERSION 1
+
+#define IMAGE_ERR_IO 1
+#define IMAGE_ERR_BAD_MAGIC 2
+#define IMAGE_ERR_VERSION 3
+#define IMAGE_ERR_CORRUPT 4
+#define IMAGE_ERR_UNSUPPORTED_VALUE 5
+
+struct image {
+    struct object *globals;
+    unsigned int num_globals;
+
+    // constants of the image followed by those of anything compiled against it
+    struct object_list *constants;
+
+    // resolves the names of the image's globals
+    struct symbol_table *symbol_table;
+
+    unsigned int call_sites;
+
+    void *mapping;
+    size_t mapping_size;
+};
+
+int image_write(struct compiler *c, struct vm *vm, FILE *f);
+struct image *image_map(char *path, int *error);
+void image_unmap(struct image *img);
+char *image_error_str(int err);
+
+#endif
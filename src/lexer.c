@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "lexer.h"
+#include "scan.h"
 
 int is_letter(char ch) {
     return (ch >= 'a' && ch <= 'z') 
@@ -12,170 +13,106 @@ int is_digit(char ch) {
     return (ch >= '0' && ch <= '9');
 }
 
-int gettoken(struct lexer *l, struct token *t) {
+int is_whitespace(char ch) {
+    return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r';
+}
+
+/* reads more of a stream if pos is at the end of what was read so far, returns false if there is no more */
+static bool read_more(struct lexer *l, unsigned int pos) {
+    return l->source != NULL && pos >= l->source->size && source_read_more(l->source);
+}
+
+/*
+Most runs of whitespace, letters or digits are a single character, which we check for before
+handing longer runs to the scanner (see scan.h).
+*/
+static int lex_token(struct lexer *l, struct token *t) {
     char ch = l->input[l->pos++];
     
     // skip whitespace
-    while (ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r') {
+    if (is_whitespace(ch)) {
+        if (is_whitespace(l->input[l->pos])) {
+            l->pos = scanner.whitespace(l->input + l->pos) - l->input;
+        }
         ch = l->input[l->pos++];
     }
 
-    char ch_next = l->input[l->pos];
+    t->pos = l->pos - 1;
+    t->start = l->input + t->pos;
+    t->length = 1;
+    char ch_next = ch ? l->input[l->pos] : '\0';
 
     switch (ch) {
         case '=':
             if (ch_next == '=') {
                 t->type = TOKEN_EQ;
-                strcpy(t->literal, "==");
+                t->length = 2;
                 l->pos++;
             } else {
                 t->type = TOKEN_ASSIGN;
-                t->literal[0] = ch;
-                t->literal[1] = '\0';
             }
         break;
 
-        case ';':
-            t->type = TOKEN_SEMICOLON;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
-
-        case '(':
-            t->type = TOKEN_LPAREN;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
-        
-        case ')':
-            t->type = TOKEN_RPAREN;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
-
-        case ',':
-            t->type = TOKEN_COMMA;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
-
-        case '+':
-            t->type = TOKEN_PLUS;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
-
-        case '-':
-            t->type = TOKEN_MINUS;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
+        case ';': t->type = TOKEN_SEMICOLON; break;
+        case '(': t->type = TOKEN_LPAREN; break;
+        case ')': t->type = TOKEN_RPAREN; break;
+        case ',': t->type = TOKEN_COMMA; break;
+        case '+': t->type = TOKEN_PLUS; break;
+        case '-': t->type = TOKEN_MINUS; break;
 
         case '!':
             if (ch_next == '=') {
                 t->type = TOKEN_NOT_EQ;
-                strcpy(t->literal, "!=");
+                t->length = 2;
                 l->pos++;
             } else {
                 t->type = TOKEN_BANG;
-                t->literal[0] = ch;
-                t->literal[1] = '\0';
             }
         break;
 
-        case '/':
-            t->type = TOKEN_SLASH;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
-
-        case '*':
-            t->type = TOKEN_ASTERISK;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
-
-        case '<':
-            t->type = TOKEN_LT;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
-
-        case '>':
-            t->type = TOKEN_GT;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
-
-        case '{':
-            t->type = TOKEN_LBRACE;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
-
-        case '}':
-            t->type = TOKEN_RBRACE;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
-
-        case '[': 
-            t->type = TOKEN_LBRACKET;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
-
-        case ']': 
-            t->type = TOKEN_RBRACKET;
-            t->literal[0] = ch;
-            t->literal[1] = '\0';
-        break;
+        case '/': t->type = TOKEN_SLASH; break;
+        case '*': t->type = TOKEN_ASTERISK; break;
+        case '<': t->type = TOKEN_LT; break;
+        case '>': t->type = TOKEN_GT; break;
+        case '{': t->type = TOKEN_LBRACE; break;
+        case '}': t->type = TOKEN_RBRACE; break;
+        case '[': t->type = TOKEN_LBRACKET; break;
+        case ']': t->type = TOKEN_RBRACKET; break;
 
         case '"': {
+            // the string runs up to the next quote or the end of the input
             t->type = TOKEN_STRING;
-            int i;
-            char ch;
-            for (i=0; (ch = l->input[l->pos + i]) && ch != '"' && ch != '\0'; i++) {
-                t->literal[i] = ch;
-            }
-            t->literal[i++] = '\0';
-            l->pos += i;
+            t->start++;
+            unsigned int end = scanner.string_end(l->input + l->pos) - l->input;
+            t->length = end - l->pos;
+            l->pos = l->input[end] == '"' ? end + 1 : end;
         }
         break;
 
         default: {
             if (is_letter(ch)) {    
-                int i = 0; 
-                while (is_letter(ch)) {
-                    t->literal[i++] = ch;
-                    ch = l->input[l->pos++];
+                if (is_letter(l->input[l->pos])) {
+                    l->pos = scanner.letters(l->input + l->pos) - l->input;
                 }
-                t->literal[i] = '\0';
+                t->length = l->pos - t->pos;
                 get_ident(t);
-
-                 // return last character to input 
-                l->pos--;
             } else if (is_digit(ch)) {
-                int i = 0;
-                while (is_digit(ch)) {
-                    t->literal[i++] = ch;
-                    ch = l->input[l->pos++];
+                if (is_digit(l->input[l->pos])) {
+                    l->pos = scanner.digits(l->input + l->pos) - l->input;
                 }
-                t->literal[i++] = '\0';
+                t->length = l->pos - t->pos;
                 t->type = TOKEN_INT;
-
-                // return last character to input 
-                l->pos--;
             } else {
                 t->type = TOKEN_ILLEGAL;
-                t->literal[0] = ch;  
             }            
             break;
         }
 
         case '\0':
+            // stay on the terminating NUL so repeated calls keep returning EOF
+            l->pos--;
             t->type = TOKEN_EOF;
-            t->literal[0] = '\0';
+            t->length = 0;
             return -1; // signal DONE
         break;
     }
@@ -183,11 +120,33 @@ int gettoken(struct lexer *l, struct token *t) {
     return 1;
 }
 
+int gettoken(struct lexer *l, struct token *t) {
+    unsigned int start = l->pos;
+    int result = lex_token(l, t);
+
+    // with a stream, a token that runs into the end of the input read so far may go on in the next chunk
+    while (read_more(l, l->pos)) {
+        l->pos = start;
+        result = lex_token(l, t);
+    }
+    return result;
+}
 
 struct lexer new_lexer(char *input) {
     struct lexer lexer = {
         .input = input, 
-        .pos = 0
+        .pos = 0,
+        .source = NULL,
+    };
+    return lexer;
+}
+
+/* lexes s, which for streams means reading more of it whenever a token reaches the end of what is there */
+struct lexer new_source_lexer(struct source *s) {
+    struct lexer lexer = {
+        .input = s->data,
+        .pos = 0,
+        .source = s,
     };
     return lexer;
 }
\ No newline at end of file
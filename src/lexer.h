@@ -2,14 +2,19 @@
 #define LEXER_H
 
 #include "token.h"
+#include "source.h"
 
 struct lexer {
     char *input;
     unsigned int pos;
+
+    // stream that input comes from, NULL if all of it is there already
+    struct source *source;
 };
 
 int gettoken(struct lexer *l, struct token *t);
 
 extern struct lexer new_lexer(char *input);
+extern struct lexer new_source_lexer(struct source *s);
 
 #endif
\ No newline at end of file
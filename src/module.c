@@ -0,0 +1,167 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <err.h>
+
+#include "module.h"
+
+// modules loaded by this thread that are still being compiled, the cache is locked while there are any
+static _Thread_local unsigned int loading;
+
+struct module_cache *module_cache_new() {
+    struct module_cache *mc = malloc(sizeof *mc);
+    if (!mc) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    mc->modules = NULL;
+    mc->size = 0;
+    mc->cap = 0;
+    pthread_mutex_init(&mc->lock, NULL);
+    return mc;
+}
+
+/* the path of the module name imported from the file at from, which is resolved unless the module does not exist */
+static char *module_path(char *from, char *name) {
+    char path[PATH_MAX];
+    char *dir_end = from != NULL ? strrchr(from, '/') : NULL;
+    if (name[0] == '/' || dir_end == NULL) {
+        snprintf(path, sizeof path, "%s", name);
+    } else {
+        snprintf(path, sizeof path, "%.*s/%s", (int) (dir_end - from), from, name);
+    }
+
+    char *resolved = realpath(path, NULL);
+    if (resolved == NULL) {
+        resolved = strdup(path);
+        if (!resolved) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+    return resolved;
+}
+
+/* the globals a module uses without defining them have to come from the modules it imports */
+static int module_check_externals(struct compiler *unit) {
+    for (unsigned int i = 0; i < unit->symbol_table->size; i++) {
+        if (!unit->unit_globals[i].external) {
+            continue;
+        }
+
+        bool imported = false;
+        for (unsigned int j = 0; j < unit->modules_size && !imported; j++) {
+            imported = symbol_table_resolve(unit->modules[j]->unit->symbol_table, unit->unit_globals[i].name) != NULL;
+        }
+        if (!imported) {
+            return COMPILE_ERR_UNKNOWN_IDENTIFIER;
+        }
+    }
+
+    return 0;
+}
+
+static void module_compile(struct module_cache *mc, struct module *m) {
+    m->source = source_map(m->path);
+    if (!m->source) {
+        m->error = MODULE_ERR_IO;
+        return;
+    }
+
+    struct lexer lexer = new_source_lexer(m->source);
+    struct parser parser = new_parser(&lexer);
+    parser.pre_parse = true;
+    m->program = parse_program(&parser);
+    if (parser.errors > 0) {
+        m->error = MODULE_ERR_PARSE;
+        m->parse_errors = parser.errors;
+        memcpy(m->parse_error_messages, parser.error_messages, sizeof m->parse_error_messages);
+        return;
+    }
+
+    m->unit = compiler_new_unit();
+    m->unit->module_cache = mc;
+    m->unit->path = m->path;
+    m->loading = true;
+    m->compile_error = compile_program(m->unit, m->program);
+    if (!m->compile_error) {
+        m->compile_error = compile_function_stubs(m->unit);
+    }
+    if (!m->compile_error) {
+        m->compile_error = module_check_externals(m->unit);
+    }
+    m->loading = false;
+    if (m->compile_error) {
+        m->error = MODULE_ERR_COMPILE;
+    }
+}
+
+static struct module *module_get(struct module_cache *mc, char *path) {
+    for (unsigned int i = 0; i < mc->size; i++) {
+        if (strcmp(mc->modules[i]->path, path) == 0) {
+            free(path);
+            return mc->modules[i];
+        }
+    }
+
+    struct module *m = calloc(1, sizeof *m);
+    if (!m) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    m->path = path;
+    if (mc->size == mc->cap) {
+        mc->cap = mc->cap ? mc->cap * 2 : 16;
+        mc->modules = realloc(mc->modules, mc->cap * sizeof *mc->modules);
+        if (!mc->modules) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+    mc->modules[mc->size++] = m;
+
+    module_compile(mc, m);
+    return m;
+}
+
+/*
+Looks up the module name imported from the file at from (NULL for the working directory) in the cache, compiling
+it first if it is not in there. Returns COMPILE_ERR_IMPORT if the module (or one it imports) could not be read,
+parsed or compiled, see the module for what went wrong, or COMPILE_ERR_IMPORT_CYCLE if it is being compiled already.
+*/
+int module_load(struct module_cache *mc, char *from, char *name, struct module **m) {
+    if (mc == NULL) {
+        return COMPILE_ERR_IMPORT;
+    }
+
+    // modules imported while compiling a module are loaded under the lock taken for that one
+    if (loading++ == 0) {
+        pthread_mutex_lock(&mc->lock);
+    }
+    *m = module_get(mc, module_path(from, name));
+    int error = (*m)->loading ? COMPILE_ERR_IMPORT_CYCLE : (*m)->error ? COMPILE_ERR_IMPORT : 0;
+    if (--loading == 0) {
+        pthread_mutex_unlock(&mc->lock);
+    }
+
+    return error;
+}
+
+/* the programs and units of modules are shared by everything compiled with the cache, which has to go first */
+void module_cache_free(struct module_cache *mc) {
+    for (unsigned int i = 0; i < mc->size; i++) {
+        struct module *m = mc->modules[i];
+        if (m->unit) {
+            compiler_free(m->unit);
+        }
+        if (m->program) {
+            free_program(m->program);
+        }
+        if (m->source) {
+            source_free(m->source);
+        }
+        free(m->path);
+        free(m);
+    }
+    pthread_mutex_destroy(&mc->lock);
+    free(mc->modules);
+    free(mc);
+}
@@ -0,0 +1,56 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include "compiler.h"
+#include "parser.h"
+#include "source.h"
+
+/*
+Modules are files pulled into a program by an import statement at the top level: import "lib/math.monkey";
+The path is relative to the directory of the file with the import.
+
+A module cache parses and compiles every module once, as a unit (see compiler_link) of which all functions are
+compiled right away, and keeps it for every compiler using the cache, also on other threads. Importing links a copy
+of the module into the program, at most once per program: its globals become globals of the program and its
+top-level code runs where it was first imported.
+
+Units, like the files of a project, only learn the names of the globals of the modules they import; compiler_link
+links the modules ahead of the unit. A module is a unit too, so modules can import modules, but not each other.
+*/
+#define MODULE_ERR_IO 1
+#define MODULE_ERR_PARSE 2
+#define MODULE_ERR_COMPILE 3
+
+struct module {
+    // resolved path, which identifies the module
+    char *path;
+    struct source *source;
+    struct program *program;
+    struct compiler *unit;
+
+    // set while the module is compiled, importing it then means modules import each other
+    bool loading;
+
+    // one of MODULE_ERR_*, the parser's messages or compiler's error code tell what went wrong
+    int error;
+    int compile_error;
+    unsigned int parse_errors;
+    char parse_error_messages[8][128];
+};
+
+struct module_cache {
+    struct module **modules;
+    unsigned int size;
+    unsigned int cap;
+
+    // held while a module is loaded, including the modules it imports
+    pthread_mutex_t lock;
+};
+
+struct module_cache *module_cache_new();
+int module_load(struct module_cache *mc, char *from, char *name, struct module **m);
+void module_cache_free(struct module_cache *mc);
+
+#endif
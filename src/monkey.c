@@ -1,9 +1,19 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "eval.h"
 #include "compiler.h"
 #include "vm.h"
+#include "verifier.h"
+#include "bytecode.h"
+#include "image.h"
+#include "project.h"
+#include "module.h"
 
 #define VERSION_MAJOR 0
 #define VERSION_MINOR 0
@@ -12,12 +22,72 @@
 // TODO: perhaps mock this in case it's not installed, since it's not super necessary
 #include <editline/readline.h>
 
-char *read_file(char *filename);
+struct source *load_script(char *filename);
+
+// maximum number of stack values and nested calls, 0 for the VM's default
+unsigned int stack_limit = 0;
+
+// compile scripts while parsing them, without building an AST first
+bool single_pass = false;
+
+// modules imported by anything compiled in this process, each one is compiled only once
+struct module_cache *module_cache = NULL;
+
+/* parses the value of --stack-limit, returns 0 if it is not a limit the VM can be set to */
+unsigned int parse_stack_limit(char *str) {
+    char *end;
+    errno = 0;
+    unsigned long limit = strtoul(str, &end, 10);
+    if (errno != 0 || end == str || *end != '\0' || str[0] == '-' || limit < VM_MIN_STACK_LIMIT || limit > VM_MAX_STACK_LIMIT) {
+        return 0;
+    }
+    return limit;
+}
 
 void print_version() {
     printf("Monkey-C %d.%d.%d\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
 }
 
+/* prints a compiler error, and for failed imports what went wrong with the modules */
+void print_compile_error(int err) {
+    puts(compiler_error_str(err));
+    if (err != COMPILE_ERR_IMPORT && err != COMPILE_ERR_IMPORT_CYCLE) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < module_cache->size; i++) {
+        struct module *m = module_cache->modules[i];
+        switch (m->error) {
+            case MODULE_ERR_IO:
+                printf("Could not open \"%s\" for reading\n", m->path);
+            break;
+            case MODULE_ERR_PARSE:
+                for (unsigned int j = 0; j < m->parse_errors; j++) {
+                    printf("%s: %s\n", m->path, m->parse_error_messages[j]);
+                }
+            break;
+            case MODULE_ERR_COMPILE:
+                printf("%s: %s\n", m->path, compiler_error_str(m->compile_error));
+            break;
+        }
+    }
+}
+
+// functions are compiled on their first call, so compiler errors in their bodies only turn up while running
+void print_vm_error(struct vm *machine, int err) {
+    if (machine->compile_error == 0) {
+        printf("Error executing bytecode: %d\n", err);
+        return;
+    }
+
+    if (machine->compile_error_function != NULL) {
+        printf("In function %s: ", machine->compile_error_function);
+    } else {
+        printf("In anonymous function: ");
+    }
+    print_compile_error(machine->compile_error);
+}
+
 int repl() {
     print_version();
     printf("press CTRL+c to exit\n\n");
@@ -33,11 +103,12 @@ int repl() {
 
     struct symbol_table *symbol_table = symbol_table_new();
     struct object_list *constants = make_object_list(128);
+    unsigned int call_sites = 0;
+    struct function_stub *stubs = NULL;
+    unsigned int stubs_cap = 0;
     
-    struct object globals[STACK_SIZE];
-    for (int i = 0; i < STACK_SIZE; i++) {
-        globals[i] = obj_null;
-    }
+    struct object *globals = NULL;
+    unsigned int num_globals = 0;
 
     while (1)
     {
@@ -60,17 +131,39 @@ int repl() {
         }
 
         struct compiler *compiler = compiler_new_with_state(symbol_table, constants);
+        compiler->call_sites = call_sites;
+        compiler->stubs = stubs;
+        compiler->stubs_cap = stubs_cap;
+        compiler->module_cache = module_cache;
         int err = compile_program(compiler, program);
+
+        // functions from earlier lines keep referring to their own inline cache slots, and the ones
+        // not called yet to where their literal is
+        call_sites = compiler->call_sites;
+        stubs = compiler->stubs;
+        stubs_cap = compiler->stubs_cap;
         if (err) {
-            puts(compiler_error_str(err));
+            print_compile_error(err);
             continue;
         }
 
         struct bytecode *code = get_bytecode(compiler);
-        struct vm *machine = vm_new_with_globals(code, globals);
+        struct vm *machine = vm_new_with_globals(code, globals, num_globals);
+        if (!machine) {
+            printf("Invalid bytecode: %s\n", verifier_error_str(verify_bytecode(code)));
+            continue;
+        }
+        if (stack_limit > 0) {
+            vm_set_stack_limit(machine, stack_limit);
+        }
         err = vm_run(machine);
+
+        // the same goes for call sites and stubs of functions compiled while running
+        call_sites = compiler->call_sites;
+        stubs = compiler->stubs;
+        stubs_cap = compiler->stubs_cap;
         if (err) {
-            printf("Error executing bytecode: %d\n", err);
+            print_vm_error(machine, err);
             continue;
         }
 
@@ -84,21 +177,69 @@ int repl() {
         output[0] = '\0';
 
         // copy globals out of VM so we can re-use it next iteration
-        for (int i=0; i < STACK_SIZE; i++) {
+        if (machine->num_globals > num_globals) {
+            globals = realloc(globals, machine->num_globals * sizeof *globals);
+            if (!globals) {
+                puts("Failed to allocate memory for globals");
+                exit(1);
+            }
+            num_globals = machine->num_globals;
+        }
+        for (int i=0; i < num_globals; i++) {
             globals[i] = machine->globals[i];
         }
 
-        free(input);
+        // the program is kept for functions that are compiled when first called, their bodies are parsed from the input
     }
 
+    free(globals);
     free(output);
     return 0;
 }
 
-int run_script(char *filename) {
-    char *input = read_file(filename);
-    struct lexer lexer = new_lexer(input);
+// runs the bytecode, starting from the given globals, and returns the VM or NULL if it failed
+struct vm *run_vm(struct bytecode *code, struct object *globals, unsigned int num_globals) {
+    struct vm *machine = vm_new_with_globals(code, globals, num_globals);
+    if (!machine) {
+        printf("Invalid bytecode: %s\n", verifier_error_str(verify_bytecode(code)));
+        return NULL;
+    }
+    if (stack_limit > 0) {
+        vm_set_stack_limit(machine, stack_limit);
+    }
+    int err = vm_run(machine);
+    if (err) {
+        print_vm_error(machine, err);
+        return NULL;
+    }
+
+    return machine;
+}
+
+int run_bytecode(struct bytecode *code, struct object *globals, unsigned int num_globals) {
+    struct vm *machine = run_vm(code, globals, num_globals);
+    if (!machine) {
+        return EXIT_FAILURE;
+    }
+
+    char output[256];
+    output[0] = '\0';
+    struct object obj = vm_stack_last_popped(machine);
+    if (obj.type == OBJ_NULL && obj.type != OBJ_BUILTIN && obj.type != OBJ_FUNCTION) {
+        object_to_str(output, &obj);
+        printf("%s\n", output);
+    }
+
+    vm_free(machine);
+    return EXIT_SUCCESS;
+}
+
+struct program *parse_script(struct source *src) {
+    struct lexer lexer = new_source_lexer(src);
     struct parser parser = new_parser(&lexer);
+
+    // only functions that end up being called are parsed in full, the input stays around for that
+    parser.pre_parse = true;
     struct program *program = parse_program(&parser);
 
     if (parser.errors > 0) {
@@ -109,34 +250,325 @@ int run_script(char *filename) {
         exit(1);
     }
 
+    return program;
+}
+
+/* like parse_script, but compiles the top level code while parsing it */
+struct program *compile_script_single_pass(struct compiler *c, struct source *src, int *err) {
+    struct lexer lexer = new_source_lexer(src);
+    struct parser parser = new_parser(&lexer);
+    struct program *program = compile_single_pass(c, &parser, err);
+
+    if (parser.errors > 0) {
+        for (int i = 0; i < parser.errors; i++) {
+            puts(parser.error_messages[i]);
+        }
+
+        exit(1);
+    }
+
+    return program;
+}
+
+/*
+Compiled scripts are cached as bytecode files named after a hash of their source, in $MONKEY_CACHE_DIR,
+$XDG_CACHE_HOME/monkey or ~/.cache/monkey (in that order). Setting MONKEY_CACHE_DIR to an empty string
+turns the cache off. Returns NULL if there is no usable cache directory.
+*/
+char *cache_path(char *source) {
+    char dir[4096];
+    char *env = getenv("MONKEY_CACHE_DIR");
+    if (env != NULL) {
+        if (env[0] == '\0') {
+            return NULL;
+        }
+        snprintf(dir, sizeof dir, "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) != NULL && env[0] != '\0') {
+        snprintf(dir, sizeof dir, "%s/monkey", env);
+    } else if ((env = getenv("HOME")) != NULL && env[0] != '\0') {
+        snprintf(dir, sizeof dir, "%s/.cache", env);
+        mkdir(dir, 0755);
+        snprintf(dir, sizeof dir, "%s/.cache/monkey", env);
+    } else {
+        return NULL;
+    }
+
+    struct stat st;
+    if (mkdir(dir, 0755) != 0 && (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))) {
+        return NULL;
+    }
+
+    // FNV-1a over the source and the bytecode version, so that files from older versions are never picked up
+    uint64_t hash = 0xcbf29ce484222325;
+    for (char *c = source; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t) *c) * 0x100000001b3;
+    }
+    hash = (hash ^ BYTECODE_VERSION) * 0x100000001b3;
+
+    char *path = malloc(strlen(dir) + 32);
+    if (!path) {
+        puts("Failed to allocate memory for cache path");
+        exit(1);
+    }
+    sprintf(path, "%s/%016llx.mbc", dir, (unsigned long long) hash);
+    return path;
+}
+
+/*
+Writes bytecode to a temporary file next to the cache entry and renames it into place, so that
+concurrent runs of the same script only ever see complete files. Failing to cache is not an error.
+*/
+void cache_store(char *path, struct bytecode *code) {
+    char *tmp = malloc(strlen(path) + 8);
+    if (!tmp) {
+        puts("Failed to allocate memory for cache path");
+        exit(1);
+    }
+    sprintf(tmp, "%s.XXXXXX", path);
+
+    int fd = mkstemp(tmp);
+    FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!f) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        return;
+    }
+
+    int err = bytecode_write(code, f);
+    if (fclose(f) != 0 || err || chmod(tmp, 0644) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+int run_script(char *filename) {
+    if (bytecode_is_file(filename)) {
+        int err;
+        struct bytecode *code = bytecode_map(filename, &err);
+        if (!code) {
+            puts(bytecode_error_str(err));
+            return EXIT_FAILURE;
+        }
+
+        err = run_bytecode(code, NULL, 0);
+        bytecode_unmap(code);
+        return err;
+    }
+
+    // scripts read from stdin are compiled as they come in, so they can not be looked up in the cache
+    struct source *src = load_script(filename);
+    char *cached = src->fd < 0 ? cache_path(src->data) : NULL;
+    if (cached != NULL) {
+        // a missing or broken cache entry is replaced by compiling the script again
+        int err;
+        struct bytecode *code = bytecode_map(cached, &err);
+        if (code != NULL) {
+            free(cached);
+            source_free(src);
+            err = run_bytecode(code, NULL, 0);
+            bytecode_unmap(code);
+            return err;
+        }
+    }
+
     struct compiler *compiler = compiler_new();
+    compiler->module_cache = module_cache;
+    compiler->path = src->fd < 0 ? filename : NULL;
+    struct program *program;
+    int err;
+    if (single_pass) {
+        program = compile_script_single_pass(compiler, src, &err);
+    } else {
+        program = parse_script(src);
+        err = compile_program(compiler, program);
+    }
+    if (err) {
+        print_compile_error(err);
+        return EXIT_FAILURE;
+    }
+
+    /*
+    Only scripts whose functions all compile can be cached, the others still run with lazily compiled functions.
+    Neither can scripts with imports, the cache entry would outlive changes to the modules.
+    */
+    if (cached != NULL && compiler->modules_size == 0 && compile_function_stubs(compiler) == 0) {
+        struct bytecode *code = get_bytecode(compiler);
+        cache_store(cached, code);
+        free(code);
+    }
+    free(cached);
+
+    err = run_bytecode(get_bytecode(compiler), NULL, 0);
+    free_program(program);
+    return err;
+}
+
+/* runs the files as one program, reading, parsing and compiling them in parallel */
+int run_project(char **filenames, unsigned int n) {
+    struct project *project = project_new(filenames, n);
+    struct compiler *compiler = compiler_new();
+    compiler->module_cache = module_cache;
+    unsigned int failed;
+    int err = project_compile(project, compiler, 0, &failed);
+    if (err) {
+        struct project_file *f = &project->files[failed];
+        switch (err) {
+            case PROJECT_ERR_IO:
+                printf("Could not open \"%s\" for reading\n", f->path);
+            break;
+            case PROJECT_ERR_PARSE:
+                for (unsigned int i = 0; i < f->parse_errors; i++) {
+                    printf("%s: %s\n", f->path, f->parse_error_messages[i]);
+                }
+            break;
+            default:
+                printf("%s: ", f->path);
+                print_compile_error(f->compile_error);
+            break;
+        }
+        return EXIT_FAILURE;
+    }
+
+    return run_bytecode(get_bytecode(compiler), NULL, 0);
+}
+
+int compile_script(char *filename, char *output) {
+    struct program *program = parse_script(load_script(filename));
+    struct compiler *compiler = compiler_new();
+    compiler->module_cache = module_cache;
+    compiler->path = filename;
+
+    // a bytecode file has no source to compile functions from later on, so compile them all now
     int err = compile_program(compiler, program);
+    if (!err) {
+        err = compile_function_stubs(compiler);
+    }
     if (err) {
-        puts(compiler_error_str(err));
+        print_compile_error(err);
+        return EXIT_FAILURE;
+    }
+
+    FILE *f = fopen(output, "wb");
+    if (!f) {
+        printf("Could not open \"%s\" for writing\n", output);
         return EXIT_FAILURE;
     }
 
     struct bytecode *code = get_bytecode(compiler);
-    struct vm *machine = vm_new(code);
-    err = vm_run(machine);
+    err = bytecode_write(code, f);
+    if (fclose(f) != 0 && !err) {
+        err = BYTECODE_ERR_IO;
+    }
     if (err) {
-        printf("Error executing bytecode: %d\n", err);
+        puts(bytecode_error_str(err));
+        remove(output);
         return EXIT_FAILURE;
     }
 
-    char output[256];
-    output[0] = '\0';
-    struct object obj = vm_stack_last_popped(machine);
-    if (obj.type == OBJ_NULL && obj.type != OBJ_BUILTIN && obj.type != OBJ_FUNCTION) {
-        object_to_str(output, &obj);
-        printf("%s\n", output);
+    free(code);
+    compiler_free(compiler);
+    free_program(program);
+    return EXIT_SUCCESS;
+}
+
+/*
+Runs a script and saves the state it leaves behind as an image, so that its initialization does not
+have to be repeated by scripts that run on top of it, see run_with_image.
+*/
+int dump_image(char *filename, char *output) {
+    struct program *program = parse_script(load_script(filename));
+    struct compiler *compiler = compiler_new();
+    compiler->module_cache = module_cache;
+    compiler->path = filename;
+    int err = compile_program(compiler, program);
+    if (err) {
+        print_compile_error(err);
+        return EXIT_FAILURE;
+    }
+
+    struct bytecode *code = get_bytecode(compiler);
+    struct vm *machine = run_vm(code, NULL, 0);
+    if (!machine) {
+        return EXIT_FAILURE;
     }
 
+    // scripts running on top of the image have no source to compile its functions from
+    err = compile_function_stubs(compiler);
+    if (err) {
+        puts(compiler_error_str(err));
+        return EXIT_FAILURE;
+    }
+
+    FILE *f = fopen(output, "wb");
+    if (!f) {
+        printf("Could not open \"%s\" for writing\n", output);
+        return EXIT_FAILURE;
+    }
+
+    err = image_write(compiler, machine, f);
+    if (fclose(f) != 0 && !err) {
+        err = IMAGE_ERR_IO;
+    }
+    if (err) {
+        puts(image_error_str(err));
+        remove(output);
+        return EXIT_FAILURE;
+    }
+
+    vm_free(machine);
+    free(code);
+    compiler_free(compiler);
     free_program(program);
     return EXIT_SUCCESS;
 }
 
+/* runs a script with the globals of an image, which were set up by the script the image was made from */
+int run_with_image(char *image_path, char *filename) {
+    int err;
+    struct image *img = image_map(image_path, &err);
+    if (!img) {
+        puts(image_error_str(err));
+        return EXIT_FAILURE;
+    }
+
+    struct program *program = parse_script(load_script(filename));
+    struct compiler *compiler = compiler_new_with_state(img->symbol_table, img->constants);
+    compiler->call_sites = img->call_sites;
+    compiler->module_cache = module_cache;
+    compiler->path = filename;
+    err = compile_program(compiler, program);
+    if (err) {
+        print_compile_error(err);
+        return EXIT_FAILURE;
+    }
+
+    err = run_bytecode(get_bytecode(compiler), img->globals, img->num_globals);
+    free_program(program);
+    return err;
+}
+
 int main(int argc, char *argv[]) {
+    module_cache = module_cache_new();
+
+    if (argc >= 3 && strcmp(argv[1], "--stack-limit") == 0) {
+        stack_limit = parse_stack_limit(argv[2]);
+        if (stack_limit == 0) {
+            printf("Usage: monkey --stack-limit <values> ..., with values from %u to %u\n", (unsigned int) VM_MIN_STACK_LIMIT, VM_MAX_STACK_LIMIT);
+            return EXIT_FAILURE;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--single-pass") == 0) {
+        single_pass = true;
+        argc--;
+        argv++;
+    }
+
     if (argc < 2) {
         return repl();
     }
@@ -146,24 +578,47 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
+    if (strcmp(argv[1], "--compile") == 0) {
+        if (argc < 4) {
+            puts("Usage: monkey --compile <script> <output>");
+            return EXIT_FAILURE;
+        }
+        return compile_script(argv[2], argv[3]);
+    }
+
+    if (strcmp(argv[1], "--dump-image") == 0) {
+        if (argc < 4) {
+            puts("Usage: monkey --dump-image <script> <image>");
+            return EXIT_FAILURE;
+        }
+        return dump_image(argv[2], argv[3]);
+    }
+
+    if (strcmp(argv[1], "--image") == 0) {
+        if (argc < 4) {
+            puts("Usage: monkey --image <image> <script>");
+            return EXIT_FAILURE;
+        }
+        return run_with_image(argv[2], argv[3]);
+    }
+
+    if (argc > 2) {
+        return run_project(argv + 1, argc - 1);
+    }
+
     return run_script(argv[1]);
 }
 
-char *read_file(char *filename) {
-    char *input = malloc(1024);
-    unsigned int size = 0;
-
-    FILE *f = fopen(filename, "r");
-    if (!f) {
-        printf("Could not open \"%s\" for reading", filename);
-        exit(1);
+/* maps the script at filename, or streams it from stdin if filename is "-" */
+struct source *load_script(char *filename) {
+    if (strcmp(filename, "-") == 0) {
+        return source_stream(STDIN_FILENO, SOURCE_CHUNK_SIZE);
     }
 
-    unsigned int read = 0;
-    while ( (read = fread(input, 512, 1024, f)) > 0) {
-        size += read;
-        input = realloc(input, size + 1024);
+    struct source *src = source_map(filename);
+    if (!src) {
+        printf("Could not open \"%s\" for reading\n", filename);
+        exit(1);
     }
-    fclose(f);
-    return input;
-}
\ No newline at end of file
+    return src;
+}
@@ -45,8 +45,10 @@ struct object *object_true = &_object_true;
 struct object *object_false = &_object_false;
 struct object *object_true_return = &_object_true_return;
 struct object *object_false_return = &_object_false_return;
-struct object *object_pool_head = NULL;
-struct object_list *object_list_pool_head = NULL;
+
+// freed objects and lists are kept for reuse by the thread that freed them, see free_object_pool
+static _Thread_local struct object *object_pool_head = NULL;
+static _Thread_local struct object_list *object_list_pool_head = NULL;
 
 static const char *object_names[] = {
     "NULL",
@@ -139,10 +141,10 @@ struct object *make_error_object(char *format, ...) {
 }
 
 
-struct object *make_function_object(struct identifier_list *parameters, struct block_statement *body, struct environment *env) {
+struct object *make_function_object(struct ast *ast, uint32_t literal, struct environment *env) {
     struct object *obj = make_object(OBJ_FUNCTION);
-    obj->value.function.parameters = parameters;
-    obj->value.function.body = body;
+    obj->value.function.ast = ast;
+    obj->value.function.literal = literal;
     obj->value.function.env = env;
     return obj;
 }
@@ -151,10 +153,26 @@ struct object *make_compiled_function_object(struct instruction *ins, unsigned i
     struct object *obj = make_object(OBJ_COMPILED_FUNCTION);
     //obj->value.compiled_function = malloc(sizeof *obj->value.compiled_function);
     obj->value.compiled_function.num_locals = num_locals;
+    obj->value.compiled_function.num_parameters = 0;
     obj->value.compiled_function.instructions = *ins;
     return obj;
 }   
 
+struct object *make_function_stub_object(unsigned int num_parameters, unsigned int constant) {
+    struct object *obj = make_object(OBJ_COMPILED_FUNCTION);
+    obj->value.compiled_function.constant = constant;
+    obj->value.compiled_function.num_parameters = num_parameters;
+
+    // never freed, since copies of the stub may outlive it and its address must not be handed out again
+    obj->value.compiled_function.instructions.bytes = malloc(1);
+    if (!obj->value.compiled_function.instructions.bytes) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    obj->value.compiled_function.instructions.size = 0;
+    obj->value.compiled_function.instructions.cap = 1;
+    return obj;
+}
+
 struct object *copy_object(struct object *obj) {
     switch (obj->type) {
         case OBJ_BOOL:
@@ -168,7 +186,7 @@ struct object *copy_object(struct object *obj) {
             break;
 
         case OBJ_FUNCTION:
-            return make_function_object(obj->value.function.parameters, obj->value.function.body, obj->value.function.env);
+            return make_function_object(obj->value.function.ast, obj->value.function.literal, obj->value.function.env);
             break;
 
         case OBJ_ERROR: 
@@ -238,6 +256,18 @@ void free_object(struct object *obj)
 }
 
 
+static void object_list_reserve(struct object_list *list, unsigned int cap) {
+    if (cap <= list->cap) {
+        return;
+    }
+
+    list->values = realloc(list->values, cap * sizeof *list->values);
+    if (!list->values) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    list->cap = cap;
+}
+
 struct object_list *make_object_list(unsigned int cap) {
    struct object_list *list = object_list_pool_head;
 
@@ -247,14 +277,27 @@ struct object_list *make_object_list(unsigned int cap) {
            err(EXIT_FAILURE, "out of memory");
        }
        list->size = 0;
+       list->cap = 0;
+       list->values = NULL;
    } else {
         object_list_pool_head = list->next;
         list->next = NULL;
    }
 
+   object_list_reserve(list, cap > 4 ? cap : 4);
    return list;
 }
 
+/* appends obj to the list, growing it if needed, and returns its index */
+unsigned int object_list_append(struct object_list *list, struct object *obj) {
+    if (list->size >= list->cap) {
+        object_list_reserve(list, list->cap * 2);
+    }
+
+    list->values[list->size++] = obj;
+    return list->size - 1;
+}
+
 void free_object_list(struct object_list *list) {
     // reset list values and size
     for (int i=0; i < list->size; i++) {
@@ -304,9 +347,9 @@ void object_to_str(char *str, struct object *obj)
          
     case OBJ_FUNCTION: 
         strcat(str, "fn(");
-        identifier_list_to_str(str, obj->value.function.parameters);
+        parameters_to_str(str, obj->value.function.ast, obj->value.function.literal);
         strcat(str, ") {\n");
-        block_statement_to_str(str, obj->value.function.body);
+        node_to_str(str, obj->value.function.ast, obj->value.function.ast->nodes[obj->value.function.literal].rhs);
         strcat(str, "\n}");
         break;
 
@@ -335,6 +378,7 @@ void object_to_str(char *str, struct object *obj)
     }
 }
 
+/* releases the objects pooled by the calling thread, threads that allocate objects call this before they exit */
 void free_object_pool() {
     struct object *node = object_pool_head;
     struct object *next = NULL;
@@ -354,6 +398,7 @@ void free_object_list_pool() {
 
     while (node) {
         next = node->next;
+        free(node->values);
         free(node);
         node = next;
     }
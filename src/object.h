@@ -9,9 +9,7 @@
 #define is_object_error(t) (t == OBJ_ERROR)
 #define is_object_truthy(obj) (obj != object_null && obj != object_false)
 #define make_boolean_object(value) (value ? object_true : object_false)
-
-// TODO: Dynamically allocate this
-#define OBJECT_LIST_MAX_VALUES 512
+#define is_function_stub(fn) ((fn)->instructions.size == 0)
 
 enum object_type
 {
@@ -27,19 +25,31 @@ enum object_type
 };
 
 struct function {
-    struct identifier_list *parameters;
-    struct block_statement *body;
+    // the function literal in the AST it was evaluated from
+    struct ast *ast;
+    uint32_t literal;
     struct environment *env;
 };
 
 struct compiled_function {
     struct instruction instructions;
-    unsigned int num_locals;
+    union {
+        unsigned int num_locals;
+
+        /*
+        Function literals are compiled on their first call. Until then the constant pool holds a stub, whose
+        instructions are empty but have a unique non-NULL bytes pointer so inline caches can tell stubs apart.
+        A stub has no locals yet, it keeps its own index in the pool instead (see compile_function_stub).
+        */
+        unsigned int constant;
+    };
+    unsigned int num_parameters;
 };
 
 struct object_list {
-    struct object *values[OBJECT_LIST_MAX_VALUES];
+    struct object **values;
     unsigned int size;
+    unsigned int cap;
 
     // for linking in pool
     struct object_list *next;
@@ -65,25 +75,27 @@ struct object
     struct object *next;
 };
 
-struct object *object_null;
-struct object *object_null_return;
-struct object *object_true;
-struct object *object_false;
-struct object *object_true_return;
-struct object *object_false_return;
+extern struct object *object_null;
+extern struct object *object_null_return;
+extern struct object *object_true;
+extern struct object *object_false;
+extern struct object *object_true_return;
+extern struct object *object_false_return;
 
 const char *object_type_to_str(enum object_type t);
 struct object *make_integer_object(long value);
 struct object *make_string_object(char *str1, char *str2);
 struct object *make_error_object(char *format, ...);
 struct object *make_array_object(struct object_list *elements);
-struct object *make_function_object(struct identifier_list *parameters, struct block_statement *body, struct environment *env);
+struct object *make_function_object(struct ast *ast, uint32_t literal, struct environment *env);
 struct object *make_compiled_function_object(struct instruction *ins, unsigned int num_locals);
+struct object *make_function_stub_object(unsigned int num_parameters, unsigned int constant);
 struct object *copy_object(struct object *obj);
 void free_object(struct object *obj);
 void object_to_str(char *str, struct object *obj);
 
 struct object_list *make_object_list(unsigned int cap);
+unsigned int object_list_append(struct object_list *list, struct object *obj);
 void free_object_list(struct object_list *list);
 void free_object_list_pool();
 void free_object_pool();
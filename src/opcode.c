@@ -50,10 +50,10 @@ struct definition definitions[] = {
         "OpBang", 0, {0}
     },
     {
-        "OpJump", 1, {2}
+        "OpJump", 1, {4}
     },
     {
-        "OpJumpNotTrue", 1, {2}
+        "OpJumpNotTrue", 1, {4}
     },
     {
         "OpNull", 0, {0}
@@ -65,7 +65,7 @@ struct definition definitions[] = {
         "OpSetGlobal", 1, {2}
     },
     {
-        "OpCall", 1, {1},
+        "OpCall", 2, {1, 2},
     },
     {
         "OpReturnValue", 0, {0}
@@ -79,6 +79,32 @@ struct definition definitions[] = {
     {
         "OpSetLocal", 1, {1}
     },
+    {
+        "OpCallConstant", 2, {2, 1}
+    },
+    {
+        // operands depend on the opcode that follows, see read_instruction
+        "OpWide", 0, {0}
+    },
+    {
+        "OpConstantShort", 1, {1}
+    },
+    {
+        "OpGetGlobalShort", 1, {1}
+    },
+    {
+        "OpSetGlobalShort", 1, {1}
+    },
+    {
+        "OpJumpShort", 1, {1}
+    },
+    {
+        "OpJumpNotTrueShort", 1, {1}
+    },
+    {
+        // pushes its operand as an integer, so small literals need no constant
+        "OpSmallInteger", 1, {1}
+    },
 };
 
 char *opcode_to_str(enum opcode opcode) {
@@ -89,26 +115,149 @@ struct definition lookup(enum opcode opcode) {
     return definitions[opcode];
 }
 
+bool opcode_has_wide_form(enum opcode opcode) {
+    switch (opcode) {
+        case OPCODE_CONST:
+        case OPCODE_GET_GLOBAL:
+        case OPCODE_SET_GLOBAL:
+        case OPCODE_GET_LOCAL:
+        case OPCODE_SET_LOCAL:
+        case OPCODE_CALL:
+        case OPCODE_CALL_CONST:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* 
+Returns the one byte operand form of opcode, or opcode itself if it has none. 
+Jumps are left out: their short form is relative, see compiler_relax_jumps.
+*/
+enum opcode opcode_short_form(enum opcode opcode) {
+    switch (opcode) {
+        case OPCODE_CONST: return OPCODE_CONST_SHORT;
+        case OPCODE_GET_GLOBAL: return OPCODE_GET_GLOBAL_SHORT;
+        case OPCODE_SET_GLOBAL: return OPCODE_SET_GLOBAL_SHORT;
+        default: return opcode;
+    }
+}
+
+/* the opcode whose short form the given one is, or the opcode itself if it is not a short form */
+enum opcode opcode_long_form(enum opcode opcode) {
+    switch (opcode) {
+        case OPCODE_CONST_SHORT: return OPCODE_CONST;
+        case OPCODE_GET_GLOBAL_SHORT: return OPCODE_GET_GLOBAL;
+        case OPCODE_SET_GLOBAL_SHORT: return OPCODE_SET_GLOBAL;
+        case OPCODE_JUMP_SHORT: return OPCODE_JUMP;
+        case OPCODE_JUMP_NOT_TRUE_SHORT: return OPCODE_JUMP_NOT_TRUE;
+        default: return opcode;
+    }
+}
+
+bool opcode_is_jump(enum opcode opcode) {
+    switch (opcode) {
+        case OPCODE_JUMP:
+        case OPCODE_JUMP_NOT_TRUE:
+        case OPCODE_JUMP_SHORT:
+        case OPCODE_JUMP_NOT_TRUE_SHORT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Returns the offset the jump at pos lands on: short jumps are relative to the next instruction, others are absolute */
+unsigned int jump_target(enum opcode opcode, unsigned int pos, unsigned int length, int operand) {
+    if (opcode == OPCODE_JUMP_SHORT || opcode == OPCODE_JUMP_NOT_TRUE_SHORT) {
+        return pos + length + operand;
+    }
+
+    return operand;
+}
+
+/* Writes value to dest as a big-endian operand of the given width */
+void write_operand(uint8_t *dest, unsigned int width, unsigned int value) {
+    for (int byte_idx = width-1; byte_idx >= 0; byte_idx--) {
+        *dest++ = (uint8_t) (value >> (byte_idx * 8) & 0xff);
+    }
+}
+
+/* 
+Encodes an instruction into dest, which must have room for MAX_INSTRUCTION_LENGTH bytes.
+Returns the number of bytes written.
+*/
+unsigned int write_instruction_va(uint8_t *dest, enum opcode opcode, va_list operands) {
+    const struct definition *def = &definitions[opcode];
+
+    // switch to the wide form if any operand does not fit its regular width
+    unsigned int values[MAX_OP_SIZE];
+    bool wide = false;
+    for (int op_idx = 0; op_idx < def->operands; op_idx++) {
+        values[op_idx] = va_arg(operands, unsigned int);
+        if (def->operand_widths[op_idx] < WIDE_OPERAND_WIDTH && values[op_idx] >> (def->operand_widths[op_idx] * 8) != 0) {
+            wide = true;
+        }
+    }
+    if (wide && !opcode_has_wide_form(opcode)) {
+        errx(EXIT_FAILURE, "operand out of range for %s", def->name);
+    }
+
+    // or to the short form if the only operand fits a single byte
+    if (opcode_short_form(opcode) != opcode && def->operands == 1 && values[0] <= SHORT_OPERAND_MAX) {
+        opcode = opcode_short_form(opcode);
+        def = &definitions[opcode];
+    }
+
+    unsigned int size = 0;
+    if (wide) {
+        dest[size++] = OPCODE_WIDE;
+    }
+    dest[size++] = opcode;
+
+    for (int op_idx = 0; op_idx < def->operands; op_idx++) {
+        int width = wide ? WIDE_OPERAND_WIDTH : def->operand_widths[op_idx];
+        write_operand(dest + size, width, values[op_idx]);
+        size += width;
+    }
+
+    return size;
+}
+
 struct instruction *make_instruction_va(enum opcode opcode, va_list operands) {
-    struct definition def = lookup(opcode);
     struct instruction *ins = malloc(sizeof *ins);
-    
-    ins->bytes = malloc(sizeof *ins->bytes * (def.operands + 1) * 3);
-    ins->bytes[0] = opcode;
-    ins->size = 1;
-    ins->cap = (def.operands + 1);      
-
-     // write operands to remaining bytes
-    for (int op_idx = 0; op_idx < def.operands; op_idx++) {
-        int operand = va_arg(operands, int);
-        for (int byte_idx = def.operand_widths[op_idx]-1; byte_idx >= 0; byte_idx--) {
-            ins->bytes[ins->size++] = (uint8_t) (operand >> (byte_idx * 8) & 0xff);
-        }
+    if (!ins) {
+        err(EXIT_FAILURE, "out of memory");
     }
 
+    ins->cap = MAX_INSTRUCTION_LENGTH;
+    ins->bytes = malloc(sizeof *ins->bytes * ins->cap);
+    if (!ins->bytes) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    ins->size = write_instruction_va(ins->bytes, opcode, operands);
     return ins;
 }
 
+/*
+Reads the instruction starting at bytes into opcode and operands, following an OPCODE_WIDE prefix if there is one.
+Returns the length of the instruction in bytes.
+*/
+unsigned int read_instruction(uint8_t *bytes, enum opcode *opcode, int operands[MAX_OP_SIZE]) {
+    bool wide = bytes[0] == OPCODE_WIDE;
+    unsigned int offset = wide ? 2 : 1;
+    *opcode = bytes[offset - 1];
+
+    struct definition def = lookup(*opcode);
+    for (int i=0; i < def.operands; i++) {
+        int width = wide ? WIDE_OPERAND_WIDTH : def.operand_widths[i];
+        operands[i] = read_bytes(bytes + offset, width);
+        offset += width;
+    }
+
+    return offset;
+}
+
 struct instruction *make_instruction(enum opcode opcode, ...) {
     va_list args;
     va_start(args, opcode);
@@ -143,28 +292,30 @@ char *instruction_to_str(struct instruction *ins) {
     int operands[MAX_OP_SIZE] = {0, 0};
     buffer[0] = '\0';
 
-    for (int i=0; i < ins->size; i++) {
-        struct definition def = lookup(ins->bytes[i]);
-        unsigned int bytes_read = read_operands(operands, def, ins, i);
+    for (int i=0; i < ins->size; ) {
+        enum opcode opcode;
+        unsigned int length = read_instruction(ins->bytes + i, &opcode, operands);
+        struct definition def = lookup(opcode);
         
         if (i > 0) {
             strcat(buffer, " | ");
         }
 
         char str[512];
+        char *prefix = ins->bytes[i] == OPCODE_WIDE ? "OpWide " : "";
         switch (def.operands) {
             case 0:
-                sprintf(str, "%04d %s", i, def.name);
+                sprintf(str, "%04d %s%s", i, prefix, def.name);
             break;
             case 1:
-                sprintf(str, "%04d %s %d", i, def.name, operands[0]);
+                sprintf(str, "%04d %s%s %d", i, prefix, def.name, operands[0]);
             break;
             case 2:
-                sprintf(str, "%04d %s %d %d", i, def.name, operands[0], operands[1]);
+                sprintf(str, "%04d %s%s %d %d", i, prefix, def.name, operands[0], operands[1]);
             break;
         }
         strcat(buffer, str);
-        i += bytes_read;
+        i += length;
     }
 
 
@@ -175,6 +326,7 @@ int read_bytes(uint8_t *bytes, unsigned int len) {
     switch (len) {
         case 1: return read_uint8(bytes);
         case 2: return read_uint16(bytes);
+        case 4: return read_uint32(bytes);
     }
 
     err(EXIT_FAILURE, "Unsupported byte length");
@@ -195,7 +347,11 @@ unsigned int read_operands(int dest[], struct definition def, struct instruction
             case 2: 
                 dest[i] = read_uint16(ins->bytes + offset);
             break;
+            case 4: 
+                dest[i] = read_uint32(ins->bytes + offset);
+            break;
         }
+        offset += def.operand_widths[i];
         bytes_read += def.operand_widths[i];
     }
 
@@ -4,9 +4,26 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #define MAX_OP_SIZE 16
 
+/*
+Operands that do not fit their regular width are encoded with a prefix: OPCODE_WIDE, the opcode,
+and then every operand as 4 bytes. Jump targets are always 4 bytes, so jumps have no wide form.
+*/
+#define WIDE_OPERAND_WIDTH 4
+
+/*
+Constants and globals with an index below 256 use a short form with a single byte operand instead.
+Short jumps store the distance from the end of the jump to its target in one byte, and are picked
+by the compiler once a function is complete and all of its jump targets are known.
+*/
+#define SHORT_OPERAND_MAX 255
+
+// longest encoding of any instruction: OPCODE_WIDE, the opcode and two wide operands
+#define MAX_INSTRUCTION_LENGTH (2 + 2 * WIDE_OPERAND_WIDTH)
+
 enum opcode {
     OPCODE_CONST = 0,
     OPCODE_POP,
@@ -32,6 +49,17 @@ enum opcode {
     OPCODE_RETURN,
     OPCODE_GET_LOCAL,
     OPCODE_SET_LOCAL,
+    OPCODE_CALL_CONST,
+    OPCODE_WIDE,
+    OPCODE_CONST_SHORT,
+    OPCODE_GET_GLOBAL_SHORT,
+    OPCODE_SET_GLOBAL_SHORT,
+    OPCODE_JUMP_SHORT,
+    OPCODE_JUMP_NOT_TRUE_SHORT,
+    OPCODE_SMALL_INT,
+
+    // not an opcode, keep this last
+    OPCODE_COUNT,
 };
 
 struct definition {
@@ -49,12 +77,33 @@ struct instruction {
 struct bytecode {
     struct instruction *instructions;
     struct object_list *constants;
+
+    // number of inline cache slots referenced by OPCODE_CALL instructions
+    unsigned int call_sites;
+
+    // number of global slots the program uses
+    unsigned int num_globals;
+
+    // compiler that produced this bytecode, used to compile function stubs when they are first called
+    struct compiler *compiler;
+
+    // for bytecode loaded by bytecode_map, the file mapping its code and strings point into
+    void *mapping;
+    size_t mapping_size;
 };
 
 char *opcode_to_str(enum opcode opcode);
 struct definition lookup(enum opcode opcode);
+bool opcode_has_wide_form(enum opcode opcode);
+enum opcode opcode_short_form(enum opcode opcode);
+enum opcode opcode_long_form(enum opcode opcode);
+bool opcode_is_jump(enum opcode opcode);
+unsigned int jump_target(enum opcode opcode, unsigned int pos, unsigned int length, int operand);
+unsigned int read_instruction(uint8_t *bytes, enum opcode *opcode, int operands[MAX_OP_SIZE]);
 struct instruction *make_instruction(enum opcode opcode, ...);
 struct instruction *make_instruction_va(enum opcode opcode, va_list operands);
+unsigned int write_instruction_va(uint8_t *dest, enum opcode opcode, va_list operands);
+void write_operand(uint8_t *dest, unsigned int width, unsigned int value);
 void free_instruction(struct instruction *ins);
 struct instruction *flatten_instructions_array(struct instruction *arr[], unsigned int size);
 char *instruction_to_str(struct instruction *ins);
@@ -64,6 +113,7 @@ int read_bytes(uint8_t *bytes, unsigned int len);
 
 #define read_uint8(bytes) (bytes)[0]
 #define read_uint16(bytes) ((bytes)[0] << 8) + (bytes)[1]
+#define read_uint32(bytes) (((uint32_t) (bytes)[0] << 24) + ((bytes)[1] << 16) + ((bytes)[2] << 8) + (bytes)[3])
 
 
 #endif
\ No newline at end of file
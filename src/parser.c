@@ -5,11 +5,126 @@
 
 #include "parser.h"
 
-struct expression *parse_expression(struct parser *p, int precedence);
-int parse_statement(struct parser *p, struct statement *s);
-void expression_to_str(char *str, struct expression *expr);
-void free_expression(struct expression *expr);
-enum operator parse_operator(enum token_type t);
+uint32_t parse_expression(struct parser *p, int precedence);
+uint32_t parse_statement(struct parser *p);
+
+void ast_init(struct ast *ast, char *source) {
+    *ast = (struct ast) {
+        .source = source,
+    };
+
+    // index 0 is AST_NONE and the empty string
+    ast_add_node(ast, (struct node) { .type = 0 });
+    ast->strings_cap = 64;
+    ast->strings = malloc(ast->strings_cap * sizeof *ast->strings);
+    if (!ast->strings) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    ast->strings[ast->strings_size++] = "";
+}
+
+void ast_free(struct ast *ast) {
+    free(ast->nodes);
+    free(ast->extra);
+    free(ast->free_names);
+    free(ast->strings);
+    free(ast->string_slots);
+    arena_free(&ast->arena);
+}
+
+uint32_t ast_add_node(struct ast *ast, struct node node) {
+    if (ast->size == ast->cap) {
+        ast->cap = ast->cap ? ast->cap * 2 : 256;
+        ast->nodes = realloc(ast->nodes, ast->cap * sizeof *ast->nodes);
+        if (!ast->nodes) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+
+    ast->nodes[ast->size] = node;
+    return ast->size++;
+}
+
+/* appends n values to extra and returns the index of the first */
+uint32_t ast_add_extra(struct ast *ast, uint32_t *values, uint32_t n) {
+    if (ast->extra_size + n > ast->extra_cap) {
+        ast->extra_cap = ast->extra_cap ? ast->extra_cap * 2 : 256;
+        while (ast->extra_size + n > ast->extra_cap) {
+            ast->extra_cap *= 2;
+        }
+        ast->extra = realloc(ast->extra, ast->extra_cap * sizeof *ast->extra);
+        if (!ast->extra) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+
+    if (n > 0) {
+        memcpy(ast->extra + ast->extra_size, values, n * sizeof *values);
+        ast->extra_size += n;
+    }
+    return ast->extra_size - n;
+}
+
+static uint32_t ast_string_hash(char *s, uint32_t length) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) s[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* returns the index of the string with the given characters, adding it if this is the first time it is seen */
+uint32_t ast_intern(struct ast *ast, char *s, uint32_t length) {
+    if (length == 0) {
+        return 0;
+    }
+
+    // keep the table at most half full, rebuilding it from the strings when it grows
+    if (ast->strings_size * 2 >= ast->string_slots_cap) {
+        free(ast->string_slots);
+        ast->string_slots_cap = ast->string_slots_cap ? ast->string_slots_cap * 2 : 256;
+        ast->string_slots = calloc(ast->string_slots_cap, sizeof *ast->string_slots);
+        if (!ast->string_slots) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+
+        uint32_t mask = ast->string_slots_cap - 1;
+        for (uint32_t i = 1; i < ast->strings_size; i++) {
+            uint32_t slot = ast_string_hash(ast->strings[i], strlen(ast->strings[i])) & mask;
+            while (ast->string_slots[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            ast->string_slots[slot] = i;
+        }
+    }
+
+    uint32_t mask = ast->string_slots_cap - 1;
+    uint32_t slot = ast_string_hash(s, length) & mask;
+    while (ast->string_slots[slot] != 0) {
+        char *str = ast->strings[ast->string_slots[slot]];
+        if (strncmp(str, s, length) == 0 && str[length] == '\0') {
+            return ast->string_slots[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (ast->strings_size == ast->strings_cap) {
+        ast->strings_cap *= 2;
+        ast->strings = realloc(ast->strings, ast->strings_cap * sizeof *ast->strings);
+        if (!ast->strings) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+
+    char *str = arena_alloc(&ast->arena, length + 1);
+    memcpy(str, s, length);
+    str[length] = '\0';
+    ast->strings[ast->strings_size] = str;
+    ast->string_slots[slot] = ast->strings_size;
+    return ast->strings_size++;
+}
 
 enum precedence get_token_precedence(struct token t) {
     switch (t.type) {
@@ -37,15 +152,43 @@ void next_token(struct parser * p) {
 struct parser new_parser(struct lexer *l) {
     struct parser p = {
         .lexer = l,
+        .pre_parse = false,
+        .skip_depth = 0,
+        .function_depth = 0,
+        .free_names = NULL,
+        .free_names_size = 0,
+        .free_names_cap = 0,
+        .names = NULL,
+        .names_size = 0,
+        .names_cap = 0,
+        .names_base = 0,
+        .ast = NULL,
+        .scratch = NULL,
+        .scratch_size = 0,
+        .scratch_cap = 0,
         .errors = 0,
     };
-   
+
     // read two tokens so that both current_token and next_token are set
     gettoken(p.lexer, &p.current_token);
     gettoken(p.lexer, &p.next_token);
     return p;
 }
 
+/* frees what the parser allocated for itself, the AST it added to is left alone */
+void parser_free(struct parser *p) {
+    free(p->scratch);
+    free(p->free_names);
+    free(p->names);
+    p->scratch = NULL;
+    p->scratch_cap = 0;
+    p->free_names = NULL;
+    p->free_names_size = 0;
+    p->free_names_cap = 0;
+    p->names = NULL;
+    p->names_cap = 0;
+}
+
 int current_token_is(struct parser *p, enum token_type t) {
     return t == p->current_token.type;
 }
@@ -60,459 +203,448 @@ int expect_next_token(struct parser *p, enum token_type t) {
         return 1;
     }
 
-    sprintf(p->error_messages[p->errors++], "expected next token to be %s, got %s instead", token_type_to_str(t), token_type_to_str(p->next_token.type));
+    if (p->errors < 8) {
+        sprintf(p->error_messages[p->errors++], "expected next token to be %s, got %s instead", token_type_to_str(t), token_type_to_str(p->next_token.type));
+    }
     return 0;
 }
 
-int parse_let_statement(struct parser *p, struct statement *s) {
-    s->type = STMT_LET;
-    s->token = p->current_token;
+/* pushes an item of the list that is being parsed, see end_list */
+void push_list_item(struct parser *p, uint32_t item) {
+    if (p->scratch_size == p->scratch_cap) {
+        p->scratch_cap = p->scratch_cap ? p->scratch_cap * 2 : 64;
+        p->scratch = realloc(p->scratch, p->scratch_cap * sizeof *p->scratch);
+        if (!p->scratch) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
 
-    if (!expect_next_token(p, TOKEN_IDENT)) {
-        return -1;
+    p->scratch[p->scratch_size++] = item;
+}
+
+/* adds the current token to the names of the function the parser is in, see struct parser */
+static void parser_add_name(struct parser *p) {
+    if (p->function_depth == 0) {
+        return;
     }
 
-    // parse identifier
-    struct identifier id = {
-        .token = p->current_token,
-    };
-    strncpy(id.value, p->current_token.literal, MAX_IDENT_LENGTH);
-    s->name = id;
+    if (p->names_size == p->names_cap) {
+        p->names_cap = p->names_cap ? p->names_cap * 2 : 64;
+        p->names = realloc(p->names, p->names_cap * sizeof *p->names);
+        if (!p->names) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+
+    p->names[p->names_size++] = p->current_token;
+}
 
+/* records the identifier that is the current token if the function the parser is in uses it without defining it */
+static void parser_use_name(struct parser *p) {
+    if (p->function_depth == 0) {
+        return;
+    }
+
+    struct token t = p->current_token;
+    for (uint32_t i = p->names_base; i < p->names_size; i++) {
+        if (p->names[i].length == t.length && memcmp(p->names[i].start, t.start, t.length) == 0) {
+            return;
+        }
+    }
+
+    if (p->free_names_size == p->free_names_cap) {
+        p->free_names_cap = p->free_names_cap ? p->free_names_cap * 2 : 64;
+        p->free_names = realloc(p->free_names, p->free_names_cap * sizeof *p->free_names);
+        if (!p->free_names) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+    p->free_names[p->free_names_size++] = t.pos;
+    parser_add_name(p);
+}
+
+/* like ast_add_node, but the bodies of pre-parsed functions get no nodes, see parse_function_literal */
+static uint32_t parser_add_node(struct parser *p, struct node node) {
+    return p->skip_depth > 0 ? AST_NONE : ast_add_node(p->ast, node);
+}
+
+static uint32_t parser_add_extra(struct parser *p, uint32_t *values, uint32_t n) {
+    return p->skip_depth > 0 ? 0 : ast_add_extra(p->ast, values, n);
+}
+
+/* adds the items pushed since base to the AST as a list and returns it */
+uint32_t end_list(struct parser *p, uint32_t base) {
+    uint32_t size = p->scratch_size - base;
+    uint32_t list = parser_add_extra(p, &size, 1);
+    parser_add_extra(p, p->scratch + base, size);
+    p->scratch_size = base;
+    return list;
+}
+
+/* the names in pre-parsed function bodies are not interned until the body is parsed, they all read as 0 until then */
+uint32_t current_token_string(struct parser *p) {
+    if (p->skip_depth > 0) {
+        return 0;
+    }
+
+    return ast_intern(p->ast, p->current_token.start, p->current_token.length);
+}
+
+uint32_t parse_let_statement(struct parser *p) {
+    uint32_t pos = p->current_token.pos;
+    if (!expect_next_token(p, TOKEN_IDENT)) {
+        return AST_NONE;
+    }
+
+    uint32_t name = current_token_string(p);
+    parser_add_name(p);
+    uint32_t ident = parser_add_node(p, (struct node) { .type = EXPR_IDENT, .pos = p->current_token.pos, .lhs = name });
     if (!expect_next_token(p, TOKEN_ASSIGN)) {
-        return -1;
+        return AST_NONE;
     }
 
     // parse expression
     next_token(p);
-    s->value = parse_expression(p, LOWEST);
-    if (s->value->type == EXPR_FUNCTION) {
-        strcpy(s->value->function.name, s->name.value);
-    } 
+    uint32_t value = parse_expression(p, LOWEST);
+    if (p->ast->nodes[value].type == EXPR_FUNCTION) {
+        ast_function_name(p->ast, value) = name;
+    }
     if (next_token_is(p, TOKEN_SEMICOLON)) {
         next_token(p);
     }
 
-    return 1;
+    return parser_add_node(p, (struct node) { .type = STMT_LET, .pos = pos, .lhs = ident, .rhs = value });
 }
 
-int parse_return_statement(struct parser *p, struct statement *s) {
-    s->type = STMT_RETURN;
-    s->token = p->current_token;
+uint32_t parse_return_statement(struct parser *p) {
+    uint32_t pos = p->current_token.pos;
 
     // parse expression
     next_token(p);
-    s->value = parse_expression(p, LOWEST);
+    uint32_t value = parse_expression(p, LOWEST);
 
     if (next_token_is(p, TOKEN_SEMICOLON)) {
         next_token(p);
     }
 
-    return 1;
+    return parser_add_node(p, (struct node) { .type = STMT_RETURN, .pos = pos, .lhs = value });
 }
 
-struct expression *parse_identifier_expression(struct parser *p) {
-    struct expression *expr = malloc(sizeof *expr);
-    if (!expr) {
-        err(EXIT_FAILURE, "out of memory");
+uint32_t parse_import_statement(struct parser *p) {
+    uint32_t pos = p->current_token.pos;
+    if (!expect_next_token(p, TOKEN_STRING)) {
+        return AST_NONE;
     }
 
-    expr->type = EXPR_IDENT;
-    expr->token = expr->ident.token = p->current_token;
-    strncpy(expr->ident.value, p->current_token.literal, MAX_IDENT_LENGTH);
-    return expr;
-}
-
-struct expression *parse_string_literal(struct parser *p) {
-    struct expression *expr = malloc(sizeof *expr);
-    if (!expr) {
-        err(EXIT_FAILURE, "out of memory");
+    uint32_t path = current_token_string(p);
+    if (next_token_is(p, TOKEN_SEMICOLON)) {
+        next_token(p);
     }
 
-    int len = strlen(p->current_token.literal) + 1;
-    expr->string = malloc(len);
-    if (!expr->string) {
-        err(EXIT_FAILURE, "out of memory");
-    }
-    expr->type = EXPR_STRING;
-    expr->token = p->current_token;
-    strncpy(expr->string, p->current_token.literal, len);
-    return expr;
+    return parser_add_node(p, (struct node) { .type = STMT_IMPORT, .pos = pos, .lhs = path });
 }
 
-struct expression *parse_int_expression(struct parser *p) {
-    struct expression *expr = malloc(sizeof *expr);
-    if (!expr) {
-        err(EXIT_FAILURE, "out of memory");
-    }
-
-    expr->type = EXPR_INT;
-    expr->token = p->current_token;
-    expr->integer = atoi(p->current_token.literal);
-    return expr;
+uint32_t parse_identifier_expression(struct parser *p) {
+    parser_use_name(p);
+    return parser_add_node(p, (struct node) { .type = EXPR_IDENT, .pos = p->current_token.pos, .lhs = current_token_string(p) });
 }
 
-struct expression *parse_prefix_expression(struct parser *p) {
-    struct expression *expr = malloc(sizeof *expr);
-    if (!expr) {
-        err(EXIT_FAILURE, "out of memory");
-    }
+uint32_t parse_string_literal(struct parser *p) {
+    return parser_add_node(p, (struct node) { .type = EXPR_STRING, .pos = p->current_token.pos, .lhs = current_token_string(p) });
+}
 
-    expr->type = EXPR_PREFIX;
-    expr->token = p->current_token;
-    expr->prefix.operator = parse_operator(p->current_token.type);
-    next_token(p);
-    expr->prefix.right = parse_expression(p, PREFIX);
-    return expr;
+uint32_t parse_int_expression(struct parser *p) {
+    // the digits are followed by something that is not a digit, which is where atoi stops
+    uint32_t value = atoi(p->current_token.start);
+    return parser_add_node(p, (struct node) { .type = EXPR_INT, .pos = p->current_token.pos, .lhs = value });
 }
 
-struct expression_list parse_expression_list(struct parser *p, enum token_type end_token) {
-    struct expression_list list = {
-        .size = 0,
-        .cap = 0,
+uint32_t parse_prefix_expression(struct parser *p) {
+    struct node node = {
+        .type = EXPR_PREFIX,
+        .pos = p->current_token.pos,
+        .operator = parse_operator(p->current_token.type),
     };
+    next_token(p);
+    node.lhs = parse_expression(p, PREFIX);
+    return parser_add_node(p, node);
+}
 
+uint32_t parse_expression_list(struct parser *p, enum token_type end_token) {
+    uint32_t base = p->scratch_size;
     if (next_token_is(p, end_token)) {
         next_token(p);
-        return list;
+        return end_list(p, base);
     }
 
-    // allocate memory here, so we do not need an alloc for calls without any arguments
-    list.cap = 4;
-    list.values = malloc(list.cap * sizeof *list.values);
-    if (!list.values) {
-        err(EXIT_FAILURE, "out of memory");
-    }
     next_token(p);
-    list.values[list.size++] = parse_expression(p, LOWEST);
+    push_list_item(p, parse_expression(p, LOWEST));
 
     while (next_token_is(p, TOKEN_COMMA)) {
         next_token(p);
         next_token(p);
-
-        list.values[list.size++] = parse_expression(p, LOWEST);
-
-        // double capacity if needed
-        if (list.size >= list.cap) {
-            list.cap *= 2;
-            list.values = realloc(list.values, list.cap * sizeof *list.values);
-        }
+        push_list_item(p, parse_expression(p, LOWEST));
     }
 
-    if (!expect_next_token(p, end_token)) {
-        free(list.values);
-        return list;
-    }
-
-    return list;
+    expect_next_token(p, end_token);
+    return end_list(p, base);
 }
 
-struct expression *parse_array_literal(struct parser *p) {
-    struct expression *expr = malloc(sizeof *expr);
-    if (!expr) {
-        err(EXIT_FAILURE, "out of memory");
-    }
-    expr->type = EXPR_ARRAY;
-    expr->token = p->current_token;
-    expr->array = parse_expression_list(p, TOKEN_RBRACKET);
-    return expr;
+uint32_t parse_array_literal(struct parser *p) {
+    uint32_t pos = p->current_token.pos;
+    uint32_t elements = parse_expression_list(p, TOKEN_RBRACKET);
+    return parser_add_node(p, (struct node) { .type = EXPR_ARRAY, .pos = pos, .lhs = elements });
 }
 
 
-struct expression *parse_index_expression(struct parser *p, struct expression *left) {
-    struct expression *expr = malloc(sizeof *expr);
-    if (!expr) {
-        err(EXIT_FAILURE, "out of memory");
-    }
-    expr->type = EXPR_INDEX;
-    expr->token = p->current_token;
-    expr->index.left = left;
-
+uint32_t parse_index_expression(struct parser *p, uint32_t left) {
+    uint32_t pos = p->current_token.pos;
     next_token(p);
-    expr->index.index = parse_expression(p, LOWEST);
+    uint32_t index = parse_expression(p, LOWEST);
     if (!expect_next_token(p, TOKEN_RBRACKET)) {
-        free(expr);
-        return NULL;
+        return AST_NONE;
     }
-    return expr;
-}
 
-struct expression *parse_call_expression(struct parser *p, struct expression *left) {
-    struct expression *expr = malloc(sizeof *expr);
-    if (!expr) {
-        err(EXIT_FAILURE, "out of memory");
-    }
-    expr->type = EXPR_CALL;
-    expr->token = p->current_token;
-    expr->call.function = left;
-    expr->call.arguments = parse_expression_list(p, TOKEN_RPAREN);
-    return expr;
+    return parser_add_node(p, (struct node) { .type = EXPR_INDEX, .pos = pos, .lhs = left, .rhs = index });
 }
 
-struct expression *parse_infix_expression(struct parser *p, struct expression *left) {
-    struct expression * expr = malloc(sizeof *expr);
-    if (!expr) {
-        err(EXIT_FAILURE, "out of memory");
-    }
+uint32_t parse_call_expression(struct parser *p, uint32_t function) {
+    uint32_t pos = p->current_token.pos;
+    uint32_t arguments = parse_expression_list(p, TOKEN_RPAREN);
+    return parser_add_node(p, (struct node) { .type = EXPR_CALL, .pos = pos, .lhs = function, .rhs = arguments });
+}
 
-    expr->type = EXPR_INFIX;
-    expr->token = p->current_token;
-    expr->infix.left = left;
-    expr->infix.operator = parse_operator(p->current_token.type);
+uint32_t parse_infix_expression(struct parser *p, uint32_t left) {
+    struct node node = {
+        .type = EXPR_INFIX,
+        .pos = p->current_token.pos,
+        .operator = parse_operator(p->current_token.type),
+        .lhs = left,
+    };
     int precedence = get_token_precedence(p->current_token);
     next_token(p);
-    expr->infix.right = parse_expression(p, precedence);
-    return expr;
+    node.rhs = parse_expression(p, precedence);
+    return parser_add_node(p, node);
 }
 
-struct expression *parse_boolean_expression(struct parser *p) {
-    struct expression *expr = malloc(sizeof *expr);
-    if (!expr) {
-        err(EXIT_FAILURE, "out of memory");
-    }
-
-    expr->type = EXPR_BOOL;
-    expr->token = p->current_token;
-    expr->boolean = current_token_is(p, TOKEN_TRUE);
-    return expr;
+uint32_t parse_boolean_expression(struct parser *p) {
+    return parser_add_node(p, (struct node) { .type = EXPR_BOOL, .pos = p->current_token.pos, .lhs = current_token_is(p, TOKEN_TRUE) });
 }
 
-struct expression *parse_grouped_expression(struct parser *p) {
+uint32_t parse_grouped_expression(struct parser *p) {
     next_token(p);
-    
-    struct expression *expr = parse_expression(p, LOWEST);
+
+    uint32_t expr = parse_expression(p, LOWEST);
 
     if (!expect_next_token(p, TOKEN_RPAREN)) {
-        free(expr);
-        return NULL;
+        return AST_NONE;
     }
 
     return expr;
 }
 
-struct block_statement *parse_block_statement(struct parser *p) {
-    struct block_statement *b = malloc(sizeof *b);
-    if (!b) {
-        err(EXIT_FAILURE, "out of memory");
-    }
-
-    b->cap = 16;
-    b->size = 0;
-    b->statements = malloc(b->cap * sizeof (struct statement));
-    if (!b->statements) {
-        err(EXIT_FAILURE, "out of memory");
-    }
+uint32_t parse_block_statement(struct parser *p) {
+    uint32_t pos = p->current_token.pos;
+    uint32_t base = p->scratch_size;
     next_token(p);
 
     while (!current_token_is(p, TOKEN_RBRACE) && !current_token_is(p, TOKEN_EOF)) {
-        struct statement s;
-        if (parse_statement(p, &s) > -1) {
-            b->statements[b->size++] = s;
-
-            if (b->size >= b->cap) {
-                b->cap *= 2;
-                b->statements = realloc(b->statements, b->cap * sizeof *b->statements);
-            }
+        uint32_t s = parse_statement(p);
+        if (s != AST_NONE) {
+            push_list_item(p, s);
         }
         next_token(p);
     }
 
-    return b;
+    uint32_t statements = end_list(p, base);
+    return parser_add_node(p, (struct node) { .type = STMT_BLOCK, .pos = pos, .lhs = statements });
 }
 
-struct expression *make_expression(enum expression_type type, struct token tok) {
-    struct expression *expr = malloc(sizeof *expr);
-    if (!expr) {
-        err(EXIT_FAILURE, "out of memory");
-    }
-
-    expr->type = type;
-    expr->token = tok;
-    return expr;
-}
-
-struct expression *parse_while_expression(struct parser *p) {
-    struct expression *expr = make_expression(EXPR_WHILE, p->current_token);
+uint32_t parse_while_expression(struct parser *p) {
+    uint32_t pos = p->current_token.pos;
     if (!expect_next_token(p, TOKEN_LPAREN)) {
-        free(expr);
-        return NULL;
+        return AST_NONE;
     }
 
     next_token(p);
-    expr->whilst.condition = parse_expression(p, LOWEST);
-     if (!expect_next_token(p, TOKEN_RPAREN)) {
-        free(expr->whilst.condition);
-        free(expr);
-        return NULL;
+    uint32_t condition = parse_expression(p, LOWEST);
+    if (!expect_next_token(p, TOKEN_RPAREN)) {
+        return AST_NONE;
     }
 
     if (!expect_next_token(p, TOKEN_LBRACE)) {
-        free(expr->whilst.condition);
-        free(expr);
-        return NULL;
+        return AST_NONE;
     }
 
-    expr->whilst.body = parse_block_statement(p);
-    return expr;
+    uint32_t body = parse_block_statement(p);
+    return parser_add_node(p, (struct node) { .type = EXPR_WHILE, .pos = pos, .lhs = condition, .rhs = body });
 }
 
-struct expression *parse_if_expression(struct parser *p) {
-    struct expression *expr = malloc(sizeof *expr);
-    if (!expr) {
-        err(EXIT_FAILURE, "out of memory");
-    }
-
-    expr->type = EXPR_IF;
-    expr->token = p->current_token;
-
+uint32_t parse_if_expression(struct parser *p) {
+    uint32_t pos = p->current_token.pos;
     if (!expect_next_token(p, TOKEN_LPAREN)) {
-        free(expr);
-        return NULL;
+        return AST_NONE;
     }
 
     next_token(p);
-    expr->ifelse.condition = parse_expression(p, LOWEST);
+    uint32_t condition = parse_expression(p, LOWEST);
 
     if (!expect_next_token(p, TOKEN_RPAREN)) {
-        free(expr->ifelse.condition);
-        free(expr);
-        return NULL;
+        return AST_NONE;
     }
 
     if (!expect_next_token(p, TOKEN_LBRACE)) {
-        free(expr->ifelse.condition);
-        free(expr);
-        return NULL;
+        return AST_NONE;
     }
 
-    expr->ifelse.consequence = parse_block_statement(p);
+    uint32_t branches[2] = { parse_block_statement(p), AST_NONE };
 
     if (next_token_is(p, TOKEN_ELSE)) {
         next_token(p);
 
         if (!expect_next_token(p, TOKEN_LBRACE)) {
-            free(expr->ifelse.consequence);
-            free(expr->ifelse.condition);
-            free(expr);
-            return NULL;
+            return AST_NONE;
         }
 
-        expr->ifelse.alternative = parse_block_statement(p);
-    } else {
-        expr->ifelse.alternative = NULL;
+        branches[1] = parse_block_statement(p);
     }
 
-    return expr;
+    uint32_t extra = parser_add_extra(p, branches, 2);
+    return parser_add_node(p, (struct node) { .type = EXPR_IF, .pos = pos, .lhs = condition, .rhs = extra });
 }
 
-struct identifier_list parse_function_parameters(struct parser *p) {
-    struct identifier_list params = {
-        .size = 0,
-        .cap = 4,
-    };
-    params.values = malloc(sizeof *params.values * params.cap);
-    if (!params.values) {
-        err(EXIT_FAILURE, "out of memory");
-    }
-
+uint32_t parse_function_parameters(struct parser *p) {
+    uint32_t base = p->scratch_size;
     if (next_token_is(p, TOKEN_RPAREN)) {
         next_token(p);
-        return params;
+        return end_list(p, base);
     }
 
     next_token(p);
-    struct identifier i;
-    i.token = p->current_token;
-    strncpy(i.value, i.token.literal, MAX_IDENT_LENGTH);
-    params.values[params.size++] = i;
+    push_list_item(p, current_token_string(p));
+    parser_add_name(p);
 
     while (next_token_is(p, TOKEN_COMMA)) {
         next_token(p);
         next_token(p);
+        push_list_item(p, current_token_string(p));
+        parser_add_name(p);
+    }
 
-        struct identifier i;
-        i.token = p->current_token;
-        strncpy(i.value, i.token.literal, MAX_IDENT_LENGTH);
-        params.values[params.size++] = i;
+    expect_next_token(p, TOKEN_RPAREN);
+    return end_list(p, base);
+}
 
-        if (params.size >= params.cap) {
-            params.cap *= 2;
-            params.values = realloc(params.values, params.cap * sizeof *params.values);
+uint32_t parse_function_literal(struct parser *p) {
+    uint32_t pos = p->current_token.pos;
+    if (!expect_next_token(p, TOKEN_LPAREN)) {
+        return AST_NONE;
+    }
+
+    // the function's names start out as its parameters, the ones of the functions around it are not seen
+    uint32_t names_base = p->names_base;
+    p->names_base = p->names_size;
+    p->function_depth++;
+    uint32_t parameters = parse_function_parameters(p);
+    bool has_body = expect_next_token(p, TOKEN_LBRACE);
+    uint32_t body_start = p->current_token.pos;
+    uint32_t body = AST_NONE;
+    if (has_body) {
+        /*
+        Pre-parsed bodies are only checked for syntax errors: the parser goes through them like through any other
+        code, but adds no nodes and interns no strings until the function is needed (see parse_function_body).
+        */
+        if (p->pre_parse) {
+            p->skip_depth++;
+        }
+        body = parse_block_statement(p);
+        if (p->pre_parse) {
+            p->skip_depth--;
         }
     }
+    p->function_depth--;
+    p->names_size = p->names_base;
+    p->names_base = names_base;
 
-    if (!expect_next_token(p, TOKEN_RPAREN)) {
-        free(params.values);
-        return params;
+    if (!has_body) {
+        return AST_NONE;
+    }
+    if (!current_token_is(p, TOKEN_RBRACE)) {
+        if (p->errors < 8) {
+            sprintf(p->error_messages[p->errors++], "expected function body to end with %s, got %s instead", token_type_to_str(TOKEN_RBRACE), token_type_to_str(p->current_token.type));
+        }
+        return AST_NONE;
     }
 
-    return params;
+    // the name is set by the let statement the function is bound in, if any
+    uint32_t extra = parser_add_extra(p, (uint32_t[]) { 0, body_start, parameters, 0 }, 4);
+    return parser_add_node(p, (struct node) { .type = EXPR_FUNCTION, .pos = pos, .lhs = extra, .rhs = body });
 }
 
-struct expression *parse_function_literal(struct parser *p) {
-    struct expression *expr = malloc(sizeof *expr);
-    if (!expr) {
-        err(EXIT_FAILURE, "out of memory");
+/*
+Parses the body of a function that was pre-parsed, if that was not done before.
+Functions inside of it are pre-parsed again. Returns the number of errors, in which case the body stays unparsed.
+*/
+int parse_function_body(struct ast *ast, uint32_t fn) {
+    if (ast->nodes[fn].rhs != AST_NONE) {
+        return 0;
     }
 
-    expr->type = EXPR_FUNCTION;
-    expr->token = p->current_token;
-
-    if (!expect_next_token(p, TOKEN_LPAREN)) {
-        free(expr);
-        return NULL;
-    }
-    strcpy(expr->function.name, "");
-    expr->function.parameters = parse_function_parameters(p);
-    if (!expect_next_token(p, TOKEN_LBRACE)) {
-        free(expr);
-        return NULL;
+    struct lexer lexer = new_lexer(ast->source);
+    lexer.pos = ast_function_body_start(ast, fn);
+    struct parser parser = new_parser(&lexer);
+    parser.pre_parse = true;
+    parser.ast = ast;
+    uint32_t body = parse_block_statement(&parser);
+    parser_free(&parser);
+    if (parser.errors > 0) {
+        return parser.errors;
     }
 
-    expr->function.body = parse_block_statement(p);
-    return expr;
+    ast->nodes[fn].rhs = body;
+    return 0;
 }
 
-struct expression *parse_expression(struct parser *p, int precedence) {
-    struct expression *left;
+uint32_t parse_expression(struct parser *p, int precedence) {
+    uint32_t left;
     switch (p->current_token.type) {
-        case TOKEN_IDENT: 
-            left = parse_identifier_expression(p); 
+        case TOKEN_IDENT:
+            left = parse_identifier_expression(p);
         break;
-        case TOKEN_INT: 
-            left = parse_int_expression(p); 
+        case TOKEN_INT:
+            left = parse_int_expression(p);
         break;
         case TOKEN_BANG:
-        case TOKEN_MINUS: 
+        case TOKEN_MINUS:
             left = parse_prefix_expression(p);
         break;
         case TOKEN_TRUE:
-        case TOKEN_FALSE: 
-            left = parse_boolean_expression(p); 
+        case TOKEN_FALSE:
+            left = parse_boolean_expression(p);
         break;
         case TOKEN_LPAREN:
             left = parse_grouped_expression(p);
         break;
         case TOKEN_IF:
             left = parse_if_expression(p);
-        break; 
-        case TOKEN_WHILE: 
+        break;
+        case TOKEN_WHILE:
             left = parse_while_expression(p);
         break;
         case TOKEN_FUNCTION:
             left = parse_function_literal(p);
-        break;   
-        case TOKEN_STRING: 
+        break;
+        case TOKEN_STRING:
             left = parse_string_literal(p);
         break;
-        case TOKEN_LBRACKET: 
+        case TOKEN_LBRACKET:
             left = parse_array_literal(p);
         break;
-        default: 
+        default:
             if (p->errors < 8) {
                 sprintf(p->error_messages[p->errors++], "no prefix parse function found for %s", token_type_to_str(p->current_token.type));
             }
-            return NULL;
+            return AST_NONE;
         break;
     }
 
@@ -520,29 +652,29 @@ struct expression *parse_expression(struct parser *p, int precedence) {
     while (!next_token_is(p, TOKEN_SEMICOLON) && precedence < get_token_precedence(p->next_token)) {
         enum token_type type = p->next_token.type;
         switch (type) {
-            case TOKEN_PLUS: 
-            case TOKEN_MINUS: 
-            case TOKEN_ASTERISK: 
-            case TOKEN_SLASH: 
-            case TOKEN_EQ: 
-            case TOKEN_NOT_EQ: 
-            case TOKEN_LT: 
-            case TOKEN_GT: 
+            case TOKEN_PLUS:
+            case TOKEN_MINUS:
+            case TOKEN_ASTERISK:
+            case TOKEN_SLASH:
+            case TOKEN_EQ:
+            case TOKEN_NOT_EQ:
+            case TOKEN_LT:
+            case TOKEN_GT:
                 next_token(p);
                 left = parse_infix_expression(p, left);
-            break; 
+            break;
 
-            case TOKEN_LPAREN: 
+            case TOKEN_LPAREN:
                 next_token(p);
                 left = parse_call_expression(p, left);
-            break; 
+            break;
 
-            case TOKEN_LBRACKET: 
+            case TOKEN_LBRACKET:
                 next_token(p);
                 left = parse_index_expression(p, left);
             break;
 
-            default: 
+            default:
                 return left;
             break;
         }
@@ -551,26 +683,26 @@ struct expression *parse_expression(struct parser *p, int precedence) {
     return left;
 }
 
-int parse_expression_statement(struct parser *p, struct statement *s) {
-    s->type = STMT_EXPR;
-    s->token = p->current_token;
-    s->value = parse_expression(p, LOWEST);
+uint32_t parse_expression_statement(struct parser *p) {
+    uint32_t expr = parse_expression(p, LOWEST);
 
     if (next_token_is(p, TOKEN_SEMICOLON)) {
         next_token(p);
-    } 
+    }
 
-    return 1;
+    return expr;
 }
 
-int parse_statement(struct parser *p, struct statement *s) {
+/* returns AST_NONE if the statement could not be parsed */
+uint32_t parse_statement(struct parser *p) {
     switch (p->current_token.type) {
-        case TOKEN_LET: return parse_let_statement(p, s); break;
-        case TOKEN_RETURN: return parse_return_statement(p, s); break;
-        default: return parse_expression_statement(p, s); break;
+        case TOKEN_LET: return parse_let_statement(p); break;
+        case TOKEN_RETURN: return parse_return_statement(p); break;
+        case TOKEN_IMPORT: return parse_import_statement(p); break;
+        default: return parse_expression_statement(p); break;
     }
-  
-   return -1;
+
+   return AST_NONE;
 }
 
 struct program *parse_program_str(char *str) {
@@ -585,171 +717,159 @@ struct program *parse_program(struct parser *parser) {
         err(EXIT_FAILURE, "out of memory");
     }
 
-    program->size = 0;
-    program->cap = 32;
-    program->statements = malloc(program->cap * sizeof *program->statements);
-    if (!program->statements) {
-        err(EXIT_FAILURE, "out of memory");
-    }
+    ast_init(&program->ast, parser->lexer->input);
+    parser->ast = &program->ast;
+    uint32_t pos = parser->current_token.pos;
+    uint32_t base = parser->scratch_size;
 
-    struct statement s;
     while (parser->current_token.type != TOKEN_EOF) {
-        
         // if an error occured, skip token & continue
-        if (parse_statement(parser, &s) == -1) {
-            next_token(parser);
-            continue;
+        uint32_t s = parse_statement(parser);
+        if (s != AST_NONE) {
+            push_list_item(parser, s);
         }
-        
-        program->statements[program->size++] = s;
 
-        // double program capacity if needed
-        if (program->size >= program->cap) {
-            program->cap *= 2;
-            program->statements = realloc(program->statements, sizeof *program->statements * program->cap);
-        }
-
-        next_token(parser);        
+        next_token(parser);
     }
 
+    uint32_t statements = end_list(parser, base);
+    program->statements = ast_add_node(parser->ast, (struct node) { .type = STMT_BLOCK, .pos = pos, .lhs = statements });
+    program->ast.free_names = parser->free_names;
+    program->ast.free_names_size = parser->free_names_size;
+    parser->free_names = NULL;
+    parser_free(parser);
     return program;
 }
 
-void let_statement_to_str(char *str, struct statement *stmt) {    
-    strcat(str, stmt->token.literal);
-    strcat(str, " ");
-    strcat(str, stmt->name.value);
-    strcat(str, " = ");
-    expression_to_str(str, stmt->value);
-    strcat(str, ";");
-}
-
-void return_statement_to_str(char *str, struct statement *stmt) {
-    strcat(str, stmt->token.literal);
-    strcat(str, " ");
-    expression_to_str(str, stmt->value);
-    strcat(str, ";");
-}
-
-void statement_to_str(char *str, struct statement *stmt) {
-    switch (stmt->type) {
-        case STMT_LET: let_statement_to_str(str, stmt); break;
-        case STMT_RETURN: return_statement_to_str(str, stmt); break;
-        case STMT_EXPR: expression_to_str(str, stmt->value); break;
-    }
-}
-
-void block_statement_to_str(char *str, struct block_statement *b) {
-    for (int i=0; i < b->size; i++) {
-        statement_to_str(str, &b->statements[i]);
+void list_to_str(char *str, struct ast *ast, uint32_t list) {
+    for (uint32_t i=0; i < ast_list_size(ast, list); i++) {
+        node_to_str(str, ast, ast_list_item(ast, list, i));
+        if (i < (ast_list_size(ast, list) - 1)) {
+            strcat(str, ", ");
+        }
     }
 }
 
-void identifier_list_to_str(char *str, struct identifier_list *identifiers) {
-    for (int i=0; i < identifiers->size; i++) {
-        strcat(str, identifiers->values[i].value);
-        if (i < (identifiers->size - 1)) {
+void parameters_to_str(char *str, struct ast *ast, uint32_t fn) {
+    uint32_t parameters = ast_function_parameters(ast, fn);
+    for (uint32_t i=0; i < ast_list_size(ast, parameters); i++) {
+        strcat(str, ast_string(ast, ast_list_item(ast, parameters, i)));
+        if (i < (ast_list_size(ast, parameters) - 1)) {
             strcat(str, ", ");
         }
     }
 }
 
-void expression_to_str(char *str, struct expression *expr) {
-    switch (expr->type) {
-        case EXPR_PREFIX: 
+void node_to_str(char *str, struct ast *ast, uint32_t node) {
+    struct node n = ast->nodes[node];
+    switch (n.type) {
+        case STMT_LET:
+            strcat(str, "let ");
+            node_to_str(str, ast, n.lhs);
+            strcat(str, " = ");
+            node_to_str(str, ast, n.rhs);
+            strcat(str, ";");
+        break;
+
+        case STMT_RETURN:
+            strcat(str, "return ");
+            node_to_str(str, ast, n.lhs);
+            strcat(str, ";");
+        break;
+
+        case STMT_IMPORT:
+            strcat(str, "import \"");
+            strcat(str, ast_string(ast, n.lhs));
+            strcat(str, "\";");
+        break;
+
+        case STMT_BLOCK:
+            for (uint32_t i=0; i < ast_list_size(ast, n.lhs); i++) {
+                node_to_str(str, ast, ast_list_item(ast, n.lhs, i));
+            }
+        break;
+
+        case EXPR_PREFIX:
             strcat(str, "(");
-            strcat(str, expr->token.literal);
-            expression_to_str(str, expr->prefix.right);
+            strcat(str, n.operator == OP_NEGATE ? "!" : "-");
+            node_to_str(str, ast, n.lhs);
             strcat(str, ")");
         break;
 
-        case EXPR_INFIX: 
+        case EXPR_INFIX:
             strcat(str, "(");
-            expression_to_str(str, expr->infix.left);
+            node_to_str(str, ast, n.lhs);
             strcat(str, " ");
-            strcat(str, expr->token.literal);
+            strcat(str, operator_to_str(n.operator));
             strcat(str, " ");
-            expression_to_str(str, expr->infix.right);
+            node_to_str(str, ast, n.rhs);
             strcat(str, ")");
         break;
 
         case EXPR_STRING:
-            strcat(str, expr->string);
-        break;
-
         case EXPR_IDENT:
-            strcat(str, expr->ident.value);
+            strcat(str, ast_string(ast, n.lhs));
         break;
 
         case EXPR_BOOL:
-            strcat(str, expr->boolean ? "true" : "false");
+            strcat(str, n.lhs ? "true" : "false");
         break;
 
         case EXPR_INT:
-            strcat(str, expr->token.literal);
+            sprintf(str + strlen(str), "%d", (int) n.lhs);
         break;
 
         case EXPR_IF:
             strcat(str, "if ");
-            expression_to_str(str, expr->ifelse.condition);
+            node_to_str(str, ast, n.lhs);
             strcat(str, " ");
-            block_statement_to_str(str, expr->ifelse.consequence);
-            if (expr->ifelse.alternative) {
+            node_to_str(str, ast, ast_if_consequence(ast, node));
+            if (ast_if_alternative(ast, node) != AST_NONE) {
                 strcat(str, "else ");
-                block_statement_to_str(str, expr->ifelse.alternative);
+                node_to_str(str, ast, ast_if_alternative(ast, node));
             }
         break;
 
-        case EXPR_WHILE: 
+        case EXPR_WHILE:
             strcat(str, "while ");
-            expression_to_str(str, expr->whilst.condition);
+            node_to_str(str, ast, n.lhs);
             strcat(str, " ");
-            block_statement_to_str(str, expr->whilst.body);
+            node_to_str(str, ast, n.rhs);
         break;
 
         case EXPR_FUNCTION:
-            strcat(str, expr->token.literal);
-
-            if (strlen(expr->function.name)) {
+            strcat(str, "fn");
+            if (ast_function_name(ast, node) != 0) {
                 strcat(str, "<");
-                strcat(str, expr->function.name);
+                strcat(str, ast_string(ast, ast_function_name(ast, node)));
                 strcat(str, ">");
             }
             strcat(str, "(");
-            identifier_list_to_str(str, &expr->function.parameters);
+            parameters_to_str(str, ast, node);
             strcat(str, ") ");
-            block_statement_to_str(str, expr->function.body);
+            if (parse_function_body(ast, node) == 0) {
+                node_to_str(str, ast, ast->nodes[node].rhs);
+            }
         break;
 
         case EXPR_CALL:
-            expression_to_str(str, expr->call.function);
+            node_to_str(str, ast, n.lhs);
             strcat(str, "(");
-            for (int i=0; i < expr->call.arguments.size; i++){
-                expression_to_str(str, expr->call.arguments.values[i]);
-                if (i < (expr->call.arguments.size - 1)) {
-                    strcat(str, ", ");
-                }
-            }
+            list_to_str(str, ast, n.rhs);
             strcat(str, ")");
         break;
 
-        case EXPR_ARRAY: 
+        case EXPR_ARRAY:
             strcat(str, "[");
-            for (int i=0; i < expr->array.size; i++) {
-                expression_to_str(str, expr->array.values[i]);
-
-                if (i < (expr->array.size - 1)) {
-                    strcat(str, ", ");
-                }
-            }
+            list_to_str(str, ast, n.lhs);
             strcat(str, "]");
         break;
 
-        case EXPR_INDEX: 
+        case EXPR_INDEX:
             strcat(str, "(");
-            expression_to_str(str, expr->index.left);
+            node_to_str(str, ast, n.lhs);
             strcat(str, "[");
-            expression_to_str(str, expr->index.index);
+            node_to_str(str, ast, n.rhs);
             strcat(str, "])");
         break;
     }
@@ -765,13 +885,14 @@ char *program_to_str(struct program *p) {
 
     *str = '\0';
 
-    for (int i = 0; i < p->size; i++) {  
-        statement_to_str(str, &p->statements[i]);
-        
-        if (i < p->size -1) {
+    uint32_t statements = p->ast.nodes[p->statements].lhs;
+    for (int i = 0; i < ast_list_size(&p->ast, statements); i++) {
+        node_to_str(str, &p->ast, ast_list_item(&p->ast, statements, i));
+
+        if (i < ast_list_size(&p->ast, statements) -1) {
             str = realloc(str, sizeof str + 256);
         }
-    }    
+    }
 
     return str;
 }
@@ -787,7 +908,7 @@ enum operator parse_operator(enum token_type t) {
         case TOKEN_EQ: return OP_EQ; break;
         case TOKEN_NOT_EQ: return OP_NOT_EQ; break;
         case TOKEN_SLASH: return OP_DIVIDE; break;
-        default: 
+        default:
         break;
     }
 
@@ -811,88 +932,7 @@ char *operator_to_str(enum operator operator) {
     return "???";
 }
 
-void free_statements(struct statement *stmts, unsigned int size) {
-    for (int i=0; i < size; i++) {
-        free_expression(stmts[i].value);
-    }
-    
-    free(stmts);
-}
-
-void free_block_statement(struct block_statement *b) {
-    free_statements(b->statements, b->size);
-    free(b);
-}
-
-void free_expression(struct expression *expr) {
-    if (expr == NULL) {
-        return;
-    }
-
-    switch (expr->type) {
-        case EXPR_PREFIX: 
-            free_expression(expr->prefix.right);
-        break;
-
-        case EXPR_INFIX:
-            free_expression(expr->infix.left);
-            free_expression(expr->infix.right);
-        break;
-
-        case EXPR_FUNCTION:
-            free(expr->function.parameters.values);
-            free_block_statement(expr->function.body);
-        break;
-
-        case EXPR_IF:
-            free_expression(expr->ifelse.condition);
-            free_block_statement(expr->ifelse.consequence);
-
-            if (expr->ifelse.alternative) {
-                free_block_statement(expr->ifelse.alternative);
-            }
-        break;
-
-        case EXPR_WHILE: 
-            free_expression(expr->whilst.condition);
-            free_block_statement(expr->whilst.body);
-        break;
-
-        case EXPR_CALL:
-            for (int i=0; i < expr->call.arguments.size; i++) {
-                free_expression(expr->call.arguments.values[i]);
-            }
-            free(expr->call.arguments.values);
-            free_expression(expr->call.function);
-        break;
-
-        case EXPR_STRING:
-            free(expr->string);
-        break;
-
-       case EXPR_ARRAY: 
-            for (int i=0; i < expr->array.size; i++) {
-                free_expression(expr->array.values[i]);
-            }
-            free(expr->array.values);
-       break;
-
-       case EXPR_INDEX: 
-            free_expression(expr->index.left);
-            free_expression(expr->index.index);
-       break;
-
-       case EXPR_INT: 
-       case EXPR_IDENT: 
-       case EXPR_BOOL: 
-            //nothing to free
-       break;
-    }
-
-    free(expr);
-}
-
 void free_program(struct program *p) {
-    free_statements(p->statements, p->size);
+    ast_free(&p->ast);
     free(p);
-}
\ No newline at end of file
+}
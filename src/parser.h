@@ -2,9 +2,9 @@
 #define PARSER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "lexer.h"
-
-#define MAX_IDENT_LENGTH 32
+#include "arena.h"
 
 enum precedence {
     LOWEST = 1,
@@ -17,7 +17,7 @@ enum precedence {
     INDEX,          // array[i]
 };
 
-enum expression_type {
+enum node_type {
     EXPR_INFIX = 1,
     EXPR_PREFIX,
     EXPR_INT,
@@ -30,12 +30,10 @@ enum expression_type {
     EXPR_ARRAY,
     EXPR_INDEX,
     EXPR_WHILE,
-};
-
-enum statement_type {
-    STMT_LET = 1,
+    STMT_LET,
     STMT_RETURN,
-    STMT_EXPR,
+    STMT_BLOCK,
+    STMT_IMPORT,
 };
 
 enum operator {
@@ -51,98 +49,100 @@ enum operator {
     OP_NEGATE,
 };
 
-struct prefix_expression {
-    enum operator operator;
-    struct expression *right;
-};
-
-struct infix_expression {
-    enum operator operator;
-    struct expression *left;
-    struct expression *right;
-};
-
-struct identifier {
-    char value[MAX_IDENT_LENGTH];
-    struct token token;
-};
-
-struct identifier_list {
-    struct identifier *values;
-    unsigned int size;
-    unsigned int cap;
-};
-
-struct statement {
-    enum statement_type type;
-    struct token token;
-    struct identifier name;
-    struct expression *value;
-};
-
-struct block_statement {
-    struct token token;
-    struct statement *statements;
-    unsigned int size;
-    unsigned int cap;
-};
-
-struct if_expression {
-    struct expression *condition;
-    struct block_statement *consequence;
-    struct block_statement *alternative;
-};
-
-struct function_literal {
-    char name[MAX_IDENT_LENGTH];
-    struct identifier_list parameters;
-    struct block_statement *body;
-};
-
-struct expression_list {
-    unsigned int size;
-    unsigned int cap;
-    struct expression **values;
-};
-
-struct call_expression {
-    struct expression *function;
-    struct expression_list arguments;
-};
-
-struct index_expression {
-    struct expression *left;
-    struct expression *index;
-};
-
-struct while_expression {
-    struct expression *condition;
-    struct block_statement *body;
-};
-
-struct expression {
-    enum expression_type type;
-    struct token token;
-    union {
-        long integer;
-        bool boolean;
-        char *string;
-        struct identifier ident;
-        struct prefix_expression prefix;
-        struct infix_expression infix;
-        struct if_expression ifelse;
-        struct function_literal function;
-        struct call_expression call;
-        struct expression_list array;
-        struct index_expression index;
-        struct while_expression whilst;
-    };
-} expression;
+/*
+A program is stored as one flat array of nodes that refer to each other by index. Index 0 (AST_NONE) is never
+a node, it stands for a missing child like an if without else. Expression statements are just the expression.
+
+Lists (statements of a block, arguments, array elements, parameters) live in extra as their size followed by
+the items, nodes refer to them by the index of the size. Names and string literals are interned: stored once
+per AST as NUL-terminated strings that stay put until the AST is freed, and referred to by index, where index
+0 is the empty string.
+
+What lhs and rhs hold for each type of node:
+
+    EXPR_INT        lhs: value
+    EXPR_BOOL       lhs: 1 if true
+    EXPR_STRING     lhs: string
+    EXPR_IDENT      lhs: name (a string), rhs and operator: where the evaluator finds it, set by the resolver
+    EXPR_PREFIX     lhs: operand
+    EXPR_INFIX      lhs: left operand, rhs: right operand
+    EXPR_IF         lhs: condition, rhs: index in extra of the consequence block and the alternative block or AST_NONE
+    EXPR_WHILE      lhs: condition, rhs: body block
+    EXPR_FUNCTION   lhs: index in extra of the name, the offset of the '{' starting the body, the parameter
+                    list (of names) and the evaluator's scope for the body, 0 until it is resolved (see resolver.h),
+                    rhs: body block, AST_NONE until parse_function_body if it was pre-parsed
+    EXPR_CALL       lhs: function, rhs: argument list
+    EXPR_ARRAY      lhs: element list
+    EXPR_INDEX      lhs: left, rhs: index
+    STMT_LET        lhs: name (an identifier), rhs: value
+    STMT_RETURN     lhs: value
+    STMT_BLOCK      lhs: statement list
+    STMT_IMPORT     lhs: path of the module (a string)
+
+Nodes are added to the end of the arrays, so pointers into them are only good until the next node is parsed,
+which can happen while compiling or evaluating a function whose body was pre-parsed. Hold on to indices instead.
+*/
+#define AST_NONE 0
+
+struct node {
+    uint8_t type;
+    uint8_t operator;
+
+    // offset in the source of the token the node was parsed from
+    uint32_t pos;
+    uint32_t lhs;
+    uint32_t rhs;
+};
+
+struct ast {
+    struct node *nodes;
+    uint32_t size;
+    uint32_t cap;
+
+    uint32_t *extra;
+    uint32_t extra_size;
+    uint32_t extra_cap;
+
+    char **strings;
+    uint32_t strings_size;
+    uint32_t strings_cap;
+
+    // open addressing table of string indices by value, 0 marks an empty slot since the empty string is never looked up
+    uint32_t *string_slots;
+    uint32_t string_slots_cap;
+
+    // the characters of the strings
+    struct arena arena;
+
+    // input the AST was parsed from, the bodies of pre-parsed functions are parsed from it later
+    char *source;
+
+    // offsets in source of the names function bodies use without defining them, see compile_program
+    uint32_t *free_names;
+    uint32_t free_names_size;
+
+    /*
+    Set for ASTs built by compile_single_pass, which only hold function literals and names. Their bodies are
+    never parsed into nodes, they are compiled straight from the source.
+    */
+    bool single_pass;
+};
+
+#define ast_list_size(ast, list) ((ast)->extra[list])
+#define ast_list_item(ast, list, i) ((ast)->extra[(list) + 1 + (i)])
+#define ast_string(ast, s) ((ast)->strings[s])
+#define ast_if_consequence(ast, n) ((ast)->extra[(ast)->nodes[n].rhs])
+#define ast_if_alternative(ast, n) ((ast)->extra[(ast)->nodes[n].rhs + 1])
+#define ast_function_name(ast, fn) ((ast)->extra[(ast)->nodes[fn].lhs])
+#define ast_function_body_start(ast, fn) ((ast)->extra[(ast)->nodes[fn].lhs + 1])
+#define ast_function_parameters(ast, fn) ((ast)->extra[(ast)->nodes[fn].lhs + 2])
+#define ast_function_scope(ast, fn) ((ast)->extra[(ast)->nodes[fn].lhs + 3])
 
 struct program {
-    struct statement *statements;
-    unsigned int cap;
-    unsigned int size;
+    struct ast ast;
+
+    // block holding the top-level statements
+    uint32_t statements;
 };
 
 struct parser {
@@ -150,16 +150,62 @@ struct parser {
     struct token current_token;
     struct token next_token;
 
+    /*
+    When set, function bodies are only checked for syntax errors and their nodes are added once they are needed,
+    see parse_function_body. The input has to outlive the program in that case.
+    */
+    bool pre_parse;
+
+    // number of pre-parsed function bodies the parser is in, which get no nodes
+    unsigned int skip_depth;
+
+    /*
+    Offsets of the names function bodies use without defining them, which parse_program hands on to the AST.
+    names holds the parameters and locals of the functions the parser is in, and the names each one was found
+    to use so far, so those are recorded once per function. The innermost function's start at names_base.
+    */
+    unsigned int function_depth;
+    uint32_t *free_names;
+    uint32_t free_names_size;
+    uint32_t free_names_cap;
+    struct token *names;
+    uint32_t names_size;
+    uint32_t names_cap;
+    uint32_t names_base;
+
+    // AST the nodes are added to, set by parse_program
+    struct ast *ast;
+
+    // items of the lists being parsed, lists nested in them are stacked on top until they are added to the AST
+    uint32_t *scratch;
+    uint32_t scratch_size;
+    uint32_t scratch_cap;
+
     // TODO: allocate this dynamically
     unsigned int errors;
     char error_messages[8][128];
 };
 
+void ast_init(struct ast *ast, char *source);
+void ast_free(struct ast *ast);
+uint32_t ast_add_node(struct ast *ast, struct node node);
+uint32_t ast_add_extra(struct ast *ast, uint32_t *values, uint32_t n);
+uint32_t ast_intern(struct ast *ast, char *s, uint32_t length);
 struct parser new_parser(struct lexer *l);
+void parser_free(struct parser *p);
+void next_token(struct parser *p);
+int current_token_is(struct parser *p, enum token_type t);
+int next_token_is(struct parser *p, enum token_type t);
+int expect_next_token(struct parser *p, enum token_type t);
+enum precedence get_token_precedence(struct token t);
+enum operator parse_operator(enum token_type t);
+uint32_t current_token_string(struct parser *p);
+uint32_t parse_function_literal(struct parser *p);
 struct program *parse_program(struct parser *parser);
 struct program *parse_program_str(char *str);
-void block_statement_to_str(char *str, struct block_statement *b);
-void identifier_list_to_str(char *str, struct identifier_list *identifiers);
+int parse_function_body(struct ast *ast, uint32_t fn);
+void node_to_str(char *str, struct ast *ast, uint32_t node);
+void parameters_to_str(char *str, struct ast *ast, uint32_t fn);
 char *program_to_str(struct program *p);
 void free_program(struct program *p);
 char *operator_to_str(enum operator operator);
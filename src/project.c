@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <err.h>
+
+#include "project.h"
+
+struct project *project_new(char **paths, unsigned int size) {
+    struct project *p = malloc(sizeof *p);
+    if (!p) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    p->files = calloc(size > 0 ? size : 1, sizeof *p->files);
+    if (!p->files) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    for (unsigned int i = 0; i < size; i++) {
+        p->files[i].path = paths[i];
+    }
+    p->size = size;
+    p->module_cache = NULL;
+    atomic_init(&p->next, 0);
+    return p;
+}
+
+static void project_compile_file(struct project *p, struct project_file *f) {
+    f->source = source_map(f->path);
+    if (!f->source) {
+        f->error = PROJECT_ERR_IO;
+        return;
+    }
+
+    // like a single script, function bodies are only parsed once they are called, by the linked compiler
+    struct lexer lexer = new_source_lexer(f->source);
+    struct parser parser = new_parser(&lexer);
+    parser.pre_parse = true;
+    f->program = parse_program(&parser);
+    if (parser.errors > 0) {
+        f->error = PROJECT_ERR_PARSE;
+        f->parse_errors = parser.errors;
+        memcpy(f->parse_error_messages, parser.error_messages, sizeof f->parse_error_messages);
+        return;
+    }
+
+    f->unit = compiler_new_unit();
+    f->unit->module_cache = p->module_cache;
+    f->unit->path = f->path;
+    f->compile_error = compile_program(f->unit, f->program);
+    if (f->compile_error) {
+        f->error = PROJECT_ERR_COMPILE;
+    }
+}
+
+static void project_work(struct project *p) {
+    unsigned int i;
+    while ((i = atomic_fetch_add(&p->next, 1)) < p->size) {
+        project_compile_file(p, &p->files[i]);
+    }
+}
+
+static void *project_worker(void *arg) {
+    project_work(arg);
+
+    // objects made here live on in the units, but the ones pooled by this thread would be lost
+    free_object_pool();
+    free_object_list_pool();
+    return NULL;
+}
+
+/*
+Compiles every file of the project on up to threads threads (the number of CPUs if 0), the calling thread included,
+and links them into c. Returns one of PROJECT_ERR_* for the first file, in order, that could not be read, parsed,
+compiled or linked, with its index in *failed.
+*/
+int project_compile(struct project *p, struct compiler *c, unsigned int threads, unsigned int *failed) {
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? cpus : 1;
+    }
+    if (threads > p->size) {
+        threads = p->size;
+    }
+    p->module_cache = c->module_cache;
+
+    pthread_t *workers = malloc(sizeof *workers * (threads > 0 ? threads : 1));
+    if (!workers) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    unsigned int started = 0;
+    for (; started + 1 < threads; started++) {
+        if (pthread_create(&workers[started], NULL, project_worker, p) != 0) {
+            break;
+        }
+    }
+    project_work(p);
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    for (unsigned int i = 0; i < p->size; i++) {
+        struct project_file *f = &p->files[i];
+        if (!f->error) {
+            f->compile_error = compiler_link(c, f->unit);
+            f->error = f->compile_error ? PROJECT_ERR_LINK : 0;
+        }
+        if (f->error) {
+            *failed = i;
+            return f->error;
+        }
+    }
+
+    // names in function bodies can only be checked once every file is linked
+    for (unsigned int i = 0; i < p->size; i++) {
+        struct project_file *f = &p->files[i];
+        struct ast *ast = &f->program->ast;
+        f->compile_error = compiler_check_free_names(c, ast, ast->free_names, ast->free_names_size);
+        if (f->compile_error) {
+            f->error = PROJECT_ERR_LINK;
+            *failed = i;
+            return f->error;
+        }
+    }
+
+    return 0;
+}
+
+/* programs have to outlive the compiler the project was linked into, which compiles functions from them */
+void project_free(struct project *p) {
+    for (unsigned int i = 0; i < p->size; i++) {
+        struct project_file *f = &p->files[i];
+        if (f->unit) {
+            compiler_free(f->unit);
+        }
+        if (f->program) {
+            free_program(f->program);
+        }
+        if (f->source) {
+            source_free(f->source);
+        }
+    }
+    free(p->files);
+    free(p);
+}
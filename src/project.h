@@ -0,0 +1,49 @@
+#ifndef PROJECT_H
+#define PROJECT_H
+
+#include <stdatomic.h>
+#include "compiler.h"
+#include "parser.h"
+#include "source.h"
+#include "module.h"
+
+/*
+Programs made of several files. Every file is parsed and compiled as a unit of its own (see compiler_link)
+on a pool of threads, then the units are linked into a single compiler in the order the files were given.
+The result runs as if the files were one: each file sees the globals of the files before it, and function
+bodies, which are still compiled when first called, can also use the ones only later files define.
+*/
+#define PROJECT_ERR_IO 1
+#define PROJECT_ERR_PARSE 2
+#define PROJECT_ERR_COMPILE 3
+#define PROJECT_ERR_LINK 4
+
+struct project_file {
+    char *path;
+    struct source *source;
+    struct program *program;
+    struct compiler *unit;
+
+    // one of PROJECT_ERR_*, the parser's messages or compiler's error code tell what went wrong
+    int error;
+    int compile_error;
+    unsigned int parse_errors;
+    char parse_error_messages[8][128];
+};
+
+struct project {
+    struct project_file *files;
+    unsigned int size;
+
+    // next file for a thread to pick up
+    atomic_uint next;
+
+    // that of the compiler the project is linked into
+    struct module_cache *module_cache;
+};
+
+struct project *project_new(char **paths, unsigned int size);
+int project_compile(struct project *p, struct compiler *c, unsigned int threads, unsigned int *failed);
+void project_free(struct project *p);
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <err.h>
+
+#include "builtins.h"
+#include "resolver.h"
+
+struct resolver *resolver_new() {
+    struct resolver *r = malloc(sizeof *r);
+    if (!r) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+
+    r->globals = symbol_table_new();
+    for (int i = 0; i < BUILTINS_SIZE; i++) {
+        r->builtin_globals[i] = 0;
+    }
+    r->scopes = NULL;
+    r->scopes_size = 0;
+    r->scopes_cap = 0;
+    return r;
+}
+
+static struct symbol *resolver_define(struct resolver *r, struct symbol_table *scope, char *name) {
+    struct symbol *s = symbol_table_define(scope, name);
+    if (scope == r->globals) {
+        int builtin = builtin_index(name);
+        if (builtin >= 0) {
+            r->builtin_globals[builtin] = s->index + 1;
+        }
+    }
+    return s;
+}
+
+static int resolve_identifier(struct resolver *r, struct ast *ast, uint32_t ident, struct symbol_table *scope) {
+    char *name = ast_string(ast, ast->nodes[ident].lhs);
+    uint32_t depth = 0;
+    struct symbol *s = symbol_table_lookup(scope, name);
+    while (s == NULL && scope->outer != NULL) {
+        scope = scope->outer;
+        depth++;
+        s = symbol_table_lookup(scope, name);
+    }
+
+    // scope is the global one if the name was not found
+    if (s == NULL) {
+        int builtin = builtin_index(name);
+        if (builtin >= 0) {
+            ast->nodes[ident].operator = RESOLVED_BUILTIN;
+            ast->nodes[ident].rhs = builtin;
+            return 0;
+        }
+        s = resolver_define(r, scope, name);
+    }
+
+    if (depth > RESOLVER_MAX_DEPTH) {
+        return RESOLVER_ERR_DEPTH;
+    }
+    ast->nodes[ident].operator = depth + 1;
+    ast->nodes[ident].rhs = s->index;
+    return 0;
+}
+
+static int resolve_node(struct resolver *r, struct ast *ast, uint32_t node, struct symbol_table *scope);
+
+static int resolve_list(struct resolver *r, struct ast *ast, uint32_t list, struct symbol_table *scope) {
+    for (uint32_t i = 0; i < ast_list_size(ast, list); i++) {
+        int err = resolve_node(r, ast, ast_list_item(ast, list, i), scope);
+        if (err) return err;
+    }
+    return 0;
+}
+
+static int resolve_node(struct resolver *r, struct ast *ast, uint32_t node, struct symbol_table *scope) {
+    int err;
+    struct node n = ast->nodes[node];
+    switch (n.type) {
+        case EXPR_IDENT:
+            return resolve_identifier(r, ast, node, scope);
+
+        case EXPR_PREFIX:
+        case STMT_RETURN:
+            return resolve_node(r, ast, n.lhs, scope);
+
+        case EXPR_INFIX:
+        case EXPR_INDEX:
+        case EXPR_WHILE:
+            err = resolve_node(r, ast, n.lhs, scope);
+            if (err) return err;
+            return resolve_node(r, ast, n.rhs, scope);
+
+        case EXPR_IF:
+            err = resolve_node(r, ast, n.lhs, scope);
+            if (err) return err;
+            err = resolve_node(r, ast, ast_if_consequence(ast, node), scope);
+            if (err) return err;
+            if (ast_if_alternative(ast, node) != AST_NONE) {
+                return resolve_node(r, ast, ast_if_alternative(ast, node), scope);
+            }
+            return 0;
+
+        case EXPR_CALL:
+            err = resolve_node(r, ast, n.lhs, scope);
+            if (err) return err;
+            return resolve_list(r, ast, n.rhs, scope);
+
+        case EXPR_ARRAY:
+        case STMT_BLOCK:
+            return resolve_list(r, ast, n.lhs, scope);
+
+        case STMT_LET: {
+            // the value is resolved before the name is defined
+            err = resolve_node(r, ast, n.rhs, scope);
+            if (err) return err;
+
+            char *name = ast_string(ast, ast->nodes[n.lhs].lhs);
+            struct symbol *s = symbol_table_lookup(scope, name);
+            if (s == NULL) {
+                s = resolver_define(r, scope, name);
+            }
+            ast->nodes[n.lhs].operator = 1;
+            ast->nodes[n.lhs].rhs = s->index;
+            return 0;
+        }
+
+        // function bodies are resolved once evaluated, see resolve_function
+        case EXPR_FUNCTION:
+        default:
+            return 0;
+    }
+}
+
+/* resolves the top-level statements of the program in the global scope */
+int resolve_program(struct resolver *r, struct program *prog) {
+    return resolve_node(r, &prog->ast, prog->statements, r->globals);
+}
+
+/*
+Resolves the body of the function literal, which has to be parsed, in a new scope enclosed by outer: that of the
+function the literal is in, or the globals. Does nothing if it was resolved before.
+*/
+int resolve_function(struct resolver *r, struct ast *ast, uint32_t fn, struct symbol_table *outer) {
+    if (ast_function_scope(ast, fn) != 0) {
+        return 0;
+    }
+
+    struct symbol_table *scope = symbol_table_new_enclosed(outer);
+    uint32_t parameters = ast_function_parameters(ast, fn);
+    for (uint32_t i = 0; i < ast_list_size(ast, parameters); i++) {
+        symbol_table_define(scope, ast_string(ast, ast_list_item(ast, parameters, i)));
+    }
+
+    if (r->scopes_size == r->scopes_cap) {
+        r->scopes_cap = r->scopes_cap ? r->scopes_cap * 2 : 64;
+        r->scopes = realloc(r->scopes, r->scopes_cap * sizeof *r->scopes);
+        if (!r->scopes) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+    }
+    r->scopes[r->scopes_size++] = scope;
+
+    int err = resolve_node(r, ast, ast->nodes[fn].rhs, scope);
+    if (err) return err;
+    ast_function_scope(ast, fn) = r->scopes_size;
+    return 0;
+}
+
+char *resolver_error_str(int err) {
+    static char *messages[] = {
+        "success",
+        "functions nested too deeply",
+    };
+    return messages[err];
+}
+
+void resolver_free(struct resolver *r) {
+    for (uint32_t i = 0; i < r->scopes_size; i++) {
+        symbol_table_free(r->scopes[i]);
+    }
+    free(r->scopes);
+    symbol_table_free(r->globals);
+    free(r);
+}
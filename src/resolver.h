@@ -0,0 +1,54 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <stdint.h>
+#include "parser.h"
+#include "symbol_table.h"
+#include "builtins.h"
+
+/*
+The resolver works out where the evaluator finds every identifier before it is evaluated, so that looking one up
+is following a few environments out and indexing their slots (see env.h) instead of searching for it by name.
+Identifier nodes, including the names of let statements, get:
+
+    operator    depth + 1, where depth is the number of environments out from the current one holding it,
+                or RESOLVED_BUILTIN
+    rhs         its slot in that environment, or its index in builtins
+
+Names are resolved in order: a let gives its name a slot in the scope of the function it is in (blocks have no
+scope of their own) for the statements after it, so the value of `let x = x + 1` is still the outer x. Names
+defined nowhere yet, other than builtins, are globals that may still be defined by a later statement or program.
+
+Function bodies are resolved when their literal is first evaluated, once the scope around it is resolved as a
+whole. Their scopes are kept by the resolver, the literal refers to its one by index + 1 (see ast_function_scope).
+A program is therefore resolved against the globals of one resolver only.
+
+A name can be bound to a slot of an enclosing function that is only set later. While that slot is not set, the
+name is looked up further out by name, like it was before the resolver (see environment_get). Names resolved to
+a builtin turn into the global of the same name once a later program defines and sets it (see eval_identifier).
+*/
+#define RESOLVED_BUILTIN 255
+#define RESOLVER_MAX_DEPTH (RESOLVED_BUILTIN - 2)
+
+#define RESOLVER_ERR_DEPTH 1
+
+#define resolver_function_scope(r, ast, fn) ((r)->scopes[ast_function_scope(ast, fn) - 1])
+
+struct resolver {
+    struct symbol_table *globals;
+
+    // slot + 1 of the global named like each builtin, 0 while there is none
+    uint32_t builtin_globals[BUILTINS_SIZE];
+
+    struct symbol_table **scopes;
+    uint32_t scopes_size;
+    uint32_t scopes_cap;
+};
+
+struct resolver *resolver_new();
+int resolve_program(struct resolver *r, struct program *prog);
+int resolve_function(struct resolver *r, struct ast *ast, uint32_t fn, struct symbol_table *outer);
+char *resolver_error_str(int err);
+void resolver_free(struct resolver *r);
+
+#endif
@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+static char *scalar_whitespace(char *s) {
+    while (*s == ' ' || *s == '\n' || *s == '\t' || *s == '\r') {
+        s++;
+    }
+    return s;
+}
+
+static char *scalar_letters(char *s) {
+    while ((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || *s == '_') {
+        s++;
+    }
+    return s;
+}
+
+static char *scalar_digits(char *s) {
+    while (*s >= '0' && *s <= '9') {
+        s++;
+    }
+    return s;
+}
+
+static char *scalar_string_end(char *s) {
+    while (*s != '"' && *s != '\0') {
+        s++;
+    }
+    return s;
+}
+
+#ifdef SCAN_X86
+
+/*
+Starting from the aligned block holding s, finds the first byte whose bit is set in STOP(block),
+ignoring the bytes in front of s. Aligned loads can not cross a page boundary, so they never fault
+past the end of the input, but they do read past it, which is why the scanners opt out of ASan.
+*/
+#define SCAN(s, width, full, load, vec, STOP) do {                      \
+    unsigned int offset = (uintptr_t) (s) % (width);                    \
+    char *p = (s) - offset;                                             \
+    vec v = load((vec *) p);                                            \
+    uint32_t stop = (STOP) & (full) & ((full) << offset);              \
+    while (stop == 0) {                                                 \
+        p += (width);                                                   \
+        v = load((vec *) p);                                            \
+        stop = (STOP) & (full);                                         \
+    }                                                                   \
+    return p + __builtin_ctz(stop);                                     \
+} while (0)
+
+#define NO_ASAN __attribute__((no_sanitize_address))
+#define SSE2 __attribute__((target("sse2")))
+
+// bytes of v equal to c
+#define SSE2_EQ(v, c) _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+
+// bytes of v within [lo, hi], using signed compares that put bytes >= 0x80 below every ASCII bound
+#define SSE2_IN(v, lo, hi) _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((lo) - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8((hi) + 1)))
+
+#define SSE2_WHITESPACE(v) _mm_or_si128(_mm_or_si128(SSE2_EQ(v, ' '), SSE2_EQ(v, '\n')), _mm_or_si128(SSE2_EQ(v, '\t'), SSE2_EQ(v, '\r')))
+#define SSE2_LETTER(v) _mm_or_si128(SSE2_IN(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'), SSE2_EQ(v, '_'))
+#define SSE2_DIGIT(v) SSE2_IN(v, '0', '9')
+#define SSE2_STRING_END(v) _mm_or_si128(SSE2_EQ(v, '"'), SSE2_EQ(v, '\0'))
+
+SSE2 NO_ASAN static char *sse2_whitespace(char *s) {
+    SCAN(s, 16, 0xffffu, _mm_load_si128, __m128i, ~_mm_movemask_epi8(SSE2_WHITESPACE(v)));
+}
+
+SSE2 NO_ASAN static char *sse2_letters(char *s) {
+    SCAN(s, 16, 0xffffu, _mm_load_si128, __m128i, ~_mm_movemask_epi8(SSE2_LETTER(v)));
+}
+
+SSE2 NO_ASAN static char *sse2_digits(char *s) {
+    SCAN(s, 16, 0xffffu, _mm_load_si128, __m128i, ~_mm_movemask_epi8(SSE2_DIGIT(v)));
+}
+
+SSE2 NO_ASAN static char *sse2_string_end(char *s) {
+    SCAN(s, 16, 0xffffu, _mm_load_si128, __m128i, _mm_movemask_epi8(SSE2_STRING_END(v)));
+}
+
+#define AVX2 __attribute__((target("avx2")))
+#define AVX2_EQ(v, c) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+#define AVX2_IN(v, lo, hi) _mm256_andnot_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(hi)), _mm256_cmpgt_epi8(v, _mm256_set1_epi8((lo) - 1)))
+#define AVX2_WHITESPACE(v) _mm256_or_si256(_mm256_or_si256(AVX2_EQ(v, ' '), AVX2_EQ(v, '\n')), _mm256_or_si256(AVX2_EQ(v, '\t'), AVX2_EQ(v, '\r')))
+#define AVX2_LETTER(v) _mm256_or_si256(AVX2_IN(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z'), AVX2_EQ(v, '_'))
+#define AVX2_DIGIT(v) AVX2_IN(v, '0', '9')
+#define AVX2_STRING_END(v) _mm256_or_si256(AVX2_EQ(v, '"'), AVX2_EQ(v, '\0'))
+
+AVX2 NO_ASAN static char *avx2_whitespace(char *s) {
+    SCAN(s, 32, 0xffffffffu, _mm256_load_si256, __m256i, ~(uint32_t) _mm256_movemask_epi8(AVX2_WHITESPACE(v)));
+}
+
+AVX2 NO_ASAN static char *avx2_letters(char *s) {
+    SCAN(s, 32, 0xffffffffu, _mm256_load_si256, __m256i, ~(uint32_t) _mm256_movemask_epi8(AVX2_LETTER(v)));
+}
+
+AVX2 NO_ASAN static char *avx2_digits(char *s) {
+    SCAN(s, 32, 0xffffffffu, _mm256_load_si256, __m256i, ~(uint32_t) _mm256_movemask_epi8(AVX2_DIGIT(v)));
+}
+
+AVX2 NO_ASAN static char *avx2_string_end(char *s) {
+    SCAN(s, 32, 0xffffffffu, _mm256_load_si256, __m256i, (uint32_t) _mm256_movemask_epi8(AVX2_STRING_END(v)));
+}
+
+#endif
+
+static const struct scanner scanners[] = {
+    [SCANNER_SCALAR] = { "scalar", scalar_whitespace, scalar_letters, scalar_digits, scalar_string_end },
+#ifdef SCAN_X86
+    [SCANNER_SSE2] = { "sse2", sse2_whitespace, sse2_letters, sse2_digits, sse2_string_end },
+    [SCANNER_AVX2] = { "avx2", avx2_whitespace, avx2_letters, avx2_digits, avx2_string_end },
+#endif
+};
+
+struct scanner scanner = { "scalar", scalar_whitespace, scalar_letters, scalar_digits, scalar_string_end };
+
+/* switches to the given scanner, returns false if the CPU (or this build) does not support it */
+bool scanner_use(int kind) {
+    bool supported = kind == SCANNER_SCALAR;
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (kind == SCANNER_SSE2) {
+        supported = __builtin_cpu_supports("sse2");
+    } else if (kind == SCANNER_AVX2) {
+        supported = __builtin_cpu_supports("avx2");
+    }
+#endif
+
+    if (supported) {
+        scanner = scanners[kind];
+    }
+    return supported;
+}
+
+__attribute__((constructor)) static void scanner_select() {
+    if (!scanner_use(SCANNER_AVX2)) {
+        scanner_use(SCANNER_SSE2);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+
+/*
+Character class scanners for the lexer. Each returns a pointer to the first character at or after s
+that does not belong to the scanned run. Input has to be NUL-terminated, the NUL ends every run.
+
+The vector versions read whole 16 or 32 byte blocks, aligned so they never cross into a page the
+input does not reach, which means they may look at (but never use) bytes past the terminating NUL.
+*/
+struct scanner {
+    char *name;
+    char *(*whitespace)(char *s);
+    char *(*letters)(char *s);
+    char *(*digits)(char *s);
+
+    // finds the closing quote of a string, or the end of the input
+    char *(*string_end)(char *s);
+};
+
+#define SCANNER_SCALAR 0
+#define SCANNER_SSE2 1
+#define SCANNER_AVX2 2
+
+// the fastest scanner the CPU supports, selected at startup
+extern struct scanner scanner;
+
+bool scanner_use(int kind);
+
+#endif
@@ -0,0 +1,132 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include "source.h"
+
+static size_t round_to_pages(size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+static struct source *source_new() {
+    struct source *s = malloc(sizeof *s);
+    if (!s) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    return s;
+}
+
+/* maps the file at path followed by its padding, returns NULL (with errno set) if that fails */
+struct source *source_map(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    // the lexer works with 32-bit offsets, so files are limited to what a stream can hold
+    if ((size_t) st.st_size > SOURCE_STREAM_RESERVE - SOURCE_PADDING) {
+        close(fd);
+        errno = EFBIG;
+        return NULL;
+    }
+
+    // the anonymous mapping provides the zero bytes after the file, which goes on top of it
+    size_t size = st.st_size;
+    size_t mapping_size = round_to_pages(size + SOURCE_PADDING);
+    char *data = mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (size > 0 && mmap(data, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        int error = errno;
+        munmap(data, mapping_size);
+        close(fd);
+        errno = error;
+        return NULL;
+    }
+    close(fd);
+
+    struct source *s = source_new();
+    s->data = data;
+    s->size = size;
+    s->fd = -1;
+    s->chunk_size = 0;
+    s->committed = 0;
+    s->mapping_size = mapping_size;
+    return s;
+}
+
+/* a source that reads fd in chunks of at most chunk_size bytes, on demand */
+struct source *source_stream(int fd, size_t chunk_size) {
+    char *data = mmap(NULL, SOURCE_STREAM_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+
+    struct source *s = source_new();
+    s->data = data;
+    s->size = 0;
+    s->fd = fd;
+    s->chunk_size = chunk_size;
+    s->committed = round_to_pages(SOURCE_CHUNK_SIZE + SOURCE_PADDING);
+    s->mapping_size = SOURCE_STREAM_RESERVE;
+    if (mprotect(s->data, s->committed, PROT_READ | PROT_WRITE) != 0) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    return s;
+}
+
+/*
+Appends the next chunk of a stream, which may be shorter than chunk_size if that is all there is for now.
+Returns false once the stream has ended, a read error ends it too.
+*/
+bool source_read_more(struct source *s) {
+    if (s->fd < 0) {
+        return false;
+    }
+
+    size_t chunk = s->chunk_size;
+    if (s->size + chunk + SOURCE_PADDING > SOURCE_STREAM_RESERVE) {
+        errx(EXIT_FAILURE, "input is larger than %d bytes", SOURCE_STREAM_RESERVE - SOURCE_PADDING);
+    }
+
+    // freshly committed pages are zero, so the padding after the text is already in place
+    if (s->size + chunk + SOURCE_PADDING > s->committed) {
+        size_t committed = round_to_pages(s->size + chunk + SOURCE_PADDING + SOURCE_CHUNK_SIZE);
+        if (mprotect(s->data + s->committed, committed - s->committed, PROT_READ | PROT_WRITE) != 0) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+        s->committed = committed;
+    }
+
+    ssize_t n;
+    do {
+        n = read(s->fd, s->data + s->size, chunk);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        s->fd = -1;
+        return false;
+    }
+
+    s->size += n;
+    return true;
+}
+
+void source_free(struct source *s) {
+    munmap(s->data, s->mapping_size);
+    free(s);
+}
@@ -0,0 +1,42 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+Script source text. The lexer stops at the first NUL byte and the scanners (see scan.h) read whole
+vector blocks around it, so the text is always followed by at least SOURCE_PADDING zero bytes.
+
+Files are mapped rather than read: the mapping sits at the start of a zero-filled anonymous one that
+provides the padding, also for files whose size is a multiple of the page size.
+
+Streams (stdin) are read in chunks into address space reserved up front, so the text never moves
+while tokens and parsed programs point into it. A lexer attached to a stream (see new_source_lexer)
+reads the next chunk once a token runs into the end of the text read so far, which lets parsing
+and single-pass compiling start before the whole input has arrived.
+*/
+#define SOURCE_PADDING 64
+#define SOURCE_CHUNK_SIZE (64 * 1024)
+
+// largest stream that can be read, only address space is reserved for it
+#define SOURCE_STREAM_RESERVE (1024 * 1024 * 1024)
+
+struct source {
+    char *data;
+    size_t size;
+
+    // streams only, -1 for files and streams that reached their end
+    int fd;
+    size_t chunk_size;
+    size_t committed;
+
+    size_t mapping_size;
+};
+
+struct source *source_map(char *path);
+struct source *source_stream(int fd, size_t chunk_size);
+bool source_read_more(struct source *s);
+void source_free(struct source *s);
+
+#endif
@@ -3,126 +3,164 @@
 #include <err.h>
 #include "symbol_table.h"
 
-struct hashmap *hashmap_new() {
-    struct hashmap *hm = malloc(sizeof *hm);
-    if (!hm) err(EXIT_FAILURE, "out of memory");
-
-    for (int i=0; i < 26; i++) {
-        hm->table[i] = NULL;
+static uint32_t symbol_hash(char *name) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (char *ch = name; *ch != '\0'; ch++) {
+        hash ^= (unsigned char) *ch;
+        hash *= 16777619u;
     }
-
-    return hm;
+    return hash;
 }
 
-void hashmap_insert(struct hashmap *hm, char *key, void *item) {
-    unsigned int pos = hash(key);
-    struct hashmap_node *head = hm->table[pos];
-    struct hashmap_node *node = head;
-
-    // walk list to find existing value with that key
-    while (node) {
-        if (strcmp(node->key, key) == 0) {
-            //free(item);
-            node->value = item;
-            return;
-        }
+static struct symbol_table *symbol_table_new_cap(unsigned int cap) {
+    struct symbol_table *t = malloc(sizeof *t);
+    if (!t) err(EXIT_FAILURE, "out of memory");
 
-        node = node->next;
-    }
+    t->size = 0;
+    t->slots = calloc(cap, sizeof *t->slots);
+    if (!t->slots) err(EXIT_FAILURE, "out of memory");
+    t->slots_size = 0;
+    t->slots_cap = cap;
+    t->outer = NULL;
+    t->replaced = NULL;
+    t->replaced_cap = 0;
+    return t;
+}
+
+struct symbol_table *symbol_table_new() {
+    return symbol_table_new_cap(64);
+}
 
-    // insert new node at start of list
-    node = malloc(sizeof *node);
-    node->key = key;
-    node->value = item;
-    node->next = head;
-    hm->table[pos] = node;
+/* function scopes usually hold a handful of parameters and locals */
+struct symbol_table *symbol_table_new_enclosed(struct symbol_table *outer) {
+    struct symbol_table *t = symbol_table_new_cap(8);
+    t->outer = outer;
+    return t;
 }
 
-void *hashmap_get(struct hashmap *hm, char *key) {
-    int pos = hash(key);
-    struct hashmap_node *node = hm->table[pos];
-    while (node) {
-         if (strcmp(node->key, key) == 0) {
-           return node->value;
+/* returns the slot holding name, or the empty slot it would go in */
+static struct symbol_slot *symbol_table_slot(struct symbol_table *t, char *name, uint32_t hash) {
+    unsigned int mask = t->slots_cap - 1;
+    unsigned int i = hash & mask;
+    while (t->slots[i].symbol.name != NULL) {
+        struct symbol_slot *slot = &t->slots[i];
+        if (slot->symbol.name == name || (slot->hash == hash && strcmp(slot->symbol.name, name) == 0)) {
+            break;
         }
-        node = node->next;
+        i = (i + 1) & mask;
     }
-    return NULL;
+    return &t->slots[i];
 }
 
-void hashmap_free(struct hashmap *hm) {
-    struct hashmap_node *node;
-    struct hashmap_node *next;
-
-    for (int i=0; i < 26; i++) {
-        node = hm->table[i];
-        while (node) {
-            next = node->next;
-            free(node->value);
-            free(node);            
-            node = next;
-        }
+/* doubles the table once it would be more than half full, rehashing the symbols from their stored hashes */
+static void symbol_table_reserve(struct symbol_table *t) {
+    if ((t->slots_size + 1) * 2 <= t->slots_cap) {
+        return;
     }
 
-    free(hm);
+    struct symbol_slot *old = t->slots;
+    unsigned int old_cap = t->slots_cap;
+    t->slots_cap *= 2;
+    t->slots = calloc(t->slots_cap, sizeof *t->slots);
+    if (!t->slots) err(EXIT_FAILURE, "out of memory");
+
+    unsigned int mask = t->slots_cap - 1;
+    for (unsigned int i = 0; i < old_cap; i++) {
+        if (old[i].symbol.name == NULL) {
+            continue;
+        }
+        unsigned int j = old[i].hash & mask;
+        while (t->slots[j].symbol.name != NULL) {
+            j = (j + 1) & mask;
+        }
+        t->slots[j] = old[i];
+    }
+    free(old);
 }
 
-struct symbol_table *symbol_table_new() {
-    struct symbol_table *t = malloc(sizeof *t);
-    if (!t) err(EXIT_FAILURE, "out of memory");
+/* inserts the symbol, replacing the one with the same name in this table if there is one */
+static struct symbol *symbol_table_insert(struct symbol_table *t, struct symbol s) {
+    symbol_table_reserve(t);
 
-    t->size = 0;
-    t->store = hashmap_new();
-    t->outer = NULL;
-    return t;
+    uint32_t hash = symbol_hash(s.name);
+    struct symbol_slot *slot = symbol_table_slot(t, s.name, hash);
+    if (slot->symbol.name == NULL) {
+        t->slots_size++;
+    }
+    slot->symbol = s;
+    slot->hash = hash;
+    return &slot->symbol;
 }
 
-struct symbol_table *symbol_table_new_enclosed(struct symbol_table *outer) {
-    struct symbol_table *t = symbol_table_new();
-    t->outer = outer;
-    return t;
+static void symbol_table_set_replaced(struct symbol_table *t, int index, int replaced) {
+    if (index >= t->replaced_cap) {
+        unsigned int cap = t->replaced_cap ? t->replaced_cap : 64;
+        while (cap <= index) {
+            cap *= 2;
+        }
+
+        t->replaced = realloc(t->replaced, cap * sizeof *t->replaced);
+        if (!t->replaced) err(EXIT_FAILURE, "out of memory");
+        for (unsigned int i = t->replaced_cap; i < cap; i++) {
+            t->replaced[i] = -1;
+        }
+        t->replaced_cap = cap;
+    }
+
+    t->replaced[index] = replaced;
 }
 
 struct symbol *symbol_table_define(struct symbol_table *t, char *name) {
-    struct symbol *s = malloc(sizeof *s);
-    if (!s) err(EXIT_FAILURE, "out of memory");
+    struct symbol *old = symbol_table_lookup(t, name);
+    if (old != NULL && old->scope != SCOPE_FUNCTION) {
+        symbol_table_set_replaced(t, t->size, old->index);
+    }
 
     // TODO: Copy name? 
     // Should only be required if we free the original program string before evaluating bytecode
-    s->name = name;
-    s->scope = t->outer ? SCOPE_LOCAL : SCOPE_GLOBAL;
-    s->index = t->size;
-
-    // insert into store
-    hashmap_insert(t->store, name, s);
+    struct symbol *s = symbol_table_insert(t, (struct symbol) {
+        .name = name,
+        .scope = t->outer ? SCOPE_LOCAL : SCOPE_GLOBAL,
+        .index = t->size,
+    });
     t->size++;
     return s;
 }
 
 
 struct symbol *symbol_table_define_function(struct symbol_table *t, char *name) {
-    struct symbol *s = malloc(sizeof *s);
-    if (!s) err(EXIT_FAILURE, "out of memory");
+    return symbol_table_insert(t, (struct symbol) {
+        .name = name,
+        .scope = SCOPE_FUNCTION,
+        .index = 0,
+    });
+}
 
-    // TODO: Copy name? 
-    // Should only be required if we free the original program string before evaluating bytecode
-    s->name = name;
-    s->scope = SCOPE_FUNCTION;
-    s->index = 0;
-    hashmap_insert(t->store, name, s);
-    return s;    
+/* looks name up in t only, not in the tables enclosing it */
+struct symbol *symbol_table_lookup(struct symbol_table *t, char *name) {
+    struct symbol_slot *slot = symbol_table_slot(t, name, symbol_hash(name));
+    return slot->symbol.name != NULL ? &slot->symbol : NULL;
 }
 
 struct symbol *symbol_table_resolve(struct symbol_table *t, char *name) {
-    void *r = hashmap_get(t->store, name);
-    if (r == NULL && t->outer != NULL) {
-        return symbol_table_resolve(t->outer, name);
+    uint32_t hash = symbol_hash(name);
+    for (; t != NULL; t = t->outer) {
+        struct symbol_slot *slot = symbol_table_slot(t, name, hash);
+        if (slot->symbol.name != NULL) {
+            return &slot->symbol;
+        }
     }
-    
-    return (struct symbol *) r;
+    return NULL;
+}
+
+/* returns the index of the symbol that the one at index replaced in t, or -1 if it did not replace any */
+int symbol_table_replaced(struct symbol_table *t, int index) {
+    return index < t->replaced_cap ? t->replaced[index] : -1;
 }
 
 void symbol_table_free(struct symbol_table *t) {
-    hashmap_free(t->store);
+    free(t->replaced);
+    free(t->slots);
     free(t);
-}
\ No newline at end of file
+}
@@ -1,6 +1,8 @@
 #ifndef SYMBOL_TABLE_H 
 #define SYMBOL_TABLE_H 
 
+#include <stdint.h>
+
 enum symbol_scope {
     SCOPE_GLOBAL,
     SCOPE_LOCAL,
@@ -13,40 +15,43 @@ enum symbol_scope {
 //     "FUNCTION",
 // };
 
-struct hashmap {
-    struct hashmap_node *table[26];
-};
-
-struct hashmap_node {
-    char *key;
-    void *value;
-    struct hashmap_node *next;
-};
-
 struct symbol {
     char *name;
     enum symbol_scope scope;
     int index;
 };
 
+struct symbol_slot {
+    struct symbol symbol;
+    uint32_t hash;
+};
+
+/*
+Symbols live inline in an open-addressing table with linear probing, which is kept at most half full and has
+no symbol name in its empty slots. Names are not copied: they are the strings interned by the parser, so a
+name usually matches by pointer before its hash and characters are compared.
+
+A symbol returned by the table is only valid until the next symbol is defined in the same table.
+*/
 struct symbol_table {
     int size;
-    struct hashmap *store;
+    struct symbol_slot *slots;
+    unsigned int slots_size;
+    unsigned int slots_cap;
     struct symbol_table *outer;
-};
 
-#define hash(v) (v[0] - 'a') % 26
-
-struct hashmap *hashmap_new();
-void hashmap_insert(struct hashmap *hm, char *key, void *item);
-void *hashmap_get(struct hashmap *hm, char *key);
-void hashmap_free(struct hashmap *hm);
+    // index of the symbol each one replaced by being defined under the same name, -1 if none (or past the end)
+    int *replaced;
+    unsigned int replaced_cap;
+};
 
 struct symbol_table *symbol_table_new();
 struct symbol_table *symbol_table_new_enclosed(struct symbol_table *outer);
 struct symbol *symbol_table_define(struct symbol_table *t, char *name);
 struct symbol *symbol_table_define_function(struct symbol_table *t, char *name);
+struct symbol *symbol_table_lookup(struct symbol_table *t, char *name);
 struct symbol *symbol_table_resolve(struct symbol_table *t, char *name);
+int symbol_table_replaced(struct symbol_table *t, int index);
 void symbol_table_free(struct symbol_table *t);
 
-#endif
\ No newline at end of file
+#endif
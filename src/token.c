@@ -33,31 +33,46 @@ static const char *token_names[] = {
     "STRING",
     "[",
     "]",
+    "IMPORT",
+};
+
+/*
+Perfect hash of the keywords: the length, first and last character of each keyword map it to its own slot,
+so telling a keyword from an identifier takes one table lookup and at most one short memcmp.
+*/
+#define keyword_hash(s, len) (((len) * 2 + (s)[0] + (s)[(len) - 1] * 13) & 15)
+
+// indexed by keyword_hash
+static const struct {
+    char *keyword;
+    enum token_type type;
+} keywords[16] = {
+    [0] = { "fn", TOKEN_FUNCTION },
+    [1] = { "false", TOKEN_FALSE },
+    [2] = { "while", TOKEN_WHILE },
+    [4] = { "return", TOKEN_RETURN },
+    [6] = { "let", TOKEN_LET },
+    [9] = { "import", TOKEN_IMPORT },
+    [11] = { "if", TOKEN_IF },
+    [13] = { "true", TOKEN_TRUE },
+    [14] = { "else", TOKEN_ELSE },
 };
 
 void get_ident(struct token *t) {
-    // TODO: Proper implementation, using simple hashmap probably
-    if (strcmp(t->literal, "let") == 0) {
-       t->type = TOKEN_LET;
-    } else if (strcmp(t->literal, "fn") == 0) {
-        t->type = TOKEN_FUNCTION;
-    } else if (strcmp(t->literal, "true") == 0) {
-        t->type = TOKEN_TRUE;
-    } else if (strcmp(t->literal, "false") == 0) {
-        t->type = TOKEN_FALSE;
-    } else if (strcmp(t->literal, "if") == 0) {
-        t->type = TOKEN_IF;
-    } else if (strcmp(t->literal, "else") == 0) {
-        t->type = TOKEN_ELSE;
-    } else if (strcmp(t->literal, "return") == 0) {
-        t->type = TOKEN_RETURN;
-    } else if (strcmp(t->literal, "while") == 0) {
-        t->type = TOKEN_WHILE;
+    unsigned int slot = keyword_hash((unsigned char *) t->start, t->length);
+    char *keyword = keywords[slot].keyword;
+    if (keyword != NULL && strlen(keyword) == t->length && memcmp(keyword, t->start, t->length) == 0) {
+        t->type = keywords[slot].type;
     } else {
         t->type = TOKEN_IDENT;
     }
 }
 
+/* appends the token's text to str */
+void token_to_str(char *str, struct token *t) {
+    strncat(str, t->start, t->length);
+}
+
 const char *token_type_to_str(enum token_type type) {
     return token_names[type];
 }
\ No newline at end of file
@@ -1,7 +1,7 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
-#define MAX_LITERAL_LENGTH 255 
+#include <stddef.h>
 
 enum token_type {
     TOKEN_ILLEGAL,
@@ -35,15 +35,27 @@ enum token_type {
     TOKEN_STRING,
     TOKEN_LBRACKET,
     TOKEN_RBRACKET,
+    TOKEN_IMPORT,
 };
 
 
+/*
+Tokens do not own their text, they point into the input, which therefore has to outlive them
+(and anything parsed from them). Keywords are told apart by their type.
+*/
 struct token {
     enum token_type type;
-    char literal[MAX_LITERAL_LENGTH];
+
+    // the token's text, which is not NUL-terminated; for strings only what is between the quotes
+    char *start;
+    unsigned int length;
+
+    // offset of the token's first character in the input
+    unsigned int pos;
 };
 
 void get_ident(struct token *t);
+void token_to_str(char *str, struct token *t);
 
 const char *token_type_to_str(enum token_type type);
 
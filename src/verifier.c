@@ -0,0 +1,294 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include <err.h>
+#include "verifier.h"
+#include "vm.h"
+
+/*
+Load-time bytecode verification.
+
+Every function in a program is checked once before the VM runs it (or, for functions that are
+compiled on their first call, before that call goes through), so the main loop can
+push, pop and read operands without any bounds checks. For each function we make sure that:
+
+- every opcode is known and its operands fit in the instruction stream
+- jumps land on the start of an instruction (or the end of the function)
+- constant, global, local and inline cache indexes are in range
+- direct calls target a compiled function taking exactly the given number of arguments
+- the operand stack never underflows and has the same depth whenever two paths meet
+
+Along the way we work out the deepest the operand stack can get, which together with the locals
+has to fit in STACK_SIZE values: that keeps any frame within the guard region past the stack limit
+(see vm.c), so running into the limit always faults there.
+*/
+
+// marks offsets in the middle of an instruction
+#define NOT_AN_INSTRUCTION -2
+
+// marks instruction offsets we have not reached yet
+#define UNREACHED -1
+
+// records the stack depth at a branch target, queueing the target if we had not seen it yet
+static int verify_branch(int *depths, unsigned int *worklist, unsigned int *worklist_size, unsigned int target, int depth) {
+    if (depths[target] == NOT_AN_INSTRUCTION) {
+        return VERIFY_ERR_INVALID_JUMP;
+    }
+
+    if (depths[target] == UNREACHED) {
+        depths[target] = depth;
+        worklist[(*worklist_size)++] = target;
+        return 0;
+    }
+
+    return depths[target] == depth ? 0 : VERIFY_ERR_STACK_MISMATCH;
+}
+
+int verify_function(struct bytecode *bc, struct compiled_function *fn) {
+    uint8_t *bytes = fn->instructions.bytes;
+    unsigned int size = fn->instructions.size;
+    int operands[MAX_OP_SIZE];
+
+    if (fn->num_locals < fn->num_parameters || fn->num_locals > STACK_SIZE) {
+        return VERIFY_ERR_INVALID_LOCAL;
+    }
+
+    // operand stack depth before each instruction, indexed by offset, plus one entry for the end of the function
+    int *depths = malloc(sizeof *depths * (size + 1));
+    unsigned int *worklist = malloc(sizeof *worklist * (size + 1));
+    unsigned int worklist_size = 0;
+    if (!depths || !worklist) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    int err = 0;
+
+    // find out where instructions start
+    for (unsigned int i = 0; i < size; i++) {
+        depths[i] = NOT_AN_INSTRUCTION;
+    }
+    depths[size] = UNREACHED;
+    for (unsigned int pos = 0; pos < size; ) {
+        bool wide = bytes[pos] == OPCODE_WIDE;
+        unsigned int width = wide ? 2 : 1;
+        if (pos + width > size) {
+            err = VERIFY_ERR_TRUNCATED_INSTRUCTION;
+            goto done;
+        }
+
+        enum opcode opcode = bytes[pos + width - 1];
+        if (opcode >= OPCODE_COUNT || opcode == OPCODE_WIDE || (wide && !opcode_has_wide_form(opcode))) {
+            err = VERIFY_ERR_INVALID_OPCODE;
+            goto done;
+        }
+
+        struct definition def = lookup(opcode);
+        for (int i = 0; i < def.operands; i++) {
+            width += wide ? WIDE_OPERAND_WIDTH : def.operand_widths[i];
+        }
+        if (pos + width > size) {
+            err = VERIFY_ERR_TRUNCATED_INSTRUCTION;
+            goto done;
+        }
+
+        depths[pos] = UNREACHED;
+        pos += width;
+    }
+
+    int max_depth = 0;
+    depths[0] = 0;
+    worklist[worklist_size++] = 0;
+    while (worklist_size > 0) {
+        unsigned int pos = worklist[--worklist_size];
+        int depth = depths[pos];
+        if (pos == size) {
+            continue;
+        }
+
+        enum opcode opcode;
+        unsigned int next = pos + read_instruction(bytes + pos, &opcode, operands);
+        int pops = 0;
+        int pushes = 0;
+        bool falls_through = true;
+        bool jumps = false;
+
+        // wide operands are read as signed integers, so anything that does not fit one is out of range
+        for (int i = 0; i < lookup(opcode).operands; i++) {
+            if (operands[i] < 0) {
+                err = VERIFY_ERR_INVALID_OPERAND;
+                goto done;
+            }
+        }
+
+        switch (opcode) {
+            case OPCODE_CONST:
+            case OPCODE_CONST_SHORT:
+                if (operands[0] >= bc->constants->size) err = VERIFY_ERR_INVALID_CONSTANT;
+                pushes = 1;
+            break;
+
+            case OPCODE_TRUE:
+            case OPCODE_FALSE:
+            case OPCODE_NULL:
+            case OPCODE_SMALL_INT:
+                pushes = 1;
+            break;
+
+            case OPCODE_POP:
+                pops = 1;
+            break;
+
+            case OPCODE_ADD:
+            case OPCODE_SUBTRACT:
+            case OPCODE_MULTIPLY:
+            case OPCODE_DIVIDE:
+            case OPCODE_EQUAL:
+            case OPCODE_NOT_EQUAL:
+            case OPCODE_GREATER_THAN:
+            case OPCODE_LESS_THAN:
+                pops = 2;
+                pushes = 1;
+            break;
+
+            case OPCODE_MINUS:
+            case OPCODE_BANG:
+                pops = 1;
+                pushes = 1;
+            break;
+
+            case OPCODE_JUMP:
+            case OPCODE_JUMP_SHORT:
+                falls_through = false;
+                jumps = true;
+            break;
+
+            case OPCODE_JUMP_NOT_TRUE:
+            case OPCODE_JUMP_NOT_TRUE_SHORT:
+                pops = 1;
+                jumps = true;
+            break;
+
+            case OPCODE_GET_GLOBAL:
+            case OPCODE_SET_GLOBAL:
+            case OPCODE_GET_GLOBAL_SHORT:
+            case OPCODE_SET_GLOBAL_SHORT:
+                if (operands[0] >= bc->num_globals) err = VERIFY_ERR_INVALID_GLOBAL;
+                if (opcode == OPCODE_GET_GLOBAL || opcode == OPCODE_GET_GLOBAL_SHORT) {
+                    pushes = 1;
+                } else {
+                    pops = 1;
+                }
+            break;
+
+            case OPCODE_GET_LOCAL:
+            case OPCODE_SET_LOCAL:
+                if (operands[0] >= fn->num_locals) err = VERIFY_ERR_INVALID_LOCAL;
+                if (opcode == OPCODE_GET_LOCAL) {
+                    pushes = 1;
+                } else {
+                    pops = 1;
+                }
+            break;
+
+            case OPCODE_CALL:
+                if (operands[1] >= bc->call_sites) err = VERIFY_ERR_INVALID_CALL;
+                pops = operands[0] + 1;
+                pushes = 1;
+            break;
+
+            case OPCODE_CALL_CONST: {
+                if (operands[0] >= bc->constants->size) {
+                    err = VERIFY_ERR_INVALID_CONSTANT;
+                    break;
+                }
+                struct object *callee = bc->constants->values[operands[0]];
+                if (callee->type != OBJ_COMPILED_FUNCTION || callee->value.compiled_function.num_parameters != operands[1]) {
+                    err = VERIFY_ERR_INVALID_CALL;
+                }
+                pops = operands[1];
+                pushes = 1;
+            }
+            break;
+
+            case OPCODE_RETURN_VALUE:
+                pops = 1;
+                falls_through = false;
+            break;
+
+            case OPCODE_RETURN:
+                falls_through = false;
+            break;
+
+            default:
+            break;
+        }
+        if (err) goto done;
+
+        if (depth < pops) {
+            err = VERIFY_ERR_STACK_UNDERFLOW;
+            goto done;
+        }
+        depth += pushes - pops;
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+
+        if (jumps) {
+            unsigned int target = jump_target(opcode, pos, next - pos, operands[0]);
+            err = target <= size ? verify_branch(depths, worklist, &worklist_size, target, depth) : VERIFY_ERR_INVALID_JUMP;
+            if (err) goto done;
+        }
+        if (falls_through) {
+            err = verify_branch(depths, worklist, &worklist_size, next, depth);
+            if (err) goto done;
+        }
+    }
+
+    if (fn->num_locals + max_depth > STACK_SIZE) {
+        err = VERIFY_ERR_STACK_OVERFLOW;
+    }
+
+    done:
+    free(depths);
+    free(worklist);
+    return err;
+}
+
+int verify_bytecode(struct bytecode *bc) {
+    int err;
+
+    for (unsigned int i = 0; i < bc->constants->size; i++) {
+        struct object *obj = bc->constants->values[i];
+        // stubs have no code yet, the VM verifies them once they are compiled
+        if (obj->type != OBJ_COMPILED_FUNCTION || is_function_stub(&obj->value.compiled_function)) {
+            continue;
+        }
+
+        err = verify_function(bc, &obj->value.compiled_function);
+        if (err) return err;
+    }
+
+    struct compiled_function main_fn = {
+        .instructions = *bc->instructions,
+        .num_locals = 0,
+        .num_parameters = 0,
+    };
+    return verify_function(bc, &main_fn);
+}
+
+char *verifier_error_str(int err) {
+    static char *messages[] = {
+        "Success",
+        "Invalid opcode",
+        "Truncated instruction",
+        "Invalid jump target",
+        "Invalid constant",
+        "Invalid global",
+        "Invalid local",
+        "Invalid call",
+        "Stack underflow",
+        "Stack depth differs between branches",
+        "Stack overflow",
+        "Operand out of range",
+    };
+    return messages[err];
+}
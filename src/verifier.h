@@ -0,0 +1,23 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include "opcode.h"
+#include "object.h"
+
+#define VERIFY_ERR_INVALID_OPCODE 1
+#define VERIFY_ERR_TRUNCATED_INSTRUCTION 2
+#define VERIFY_ERR_INVALID_JUMP 3
+#define VERIFY_ERR_INVALID_CONSTANT 4
+#define VERIFY_ERR_INVALID_GLOBAL 5
+#define VERIFY_ERR_INVALID_LOCAL 6
+#define VERIFY_ERR_INVALID_CALL 7
+#define VERIFY_ERR_STACK_UNDERFLOW 8
+#define VERIFY_ERR_STACK_MISMATCH 9
+#define VERIFY_ERR_STACK_OVERFLOW 10
+#define VERIFY_ERR_INVALID_OPERAND 11
+
+int verify_function(struct bytecode *bc, struct compiled_function *fn);
+int verify_bytecode(struct bytecode *bc);
+char *verifier_error_str(int err);
+
+#endif
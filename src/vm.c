@@ -1,9 +1,16 @@
+#define _DEFAULT_SOURCE
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include <err.h>
 #include "vm.h"
+#include "verifier.h"
+#include "compiler.h"
 
 #ifdef DEBUG
 #include <stdio.h>
@@ -13,6 +20,8 @@
 #define VM_ERR_INVALID_INT_OPERATOR 2
 #define VM_ERR_OUT_OF_BOUNDS 3
 #define VM_ERR_STACK_OVERFLOW 4
+#define VM_ERR_WRONG_ARGUMENT_COUNT 5
+#define VM_ERR_INVALID_FUNCTION 6
 
 const struct object obj_null = {
     .type = OBJ_NULL,
@@ -26,28 +35,214 @@ const struct object obj_false = {
     .value = { .boolean = false },
 };
 
-struct vm *vm_new(struct bytecode *bc) {
-    struct vm *vm = malloc(sizeof *vm);
-    vm->stack_pointer = 0;
+/*
+Growable stacks.
+
+The frame and value stacks each reserve enough address space for their hard limit up front, but only
+the first segment is accessible. Everything past the accessible part is mapped PROT_NONE, so pushes and
+calls never need to check bounds: running into the inaccessible part faults, and the SIGSEGV handler below
+either makes more segments accessible and lets the faulting instruction retry, or, once the limit is
+reached, jumps back into vm_run, which then returns VM_ERR_STACK_OVERFLOW. Since stacks never move,
+pointers into them stay valid while they grow.
+
+A call moves the stack pointer up by the callee's number of locals before touching the new slots, so the
+region past the limit must be at least as large as the biggest frame. The verifier limits frames to
+STACK_SIZE values, which is what we reserve.
+*/
+
+// the VM currently inside vm_run on this thread, if any, and where to jump when it overflows
+static _Thread_local struct vm *vm_running = NULL;
+static _Thread_local sigjmp_buf vm_overflow;
 
-    for (int i = 0; i < STACK_SIZE; i++) {
-        vm->stack[i] = obj_null;
-        vm->globals[i] = obj_null;
-        vm->constants[i] = obj_null;
+static size_t round_to(size_t size, size_t multiple) {
+    return (size + multiple - 1) / multiple * multiple;
+}
+
+static size_t round_to_pages(size_t size) {
+    return round_to(size, sysconf(_SC_PAGESIZE));
+}
+
+static void vm_stack_map(struct vm_stack *s, size_t limit, size_t guard_size) {
+    s->limit = round_to_pages(limit);
+    s->reserved = s->limit + round_to_pages(guard_size);
+    s->committed = round_to_pages(VM_STACK_SEGMENT_SIZE) < s->limit ? round_to_pages(VM_STACK_SEGMENT_SIZE) : s->limit;
+    s->start = mmap(NULL, s->reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (s->start == MAP_FAILED) {
+        err(EXIT_FAILURE, "out of memory");
     }
 
-    for (int i=0; i < bc->constants->size; i++) {
-       struct object obj = *bc->constants->values[i];
+    if (mprotect(s->start, s->committed, PROT_READ | PROT_WRITE) != 0) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+}
+
+static void vm_stack_unmap(struct vm_stack *s) {
+    munmap(s->start, s->reserved);
+}
 
-       // copy over string values
-       if (obj.type == OBJ_STRING) {
+/* makes the stack accessible up to and including addr, returns false if that would exceed its limit */
+static bool vm_stack_grow(struct vm_stack *s, uint8_t *addr) {
+    size_t needed = round_to(addr - s->start + 1, round_to_pages(VM_STACK_SEGMENT_SIZE));
+    if ((size_t) (addr - s->start) >= s->limit) {
+        return false;
+    }
+
+    if (needed > s->limit) {
+        needed = s->limit;
+    }
+    if (mprotect(s->start + s->committed, needed - s->committed, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    s->committed = needed;
+    return true;
+}
+
+static bool vm_stack_contains(struct vm_stack *s, uint8_t *addr) {
+    return addr >= s->start + s->committed && addr < s->start + s->reserved;
+}
+
+static void vm_handle_segv(int sig, siginfo_t *info, void *context) {
+    struct vm *vm = vm_running;
+    uint8_t *addr = info->si_addr;
+    struct vm_stack *s = NULL;
+
+    if (vm != NULL && vm_stack_contains(&vm->stack_mapping, addr)) {
+        s = &vm->stack_mapping;
+    } else if (vm != NULL && vm_stack_contains(&vm->frames_mapping, addr)) {
+        s = &vm->frames_mapping;
+    }
+
+    if (s != NULL) {
+        if (vm_stack_grow(s, addr)) {
+            return;
+        }
+
+        vm_running = NULL;
+        siglongjmp(vm_overflow, 1);
+    }
+
+    // not ours: restore the default action so the faulting instruction crashes as usual when it is retried
+    signal(SIGSEGV, SIG_DFL);
+}
+
+static void vm_install_segv_handler() {
+    static bool installed = false;
+    if (installed) {
+        return;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_sigaction = vm_handle_segv;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, NULL) != 0) {
+        err(EXIT_FAILURE, "could not install stack overflow handler");
+    }
+    installed = true;
+}
+
+static void vm_map_stacks(struct vm *vm, unsigned int limit) {
+    vm_stack_map(&vm->stack_mapping, sizeof *vm->stack * limit, sizeof *vm->stack * STACK_SIZE);
+    vm_stack_map(&vm->frames_mapping, sizeof *vm->frames * limit, 1);
+    vm->stack = (struct object *) vm->stack_mapping.start;
+    vm->frames = (struct frame *) vm->frames_mapping.start;
+}
+
+/* copies constants the compiler added since the last call into the VM's own pool */
+static void vm_copy_constants(struct vm *vm) {
+    struct object_list *constants = vm->bytecode->constants;
+    if (constants->size <= vm->num_constants) {
+        return;
+    }
+
+    vm->constants = realloc(vm->constants, constants->size * sizeof *vm->constants);
+    if (!vm->constants) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+
+    for (int i = vm->num_constants; i < constants->size; i++) {
+       struct object obj = *constants->values[i];
+
+       // copy over string values, unless they are in a mapped file that outlives the VM
+       if (obj.type == OBJ_STRING && vm->bytecode->mapping == NULL) {
             char *dup = malloc(strlen(obj.value.string) + 1);
             strcpy(dup, obj.value.string);
             obj.value.string = dup;
        }
 
        vm->constants[i] = obj;
-    }    
+    }
+    vm->num_constants = constants->size;
+}
+
+/*
+Compiles the function stub at the given constant index on its first call and verifies the result.
+The function may add constants and call sites of its own, for which the VM's pool and inline caches grow.
+If it does not compile, the compiler's error is kept on the VM along with the function's name.
+*/
+static int vm_compile_function(struct vm *vm, unsigned int idx) {
+    struct bytecode *bc = vm->bytecode;
+    struct compiler *c = bc->compiler;
+    vm->compile_error = compile_function_stub(c, idx);
+    if (vm->compile_error != 0) {
+        // a function that fails to compile stays a stub
+        struct function_stub *stub = compiler_function_stub(c, idx);
+        uint32_t name = ast_function_name(stub->ast, stub->literal);
+        vm->compile_error_function = name != 0 ? ast_string(stub->ast, name) : NULL;
+        return VM_ERR_INVALID_FUNCTION;
+    }
+
+    if (c->call_sites > bc->call_sites) {
+        vm->call_caches = realloc(vm->call_caches, c->call_sites * sizeof *vm->call_caches);
+        if (!vm->call_caches) {
+            err(EXIT_FAILURE, "out of memory");
+        }
+        memset(vm->call_caches + bc->call_sites, 0, (c->call_sites - bc->call_sites) * sizeof *vm->call_caches);
+        bc->call_sites = c->call_sites;
+    }
+
+    struct object *fn = bc->constants->values[idx];
+    if (verify_function(bc, &fn->value.compiled_function) != 0) {
+        return VM_ERR_INVALID_FUNCTION;
+    }
+
+    vm_copy_constants(vm);
+    vm->constants[idx] = *fn;
+    return 0;
+}
+
+/* returns NULL if the bytecode does not pass verification */
+struct vm *vm_new(struct bytecode *bc) {
+    if (verify_bytecode(bc) != 0) {
+        return NULL;
+    }
+
+    struct vm *vm = malloc(sizeof *vm);
+    if (!vm) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+    vm_install_segv_handler();
+    vm_map_stacks(vm, DEFAULT_STACK_LIMIT);
+    vm->stack_pointer = 0;
+    vm->bytecode = bc;
+    vm->compile_error = 0;
+    vm->compile_error_function = NULL;
+    vm->call_caches = calloc(bc->call_sites, sizeof *vm->call_caches);
+    if (bc->call_sites > 0 && !vm->call_caches) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+
+    // fresh stack segments and calloc'ed globals are zeroed, which reads as null values
+    vm->num_globals = bc->num_globals;
+    vm->globals = calloc(vm->num_globals > 0 ? vm->num_globals : 1, sizeof *vm->globals);
+    if (!vm->globals) {
+        err(EXIT_FAILURE, "out of memory");
+    }
+
+    vm->constants = NULL;
+    vm->num_constants = 0;
+    vm_copy_constants(vm);
 
     struct object *fn = make_compiled_function_object(bc->instructions, 0);
     vm->frames[0] = frame_new(*fn, 0);
@@ -56,76 +251,64 @@ struct vm *vm_new(struct bytecode *bc) {
     return vm;
 }
 
-struct vm *vm_new_with_globals(struct bytecode *bc, struct object globals[STACK_SIZE]) {
+struct vm *vm_new_with_globals(struct bytecode *bc, struct object *globals, unsigned int num_globals) {
     struct vm *vm = vm_new(bc);
+    if (!vm) {
+        return NULL;
+    }
 
-    for (int i=0; i < STACK_SIZE; i++) {
+    for (int i=0; i < num_globals && i < vm->num_globals; i++) {
         vm->globals[i] = globals[i];
     }
     return vm;
 }
 
+/*
+Limits both the number of values on the stack and the number of nested calls.
+Has to be called before the VM runs, since it throws away anything already on the stacks.
+*/
+void vm_set_stack_limit(struct vm *vm, unsigned int limit) {
+    struct frame main_frame = vm->frames[0];
+    vm_stack_unmap(&vm->stack_mapping);
+    vm_stack_unmap(&vm->frames_mapping);
+    vm_map_stacks(vm, limit);
+    vm->frames[0] = main_frame;
+    vm->frame_index = 0;
+    vm->stack_pointer = 0;
+}
+
 void vm_free(struct vm *vm) {
+    vm_stack_unmap(&vm->stack_mapping);
+    vm_stack_unmap(&vm->frames_mapping);
+    free(vm->call_caches);
+    free(vm->constants);
+    free(vm->globals);
     free(vm);
 }
 
 struct frame frame_new(struct object obj, unsigned int bp) {
-    #ifndef UNSAFE
     assert(obj.type == OBJ_COMPILED_FUNCTION);
-    #endif 
     struct frame f = {
         .ip = 0,
         .fn = obj.value.compiled_function,
         .base_pointer = bp,
+        .return_pointer = bp,
     };
 
     return f;
 }
 
-#ifdef OPT_AGGRESSIVE
+/*
+All bytecode is verified before it runs (see verifier.c), so the operand stack can not underflow within
+a frame and the stack operations below need no bounds checks. Overflowing either stack as a whole runs
+into its guard region, see vm_handle_segv.
+*/
 #define vm_pop_frame(vm) vm->frames[vm->frame_index--]
 #define vm_push_frame(vm, f) vm->frames[++vm->frame_index] = f
-#else
-struct frame vm_pop_frame(struct vm *vm) {
-    return vm->frames[vm->frame_index--];
-}
-void vm_push_frame(struct vm *vm, struct frame f) {
-    #ifndef UNSAFE
-    if ((vm->frame_index + 1) >= STACK_SIZE) {
-        err(VM_ERR_STACK_OVERFLOW, "frame overflow");
-    }
-    #endif
-    vm->frames[++vm->frame_index] = f;
-}
-#endif
 
 #define vm_stack_pop_ignore(vm) vm->stack_pointer--
-
-#ifdef OPT_AGGRESSIVE
 #define vm_stack_pop(vm) vm->stack[--vm->stack_pointer]
 #define vm_stack_push(vm, obj) vm->stack[vm->stack_pointer++] = obj
-#else 
-struct object vm_stack_pop(struct vm *vm) {
-    #ifndef UNSAFE
-    if (vm->stack_pointer == 0) {
-        return obj_null;
-    }
-    #endif
-
-    return vm->stack[--vm->stack_pointer];
-}
-
-void vm_stack_push(struct vm *vm, struct object obj) {
-    #ifndef UNSAFE
-    if (vm->stack_pointer >= STACK_SIZE) {
-        err(VM_ERR_STACK_OVERFLOW, "stack overflow");
-        return;
-    }
-    #endif
-
-    vm->stack[vm->stack_pointer++] = obj;
-}
-#endif
 
 int vm_do_binary_integer_operation(struct vm *vm, enum opcode opcode, int left, int right) {
     long result;
@@ -173,7 +356,9 @@ int vm_do_binary_operation(struct vm *vm, enum opcode opcode) {
     struct object right = vm_stack_pop(vm);
     struct object left = vm_stack_pop(vm);
 
-    // FIXME: left and right type should be equal
+    if (left.type != right.type) {
+        return VM_ERR_INVALID_OP_TYPE;
+    }
 
     switch (left.type) {
         case OBJ_INT: return vm_do_binary_integer_operation(vm, opcode, left.value.integer, right.value.integer);
@@ -216,11 +401,9 @@ int vm_do_comparision(struct vm *vm, enum opcode opcode) {
     struct object right = vm_stack_pop(vm);
     struct object left = vm_stack_pop(vm);
 
-    #ifndef UNSAFE
     if (left.type != right.type) {
         return VM_ERR_INVALID_OP_TYPE;
     }
-    #endif
     
     if (left.type == OBJ_INT) {
         return vm_do_integer_comparison(vm, opcode, left.value.integer, right.value.integer);
@@ -253,11 +436,9 @@ void vm_do_bang_operation(struct vm *vm) {
 int vm_do_minus_operation(struct vm *vm) {
     struct object obj = vm_stack_pop(vm);
 
-    #ifndef UNSAFE
     if (obj.type != OBJ_INT) {
         return VM_ERR_INVALID_OP_TYPE;
     }
-    #endif
 
     obj.value.integer = -obj.value.integer;
     vm_stack_push(vm, obj);
@@ -266,7 +447,7 @@ int vm_do_minus_operation(struct vm *vm) {
 
 
 
-int vm_run(struct vm *vm) {
+static int vm_execute(struct vm *vm) {
 
     /* values used in main loop */
     unsigned int ip;
@@ -277,6 +458,7 @@ int vm_run(struct vm *vm) {
 
     /* tmp values used in switch cases */
     int err, idx, pos, num_args;
+    struct call_cache *cache;
 
     /* 
     The following comment is taken from CPython's source: https://github.com/python/cpython/blob/master/Python/ceval.c#L775
@@ -343,6 +525,25 @@ int vm_run(struct vm *vm) {
         &&GOTO_OPCODE_RETURN,
         &&GOTO_OPCODE_GET_LOCAL,
         &&GOTO_OPCODE_SET_LOCAL,
+        &&GOTO_OPCODE_CALL_CONST,
+        &&GOTO_OPCODE_WIDE,
+        &&GOTO_OPCODE_CONST_SHORT,
+        &&GOTO_OPCODE_GET_GLOBAL_SHORT,
+        &&GOTO_OPCODE_SET_GLOBAL_SHORT,
+        &&GOTO_OPCODE_JUMP_SHORT,
+        &&GOTO_OPCODE_JUMP_NOT_TRUE_SHORT,
+        &&GOTO_OPCODE_SMALL_INT,
+    };
+
+    // the verifier only lets OPCODE_WIDE prefix these opcodes
+    static const void *wide_dispatch_table[OPCODE_COUNT] = {
+        [OPCODE_CONST] = &&WIDE_OPCODE_CONST,
+        [OPCODE_GET_GLOBAL] = &&WIDE_OPCODE_GET_GLOBAL,
+        [OPCODE_SET_GLOBAL] = &&WIDE_OPCODE_SET_GLOBAL,
+        [OPCODE_GET_LOCAL] = &&WIDE_OPCODE_GET_LOCAL,
+        [OPCODE_SET_LOCAL] = &&WIDE_OPCODE_SET_LOCAL,
+        [OPCODE_CALL] = &&WIDE_OPCODE_CALL,
+        [OPCODE_CALL_CONST] = &&WIDE_OPCODE_CALL_CONST,
     };
 
     #define DISPATCH()                   \
@@ -395,12 +596,33 @@ int vm_run(struct vm *vm) {
         // intitial dispatch
         DISPATCH();
 
+        /*
+        Opcodes with a wide form decode their operands first and then share the rest of their
+        handler with the wide variant below, which reads the same operands as 32-bit values.
+        */
+        GOTO_OPCODE_WIDE:
+            goto *wide_dispatch_table[bytes[ip + 1]];
+
         GOTO_OPCODE_CONST:
             idx = read_uint16((bytes + ip + 1));
             ip += 3;
+        DO_OPCODE_CONST:
             vm_stack_push(vm, vm->constants[idx]);   
             DISPATCH();
 
+        GOTO_OPCODE_CONST_SHORT:
+            vm_stack_push(vm, vm->constants[read_uint8((bytes + ip + 1))]);
+            ip += 2;
+            DISPATCH();
+
+        GOTO_OPCODE_SMALL_INT:
+            // only the fields an integer uses are written, the rest of the slot is never read
+            vm->stack[vm->stack_pointer].type = OBJ_INT;
+            vm->stack[vm->stack_pointer].value.integer = read_uint8((bytes + ip + 1));
+            vm->stack_pointer++;
+            ip += 2;
+            DISPATCH();
+
         GOTO_OPCODE_POP:
             vm_stack_pop_ignore(vm);
             ip++;
@@ -408,50 +630,135 @@ int vm_run(struct vm *vm) {
         
         GOTO_OPCODE_CALL: 
             num_args = read_uint8((bytes + ip + 1));
+            cache = &vm->call_caches[read_uint16((bytes + ip + 2))];
+            ip += 4;
+        DO_OPCODE_CALL: {
             struct object fn = vm->stack[vm->stack_pointer - 1 - num_args];
 
-            // grab next new frame from frame stack & re-use
+            // on a cache miss, check the callee once and remember it for the next call from this site
+            if (fn.type != OBJ_COMPILED_FUNCTION || fn.value.compiled_function.instructions.bytes != cache->key) {
+                if (fn.type != OBJ_COMPILED_FUNCTION) {
+                    return VM_ERR_INVALID_OP_TYPE;
+                }
+                if (fn.value.compiled_function.num_parameters != num_args) {
+                    return VM_ERR_WRONG_ARGUMENT_COUNT;
+                }
+
+                struct compiled_function *callee = &fn.value.compiled_function;
+                if (is_function_stub(callee)) {
+                    // compiling may add call sites, which moves the inline caches
+                    idx = cache - vm->call_caches;
+                    err = vm_compile_function(vm, callee->constant);
+                    if (err) return err;
+                    cache = &vm->call_caches[idx];
+                    callee = &vm->constants[callee->constant].value.compiled_function;
+                }
+                cache->key = fn.value.compiled_function.instructions.bytes;
+                cache->bytes = callee->instructions.bytes;
+                cache->size = callee->instructions.size;
+                cache->num_locals = callee->num_locals;
+            }
+
+            // grab next new frame from frame stack & re-use, fn may be a stub so its code comes from the cache
             struct frame f = vm->frames[vm->frame_index+1];
             f.ip = 0;
             f.fn = fn.value.compiled_function;
+            f.fn.instructions.bytes = cache->bytes;
+            f.fn.instructions.size = cache->size;
+            f.base_pointer = vm->stack_pointer - num_args;
+            f.return_pointer = f.base_pointer - 1;
+            active_frame->ip = ip;
+            vm_push_frame(vm, f);
+            active_frame = &vm->frames[vm->frame_index];
+            bytes = cache->bytes;
+            ip_max = cache->size;
+            ip = 0;
+            vm->stack_pointer = f.base_pointer + cache->num_locals;
+            DISPATCH();
+        }
+
+        GOTO_OPCODE_CALL_CONST:
+            // callee is a known function in the constant pool, so it was never pushed onto the stack
+            idx = read_uint16((bytes + ip + 1));
+            num_args = read_uint8((bytes + ip + 3));
+            ip += 4;
+        DO_OPCODE_CALL_CONST: {
+            if (is_function_stub(&vm->constants[idx].value.compiled_function)) {
+                err = vm_compile_function(vm, idx);
+                if (err) return err;
+            }
+
+            struct frame f = vm->frames[vm->frame_index+1];
+            f.ip = 0;
+            f.fn = vm->constants[idx].value.compiled_function;
             f.base_pointer = vm->stack_pointer - num_args;
-            active_frame->ip = ip + 1;
+            f.return_pointer = f.base_pointer;
+            active_frame->ip = ip;
             vm_push_frame(vm, f);
             active_frame = &vm->frames[vm->frame_index];
             bytes = f.fn.instructions.bytes;
             ip_max = f.fn.instructions.size;
-            ip = active_frame->ip;
+            ip = 0;
             vm->stack_pointer = f.base_pointer + f.fn.num_locals;
             DISPATCH();
+        }
 
         GOTO_OPCODE_JUMP:
-            pos = read_uint16((bytes + ip + 1));
+            pos = read_uint32((bytes + ip + 1));
             ip = pos;
             DISPATCH();
 
         GOTO_OPCODE_JUMP_NOT_TRUE: {
             struct object condition = vm_stack_pop(vm);
             if (condition.type == OBJ_NULL || (condition.type == OBJ_BOOL && condition.value.boolean == false)) {
-                pos = read_uint16((bytes + ip + 1));
+                pos = read_uint32((bytes + ip + 1));
                 ip = pos;
             } else {
-                ip += 3;
+                ip += 5;
+            }
+            DISPATCH();
+        }
+
+        // short jumps are relative to the next instruction
+        GOTO_OPCODE_JUMP_SHORT:
+            ip += 2 + read_uint8((bytes + ip + 1));
+            DISPATCH();
+
+        GOTO_OPCODE_JUMP_NOT_TRUE_SHORT: {
+            struct object condition = vm_stack_pop(vm);
+            if (condition.type == OBJ_NULL || (condition.type == OBJ_BOOL && condition.value.boolean == false)) {
+                ip += 2 + read_uint8((bytes + ip + 1));
+            } else {
+                ip += 2;
             }
             DISPATCH();
         }
 
+        GOTO_OPCODE_SET_GLOBAL_SHORT:
+            vm->globals[read_uint8((bytes + ip + 1))] = vm_stack_pop(vm);
+            ip += 2;
+            DISPATCH();
+
+        GOTO_OPCODE_GET_GLOBAL_SHORT:
+            vm_stack_push(vm, vm->globals[read_uint8((bytes + ip + 1))]);
+            ip += 2;
+            DISPATCH();
+
         GOTO_OPCODE_SET_GLOBAL: 
             idx = read_uint16((bytes + ip + 1));
             ip += 3;
+        DO_OPCODE_SET_GLOBAL:
             vm->globals[idx] = vm_stack_pop(vm);
             DISPATCH();
 
         GOTO_OPCODE_GET_GLOBAL: 
             idx = read_uint16((bytes + ip + 1));
             ip += 3;
+        DO_OPCODE_GET_GLOBAL:
             vm_stack_push(vm, vm->globals[idx]);
             DISPATCH();
 
+        // calls save the offset of the next instruction, so returning resumes right there
         GOTO_OPCODE_RETURN_VALUE: {
             struct object obj = vm_stack_pop(vm); 
             struct frame f = vm_pop_frame(vm);
@@ -459,9 +766,8 @@ int vm_run(struct vm *vm) {
             bytes = active_frame->fn.instructions.bytes;
             ip_max = active_frame->fn.instructions.size;
             ip = active_frame->ip;
-            vm->stack_pointer = f.base_pointer - 1;
+            vm->stack_pointer = f.return_pointer;
             vm_stack_push(vm, obj);
-            ip++;
             DISPATCH();
         }
         
@@ -471,7 +777,7 @@ int vm_run(struct vm *vm) {
             ip = active_frame->ip;
             ip_max = active_frame->fn.instructions.size;
             bytes = active_frame->fn.instructions.bytes;
-            vm->stack_pointer = f.base_pointer - 1;
+            vm->stack_pointer = f.return_pointer;
             vm_stack_push(vm, obj_null);
             DISPATCH();
         }
@@ -479,23 +785,60 @@ int vm_run(struct vm *vm) {
         GOTO_OPCODE_SET_LOCAL:
             idx = read_uint8((bytes + ip + 1));
             ip += 2;
+        DO_OPCODE_SET_LOCAL:
             vm->stack[active_frame->base_pointer + idx] = vm_stack_pop(vm);
             DISPATCH();
 
         GOTO_OPCODE_GET_LOCAL: 
             idx = read_uint8((bytes + ip + 1));
             ip += 2;
+        DO_OPCODE_GET_LOCAL:
             vm_stack_push(vm, vm->stack[active_frame->base_pointer + idx]);
             DISPATCH();
 
+        WIDE_OPCODE_CONST:
+            idx = read_uint32((bytes + ip + 2));
+            ip += 6;
+            goto DO_OPCODE_CONST;
+
+        WIDE_OPCODE_GET_GLOBAL:
+            idx = read_uint32((bytes + ip + 2));
+            ip += 6;
+            goto DO_OPCODE_GET_GLOBAL;
+
+        WIDE_OPCODE_SET_GLOBAL:
+            idx = read_uint32((bytes + ip + 2));
+            ip += 6;
+            goto DO_OPCODE_SET_GLOBAL;
+
+        WIDE_OPCODE_GET_LOCAL:
+            idx = read_uint32((bytes + ip + 2));
+            ip += 6;
+            goto DO_OPCODE_GET_LOCAL;
+
+        WIDE_OPCODE_SET_LOCAL:
+            idx = read_uint32((bytes + ip + 2));
+            ip += 6;
+            goto DO_OPCODE_SET_LOCAL;
+
+        WIDE_OPCODE_CALL:
+            num_args = read_uint32((bytes + ip + 2));
+            cache = &vm->call_caches[read_uint32((bytes + ip + 6))];
+            ip += 10;
+            goto DO_OPCODE_CALL;
+
+        WIDE_OPCODE_CALL_CONST:
+            idx = read_uint32((bytes + ip + 2));
+            num_args = read_uint32((bytes + ip + 6));
+            ip += 10;
+            goto DO_OPCODE_CALL_CONST;
+
         GOTO_OPCODE_ADD:
         GOTO_OPCODE_SUBTRACT:
         GOTO_OPCODE_MULTIPLY:
         GOTO_OPCODE_DIVIDE: 
             err = vm_do_binary_operation(vm, opcode);
-            #ifndef UNSAFE
             if (err) return err;
-            #endif
             ip++;
             DISPATCH();
 
@@ -506,9 +849,7 @@ int vm_run(struct vm *vm) {
 
         GOTO_OPCODE_MINUS: 
             err = vm_do_minus_operation(vm);
-            #ifndef UNSAFE
             if (err) return err;
-            #endif
             ip++;
             DISPATCH();
 
@@ -517,9 +858,7 @@ int vm_run(struct vm *vm) {
         GOTO_OPCODE_GREATER_THAN: 
         GOTO_OPCODE_LESS_THAN: 
             err = vm_do_comparision(vm, opcode);
-            #ifndef UNSAFE
             if (err) return err;
-            #endif
             ip++;
             DISPATCH();
 
@@ -545,6 +884,18 @@ int vm_run(struct vm *vm) {
     return 0;
 }
 
+int vm_run(struct vm *vm) {
+    // the signal mask is saved as well, since we leave the SIGSEGV handler by jumping back here
+    if (sigsetjmp(vm_overflow, 1) != 0) {
+        return VM_ERR_STACK_OVERFLOW;
+    }
+
+    vm_running = vm;
+    int result = vm_execute(vm);
+    vm_running = NULL;
+    return result;
+}
+
 struct object vm_stack_last_popped(struct vm *vm) {
     return vm->stack[vm->stack_pointer];
 }
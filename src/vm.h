@@ -2,7 +2,18 @@
 #define VM_H 
 
 #define STACK_SIZE 2048
-#define MAX_GLOBALS 65536
+
+// default maximum number of values on the stack and of nested calls, see vm_set_stack_limit
+#ifndef DEFAULT_STACK_LIMIT
+#define DEFAULT_STACK_LIMIT (1 << 20)
+#endif
+
+// stacks grow in steps of this many bytes
+#define VM_STACK_SEGMENT_SIZE (64 * 1024)
+
+// stack limits accepted from users: at least the values in the first segment, at most what can be reserved
+#define VM_MIN_STACK_LIMIT (VM_STACK_SEGMENT_SIZE / sizeof(struct object))
+#define VM_MAX_STACK_LIMIT (1 << 26)
 
 #include "opcode.h"
 #include "object.h"
@@ -11,27 +22,66 @@ struct frame {
     struct compiled_function fn;
     unsigned int ip;
     unsigned int base_pointer;
+
+    // stack pointer to restore on return, which drops the arguments (and the callee for OPCODE_CALL)
+    unsigned int return_pointer;
+};
+
+/*
+Monomorphic inline cache for a single OPCODE_CALL site. Most call sites always
+call the same function, so we remember the last callee (identified by its
+instruction bytes) together with everything needed to set up its frame.
+Stubs of functions that were not compiled yet are identified by their own
+(empty) instruction bytes, but the cache holds the code they compiled to.
+*/
+struct call_cache {
+    uint8_t *key;
+    uint8_t *bytes;
+    unsigned int size;
+    unsigned int num_locals;
+};
+
+/* address space reserved for a stack, of which only the first committed bytes are accessible */
+struct vm_stack {
+    uint8_t *start;
+    size_t committed;
+    size_t limit;
+    size_t reserved;
 };
 
 struct vm {
-    struct frame frames[STACK_SIZE];
+    // frames and stack grow on demand up to their limit, see vm_handle_segv
+    struct frame *frames;
+    struct vm_stack frames_mapping;
     unsigned int frame_index;
     
-    struct object constants[STACK_SIZE];
-    struct object globals[STACK_SIZE];
-    struct object stack[STACK_SIZE];
+    struct object *constants;
+    unsigned int num_constants;
+    struct object *globals;
+    unsigned int num_globals;
+    struct object *stack;
+    struct vm_stack stack_mapping;
     unsigned int stack_pointer;
+
+    struct call_cache *call_caches;
+
+    // the program being run, whose compiler compiles function stubs on their first call
+    struct bytecode *bytecode;
+
+    // why the last function stub failed to compile (0 if it did not) and the function's name, NULL if it has none
+    int compile_error;
+    char *compile_error_function;
 };
 
-const struct object obj_null;
-const struct object obj_true;
-const struct object obj_false;
+extern const struct object obj_null;
+extern const struct object obj_true;
+extern const struct object obj_false;
 
 struct vm *vm_new(struct bytecode *bc);
-struct vm *vm_new_with_globals(struct bytecode *bc, struct object globals[STACK_SIZE]);
+struct vm *vm_new_with_globals(struct bytecode *bc, struct object *globals, unsigned int num_globals);
+void vm_set_stack_limit(struct vm *vm, unsigned int limit);
 int vm_run(struct vm *vm);
 struct object vm_stack_last_popped(struct vm *vm);
-struct object vm_stack_pop(struct vm *vm);
 void vm_free(struct vm *vm);
 
 struct frame frame_new(struct object obj, unsigned int bp);
@@ -0,0 +1,63 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "test_helpers.h"
+#include "arena.h"
+
+void test_alloc() {
+    TESTNAME(__FUNCTION__);
+
+    struct arena a = { NULL, NULL };
+    char *prev = NULL;
+    for (int i=0; i < 10000; i++) {
+        size_t size = 1 + i % 100;
+        char *ptr = arena_alloc(&a, size);
+        assertf((uintptr_t) ptr % _Alignof(max_align_t) == 0, "allocation %d is not aligned", i);
+        assertf(ptr != prev, "allocation %d was handed out twice", i);
+        memset(ptr, i, size);
+        prev = ptr;
+    }
+
+    // larger than a block
+    char *big = arena_alloc(&a, ARENA_BLOCK_SIZE * 3);
+    memset(big, 1, ARENA_BLOCK_SIZE * 3);
+    assertf(a.block->size >= ARENA_BLOCK_SIZE * 3, "large allocation did not get its own block");
+
+    arena_free(&a);
+    assertf(a.block == NULL && a.last == NULL, "arena not reset");
+}
+
+void test_realloc() {
+    TESTNAME(__FUNCTION__);
+
+    struct arena a = { NULL, NULL };
+    int *values = arena_alloc(&a, 4 * sizeof *values);
+    for (int i=0; i < 4; i++) {
+        values[i] = i;
+    }
+
+    // the last allocation grows in place
+    int *grown = arena_realloc(&a, values, 4 * sizeof *values, 64 * sizeof *values);
+    assertf(grown == values, "last allocation was moved");
+
+    // anything else is copied
+    arena_alloc(&a, 16);
+    int *moved = arena_realloc(&a, grown, 64 * sizeof *values, 128 * sizeof *values);
+    assertf(moved != grown, "allocation was grown over another one");
+    for (int i=0; i < 4; i++) {
+        assertf(moved[i] == i, "wrong value at %d: expected %d, got %d", i, i, moved[i]);
+    }
+
+    // growing past the end of the block
+    int *huge = arena_realloc(&a, moved, 128 * sizeof *values, ARENA_BLOCK_SIZE * 2);
+    for (int i=0; i < 4; i++) {
+        assertf(huge[i] == i, "wrong value at %d: expected %d, got %d", i, i, huge[i]);
+    }
+
+    arena_free(&a);
+}
+
+int main() {
+    test_alloc();
+    test_realloc();
+    printf("\x1b[32mAll arena tests passed!\033[0m\n");
+}
@@ -0,0 +1,159 @@
+#define _DEFAULT_SOURCE
+#include <unistd.h>
+#include <stdint.h>
+#include "test_helpers.h"
+#include "bytecode.h"
+#include "compiler.h"
+#include "verifier.h"
+#include "vm.h"
+
+// compiles the given program and returns its bytecode file in a malloc'd buffer
+uint8_t *compile_to_buffer(char *program_str, size_t *size) {
+    struct program *p = parse_program_str(program_str);
+    struct compiler *c = compiler_new();
+    int err = compile_program(c, p);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+    err = compile_function_stubs(c);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+
+    char *buf;
+    FILE *f = open_memstream(&buf, size);
+    struct bytecode *bc = get_bytecode(c);
+    err = bytecode_write(bc, f);
+    assertf(err == 0, "write error: %s", bytecode_error_str(err));
+    fclose(f);
+
+    free(bc);
+    compiler_free(c);
+    free_program(p);
+    return (uint8_t *) buf;
+}
+
+void test_round_trip() {
+    TESTNAME(__FUNCTION__);
+
+    struct {
+        char *input;
+        enum object_type type;
+        union object_value expected;
+    } tests[] = {
+        {"1 + 2", OBJ_INT, { .integer = 3 }},
+        {"let x = 2000000000; x + 1", OBJ_INT, { .integer = 2000000001 }},
+        {"-300000 * 7000", OBJ_INT, { .integer = -2100000000 }},
+        {"\"monkey\"", OBJ_STRING, { .string = "monkey" }},
+        {"let a = \"foo\"; let b = \"\"; a", OBJ_STRING, { .string = "foo" }},
+        {"let fib = fn(x) { if (x < 2) { return x; } fib(x - 1) + fib(x - 2) }; fib(15)", OBJ_INT, { .integer = 610 }},
+        {"let add = fn(a, b) { a + b }; let twice = fn(f, x) { f(x, x) }; twice(add, 21)", OBJ_INT, { .integer = 42 }},
+        {"let f = fn() { let g = fn() { \"inner\" }; g() }; f()", OBJ_STRING, { .string = "inner" }},
+        {"let unused = fn() { 1 }; true", OBJ_BOOL, { .boolean = true }},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        size_t size;
+        uint8_t *buf = compile_to_buffer(tests[t].input, &size);
+        char *path = write_temp_file(buf, size);
+        free(buf);
+
+        assertf(bytecode_is_file(path), "expected \"%s\" to be a bytecode file", path);
+        int err;
+        struct bytecode *bc = bytecode_map(path, &err);
+        unlink(path);
+        free(path);
+        assertf(bc != NULL, "map error: %s", bytecode_error_str(err));
+
+        struct vm *vm = vm_new(bc);
+        assertf(vm != NULL, "invalid bytecode: %s", verifier_error_str(verify_bytecode(bc)));
+        err = vm_run(vm);
+        assertf(err == 0, "vm error: %d", err);
+
+        struct object obj = vm_stack_last_popped(vm);
+        assertf(obj.type == tests[t].type, "%s: wrong type: expected %s, got %s", tests[t].input, object_type_to_str(tests[t].type), object_type_to_str(obj.type));
+        switch (obj.type) {
+            case OBJ_INT:
+                assertf(obj.value.integer == tests[t].expected.integer, "%s: expected %ld, got %ld", tests[t].input, tests[t].expected.integer, obj.value.integer);
+            break;
+            case OBJ_STRING:
+                assertf(strcmp(obj.value.string, tests[t].expected.string) == 0, "%s: expected %s, got %s", tests[t].input, tests[t].expected.string, obj.value.string);
+            break;
+            default:
+                assertf(obj.value.boolean == tests[t].expected.boolean, "%s: wrong boolean", tests[t].input);
+            break;
+        }
+
+        vm_free(vm);
+        bytecode_unmap(bc);
+    }
+}
+
+void test_functions_must_be_compiled() {
+    TESTNAME(__FUNCTION__);
+
+    struct program *p = parse_program_str("let f = fn(x) { x * 2 }; 1");
+    struct compiler *c = compiler_new();
+    int err = compile_program(c, p);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+
+    char *buf;
+    size_t size;
+    FILE *f = open_memstream(&buf, &size);
+    struct bytecode *bc = get_bytecode(c);
+    err = bytecode_write(bc, f);
+    assertf(err == BYTECODE_ERR_UNSUPPORTED_CONSTANT, "wrong error: expected \"%s\", got \"%s\"", bytecode_error_str(BYTECODE_ERR_UNSUPPORTED_CONSTANT), bytecode_error_str(err));
+    fclose(f);
+
+    free(buf);
+    free(bc);
+    compiler_free(c);
+    free_program(p);
+}
+
+void test_invalid_files() {
+    TESTNAME(__FUNCTION__);
+
+    size_t size;
+    uint8_t *valid = compile_to_buffer("let f = fn(x) { x * 2 }; f(\"a\"); f(21)", &size);
+
+    struct corrupt_file_test tests[] = {
+        {"bad magic", 0, 'X', BYTECODE_ERR_BAD_MAGIC},
+        {"wrong version", 7, BYTECODE_VERSION + 1, BYTECODE_ERR_VERSION},
+        {"truncated header", 20, -1, BYTECODE_ERR_CORRUPT},
+        {"truncated file", size - 1, -1, BYTECODE_ERR_CORRUPT},
+        {"constants out of range", 16, 0x7f, BYTECODE_ERR_CORRUPT},
+        {"code out of range", 36, 0x7f, BYTECODE_ERR_CORRUPT},
+        {"main out of range", 28, 0x7f, BYTECODE_ERR_CORRUPT},
+        {"unterminated strings", size - 1, 'a', BYTECODE_ERR_CORRUPT},
+        {"unknown constant type", 48 + 3, 0x7f, BYTECODE_ERR_CORRUPT},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        char *path = write_corrupt_file(valid, size, &tests[t]);
+        int err = 0;
+        struct bytecode *bc = bytecode_map(path, &err);
+        unlink(path);
+        free(path);
+        assertf(bc == NULL, "%s: expected an error", tests[t].name);
+        assertf(err == tests[t].expected_err, "%s: wrong error: expected \"%s\", got \"%s\"", tests[t].name, bytecode_error_str(tests[t].expected_err), bytecode_error_str(err));
+    }
+
+    // files that are well-formed but contain invalid code are caught by the verifier
+    valid[read_uint32(valid + 32)] = OPCODE_COUNT;
+    char *path = write_temp_file(valid, size);
+    int err;
+    struct bytecode *bc = bytecode_map(path, &err);
+    unlink(path);
+    free(path);
+    assertf(bc != NULL, "map error: %s", bytecode_error_str(err));
+    assertf(vm_new(bc) == NULL, "expected invalid bytecode to be rejected");
+    bytecode_unmap(bc);
+
+    int err_missing;
+    assertf(bytecode_map("/tmp/monkey_bytecode_does_not_exist", &err_missing) == NULL && err_missing == BYTECODE_ERR_IO, "expected an IO error");
+    free(valid);
+}
+
+int main() {
+    test_round_trip();
+    test_functions_must_be_compiled();
+    test_invalid_files();
+    printf("\x1b[32mAll bytecode tests passed!\033[0m\n");
+}
@@ -16,7 +16,6 @@ void test_object(struct object *expected, struct object *actual) {
     switch (expected->type) {
         case OBJ_INT:
             assertf(actual->value.integer == expected->value.integer, "invalid integer value: expected %d, got %d", expected->value.integer, actual->value.integer);
-            free(actual);
             free(expected);
         break;
         case OBJ_BOOL:
@@ -32,15 +31,11 @@ void test_object(struct object *expected, struct object *actual) {
             free(expected_str);
             free(actual_str);
             free(expected->value.compiled_function.instructions.bytes);
-            free(actual->value.compiled_function.instructions.bytes);
-            free(actual);
             free(expected);
         }
         break;
         case OBJ_STRING: 
             assertf(strcmp(expected->value.string, actual->value.string) == 0, "invalid string value: expected %s, got %s", expected->value.string, actual->value.string);
-            free(actual->value.string);
-            free(actual);
             free(expected->value.string);
             free(expected);
         break;
@@ -56,6 +51,11 @@ void run_compiler_test(struct compiler_test_case t) {
     int err = compile_program(compiler, program);
     assertf(err == 0, "compiler error: %s", compiler_error_str(err));
     struct bytecode *bytecode = get_bytecode(compiler);
+
+    // function bodies are only compiled once they are called, so compile them all to compare them
+    err = compile_function_stubs(compiler);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+
     struct instruction *concatted = flatten_instructions_array(t.instructions, t.instructions_size);
 
     char *concatted_str = instruction_to_str(concatted);
@@ -92,14 +92,11 @@ void test_integer_arithmetic() {
     struct compiler_test_case tests[] = {
         {
             .input = "1 + 2",
-            .constants = {
-                make_integer_object(1), 
-                make_integer_object(2),
-            },
-            .constants_size = 2,
+            .constants = {},
+            .constants_size = 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_SMALL_INT, 1),
+                make_instruction(OPCODE_SMALL_INT, 2),
                 make_instruction(OPCODE_ADD),
                 make_instruction(OPCODE_POP),
             },
@@ -107,14 +104,11 @@ void test_integer_arithmetic() {
         },
         {
             .input = "1 - 2",
-            .constants = {
-                make_integer_object(1), 
-                make_integer_object(2),
-            },
-            .constants_size = 2,
+            .constants = {},
+            .constants_size = 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_SMALL_INT, 1),
+                make_instruction(OPCODE_SMALL_INT, 2),
                 make_instruction(OPCODE_SUBTRACT),
                 make_instruction(OPCODE_POP),
             },
@@ -122,14 +116,11 @@ void test_integer_arithmetic() {
         },
         {
             .input = "1 * 2",
-            .constants = {
-                make_integer_object(1), 
-                make_integer_object(2),
-            },
-            .constants_size = 2,
+            .constants = {},
+            .constants_size = 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_SMALL_INT, 1),
+                make_instruction(OPCODE_SMALL_INT, 2),
                 make_instruction(OPCODE_MULTIPLY),
                 make_instruction(OPCODE_POP),
             },
@@ -137,14 +128,11 @@ void test_integer_arithmetic() {
         },
         {
             .input = "2 / 1",
-            .constants = {
-                make_integer_object(2), 
-                make_integer_object(1),
-            },
-            .constants_size = 2,
+            .constants = {},
+            .constants_size = 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_SMALL_INT, 2),
+                make_instruction(OPCODE_SMALL_INT, 1),
                 make_instruction(OPCODE_DIVIDE),
                 make_instruction(OPCODE_POP),
             },
@@ -152,14 +140,11 @@ void test_integer_arithmetic() {
         },
         {
             .input = "2 / 1",
-            .constants = {
-                make_integer_object(2), 
-                make_integer_object(1),
-            },
-            .constants_size = 2,
+            .constants = {},
+            .constants_size = 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_SMALL_INT, 2),
+                make_instruction(OPCODE_SMALL_INT, 1),
                 make_instruction(OPCODE_DIVIDE),
                 make_instruction(OPCODE_POP),
             },
@@ -167,14 +152,24 @@ void test_integer_arithmetic() {
         },
         {
             .input = "-1",
+            .constants = {}, 0,
+            .instructions = {
+                make_instruction(OPCODE_SMALL_INT, 1),
+                make_instruction(OPCODE_MINUS),
+                make_instruction(OPCODE_POP),
+            }, 3,
+        },
+        {
+            .input = "255 + 256",
             .constants = {
-                make_integer_object(1), 
+                make_integer_object(256),
             }, 1,
             .instructions = {
+                make_instruction(OPCODE_SMALL_INT, 255),
                 make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_MINUS),
+                make_instruction(OPCODE_ADD),
                 make_instruction(OPCODE_POP),
-            }, 3,
+            }, 4,
         },
     };
 
@@ -206,52 +201,40 @@ void test_boolean_expressions() {
         },
         {
             "1 > 2", 
+            {}, 0,
             {
-                make_integer_object(1),
-                make_integer_object(2),
-            }, 2,
-            {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_SMALL_INT, 1),
+                make_instruction(OPCODE_SMALL_INT, 2),
                 make_instruction(OPCODE_GREATER_THAN),
                 make_instruction(OPCODE_POP),
             }, 4
         },
         {
             "1 < 2", 
+            {}, 0,
             {
-                make_integer_object(1),
-                make_integer_object(2),
-            }, 2,
-            {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_SMALL_INT, 1),
+                make_instruction(OPCODE_SMALL_INT, 2),
                 make_instruction(OPCODE_LESS_THAN),
                 make_instruction(OPCODE_POP),
             }, 4
         },
         {
             "1 == 2", 
+            {}, 0,
             {
-                make_integer_object(1),
-                make_integer_object(2),
-            }, 2,
-            {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_SMALL_INT, 1),
+                make_instruction(OPCODE_SMALL_INT, 2),
                 make_instruction(OPCODE_EQUAL),
                 make_instruction(OPCODE_POP),
             }, 4
         },
         {
             "1 != 2", 
+            {}, 0,
             {
-                make_integer_object(1),
-                make_integer_object(2),
-            }, 2,
-            {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_SMALL_INT, 1),
+                make_instruction(OPCODE_SMALL_INT, 2),
                 make_instruction(OPCODE_NOT_EQUAL),
                 make_instruction(OPCODE_POP),
             }, 4
@@ -297,36 +280,33 @@ void test_conditionals() {
         {
             .input = "if (true) { 10; } 3333;",
             .constants = {
-                make_integer_object(10),
                 make_integer_object(3333),
-            }, 2,
+            }, 1,
             .instructions = {
                 make_instruction(OPCODE_TRUE),              // 0000
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 10),  // 0001
-                make_instruction(OPCODE_CONST, 0),          // 0004
-                make_instruction(OPCODE_JUMP, 11),          // 0007
-                make_instruction(OPCODE_NULL),              // 0010
+                make_instruction(OPCODE_JUMP_NOT_TRUE_SHORT, 4), // 0001
+                make_instruction(OPCODE_SMALL_INT, 10),     // 0003
+                make_instruction(OPCODE_JUMP_SHORT, 1),     // 0005
+                make_instruction(OPCODE_NULL),              // 0007
+                make_instruction(OPCODE_POP),               // 0008
+                make_instruction(OPCODE_CONST, 0),          // 0009
                 make_instruction(OPCODE_POP),               // 0011
-                make_instruction(OPCODE_CONST, 1),          // 0012
-                make_instruction(OPCODE_POP),               // 0015
             }, 8
         },
         {
             .input = "if (true) { 10; } else { 20; }; 3333;",
             .constants = {
-                make_integer_object(10),
-                make_integer_object(20),
                 make_integer_object(3333),
-            }, 3,
+            }, 1,
             .instructions = {
                 make_instruction(OPCODE_TRUE),              // 0000
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 10), // 0001
-                make_instruction(OPCODE_CONST, 0),          // 0004
-                make_instruction(OPCODE_JUMP, 13),          // 0007
-                make_instruction(OPCODE_CONST, 1),          // 0010
-                make_instruction(OPCODE_POP),               // 0013
-                make_instruction(OPCODE_CONST, 2),          // 0014
-                make_instruction(OPCODE_POP),               // 0017
+                make_instruction(OPCODE_JUMP_NOT_TRUE_SHORT, 4), // 0001
+                make_instruction(OPCODE_SMALL_INT, 10),     // 0003
+                make_instruction(OPCODE_JUMP_SHORT, 2),     // 0005
+                make_instruction(OPCODE_SMALL_INT, 20),     // 0007
+                make_instruction(OPCODE_POP),               // 0009
+                make_instruction(OPCODE_CONST, 0),          // 0010
+                make_instruction(OPCODE_POP),               // 0012
             }, 8
         },
     };
@@ -339,24 +319,19 @@ void test_global_let_statements() {
     struct compiler_test_case tests[] = {
         {
             .input = "let one = 1; let two = 2;",
-            .constants = {
-                make_integer_object(1),
-                make_integer_object(2),
-            }, 2,
+            .constants = {}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_SMALL_INT, 1),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_SMALL_INT, 2),
                 make_instruction(OPCODE_SET_GLOBAL, 1),
             }, 4,
         },
         {
             .input = "let one = 1; one;",
-            .constants = {
-                make_integer_object(1),
-            }, 1,
+            .constants = {}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_SMALL_INT, 1),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
                 make_instruction(OPCODE_GET_GLOBAL, 0),
                 make_instruction(OPCODE_POP),
@@ -364,11 +339,9 @@ void test_global_let_statements() {
         },
         {
             .input = "let one = 1; let two = one; two;",
-            .constants = {
-                make_integer_object(1),
-            }, 1,
+            .constants = {}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_SMALL_INT, 1),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
                 make_instruction(OPCODE_GET_GLOBAL, 0),
                 make_instruction(OPCODE_SET_GLOBAL, 1),
@@ -386,20 +359,18 @@ void test_functions() {
 
     {
         struct instruction *fn_body[] = {
-            make_instruction(OPCODE_CONST, 0),
-            make_instruction(OPCODE_CONST, 1),
+            make_instruction(OPCODE_SMALL_INT, 5),
+            make_instruction(OPCODE_SMALL_INT, 10),
             make_instruction(OPCODE_ADD),
             make_instruction(OPCODE_RETURN_VALUE),
         };
         struct compiler_test_case t = {
             .input = "fn() { return 5 + 10 }",
             .constants = {
-                make_integer_object(5),
-                make_integer_object(10),
                 make_compiled_function_object(flatten_instructions_array(fn_body, 4), 0),
-            }, 3,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 2),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_POP),
             }, 2,
         };
@@ -407,20 +378,18 @@ void test_functions() {
    }
    {
         struct instruction *fn_body[] = {
-            make_instruction(OPCODE_CONST, 0),
-            make_instruction(OPCODE_CONST, 1),
+            make_instruction(OPCODE_SMALL_INT, 5),
+            make_instruction(OPCODE_SMALL_INT, 10),
             make_instruction(OPCODE_ADD),
             make_instruction(OPCODE_RETURN_VALUE),
         };
         struct compiler_test_case t = {
             .input = "fn() { 5 + 10 }",
             .constants = {
-                make_integer_object(5),
-                make_integer_object(10),
                 make_compiled_function_object(flatten_instructions_array(fn_body, 4), 0),
-            }, 3,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 2),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_POP),
             }, 2,
         };
@@ -428,20 +397,18 @@ void test_functions() {
     }
     {
         struct instruction *fn_body[] = {
-            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_SMALL_INT, 1),
             make_instruction(OPCODE_POP),
-            make_instruction(OPCODE_CONST, 1),
+            make_instruction(OPCODE_SMALL_INT, 2),
             make_instruction(OPCODE_RETURN_VALUE),
         };
         struct compiler_test_case t = {
             .input = "fn() { 1; 2 }",
             .constants = {
-                make_integer_object(1),
-                make_integer_object(2),
                 make_compiled_function_object(flatten_instructions_array(fn_body, 4), 0),
-            }, 3,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 2),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_POP),
             }, 2,
         };
@@ -493,18 +460,17 @@ void test_function_calls() {
 
     {
         struct instruction *fn_body[] = {
-            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_SMALL_INT, 24),
             make_instruction(OPCODE_RETURN_VALUE),
         };
         struct compiler_test_case t = {
             .input = "fn() { 24 }();",
             .constants = {
-                make_integer_object(24),
                 make_compiled_function_object(flatten_instructions_array(fn_body, 2), 0),
-            }, 2,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_CALL, 0),
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_CALL, 0, 0),
                 make_instruction(OPCODE_POP),
             }, 3,
         };
@@ -512,22 +478,20 @@ void test_function_calls() {
    }
    {
         struct instruction *fn_body[] = {
-            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_SMALL_INT, 24),
             make_instruction(OPCODE_RETURN_VALUE),
         };
         struct compiler_test_case t = {
             .input = "let noArg = fn() { 24 }; noArg();",
             .constants = {
-                make_integer_object(24),
                 make_compiled_function_object(flatten_instructions_array(fn_body, 2), 0),
-            }, 2,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
-                make_instruction(OPCODE_GET_GLOBAL, 0),
-                make_instruction(OPCODE_CALL, 0),
+                make_instruction(OPCODE_SMALL_INT, 24),
                 make_instruction(OPCODE_POP),
-            }, 5,
+            }, 4,
         };
         run_compiler_test(t);
    }
@@ -537,19 +501,19 @@ void test_function_calls() {
             make_instruction(OPCODE_RETURN_VALUE),
         };
         struct compiler_test_case t = {
-            .input = "let oneArg = fn(a) { a; }; oneArg(24);",
+            .input = "let oneArg = fn(a) { a; }; let x = 24; oneArg(x);",
             .constants = {
                 make_compiled_function_object(flatten_instructions_array(fn_body, 2), 0),
-                make_integer_object(24),
-            }, 2,
+            }, 1,
             .instructions = {
                 make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
-                make_instruction(OPCODE_GET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_CALL, 1),
+                make_instruction(OPCODE_SMALL_INT, 24),
+                make_instruction(OPCODE_SET_GLOBAL, 1),
+                make_instruction(OPCODE_GET_GLOBAL, 1),
+                make_instruction(OPCODE_CALL_CONST, 0, 1),
                 make_instruction(OPCODE_POP),
-            }, 6,
+            }, 7,
         };
         run_compiler_test(t);
    }
@@ -564,28 +528,137 @@ void test_function_calls() {
         };
         int fn_size = 6;
         struct compiler_test_case t = {
-            .input = "let manyArg = fn(a, b, c) { a; b; c; }; manyArg(24, 25, 26);",
+            .input = "let manyArg = fn(a, b, c) { a; b; c; }; let x = 25; manyArg(24, x, 26);",
             .constants = {
                 make_compiled_function_object(flatten_instructions_array(fn_body, fn_size), 0),
-                make_integer_object(24),
-                make_integer_object(25),
-                make_integer_object(26),
-            }, 4,
+            }, 1,
             .instructions = {
                 make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
-                make_instruction(OPCODE_GET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_CONST, 2),
-                make_instruction(OPCODE_CONST, 3),
-                make_instruction(OPCODE_CALL, 3),
+                make_instruction(OPCODE_SMALL_INT, 25),
+                make_instruction(OPCODE_SET_GLOBAL, 1),
+                make_instruction(OPCODE_SMALL_INT, 24),
+                make_instruction(OPCODE_GET_GLOBAL, 1),
+                make_instruction(OPCODE_SMALL_INT, 26),
+                make_instruction(OPCODE_CALL_CONST, 0, 3),
                 make_instruction(OPCODE_POP),
-            }, 8,
+            }, 9,
+        };
+        run_compiler_test(t);
+   }
+   {
+        // every call site gets its own inline cache slot
+        struct instruction *fn_body[] = {
+            make_instruction(OPCODE_GET_LOCAL, 0),
+            make_instruction(OPCODE_CALL, 0, 0),
+            make_instruction(OPCODE_GET_LOCAL, 0),
+            make_instruction(OPCODE_CALL, 0, 1),
+            make_instruction(OPCODE_ADD),
+            make_instruction(OPCODE_RETURN_VALUE),
+        };
+        struct compiler_test_case t = {
+            .input = "fn(f) { f() + f() }",
+            .constants = {
+                make_compiled_function_object(flatten_instructions_array(fn_body, 6), 0),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+            }, 2,
         };
         run_compiler_test(t);
    }
 }
 
+void test_constant_function_calls() {
+    TESTNAME(__FUNCTION__);
+
+    {
+        struct instruction *fn_body[] = {
+            make_instruction(OPCODE_GET_LOCAL, 0),
+            make_instruction(OPCODE_GET_LOCAL, 1),
+            make_instruction(OPCODE_MULTIPLY),
+            make_instruction(OPCODE_RETURN_VALUE),
+        };
+        struct compiler_test_case t = {
+            .input = "let mul = fn(a, b) { a * b }; mul(6, -7);",
+            .constants = {
+                make_compiled_function_object(flatten_instructions_array(fn_body, 4), 0),
+                make_integer_object(-42),
+            }, 2,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_POP),
+            }, 4,
+        };
+        run_compiler_test(t);
+    }
+    {
+        struct instruction *fn_body[] = {
+            make_instruction(OPCODE_GET_LOCAL, 0),
+            make_instruction(OPCODE_SMALL_INT, 10),
+            make_instruction(OPCODE_GREATER_THAN),
+            make_instruction(OPCODE_RETURN_VALUE),
+        };
+        struct compiler_test_case t = {
+            .input = "let big = fn(a) { a > 10 }; big(5 * 3);",
+            .constants = {
+                make_compiled_function_object(flatten_instructions_array(fn_body, 4), 0),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_TRUE),
+                make_instruction(OPCODE_POP),
+            }, 4,
+        };
+        run_compiler_test(t);
+    }
+    {
+        // reads a global that is not a function, so the call is left to the VM
+        struct instruction *fn_body[] = {
+            make_instruction(OPCODE_GET_GLOBAL, 0),
+            make_instruction(OPCODE_RETURN_VALUE),
+        };
+        struct compiler_test_case t = {
+            .input = "let seed = 1; let impure = fn() { seed }; impure();",
+            .constants = {
+                make_compiled_function_object(flatten_instructions_array(fn_body, 2), 0),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_SMALL_INT, 1),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_SET_GLOBAL, 1),
+                make_instruction(OPCODE_CALL_CONST, 0, 0),
+                make_instruction(OPCODE_POP),
+            }, 6,
+        };
+        run_compiler_test(t);
+    }
+    {
+        // a call that could not be folded is not tried again at the next call site
+        struct program *program = parse_program_str("let fibonacci = fn(x) { if (x < 2) { return x; } fibonacci(x-1) + fibonacci(x-2) }; fibonacci(25); fibonacci(2);");
+        struct compiler *compiler = compiler_new();
+        int err = compile_program(compiler, program);
+        assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+        assertf(compiler_function_unfoldable(compiler, 0), "expected fibonacci to be remembered as unfoldable");
+        unsigned int calls = 0;
+        struct instruction *ins = compiler->scopes[0].instructions;
+        for (unsigned int ip = 0; ip < ins->size;) {
+            enum opcode opcode;
+            int operands[MAX_OP_SIZE];
+            ip += read_instruction(ins->bytes + ip, &opcode, operands);
+            calls += opcode == OPCODE_CALL || opcode == OPCODE_CALL_CONST;
+        }
+        assertf(calls == 2, "expected both calls to be left to the VM, got %d calls", calls);
+        free_program(program);
+        compiler_free(compiler);
+    }
+}
+
 void test_let_statement_scopes() {
     TESTNAME(__FUNCTION__);
 
@@ -594,33 +667,103 @@ void test_let_statement_scopes() {
 
 void test_recursive_functions() {
     struct instruction *fn_body[] = {
-        make_instruction(OPCODE_GET_GLOBAL, 0),
         make_instruction(OPCODE_GET_LOCAL, 0),
-        make_instruction(OPCODE_CONST, 0),
+        make_instruction(OPCODE_SMALL_INT, 1),
         make_instruction(OPCODE_SUBTRACT),
-        make_instruction(OPCODE_CALL, 1),
+        make_instruction(OPCODE_CALL_CONST, 0, 1),
         make_instruction(OPCODE_RETURN_VALUE),
     };
-    int fn_size = 6;
+    int fn_size = 5;
     struct compiler_test_case t = {
         .input = "let countdown = fn(x) { return countdown(x-1); }; countdown(1);",
         .constants = {
-            make_integer_object(1),
             make_compiled_function_object(flatten_instructions_array(fn_body, fn_size), 0),
-            make_integer_object(1),
-        }, 3,
+        }, 1,
         .instructions = {   
-            make_instruction(OPCODE_CONST, 1),
+            make_instruction(OPCODE_CONST, 0),
             make_instruction(OPCODE_SET_GLOBAL, 0),
-            make_instruction(OPCODE_GET_GLOBAL, 0),
-            make_instruction(OPCODE_CONST, 2),
-            make_instruction(OPCODE_CALL, 1),
+            make_instruction(OPCODE_SMALL_INT, 1),
+            make_instruction(OPCODE_CALL_CONST, 0, 1),
             make_instruction(OPCODE_POP),
-        }, 6,
+        }, 5,
     };
     run_compiler_test(t);
 }
 
+void test_constant_deduplication() {
+    TESTNAME(__FUNCTION__);
+
+    struct compiler_test_case tests[] = {
+        {
+            .input = "1000 + 1000 - 1000",
+            .constants = {
+                make_integer_object(1000),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_ADD),
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_SUBTRACT),
+                make_instruction(OPCODE_POP),
+            }, 6,
+        },
+        {
+            .input = "\"mon\" + \"key\" + \"mon\"",
+            .constants = {
+               make_string_object("mon", NULL),
+               make_string_object("key", NULL),
+            }, 2,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_ADD),
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_ADD),
+                make_instruction(OPCODE_POP),
+            }, 6,
+        },
+    };
+
+    run_compiler_tests(tests, ARRAY_SIZE(tests));
+}
+
+void test_lazy_functions() {
+    TESTNAME(__FUNCTION__);
+    struct program *program = parse_program_str("let f = fn(a) { a + 300 }; let g = fn(b) { h(b) }; let h = fn(c) { c };");
+    struct compiler *compiler = compiler_new();
+    int err = compile_program(compiler, program);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+    assertf(compiler->constants->size == 3, "wrong constants size: expected %d, got %d", 3, compiler->constants->size);
+    for (int i=0; i < 3; i++) {
+        struct compiled_function *fn = &compiler->constants->values[i]->value.compiled_function;
+        assertf(is_function_stub(fn) && compiler_function_stub(compiler, i) != NULL, "function %d was compiled before it was called", i);
+        assertf(fn->constant == i, "wrong constant index for stub: expected %d, got %d", i, fn->constant);
+    }
+    assertf(compiler->constants->values[0]->value.compiled_function.num_parameters == 1, "wrong number of parameters for stub");
+
+    err = compile_function_stub(compiler, 0);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+    assertf(!is_function_stub(&compiler->constants->values[0]->value.compiled_function) && compiler_function_stub(compiler, 0) == NULL, "function was not compiled");
+    assertf(compiler_function_stub(compiler, 1) != NULL, "uncalled function was compiled");
+    assertf(compiler->constants->size == 4, "wrong constants size: expected %d, got %d", 4, compiler->constants->size);
+    test_object(make_integer_object(300), compiler->constants->values[3]);
+
+    // g calls h, which was defined after it but before g was compiled, through the global as it was not bound at g's literal
+    struct instruction *g_body[] = {
+        make_instruction(OPCODE_GET_GLOBAL, 2),
+        make_instruction(OPCODE_GET_LOCAL, 0),
+        make_instruction(OPCODE_CALL, 1, 0),
+        make_instruction(OPCODE_RETURN_VALUE),
+    };
+    err = compile_function_stub(compiler, 1);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+    test_object(make_compiled_function_object(flatten_instructions_array(g_body, 4), 1), compiler->constants->values[1]);
+
+    free_program(program);
+    compiler_free(compiler);
+}
+
 void test_string_expressions() {
     TESTNAME(__FUNCTION__);
 
@@ -653,6 +796,108 @@ void test_string_expressions() {
     run_compiler_tests(tests, ARRAY_SIZE(tests));
 }
 
+void assert_same_instructions(struct instruction *expected, struct instruction *actual, char *input) {
+    char *expected_str = instruction_to_str(expected);
+    char *actual_str = instruction_to_str(actual);
+    assertf(expected->size == actual->size && memcmp(expected->bytes, actual->bytes, expected->size) == 0, "different instructions for %s\nexpected:\n%s\ngot:\n%s", input, expected_str, actual_str);
+    free(expected_str);
+    free(actual_str);
+}
+
+void test_single_pass() {
+    TESTNAME(__FUNCTION__);
+
+    // both front ends emit the same code, as long as folding does not compile (and number the call sites of) functions early
+    char *tests[] = {
+        "1 + 2 * 3; -(4 - 5) / 6",
+        "!true == false; 1 < 2; 3 > 4; 5 != 6",
+        "if (1 < 2) { 10 } else { 20 }; if (false) { 1 }; 3",
+        "let a = 1; let b = \"mon\" + \"key\"; let c = a; \"mon\"",
+        "let n = 1; let f = fn(a, b) { let c = a + b; if (c > 10) { return c; } c * 2 }; f(n, 2); f(f(n, 3), n)",
+        "let n = 1; let apply = fn(g, x) { g(x) }; let inc = fn(x) { x + 1 }; (fn() { 2 })(); inc(n)",
+        "let even = fn(x) { if (x == 0) { return true; } odd(x - 1) }; let odd = fn(x) { if (x == 0) { return false; } even(x - 1) }; let n = 3; odd(n)",
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        struct program *program = parse_program_str(tests[t]);
+        struct compiler *expected = compiler_new();
+        int err = compile_program(expected, program);
+        assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+        err = compile_function_stubs(expected);
+        assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+
+        struct lexer lexer = new_lexer(tests[t]);
+        struct parser parser = new_parser(&lexer);
+        struct compiler *actual = compiler_new();
+        struct program *single_pass = compile_single_pass(actual, &parser, &err);
+        assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+        err = compile_function_stubs(actual);
+        assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+
+        assert_same_instructions(expected->scopes[0].instructions, actual->scopes[0].instructions, tests[t]);
+        assertf(expected->constants->size == actual->constants->size, "wrong constants size for %s: expected %d, got %d", tests[t], expected->constants->size, actual->constants->size);
+        for (int i=0; i < expected->constants->size; i++) {
+            struct object *e = expected->constants->values[i];
+            struct object *a = actual->constants->values[i];
+            assertf(e->type == a->type, "wrong type of constant %d for %s", i, tests[t]);
+            if (e->type == OBJ_COMPILED_FUNCTION) {
+                assert_same_instructions(&e->value.compiled_function.instructions, &a->value.compiled_function.instructions, tests[t]);
+            }
+        }
+
+        // only function literals end up in the AST
+        for (uint32_t i=1; i < single_pass->ast.size; i++) {
+            uint8_t type = single_pass->ast.nodes[i].type;
+            assertf(type == EXPR_FUNCTION || i == single_pass->statements, "node %d of %s is not a function literal: %d", i, tests[t], type);
+        }
+
+        compiler_free(expected);
+        compiler_free(actual);
+        free_program(program);
+        free_program(single_pass);
+    }
+
+    // errors
+    struct {
+        char *input;
+        int expected_err;
+    } errors[] = {
+        {"let a = ;", COMPILE_ERR_SYNTAX},
+        {"1 + (2", COMPILE_ERR_SYNTAX},
+        {"fn() { (1 + 2 }", COMPILE_ERR_SYNTAX},
+        {"let f = fn() { let = 1; }; 5;", COMPILE_ERR_SYNTAX},
+        {"missing + 1", COMPILE_ERR_UNKNOWN_IDENTIFIER},
+        {"let f = fn() { missing }; 5;", COMPILE_ERR_UNKNOWN_IDENTIFIER},
+        {"[1, 2]", COMPILE_ERR_UNKNOWN_EXPR_TYPE},
+    };
+    for (int t=0; t < ARRAY_SIZE(errors); t++) {
+        struct lexer lexer = new_lexer(errors[t].input);
+        struct parser parser = new_parser(&lexer);
+        struct compiler *c = compiler_new();
+        int err;
+        struct program *program = compile_single_pass(c, &parser, &err);
+        assertf(err == errors[t].expected_err, "wrong error for %s: expected %s, got %s", errors[t].input, compiler_error_str(errors[t].expected_err), compiler_error_str(err));
+        assertf((err == COMPILE_ERR_SYNTAX) == (parser.errors > 0), "parser errors do not match for %s", errors[t].input);
+        compiler_free(c);
+        free_program(program);
+    }
+
+    // function bodies are checked for syntax errors and unknown names up front, but only fail to compile once they are compiled
+    struct lexer lexer = new_lexer("let f = fn() { [1, 2] }; let g = fn() { f() };");
+    struct parser parser = new_parser(&lexer);
+    struct compiler *c = compiler_new();
+    int err;
+    struct program *program = compile_single_pass(c, &parser, &err);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+    err = compile_function_stub(c, 1);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+    err = compile_function_stub(c, 0);
+    assertf(err == COMPILE_ERR_UNKNOWN_EXPR_TYPE, "expected unknown expression type error, got %s", compiler_error_str(err));
+    assertf(c->scope_index == 0, "scopes were not left after error");
+    compiler_free(c);
+    free_program(program);
+}
+
 int main() {
     test_integer_arithmetic();
     test_boolean_expressions();
@@ -661,8 +906,12 @@ int main() {
     test_compiler_scopes();
     test_functions();
     test_function_calls();
+    test_constant_function_calls();
     test_let_statement_scopes();
     test_recursive_functions();
+    test_constant_deduplication();
+    test_lazy_functions();
     test_string_expressions();
+    test_single_pass();
     printf("\x1b[32mAll compiler tests passed!\033[0m\n");
 }
\ No newline at end of file
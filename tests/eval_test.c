@@ -3,6 +3,7 @@
 #include <stdbool.h>
 
 #include "eval.h"
+#include "resolver.h"
 #include "test_helpers.h"
 
 // declared here so we can free it from other tests
@@ -12,23 +13,50 @@ void test_environment() {
     struct environment *env = make_environment();
 
     // set
-    struct object o1 = {.value = { .integer = 1} };
-    struct object o2 = {.value = { .integer = 2} };
+    struct object o1 = {.type = OBJ_INT, .value = { .integer = 1} };
+    struct object o2 = {.type = OBJ_INT, .value = { .integer = 2} };
 
-    environment_set(env, "foo", &o1);
-    environment_set(env, "bar", &o2);
+    symbol_table_define(env->scope, "foo");
+    symbol_table_define(env->scope, "bar");
+    environment_set(env, 0, "foo", &o1);
+    environment_set(env, 1, "bar", &o2);
     
     // get
-    struct object *r1 = environment_get(env, "foo");
+    struct object *r1 = environment_get(env, 0, 0, "foo");
     assertf(r1->value.integer == o1.value.integer, "expected %d, got %d", o1.value.integer, r1->value.integer);
-    struct object *r2 = environment_get(env, "bar");
+    struct object *r2 = environment_get(env, 0, 1, "bar");
+    assertf(r2->value.integer == o2.value.integer, "expected %d, got %d", o2.value.integer, r2->value.integer);
+
+    // from an enclosed environment
+    struct symbol_table *scope = symbol_table_new_enclosed(env->scope);
+    symbol_table_define(scope, "foo");
+    symbol_table_define(scope, "baz");
+    struct environment *closed = make_closed_environment(env, scope);
+    assertf(closed->size == 2, "expected 2 slots, got %d", closed->size);
+    assertf(environment_get(closed, 0, 1, "baz") == NULL, "expected NULL for a slot that was not set, got something");
+
+    // a slot of an enclosing function that was not set yet falls through to the same name further out
+    struct symbol_table *inner_scope = symbol_table_new_enclosed(scope);
+    struct environment *inner = make_closed_environment(closed, inner_scope);
+    assertf(environment_get(closed, 0, 0, "foo") == NULL, "expected NULL for a slot of the current function that was not set, got something");
+    r1 = environment_get(inner, 1, 0, "foo");
+    assertf(r1 != NULL && r1->value.integer == o1.value.integer, "expected the outer foo to be %d", o1.value.integer);
+    environment_set(closed, 0, "foo", &o2);
+    r1 = environment_get(inner, 1, 0, "foo");
+    assertf(r1->value.integer == o2.value.integer, "expected %d, got %d", o2.value.integer, r1->value.integer);
+    r2 = environment_get(closed, 1, 1, "bar");
     assertf(r2->value.integer == o2.value.integer, "expected %d, got %d", o2.value.integer, r2->value.integer);
 
     // not existing
-    assertf(environment_get(env, "unexisting") == NULL, "expected NULL, got something");
+    assertf(environment_get(env, 0, 2, "unexisting") == NULL, "expected NULL, got something");
 
     // free env
-    free(env);
+    free_environment(inner);
+    free_environment(closed);
+    free_environment(env);
+    symbol_table_free(inner_scope);
+    symbol_table_free(scope);
+    free_env_pool();
 }
 
 struct object *test_eval(char *input, bool keep_prog)
@@ -349,16 +377,18 @@ void test_function_object() {
 
     assertf(!!obj, "expected object, got null pointers");
     assertf(obj->type == OBJ_FUNCTION, "wrong object type: expected OBJ_FUNCTION, got %s", object_type_to_str(obj->type));
-    assertf(obj->value.function.parameters->size == 1, "wrong parameter count: expected 1, got %d", obj->value.function.parameters->size);
+    struct ast *ast = obj->value.function.ast;
+    uint32_t parameters = ast_function_parameters(ast, obj->value.function.literal);
+    assertf(ast_list_size(ast, parameters) == 1, "wrong parameter count: expected 1, got %d", ast_list_size(ast, parameters));
 
     char tmp[64];
     tmp[0] = '\0';
-    identifier_list_to_str(tmp, obj->value.function.parameters);
+    parameters_to_str(tmp, ast, obj->value.function.literal);
     assertf(strcmp(tmp, "x") == 0, "parameter is not \"x\", got \"%s\"", tmp);
 
     tmp[0] = '\0';
     char *expected_body = "(x + 2)";
-    block_statement_to_str(tmp, obj->value.function.body);
+    node_to_str(tmp, ast, ast->nodes[obj->value.function.literal].rhs);
     assertf(strcmp(tmp, expected_body) == 0, "function body is not \"%s\", got \"%s\"", expected_body, tmp);
     
     free_program(program);
@@ -578,6 +608,118 @@ void test_while_expressions() {
     // TODO: Test out of bounds indexing
 }
 
+void test_resolver() {
+    char *input = "let a = 1;"
+        "let f = fn(x) { let b = x + a; let g = fn() { b + len(\"x\") }; g() };"
+        "let c = f(a); c";
+    struct lexer lexer = new_lexer(input);
+    struct parser parser = new_parser(&lexer);
+    struct program *program = parse_program(&parser);
+    struct environment *env = make_environment();
+    struct object *obj = eval_program(program, env);
+    test_integer_object(obj, 3);
+    free_object(obj);
+
+    // every identifier in the order of the source, function bodies are resolved as they were evaluated
+    struct {
+        char *name;
+        uint8_t operator;
+        uint32_t slot;
+    } expected[] = {
+        {"a", 1, 0},
+        {"f", 1, 1},
+        {"b", 1, 1},
+        {"x", 1, 0},
+        {"a", 2, 0},
+        {"g", 1, 2},
+        {"b", 2, 1},
+        {"len", RESOLVED_BUILTIN, 0},
+        {"g", 1, 2},
+        {"c", 1, 2},
+        {"f", 1, 1},
+        {"a", 1, 0},
+        {"c", 1, 2},
+    };
+    struct ast *ast = &program->ast;
+    uint32_t prev_pos = 0;
+    for (int i = 0; i < ARRAY_SIZE(expected); i++) {
+        uint32_t ident = AST_NONE;
+        for (uint32_t n = 1; n < ast->size; n++) {
+            if (ast->nodes[n].type == EXPR_IDENT && (i == 0 || ast->nodes[n].pos > prev_pos) && (ident == AST_NONE || ast->nodes[n].pos < ast->nodes[ident].pos)) {
+                ident = n;
+            }
+        }
+        assertf(ident != AST_NONE, "identifier %d (%s) not found", i, expected[i].name);
+        struct node n = ast->nodes[ident];
+        assertf(strcmp(ast_string(ast, n.lhs), expected[i].name) == 0, "identifier %d: expected %s, got %s", i, expected[i].name, ast_string(ast, n.lhs));
+        assertf(n.operator == expected[i].operator && n.rhs == expected[i].slot, "identifier %d (%s): expected %d/%d, got %d/%d", i, expected[i].name, expected[i].operator, expected[i].slot, n.operator, n.rhs);
+        prev_pos = n.pos;
+    }
+
+    // later programs evaluated in the same environment see the globals of earlier ones
+    struct {
+        char *input;
+        int expected;
+    } inputs[] = {
+        {"let x = 2; let double = fn(n) { n * x }; 0", 0},
+        {"double(21)", 42},
+        {"let x = 21; let y = double(1) + len(\"\"); y", 21},
+        // a builtin resolved on an earlier line is shadowed by a global defined on a later one
+        {"let size = fn(a) { len(a) }; size(\"ab\")", 2},
+        {"let len = fn(a) { 7 }; size(\"ab\") + len(\"\")", 14},
+    };
+    struct program *programs[ARRAY_SIZE(inputs)];
+    for (int i = 0; i < ARRAY_SIZE(inputs); i++) {
+        lexer = new_lexer(inputs[i].input);
+        parser = new_parser(&lexer);
+        programs[i] = parse_program(&parser);
+        obj = eval_program(programs[i], env);
+        test_integer_object(obj, inputs[i].expected);
+        free_object(obj);
+    }
+
+    free_environment(env);
+    free_program(program);
+    for (int i = 0; i < ARRAY_SIZE(inputs); i++) {
+        free_program(programs[i]);
+    }
+
+    // names are resolved in order, blocks do not have a scope of their own
+    struct {
+        char *input;
+        enum object_type type;
+        union object_value value;
+    } tests[] = {
+        {"let x = 41; let f = fn() { let x = x + 1; x }; f()", OBJ_INT, {.integer = 42}},
+        {"let f = fn() { g() }; let g = fn() { 42 }; f()", OBJ_INT, {.integer = 42}},
+        {"let f = fn() { let g = fn() { h() }; let h = fn() { 42 }; g() }; f()", OBJ_INT, {.integer = 42}},
+        {"let f = fn(x) { if (x) { let y = 42; } y }; f(true)", OBJ_INT, {.integer = 42}},
+        {"let f = fn(x) { if (x) { let y = 42; } y }; f(false)", OBJ_ERROR, {.error = "identifier not found: y"}},
+        {"let x = 1; let f = fn() { let g = fn() { x }; let r = g(); let x = 2; r }; f()", OBJ_INT, {.integer = 1}},
+        {"let x = 1; let f = fn() { let g = fn() { x }; let x = 2; g() }; f()", OBJ_INT, {.integer = 2}},
+        {"let len = fn(x) { 42 }; len(\"\")", OBJ_INT, {.integer = 42}},
+        {"fn(len) { len }(42)", OBJ_INT, {.integer = 42}},
+    };
+    for (int i = 0; i < ARRAY_SIZE(tests); i++) {
+        obj = test_eval(tests[i].input, false);
+        test_object(obj, tests[i].type, tests[i].value);
+        free_object(obj);
+    }
+
+    // a global referred to from deeper in function literals than the resolver can address
+    char deep[16 + (RESOLVER_MAX_DEPTH + 1) * (sizeof "fn() { " + sizeof " }()")] = "let x = 1; ";
+    for (int i = 0; i < RESOLVER_MAX_DEPTH + 1; i++) {
+        strcat(deep, "fn() { ");
+    }
+    strcat(deep, "x");
+    for (int i = 0; i < RESOLVER_MAX_DEPTH + 1; i++) {
+        strcat(deep, " }()");
+    }
+    obj = test_eval(deep, false);
+    test_error_object(obj, "functions nested too deeply");
+    free_object(obj);
+}
+
 int main()
 {
     test_environment();
@@ -601,6 +743,7 @@ int main()
     test_array_literals();
     test_array_index_expressions();
     test_while_expressions();
+    test_resolver();
 
     // TODO: Fix closures 
     // This is tricky because we can't just clear out the outer environment, 
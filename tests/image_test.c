@@ -0,0 +1,155 @@
+#define _DEFAULT_SOURCE
+#include <unistd.h>
+#include <stdint.h>
+#include "test_helpers.h"
+#include "image.h"
+#include "compiler.h"
+#include "verifier.h"
+#include "vm.h"
+
+// runs the program and returns an image of the state it leaves behind in a malloc'd buffer
+uint8_t *image_to_buffer(char *program_str, size_t *size) {
+    struct program *p = parse_program_str(program_str);
+    struct compiler *c = compiler_new();
+    int err = compile_program(c, p);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+    struct bytecode *bc = get_bytecode(c);
+    struct vm *vm = vm_new(bc);
+    assertf(vm != NULL, "invalid bytecode: %s", verifier_error_str(verify_bytecode(bc)));
+    err = vm_run(vm);
+    assertf(err == 0, "vm error: %d", err);
+    err = compile_function_stubs(c);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+
+    char *buf;
+    FILE *f = open_memstream(&buf, size);
+    err = image_write(c, vm, f);
+    assertf(err == 0, "write error: %s", image_error_str(err));
+    fclose(f);
+
+    vm_free(vm);
+    free(bc);
+    compiler_free(c);
+    free_program(p);
+    return (uint8_t *) buf;
+}
+
+// runs the program on top of the image and returns the last popped value
+struct object run_with_image(struct image *img, char *program_str) {
+    struct program *p = parse_program_str(program_str);
+    struct compiler *c = compiler_new_with_state(img->symbol_table, img->constants);
+    c->call_sites = img->call_sites;
+    int err = compile_program(c, p);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+    struct bytecode *bc = get_bytecode(c);
+    struct vm *vm = vm_new_with_globals(bc, img->globals, img->num_globals);
+    assertf(vm != NULL, "invalid bytecode: %s", verifier_error_str(verify_bytecode(bc)));
+    err = vm_run(vm);
+    assertf(err == 0, "vm error: %d", err);
+    struct object obj = vm_stack_last_popped(vm);
+
+    // the symbol table and constants belong to the image
+    vm_free(vm);
+    free(bc);
+    return obj;
+}
+
+void test_round_trip() {
+    TESTNAME(__FUNCTION__);
+
+    size_t size;
+    uint8_t *buf = image_to_buffer(
+        "let double = fn(x) { x * 2 };"
+        "let n = double(20) + 2;"
+        "let greeting = \"hello\" + \", \" + \"world\";"
+        "let unused = fn(a, b) { a - b };"
+        "let fib = fn(x) { if (x < 2) { return x; } fib(x - 1) + fib(x - 2) };"
+        "let alias = fib;"
+        "let flag = n > 40;", &size);
+    char *path = write_temp_file(buf, size);
+    free(buf);
+
+    int err;
+    struct image *img = image_map(path, &err);
+    unlink(path);
+    free(path);
+    assertf(img != NULL, "map error: %s", image_error_str(err));
+    assertf(img->num_globals == 7, "wrong number of globals: expected 7, got %d", img->num_globals);
+
+    struct {
+        char *input;
+        enum object_type type;
+        union object_value expected;
+    } tests[] = {
+        {"n", OBJ_INT, { .integer = 42 }},
+        {"double(n) + 1", OBJ_INT, { .integer = 85 }},
+        {"greeting", OBJ_STRING, { .string = "hello, world" }},
+        {"greeting + \"!\"", OBJ_STRING, { .string = "hello, world!" }},
+        {"unused(10, 3)", OBJ_INT, { .integer = 7 }},
+        {"alias(15)", OBJ_INT, { .integer = 610 }},
+        {"flag", OBJ_BOOL, { .boolean = true }},
+        {"let triple = fn(x) { double(x) + x }; triple(n)", OBJ_INT, { .integer = 126 }},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        struct object obj = run_with_image(img, tests[t].input);
+        assertf(obj.type == tests[t].type, "%s: wrong type: expected %s, got %s", tests[t].input, object_type_to_str(tests[t].type), object_type_to_str(obj.type));
+        switch (obj.type) {
+            case OBJ_INT:
+                assertf(obj.value.integer == tests[t].expected.integer, "%s: expected %ld, got %ld", tests[t].input, tests[t].expected.integer, obj.value.integer);
+            break;
+            case OBJ_STRING:
+                assertf(strcmp(obj.value.string, tests[t].expected.string) == 0, "%s: expected %s, got %s", tests[t].input, tests[t].expected.string, obj.value.string);
+            break;
+            default:
+                assertf(obj.value.boolean == tests[t].expected.boolean, "%s: wrong boolean", tests[t].input);
+            break;
+        }
+    }
+
+    image_unmap(img);
+}
+
+void test_invalid_images() {
+    TESTNAME(__FUNCTION__);
+
+    size_t size;
+    uint8_t *valid = image_to_buffer("let s = \"abc\"; let f = fn(x) { x }; let n = 1;", &size);
+
+    // the header is written as is, see struct image_header in image.c
+    uint64_t strings_size;
+    memcpy(&strings_size, valid + 64, sizeof strings_size);
+
+    struct corrupt_file_test tests[] = {
+        {"bad magic", 0, 'X', IMAGE_ERR_BAD_MAGIC},
+        {"wrong version", 4, IMAGE_VERSION + 1, IMAGE_ERR_VERSION},
+        {"different object layout", 8, 1, IMAGE_ERR_VERSION},
+        {"truncated header", 20, -1, IMAGE_ERR_CORRUPT},
+        {"truncated file", size - 1, -1, IMAGE_ERR_CORRUPT},
+        {"globals out of range", 12 + 1, 0x7f, IMAGE_ERR_CORRUPT},
+        {"misaligned globals", 24, 1, IMAGE_ERR_CORRUPT},
+        {"code out of range", 48 + 6, 0x7f, IMAGE_ERR_CORRUPT},
+        {"unterminated strings", size - 1, 'a', IMAGE_ERR_CORRUPT},
+        {"names out of range", 72, strings_size + 1, IMAGE_ERR_CORRUPT},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        char *path = write_corrupt_file(valid, size, &tests[t]);
+        int err = 0;
+        struct image *img = image_map(path, &err);
+        unlink(path);
+        free(path);
+        assertf(img == NULL, "%s: expected an error", tests[t].name);
+        assertf(err == tests[t].expected_err, "%s: wrong error: expected \"%s\", got \"%s\"", tests[t].name, image_error_str(tests[t].expected_err), image_error_str(err));
+    }
+
+    int err;
+    assertf(image_map("/tmp/monkey_image_does_not_exist", &err) == NULL && err == IMAGE_ERR_IO, "expected an IO error");
+    free(valid);
+}
+
+int main() {
+    test_round_trip();
+    test_invalid_images();
+    printf("\x1b[32mAll image tests passed!\033[0m\n");
+}
@@ -1,11 +1,56 @@
+#define _DEFAULT_SOURCE
 #include "lexer.h"
+#include "scan.h"
 #include "test_helpers.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
-int main() {
+void test_keywords() {
+    TESTNAME(__FUNCTION__);
+
+    struct {
+        char *input;
+        enum token_type type;
+    } tests[] = {
+        {"let", TOKEN_LET},
+        {"fn", TOKEN_FUNCTION},
+        {"true", TOKEN_TRUE},
+        {"false", TOKEN_FALSE},
+        {"if", TOKEN_IF},
+        {"else", TOKEN_ELSE},
+        {"return", TOKEN_RETURN},
+        {"while", TOKEN_WHILE},
+        {"import", TOKEN_IMPORT},
+        {"lets", TOKEN_IDENT},
+        {"le", TOKEN_IDENT},
+        {"lat", TOKEN_IDENT},
+        {"fm", TOKEN_IDENT},
+        {"f", TOKEN_IDENT},
+        {"tree", TOKEN_IDENT},
+        {"falsy", TOKEN_IDENT},
+        {"ef", TOKEN_IDENT},
+        {"elsE", TOKEN_IDENT},
+        {"returns", TOKEN_IDENT},
+        {"whale", TOKEN_IDENT},
+        {"imports", TOKEN_IDENT},
+        {"impart", TOKEN_IDENT},
+        {"_", TOKEN_IDENT},
+    };
+
+    for (int i=0; i < ARRAY_SIZE(tests); i++) {
+        struct lexer l = new_lexer(tests[i].input);
+        struct token t;
+        gettoken(&l, &t);
+        assertf(t.type == tests[i].type, "%s: wrong type: expected \"%s\", got \"%s\"", tests[i].input, token_type_to_str(tests[i].type), token_type_to_str(t.type));
+    }
+}
+
+void test_tokens() {
     char *input = "let five = 5;\n"
         "let ten = 10;\n"
         "let add = fn(x, y) {\n"
@@ -122,8 +167,156 @@ int main() {
     for (int j = 0; j < sizeof tokens / sizeof tokens[0]; j++) {
         gettoken(&l, &t);
         assertf(t.type == tokens[j].type, "[%d] wrong type: expected \"%s\", got \"%s\"\n", j, token_type_to_str(tokens[j].type), token_type_to_str(t.type));
-        assertf(strcmp(t.literal, tokens[j].literal) == 0, "[%d] wrong literal: expected \"%s\", got \"%s\"\n", j, tokens[j].literal, t.literal);
+        assertf(t.length == strlen(tokens[j].start) && strncmp(t.start, tokens[j].start, t.length) == 0, "[%d] wrong literal: expected \"%s\", got \"%.*s\"\n", j, tokens[j].start, t.length, t.start);
+        assertf(t.type == TOKEN_EOF || t.start == input + t.pos || (t.type == TOKEN_STRING && t.start == input + t.pos + 1), "[%d] token does not point into the input\n", j);
+    }
+}
+
+void test_scanner() {
+    TESTNAME(__FUNCTION__);
+
+    struct {
+        char *name;
+        char *(*scan)(char *s);
+        char run;
+        char end;
+    } tests[] = {
+        {"whitespace", scanner.whitespace, ' ', 'x'},
+        {"whitespace", scanner.whitespace, '\t', '\0'},
+        {"letters", scanner.letters, 'a', '1'},
+        {"letters", scanner.letters, 'Z', '\0'},
+        {"letters", scanner.letters, '_', '{'},
+        {"letters", scanner.letters, 'q', (char) 0xe4},
+        {"digits", scanner.digits, '7', 'a'},
+        {"digits", scanner.digits, '0', '\0'},
+        {"string end", scanner.string_end, 'a', '"'},
+        {"string end", scanner.string_end, ' ', '\0'},
+        {"string end", scanner.string_end, (char) 0xff, '"'},
+    };
+
+    // every run length and alignment across two vector blocks
+    char buf[256] __attribute__((aligned(64)));
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        for (int start = 0; start < 32; start++) {
+            for (int len = 0; len < 80; len++) {
+                memset(buf, tests[t].run, sizeof buf);
+                buf[start + len] = tests[t].end;
+                buf[sizeof buf - 1] = '\0';
+                char *end = tests[t].scan(buf + start);
+                assertf(end == buf + start + len, "%s (%s): wrong end for run of %d at %d: got %ld", tests[t].name, scanner.name, len, start, end - buf - start);
+            }
+        }
+    }
+
+    // input that ends right before a page nobody may read
+    long page = sysconf(_SC_PAGESIZE);
+    char *pages = mmap(NULL, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assertf(pages != MAP_FAILED, "could not map pages");
+    assertf(mprotect(pages + page, page, PROT_NONE) == 0, "could not protect page");
+    char source[] = "let abc = 123;   \"a string without end";
+    char *input = pages + page - sizeof source;
+    memcpy(input, source, sizeof source);
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        for (int start = 0; start < sizeof source; start++) {
+            tests[t].scan(input + start);
+        }
+    }
+    struct lexer l = new_lexer(input);
+    struct token tok;
+    while (gettoken(&l, &tok) != -1);
+    munmap(pages, page * 2);
+}
+
+void test_source_map() {
+    TESTNAME(__FUNCTION__);
+
+    // a file filling whole pages still ends in padding
+    long page = sysconf(_SC_PAGESIZE);
+    char *content = malloc(page * 2);
+    for (long i=0; i < page * 2; i++) {
+        content[i] = i % 8 == 7 ? ' ' : 'a';
+    }
+    content[page * 2 - 1] = 'z';
+    char *path = write_temp_file(content, page * 2);
+    struct source *s = source_map(path);
+    assertf(s != NULL, "could not map file");
+    assertf(s->size == page * 2 && memcmp(s->data, content, page * 2) == 0, "wrong content");
+    for (int i=0; i < SOURCE_PADDING; i++) {
+        assertf(s->data[s->size + i] == '\0', "padding byte %d is not zero", i);
+    }
+
+    struct lexer l = new_lexer(s->data);
+    struct token t;
+    unsigned int tokens = 0;
+    while (gettoken(&l, &t) != -1) {
+        tokens++;
+    }
+    assertf(tokens == page * 2 / 8, "wrong number of tokens: expected %ld, got %d", page * 2 / 8, tokens);
+    source_free(s);
+    unlink(path);
+    free(path);
+
+    path = write_temp_file("", 0);
+    s = source_map(path);
+    assertf(s != NULL && s->size == 0 && s->data[0] == '\0', "could not map empty file");
+    source_free(s);
+    unlink(path);
+    free(path);
+
+    assertf(source_map("/tmp/monkey_source_does_not_exist") == NULL, "mapped missing file");
+    free(content);
+}
+
+void test_stream() {
+    TESTNAME(__FUNCTION__);
+
+    char *input = "let abc = fn(x, y) { if (x == y) { \"a { string\" } else { [x, (y)] } };\n"
+        "let result = abc(1234, 56789) != !true;\n"
+        "let broken = fn() { ( };\n"
+        "\"a string without end";
+
+    // every chunk size lines up differently with the tokens, with 1 byte chunks every token is split
+    size_t chunk_sizes[] = {1, 2, 3, 7, SOURCE_CHUNK_SIZE};
+    char *path = write_temp_file(input, strlen(input));
+    for (int c=0; c < ARRAY_SIZE(chunk_sizes); c++) {
+        int fd = open(path, O_RDONLY);
+        assertf(fd >= 0, "could not open temporary file");
+        struct source *s = source_stream(fd, chunk_sizes[c]);
+        struct lexer actual = new_source_lexer(s);
+        struct lexer expected = new_lexer(input);
+
+        struct token a, e;
+        int i = 0;
+        do {
+            gettoken(&expected, &e);
+            gettoken(&actual, &a);
+            assertf(a.type == e.type && a.pos == e.pos && a.length == e.length, "[%zu] token %d: expected %s \"%.*s\" at %d, got %s \"%.*s\" at %d", chunk_sizes[c], i, token_type_to_str(e.type), e.length, e.start, e.pos, token_type_to_str(a.type), a.length, a.start, a.pos);
+            assertf(strncmp(a.start, e.start, e.length) == 0, "[%zu] token %d: wrong text", chunk_sizes[c], i);
+
+            i++;
+        } while (e.type != TOKEN_EOF);
+        assertf(s->size == strlen(input), "[%zu] read %zu bytes, expected %zu", chunk_sizes[c], s->size, strlen(input));
+
+        source_free(s);
+        close(fd);
+    }
+    unlink(path);
+    free(path);
+}
+
+int main() {
+    int kinds[] = { SCANNER_SCALAR, SCANNER_SSE2, SCANNER_AVX2 };
+    for (int i=0; i < ARRAY_SIZE(kinds); i++) {
+        if (!scanner_use(kinds[i])) {
+            printf("skipping unsupported scanner %d\n", kinds[i]);
+            continue;
+        }
+        test_tokens();
+        test_scanner();
+        test_stream();
     }
 
+    test_source_map();
+    test_keywords();
     printf("\x1b[32mAll lexing tests passed!\033[0m\n");
 }
@@ -0,0 +1,219 @@
+#define _DEFAULT_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "test_helpers.h"
+#include "vm.h"
+#include "compiler.h"
+#include "verifier.h"
+#include "module.h"
+#include "project.h"
+
+char dir[] = "/tmp/monkey_module_test_XXXXXX";
+char *files[32];
+unsigned int num_files = 0;
+
+/* writes a module to the test directory, returns its path */
+char *write_module(char *name, char *content) {
+    char *path = malloc(strlen(dir) + strlen(name) + 2);
+    assertf(path != NULL, "out of memory");
+    sprintf(path, "%s/%s", dir, name);
+    write_file(path, content, strlen(content));
+    files[num_files++] = path;
+    return path;
+}
+
+struct object run_bytecode_test(struct compiler *c) {
+    struct bytecode *bc = get_bytecode(c);
+    struct vm *vm = vm_new(bc);
+    assertf(vm != NULL, "invalid bytecode: %s", verifier_error_str(verify_bytecode(bc)));
+    int err = vm_run(vm);
+    assertf(err == 0, "vm error: %d", err);
+    struct object obj = vm_stack_last_popped(vm);
+    free(bc);
+    vm_free(vm);
+    return obj;
+}
+
+/* compiles input as if it were a script in the test directory */
+int compile_script(struct compiler *c, struct module_cache *mc, char *input, struct program **program, bool single_pass) {
+    c->module_cache = mc;
+    c->path = files[0];
+    if (single_pass) {
+        struct lexer lexer = new_lexer(input);
+        struct parser parser = new_parser(&lexer);
+        int err;
+        *program = compile_single_pass(c, &parser, &err);
+        return err;
+    }
+
+    *program = parse_program_str(input);
+    return compile_program(c, *program);
+}
+
+void test_import() {
+    TESTNAME(__FUNCTION__);
+
+    struct {
+        char *input;
+        long expected;
+        unsigned int modules;
+    } tests[] = {
+        {"import \"math.monkey\"; square(7)", 49, 2},
+        {"import \"math.monkey\"; let f = fn(x) { square(x) + twice(x) }; f(3)", 15, 2},
+        {"import \"./lib/../math.monkey\"; import \"util.monkey\"; twice(4)", 8, 2},
+        {"import \"util.monkey\"; import \"math.monkey\"; import \"util.monkey\"; counter", 10, 2},
+        {"let counter = 1; import \"util.monkey\"; counter", 0, 1},
+        {"import \"lib/inc.monkey\"; inc(5)", 6, 3},
+        {"import \"lib/inc.monkey\"; import \"util.monkey\"; import \"math.monkey\"; square(inc(3))", 16, 3},
+        {"import \"lib/sum.monkey\"; sum(100)", 5050, 1},
+    };
+
+    struct module_cache *mc = module_cache_new();
+    for (int mode = 0; mode < 2; mode++) {
+        for (int t=0; t < ARRAY_SIZE(tests); t++) {
+            struct compiler *c = compiler_new();
+            struct program *program;
+            int err = compile_script(c, mc, tests[t].input, &program, mode == 1);
+            assertf(err == 0, "test %d: compiler error: %s", t, compiler_error_str(err));
+            assertf(c->modules_size == tests[t].modules, "test %d: expected %d modules to be linked, got %d", t, tests[t].modules, c->modules_size);
+
+            struct object obj = run_bytecode_test(c);
+            assertf(obj.type == OBJ_INT && obj.value.integer == tests[t].expected, "test %d: expected %ld, got %s %ld", t, tests[t].expected, object_type_to_str(obj.type), obj.value.integer);
+            compiler_free(c);
+            free_program(program);
+        }
+    }
+
+    // every module was compiled once, however often it was imported
+    assertf(mc->size == 4, "expected 4 modules in the cache, got %d", mc->size);
+    for (unsigned int i = 0; i < mc->size; i++) {
+        assertf(mc->modules[i]->error == 0, "module %s failed to load", mc->modules[i]->path);
+    }
+    module_cache_free(mc);
+}
+
+void test_import_errors() {
+    TESTNAME(__FUNCTION__);
+
+    struct {
+        char *input;
+        int expected_err;
+    } tests[] = {
+        {"import \"missing.monkey\"; 1", COMPILE_ERR_IMPORT},
+        {"import \"broken.monkey\"; 1", COMPILE_ERR_IMPORT},
+        {"import \"unknown.monkey\"; 1", COMPILE_ERR_IMPORT},
+        {"import \"cycle_a.monkey\"; 1", COMPILE_ERR_IMPORT},
+        {"import \"math.monkey\"; square(x)", COMPILE_ERR_UNKNOWN_IDENTIFIER},
+        {"if (true) { import \"math.monkey\"; }", COMPILE_ERR_SYNTAX},
+    };
+
+    struct module_cache *mc = module_cache_new();
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        struct compiler *c = compiler_new();
+        struct program *program;
+        int err = compile_script(c, mc, tests[t].input, &program, false);
+        assertf(err == tests[t].expected_err, "test %d: expected %s, got %s", t, compiler_error_str(tests[t].expected_err), compiler_error_str(err));
+        compiler_free(c);
+        free_program(program);
+    }
+
+    struct {
+        char *name;
+        int error;
+        int compile_error;
+    } modules[] = {
+        {"missing.monkey", MODULE_ERR_IO, 0},
+        {"broken.monkey", MODULE_ERR_PARSE, 0},
+        {"unknown.monkey", MODULE_ERR_COMPILE, COMPILE_ERR_UNKNOWN_IDENTIFIER},
+        {"cycle_a.monkey", MODULE_ERR_COMPILE, COMPILE_ERR_IMPORT},
+        {"cycle_b.monkey", MODULE_ERR_COMPILE, COMPILE_ERR_IMPORT_CYCLE},
+    };
+    for (int t=0; t < ARRAY_SIZE(modules); t++) {
+        struct module *m = NULL;
+        for (unsigned int i = 0; i < mc->size; i++) {
+            char *name = strrchr(mc->modules[i]->path, '/') + 1;
+            if (strcmp(name, modules[t].name) == 0) {
+                m = mc->modules[i];
+            }
+        }
+        assertf(m != NULL, "%s is not in the cache", modules[t].name);
+        assertf(m->error == modules[t].error, "%s: expected error %d, got %d", modules[t].name, modules[t].error, m->error);
+        assertf(m->compile_error == modules[t].compile_error, "%s: expected %s, got %s", modules[t].name, compiler_error_str(modules[t].compile_error), compiler_error_str(m->compile_error));
+    }
+    module_cache_free(mc);
+
+    // compilers without a module cache can not import anything
+    struct compiler *c = compiler_new();
+    struct program *program = parse_program_str("import \"math.monkey\"; 1");
+    int err = compile_program(c, program);
+    assertf(err == COMPILE_ERR_IMPORT, "expected %s without a module cache, got %s", compiler_error_str(COMPILE_ERR_IMPORT), compiler_error_str(err));
+    compiler_free(c);
+    free_program(program);
+}
+
+void test_project_imports() {
+    TESTNAME(__FUNCTION__);
+
+    // every file imports the same modules on its own thread, they end up in the program once
+    char *paths[8];
+    char content[256];
+    for (int i=0; i < ARRAY_SIZE(paths) - 1; i++) {
+        char name[32];
+        sprintf(name, "part_%d.monkey", i);
+        sprintf(content, "import \"math.monkey\"; let p%c = square(%d); let q%c = fn() { twice(p%c) };", 'a' + i, i, 'a' + i, 'a' + i);
+        paths[i] = write_module(name, content);
+    }
+    paths[ARRAY_SIZE(paths) - 1] = write_module("part_total.monkey", "import \"util.monkey\"; pa + pb + pc + pd + pe + pf + qg() + counter");
+
+    struct module_cache *mc = module_cache_new();
+    unsigned int threads[] = {1, 4};
+    for (int t=0; t < ARRAY_SIZE(threads); t++) {
+        struct project *p = project_new(paths, ARRAY_SIZE(paths));
+        struct compiler *c = compiler_new();
+        c->module_cache = mc;
+        unsigned int failed;
+        int err = project_compile(p, c, threads[t], &failed);
+        assertf(err == 0, "[%d threads] project error %d in file %d", threads[t], err, failed);
+        assertf(c->modules_size == 2, "[%d threads] expected 2 modules to be linked, got %d", threads[t], c->modules_size);
+
+        // 0 + 1 + 4 + 9 + 16 + 25 + 2 * 36 + 10
+        struct object obj = run_bytecode_test(c);
+        assertf(obj.type == OBJ_INT && obj.value.integer == 137, "[%d threads] expected 137, got %s %ld", threads[t], object_type_to_str(obj.type), obj.value.integer);
+
+        compiler_free(c);
+        project_free(p);
+    }
+    assertf(mc->size == 2, "expected 2 modules in the cache, got %d", mc->size);
+    module_cache_free(mc);
+}
+
+int main() {
+    assertf(mkdtemp(dir) != NULL, "could not create a temporary directory");
+    char lib[sizeof dir + 4];
+    sprintf(lib, "%s/lib", dir);
+    assertf(mkdir(lib, 0755) == 0, "could not create %s", lib);
+
+    write_module("main.monkey", "");
+    write_module("util.monkey", "let twice = fn(x) { x * 2 }; let counter = 0;");
+    write_module("math.monkey", "import \"util.monkey\"; let square = fn(x) { twice(x) * x / 2 }; let counter = 10;");
+    write_module("lib/inc.monkey", "import \"../math.monkey\"; let inc = fn(x) { twice(x) - x + 1 };");
+    write_module("lib/sum.monkey", "let sum = fn(n) { if (n == 0) { return 0; } n + sum(n - 1) };");
+    write_module("broken.monkey", "let = 1;");
+    write_module("unknown.monkey", "let f = fn() { nothing };");
+    write_module("cycle_a.monkey", "import \"cycle_b.monkey\"; let a = 1;");
+    write_module("cycle_b.monkey", "import \"cycle_a.monkey\"; let b = 1;");
+
+    test_import();
+    test_import_errors();
+    test_project_imports();
+
+    for (int i = num_files - 1; i >= 0; i--) {
+        unlink(files[i]);
+        free(files[i]);
+    }
+    rmdir(lib);
+    rmdir(dir);
+    printf("\x1b[32mAll module tests passed!\033[0m\n");
+}
@@ -24,7 +24,32 @@ void test_make_instruction() {
             .opcode = OPCODE_GET_LOCAL,
             .operands = {255},
             .expected = {OPCODE_GET_LOCAL, 255}, 2
-        }
+        },
+        {
+            .opcode = OPCODE_CONST,
+            .operands = {255},
+            .expected = {OPCODE_CONST_SHORT, 255}, 2
+        },
+        {
+            .opcode = OPCODE_GET_GLOBAL,
+            .operands = {256},
+            .expected = {OPCODE_GET_GLOBAL, 1, 0}, 3
+        },
+        {
+            .opcode = OPCODE_CONST,
+            .operands = {70000},
+            .expected = {OPCODE_WIDE, OPCODE_CONST, 0, 1, 17, 112}, 6
+        },
+        {
+            .opcode = OPCODE_GET_LOCAL,
+            .operands = {256},
+            .expected = {OPCODE_WIDE, OPCODE_GET_LOCAL, 0, 0, 1, 0}, 6
+        },
+        {
+            .opcode = OPCODE_JUMP,
+            .operands = {70000},
+            .expected = {OPCODE_JUMP, 0, 1, 17, 112}, 5
+        },
     };
 
     for (int i=0; i < ARRAY_SIZE(tests); i++) {
@@ -44,11 +69,13 @@ void test_instruction_string() {
         make_instruction(OPCODE_ADD),
         make_instruction(OPCODE_GET_LOCAL, 1),
         make_instruction(OPCODE_CONST, 2),
-        make_instruction(OPCODE_CONST, 65535)
+        make_instruction(OPCODE_CONST, 65535),
+        make_instruction(OPCODE_CONST, 65536),
+        make_instruction(OPCODE_CALL, 1, 70000),
     };
 
-    char *expected_str = "0000 OpAdd | 0001 OpGetLocal 1 | 0003 OpConstant 2 | 0006 OpConstant 65535";
-    struct instruction *ins = flatten_instructions_array(instructions, 4);
+    char *expected_str = "0000 OpAdd | 0001 OpGetLocal 1 | 0003 OpConstantShort 2 | 0005 OpConstant 65535 | 0008 OpWide OpConstant 65536 | 0014 OpWide OpCall 1 70000";
+    struct instruction *ins = flatten_instructions_array(instructions, 6);
     char *str = instruction_to_str(ins);
     assertf(strcmp(expected_str, str) == 0, "wrong instruction string: expected \"%s\", got \"%s\"", expected_str, str);
     free_instruction(ins);
@@ -62,7 +89,8 @@ void test_read_operands() {
         size_t bytes_read;
     } tests[] = {
         {OPCODE_CONST, {65535}, 2},
-        {OPCODE_CONST, {1}, 2},
+        {OPCODE_CONST, {256}, 2},
+        {OPCODE_CONST_SHORT, {1}, 1},
         {OPCODE_GET_LOCAL, {255}, 1},
     };
 
@@ -79,10 +107,40 @@ void test_read_operands() {
     }
 }
 
+void test_read_instruction() {
+    struct {
+        enum opcode opcode;
+        int operands[MAX_OP_SIZE];
+        unsigned int length;
+    } tests[] = {
+        {OPCODE_ADD, {0, 0}, 1},
+        {OPCODE_CALL, {2, 300}, 4},
+        {OPCODE_CALL, {256, 1}, 10},
+        {OPCODE_CALL_CONST, {70000, 1}, 10},
+        {OPCODE_JUMP_NOT_TRUE, {65536, 0}, 5},
+        {OPCODE_JUMP_SHORT, {3, 0}, 2},
+    };
+
+    for (int t = 0; t < ARRAY_SIZE(tests); t++) {
+        struct instruction *ins = make_instruction(tests[t].opcode, tests[t].operands[0], tests[t].operands[1]);
+        enum opcode opcode;
+        int operands[MAX_OP_SIZE] = {0};
+        unsigned int length = read_instruction(ins->bytes, &opcode, operands);
+        assertf(length == ins->size, "wrong instruction length: expected %d, got %d", ins->size, length);
+        assertf(length == tests[t].length, "wrong instruction length: expected %d, got %d", tests[t].length, length);
+        assertf(opcode == tests[t].opcode, "wrong opcode: expected %s, got %s", opcode_to_str(tests[t].opcode), opcode_to_str(opcode));
+        for (int i=0; i < lookup(opcode).operands; i++) {
+            assertf(tests[t].operands[i] == operands[i], "wrong operand: expected %d, got %d", tests[t].operands[i], operands[i]);
+        }
+        free_instruction(ins);
+    }
+}
+
 int main() {
     test_make_instruction();
     test_read_operands();
     test_instruction_string();
+    test_read_instruction();
     
     printf("\x1b[32mAll opcode tests passed!\033[0m\n");
 }
\ No newline at end of file
@@ -6,13 +6,33 @@
 #include "parser.h"
 #include "test_helpers.h"
 
+// compares the source text of the token a node was parsed from with str
+int token_equals(struct ast *ast, uint32_t node, char *str) {
+    return strncmp(ast->source + ast->nodes[node].pos, str, strlen(str)) == 0;
+}
+
+// returns the i-th top-level statement
+uint32_t statement(struct program *p, uint32_t i) {
+    return ast_list_item(&p->ast, p->ast.nodes[p->statements].lhs, i);
+}
+
+// returns the i-th statement of a block
+uint32_t block_statement(struct ast *ast, uint32_t block, uint32_t i) {
+    return ast_list_item(ast, ast->nodes[block].lhs, i);
+}
+
+uint32_t block_size(struct ast *ast, uint32_t block) {
+    return ast_list_size(ast, ast->nodes[block].lhs);
+}
+
 union expression_value {
     int int_value;
     char bool_value;
     char *str_value;
 };
 
-void test_expression(struct expression *e, union expression_value expected);
+void test_expression(struct ast *ast, uint32_t e, union expression_value expected);
+void test_identifier_expression(struct ast *ast, uint32_t e, char *expected);
 
 void assert_parser_errors(struct parser *p) {
     if (p->errors > 0) {
@@ -26,7 +46,8 @@ void assert_parser_errors(struct parser *p) {
 }
 
 void assert_program_size(struct program *p, unsigned int expected_size) {
-    assertf(p->size == expected_size, "wrong program size. expected %d, got %d\n", expected_size, p->size); 
+    uint32_t size = block_size(&p->ast, p->statements);
+    assertf(size == expected_size, "wrong program size. expected %d, got %d\n", expected_size, size); 
 }
 
 void test_let_statements() {
@@ -52,12 +73,13 @@ void test_let_statements() {
         {"let", "foo", {.str_value = "y"}}
     };
 
+    struct ast *ast = &program->ast;
     for (int i = 0; i < 3; i++) {
-        struct statement stmt = program->statements[i];
-        assertf(strcmp(stmt.token.literal, tests[i].literal) == 0, "wrong literal. expected %s, got %s\n", tests[i].literal, stmt.token.literal);
-        assertf(strcmp(stmt.name.value, tests[i].name) == 0, "wrong name value. expected %s, got %s\n", tests[i].name, stmt.name.value);
-        assertf(strcmp(stmt.name.token.literal, tests[i].name) == 0, "wrong name literal. expected %s, got %s", tests[i].name, stmt.token.literal);
-        test_expression(stmt.value, tests[i].value);
+        uint32_t stmt = statement(program, i);
+        assertf(ast->nodes[stmt].type == STMT_LET, "wrong statement type. expected %d, got %d\n", STMT_LET, ast->nodes[stmt].type);
+        assertf(token_equals(ast, stmt, tests[i].literal), "wrong literal. expected %s, got %.6s\n", tests[i].literal, input + ast->nodes[stmt].pos);
+        test_identifier_expression(ast, ast->nodes[stmt].lhs, tests[i].name);
+        test_expression(ast, ast->nodes[stmt].rhs, tests[i].value);
     }
 
     free_program(program);
@@ -87,83 +109,73 @@ void test_return_statements() {
         {"return", "", {.str_value = "x"}}
     };
 
+    struct ast *ast = &program->ast;
     for (int i = 0; i < 3; i++) {
-        struct statement stmt = program->statements[i];
-        assertf(strcmp(stmt.token.literal, tests[i].literal) == 0, "wrong literal. expected %s, got %s\n", tests[i].literal, stmt.token.literal);
-        test_expression(stmt.value, tests[i].value);
+        uint32_t stmt = statement(program, i);
+        assertf(ast->nodes[stmt].type == STMT_RETURN, "wrong statement type. expected %d, got %d\n", STMT_RETURN, ast->nodes[stmt].type);
+        assertf(token_equals(ast, stmt, tests[i].literal), "wrong literal. expected %s, got %.6s\n", tests[i].literal, input + ast->nodes[stmt].pos);
+        test_expression(ast, ast->nodes[stmt].lhs, tests[i].value);
+    }
+
+    free_program(program);
+}
+
+void test_import_statements() {
+    char *input = ""
+        "import \"lib.monkey\";\n"
+        "import \"../util/strings.monkey\"\n";
+
+    struct lexer l = {input, 0 };
+    struct parser parser = new_parser(&l);
+    struct program *program = parse_program(&parser);
+
+    assert_parser_errors(&parser);
+    assert_program_size(program, 2);
+
+    char *expected[] = { "lib.monkey", "../util/strings.monkey" };
+    struct ast *ast = &program->ast;
+    for (int i = 0; i < 2; i++) {
+        uint32_t stmt = statement(program, i);
+        assertf(ast->nodes[stmt].type == STMT_IMPORT, "wrong statement type. expected %d, got %d\n", STMT_IMPORT, ast->nodes[stmt].type);
+        assertf(token_equals(ast, stmt, "import"), "wrong literal. expected import, got %.6s\n", input + ast->nodes[stmt].pos);
+        assertf(strcmp(ast_string(ast, ast->nodes[stmt].lhs), expected[i]) == 0, "wrong path. expected %s, got %s\n", expected[i], ast_string(ast, ast->nodes[stmt].lhs));
     }
 
+    char *str = program_to_str(program);
+    assertf(strcmp(str, "import \"lib.monkey\";import \"../util/strings.monkey\";") == 0, "wrong program string: %s", str);
+    free(str);
+    free_program(program);
+
+    // the path has to be a string literal
+    l = new_lexer("import lib;");
+    parser = new_parser(&l);
+    program = parse_program(&parser);
+    assertf(parser.errors > 0, "expected a parser error for import without a string");
     free_program(program);
 }
 
 void test_program_string() {
-    struct expression e1 = {
-        .type = EXPR_INT,
-        .token = {
-            .literal = "5",
-            .type = TOKEN_INT,
-        },
-        .integer = 5,
-    };
-    struct expression e2 = {
-        .type = EXPR_IDENT,
-        .ident = {
-            .value = "foo"
-        },
-    };
-    struct expression expressions[] = {
-        {
-            .type = EXPR_IDENT,
-            .ident = {
-                .token = {
-                    .type = TOKEN_IDENT,
-                    .literal = "anotherVar",
-                },
-                .value = "anotherVar"
-            }
-        },
-        {
-            .type = EXPR_INFIX,
-            .token = {
-                .type = TOKEN_PLUS,
-                .literal = "+",
-            },
-            .infix = {
-                .operator = OP_ADD,
-                .left = &e1,
-                .right = &e2,
-            }
-        }
-    };
-    struct statement statements[] = {
-        {
-            .type = STMT_LET,
-            .token = {
-                .type = TOKEN_LET,
-                .literal = "let",
-            },
-            .name = {
-                .token = {
-                    .type = TOKEN_IDENT,
-                    .literal = "myVar",
-                },
-                .value = "myVar",
-            },
-            .value = &expressions[0],
-        }, 
-        {
-            .type = STMT_RETURN,
-            .token = {
-                .type = TOKEN_RETURN,
-                .literal = "return",
-            },
-            .value = &expressions[1]
-        }, 
+    char *strings[] = { "", "myVar", "anotherVar", "foo" };
+    struct node nodes[] = {
+        { 0 },
+        { .type = EXPR_IDENT, .lhs = 2 },
+        { .type = EXPR_IDENT, .lhs = 1 },
+        { .type = STMT_LET, .lhs = 2, .rhs = 1 },
+        { .type = EXPR_INT, .lhs = 5 },
+        { .type = EXPR_IDENT, .lhs = 3 },
+        { .type = EXPR_INFIX, .operator = OP_ADD, .lhs = 4, .rhs = 5 },
+        { .type = STMT_RETURN, .lhs = 6 },
+        { .type = STMT_BLOCK, .lhs = 0 },
     };
+    uint32_t extra[] = { 2, 3, 7 };
 
     struct program program = {
-        .statements = statements, 
-        .size = 2
+        .ast = {
+            .nodes = nodes, .size = ARRAY_SIZE(nodes),
+            .extra = extra, .extra_size = ARRAY_SIZE(extra),
+            .strings = strings, .strings_size = ARRAY_SIZE(strings),
+        },
+        .statements = 8,
     };
 
     char *str = program_to_str(&program);
@@ -172,10 +184,10 @@ void test_program_string() {
     free(str);
 }
 
-void test_identifier_expression(struct expression *e, char *expected) {
-    assertf(e->type == EXPR_IDENT, "wrong expression type: expected %d, got %d\n", EXPR_IDENT, e->type);
-    assertf(strcmp(e->ident.token.literal, expected) == 0, "wrong token literal: expected \"%s\", got \"%s\"\n", expected, e->ident.token.literal);
-    assertf(strcmp(e->ident.value, expected) == 0, "wrong expression value: expected \"%s\", got \"%s\"\n", expected, e->ident.value);
+void test_identifier_expression(struct ast *ast, uint32_t e, char *expected) {
+    assertf(ast->nodes[e].type == EXPR_IDENT, "wrong expression type: expected %d, got %d\n", EXPR_IDENT, ast->nodes[e].type);
+    assertf(token_equals(ast, e, expected), "wrong token literal: expected \"%s\", got \"%.*s\"\n", expected, (int) strlen(expected), ast->source + ast->nodes[e].pos);
+    assertf(strcmp(ast_string(ast, ast->nodes[e].lhs), expected) == 0, "wrong expression value: expected \"%s\", got \"%s\"\n", expected, ast_string(ast, ast->nodes[e].lhs));
 }
 
 
@@ -186,21 +198,18 @@ void test_identifier_expression_parsing() {
     struct program *program = parse_program(&parser);
     assert_program_size(program, 1);
 
-    struct statement stmt = program->statements[0];
-    assertf(stmt.token.type == TOKEN_IDENT, "wrong token type: expected %s, got %s\n", token_type_to_str(TOKEN_IDENT), stmt.token.type);
-    assertf(strcmp(stmt.token.literal, "foobar") == 0, "wrong token literal: expected %s, got %s\n", "foobar", stmt.token.literal);
-    test_identifier_expression(stmt.value, "foobar");
+    test_identifier_expression(&program->ast, statement(program, 0), "foobar");
     free_program(program);
 }
 
 
-void test_integer_expression(struct expression *expr, int expected) {
-    assertf(expr->type == EXPR_INT, "wrong expression type: expected %d, got %d\n", EXPR_INT, expr->type);
-    assertf(expr->integer == expected, "wrong integer value: expected %d, got %d\n", expected, expr->integer);
+void test_integer_expression(struct ast *ast, uint32_t expr, int expected) {
+    assertf(ast->nodes[expr].type == EXPR_INT, "wrong expression type: expected %d, got %d\n", EXPR_INT, ast->nodes[expr].type);
+    assertf((int32_t) ast->nodes[expr].lhs == expected, "wrong integer value: expected %d, got %d\n", expected, ast->nodes[expr].lhs);
 
-    char expected_str[8];
+    char expected_str[16];
     sprintf(expected_str, "%d", expected);
-    assertf(strcmp(expr->token.literal, expected_str) == 0, "wrong token literal: expected %s, got %s\n", expected_str, expr->token.literal);
+    assertf(token_equals(ast, expr, expected_str), "wrong token literal: expected %s, got %.*s\n", expected_str, (int) strlen(expected_str), ast->source + ast->nodes[expr].pos);
 }
 
 
@@ -212,20 +221,17 @@ void test_integer_expression_parsing() {
     assert_parser_errors(&parser);
     assert_program_size(program, 1);
 
-    struct statement stmt = program->statements[0];
-    assertf(stmt.token.type == TOKEN_INT, "wroken token type: expected %s, got %s", token_type_to_str(TOKEN_INT), stmt.token.type);
-    assertf (strcmp(stmt.token.literal, "5") == 0, "wrong token literal: expected %s, got %s", "foobar", stmt.token.literal);
-    test_integer_expression(stmt.value, 5);
+    test_integer_expression(&program->ast, statement(program, 0), 5);
     free_program(program);
 }
 
 
-void test_boolean_expression(struct expression * expr, char expected) {
-    assertf(expr->type == EXPR_BOOL, "wrong expression type: expected %d, got %d\n", EXPR_BOOL, expr->type);
-    assertf(expr->boolean == expected, "wrong boolean value: expected %d, got %d\n", expected, expr->boolean);
+void test_boolean_expression(struct ast *ast, uint32_t expr, char expected) {
+    assertf(ast->nodes[expr].type == EXPR_BOOL, "wrong expression type: expected %d, got %d\n", EXPR_BOOL, ast->nodes[expr].type);
+    assertf(ast->nodes[expr].lhs == expected, "wrong boolean value: expected %d, got %d\n", expected, ast->nodes[expr].lhs);
     
     char *expected_str = expected ? "true" : "false";
-    assertf(strcmp(expr->token.literal, expected_str) == 0, "wrong token literal: expected %s, got %s\n", expected_str, expr->token.literal);
+    assertf(token_equals(ast, expr, expected_str), "wrong token literal: expected %s, got %.*s\n", expected_str, (int) strlen(expected_str), ast->source + ast->nodes[expr].pos);
 }
 
 void test_boolean_expression_parsing() {
@@ -244,27 +250,26 @@ void test_boolean_expression_parsing() {
 
         assert_parser_errors(&parser);
         assert_program_size(program, 1);
-        struct statement stmt = program->statements[0];
-
-        test_boolean_expression(stmt.value, tests[i].expected);
+        test_boolean_expression(&program->ast, statement(program, 0), tests[i].expected);
         free_program(program);
     }
 }
 
-void test_expression(struct expression *e, union expression_value expected) {
-    switch (e->type) {
-        case EXPR_BOOL: test_boolean_expression(e, expected.bool_value); break;
-        case EXPR_INT: test_integer_expression(e, expected.int_value); break;
-        case EXPR_IDENT: test_identifier_expression(e, expected.str_value); break;
+void test_expression(struct ast *ast, uint32_t e, union expression_value expected) {
+    switch (ast->nodes[e].type) {
+        case EXPR_BOOL: test_boolean_expression(ast, e, expected.bool_value); break;
+        case EXPR_INT: test_integer_expression(ast, e, expected.int_value); break;
+        case EXPR_IDENT: test_identifier_expression(ast, e, expected.str_value); break;
         default: break;
     }
 }
 
-void test_infix_expression(struct expression *expr, union expression_value left_value, enum operator operator, union expression_value right_value) {
-    assertf(expr->type == EXPR_INFIX, "wrong expression type. expected %d, got %d\n", EXPR_INFIX, expr->type);
-    test_expression(expr->infix.left, left_value);
-    assertf(expr->infix.operator == operator, "wrong operator: expected %d, got %d\n", operator, expr->infix.operator);
-    test_expression(expr->infix.right, right_value);
+void test_infix_expression(struct ast *ast, uint32_t expr, union expression_value left_value, enum operator operator, union expression_value right_value) {
+    struct node n = ast->nodes[expr];
+    assertf(n.type == EXPR_INFIX, "wrong expression type. expected %d, got %d\n", EXPR_INFIX, n.type);
+    test_expression(ast, n.lhs, left_value);
+    assertf(n.operator == operator, "wrong operator: expected %d, got %d\n", operator, n.operator);
+    test_expression(ast, n.rhs, right_value);
 }
 
 void test_infix_expression_parsing() {
@@ -295,8 +300,7 @@ void test_infix_expression_parsing() {
         struct program *program = parse_program(&parser);
         assert_parser_errors(&parser);
         assert_program_size(program, 1);
-        struct statement stmt = program->statements[0];
-        test_infix_expression(stmt.value, t.left_value, t.operator, t.right_value);
+        test_infix_expression(&program->ast, statement(program, 0), t.left_value, t.operator, t.right_value);
         free_program(program);   
     }
 }
@@ -323,11 +327,11 @@ void test_prefix_expression_parsing() {
 
         assert_parser_errors(&parser);
         assert_program_size(program, 1);
-        struct statement stmt = program->statements[0];
+        struct node n = program->ast.nodes[statement(program, 0)];
 
-        assertf(stmt.value->type == EXPR_PREFIX, "wrong expression type. expected %d, got %d\n", EXPR_PREFIX, stmt.value->type);
-        assertf(stmt.value->prefix.operator == t.operator, "wrong operator. expected %d, got %d\n", t.operator, stmt.value->prefix.operator);
-        test_expression(stmt.value->prefix.right, t.value); 
+        assertf(n.type == EXPR_PREFIX, "wrong expression type. expected %d, got %d\n", EXPR_PREFIX, n.type);
+        assertf(n.operator == t.operator, "wrong operator. expected %d, got %d\n", t.operator, n.operator);
+        test_expression(&program->ast, n.lhs, t.value); 
         free_program(program);       
     }
 }
@@ -391,20 +395,19 @@ void test_if_expression_parsing() {
     assert_parser_errors(&parser);
     assert_program_size(program, 1);
 
-    struct statement stmt = program->statements[0];
-    struct expression *expr = stmt.value;
-    assertf (expr->type == EXPR_IF, "invalid statement type: expected %d, got %d\n", EXPR_IF, stmt.type);
+    struct ast *ast = &program->ast;
+    uint32_t expr = statement(program, 0);
+    assertf (ast->nodes[expr].type == EXPR_IF, "invalid statement type: expected %d, got %d\n", EXPR_IF, ast->nodes[expr].type);
 
     union expression_value left = {.str_value = "x"};
     union expression_value right = {.str_value = "y"};
-    test_infix_expression(expr->ifelse.condition, left, OP_LT, right);
-
-    struct block_statement *consequence = expr->ifelse.consequence;
-    assertf(!!consequence, "expected consequence block statement, got NULL\n");
-    assertf(consequence->size == 1, "invalid consequence size: expected %d, got %d\n", 1, consequence->size);
-    assertf(consequence->statements[0].type == STMT_EXPR, "statements[0] is not a statement expression, got %d\n", consequence->statements[0].type);
-    test_identifier_expression(consequence->statements[0].value, "x");
-    assertf(!expr->ifelse.alternative, "expected NULL, got alternative block statement\n");
+    test_infix_expression(ast, ast->nodes[expr].lhs, left, OP_LT, right);
+
+    uint32_t consequence = ast_if_consequence(ast, expr);
+    assertf(consequence != AST_NONE, "expected consequence block statement, got AST_NONE\n");
+    assertf(block_size(ast, consequence) == 1, "invalid consequence size: expected %d, got %d\n", 1, block_size(ast, consequence));
+    test_identifier_expression(ast, block_statement(ast, consequence, 0), "x");
+    assertf(ast_if_alternative(ast, expr) == AST_NONE, "expected AST_NONE, got alternative block statement\n");
     free_program(program);
 }
 
@@ -416,23 +419,23 @@ void test_if_else_expression_parsing() {
     assert_parser_errors(&parser);
     assert_program_size(program, 1);
 
-    struct statement stmt = program->statements[0];
-    struct expression *expr = stmt.value;
-    assertf(expr->type == EXPR_IF, "invalid statement type: expected %d, got %d\n", EXPR_IF, stmt.type);
+    struct ast *ast = &program->ast;
+    uint32_t expr = statement(program, 0);
+    assertf(ast->nodes[expr].type == EXPR_IF, "invalid statement type: expected %d, got %d\n", EXPR_IF, ast->nodes[expr].type);
 
     union expression_value left = {.str_value = "x"};
     union expression_value right = {.str_value = "y"};
-    test_infix_expression(expr->ifelse.condition, left, OP_LT, right);
+    test_infix_expression(ast, ast->nodes[expr].lhs, left, OP_LT, right);
 
-    struct block_statement *consequence = expr->ifelse.consequence;
-    assertf(!!consequence, "expected consequence block statement, got NULL\n");
-    assertf(consequence->size == 1, "invalid consequence size: expected %d, got %d\n", 1, consequence->size);
-    assertf(consequence->statements[0].type == STMT_EXPR, "statements[0] is not a statement expression, got %d", consequence->statements[0].type);
-    test_identifier_expression(consequence->statements[0].value, "x");
+    uint32_t consequence = ast_if_consequence(ast, expr);
+    assertf(consequence != AST_NONE, "expected consequence block statement, got AST_NONE\n");
+    assertf(block_size(ast, consequence) == 1, "invalid consequence size: expected %d, got %d\n", 1, block_size(ast, consequence));
+    test_identifier_expression(ast, block_statement(ast, consequence, 0), "x");
 
-    struct block_statement *alternative = expr->ifelse.alternative;
-    assertf(alternative != NULL, "expected alternative, got NULL");
-    assertf(alternative->size == 1, "invalid alternative size: expected %d, got %d\n", 1, alternative->size);
+    uint32_t alternative = ast_if_alternative(ast, expr);
+    assertf(alternative != AST_NONE, "expected alternative, got AST_NONE");
+    assertf(block_size(ast, alternative) == 1, "invalid alternative size: expected %d, got %d\n", 1, block_size(ast, alternative));
+    test_integer_expression(ast, block_statement(ast, alternative, 0), 5);
     free_program(program);
 }
 
@@ -444,21 +447,24 @@ void test_function_literal_parsing() {
     assert_parser_errors(&parser);
     assert_program_size(program, 1);
 
-    struct statement stmt = program->statements[0];
-    assertf(stmt.type == STMT_EXPR, "invalid statement type. expected STMT_EXPR, got %d\n", stmt.type);
-
-    struct expression *expr = stmt.value;
-    assertf(expr->type == EXPR_FUNCTION, "invalid expression type: expected EXPR_FUNCTION, got %d\n", expr->type);
+    struct ast *ast = &program->ast;
+    uint32_t expr = statement(program, 0);
+    assertf(ast->nodes[expr].type == EXPR_FUNCTION, "invalid expression type: expected EXPR_FUNCTION, got %d\n", ast->nodes[expr].type);
     
-    assertf(expr->function.parameters.size == 2, "invalid param size: expected %d, got %d\n", 2, expr->function.parameters.size);
-    assertf(strcmp(expr->function.parameters.values[0].value, "x") == 0, "invalid parameter[0]: expected %s, got %s\n", "x", expr->function.parameters.values[0].value);
-    assertf(strcmp(expr->function.parameters.values[1].value, "y") == 0, "invalid parameter[0]: expected %s, got %s\n", "x", expr->function.parameters.values[1].value);
-    assertf(expr->function.body->size == 1, "invalid body size: expected %d, got %d\n", 1, expr->function.body->size);
+    uint32_t parameters = ast_function_parameters(ast, expr);
+    assertf(ast_list_size(ast, parameters) == 2, "invalid param size: expected %d, got %d\n", 2, ast_list_size(ast, parameters));
+    char *param = ast_string(ast, ast_list_item(ast, parameters, 0));
+    assertf(strcmp(param, "x") == 0, "invalid parameter[0]: expected %s, got %s\n", "x", param);
+    param = ast_string(ast, ast_list_item(ast, parameters, 1));
+    assertf(strcmp(param, "y") == 0, "invalid parameter[1]: expected %s, got %s\n", "y", param);
+
+    uint32_t body = ast->nodes[expr].rhs;
+    assertf(block_size(ast, body) == 1, "invalid body size: expected %d, got %d\n", 1, block_size(ast, body));
     
     union expression_value left = {.str_value = "x"};
     enum operator op = OP_ADD;
     union expression_value right = {.str_value = "y"};
-    test_infix_expression(expr->function.body->statements[0].value, left, op, right);
+    test_infix_expression(ast, block_statement(ast, body, 0), left, op, right);
     free_program(program);
 }
 
@@ -470,13 +476,12 @@ void test_call_expression_parsing() {
     assert_parser_errors(&parser);
     assert_program_size(program, 1);
 
-    struct statement stmt = program->statements[0];
-    assertf(stmt.type == STMT_EXPR, "invalid statement type. expected STMT_EXPR, got %d\n", stmt.type);
-
-    struct expression *expr = stmt.value;
-    assertf(expr->type == EXPR_CALL, "invalid expression type: expected EXPR_CALL, got %d\n", expr->type);
-    test_identifier_expression(expr->call.function, "add");
-    assertf(expr->call.arguments.size == 3, "expected 3 arguments, got %d\n", expr->call.arguments.size);
+    struct ast *ast = &program->ast;
+    uint32_t expr = statement(program, 0);
+    assertf(ast->nodes[expr].type == EXPR_CALL, "invalid expression type: expected EXPR_CALL, got %d\n", ast->nodes[expr].type);
+    test_identifier_expression(ast, ast->nodes[expr].lhs, "add");
+    uint32_t arguments = ast->nodes[expr].rhs;
+    assertf(ast_list_size(ast, arguments) == 3, "expected 3 arguments, got %d\n", ast_list_size(ast, arguments));
 
 
     struct {
@@ -497,16 +502,16 @@ void test_call_expression_parsing() {
         },
     };
 
-    test_integer_expression(expr->call.arguments.values[0], tests[0].left.int_value);
-    test_infix_expression(expr->call.arguments.values[1], tests[1].left, tests[1].op, tests[1].right);
-    test_infix_expression(expr->call.arguments.values[2], tests[2].left, tests[2].op, tests[2].right);
+    test_integer_expression(ast, ast_list_item(ast, arguments, 0), tests[0].left.int_value);
+    test_infix_expression(ast, ast_list_item(ast, arguments, 1), tests[1].left, tests[1].op, tests[1].right);
+    test_infix_expression(ast, ast_list_item(ast, arguments, 2), tests[2].left, tests[2].op, tests[2].right);
     free_program(program);
 }
 
 
-void test_string_literal(struct expression *expr, char *expected) {
-    assertf(expr->type == EXPR_STRING, "wrong expression type: expected EXPR_STRING, got %s", expr->type);
-    assertf(strcmp(expr->string, expected) == 0, "wrong expression value: expected \"%s\", got %s", expected, expr->string);
+void test_string_literal(struct ast *ast, uint32_t expr, char *expected) {
+    assertf(ast->nodes[expr].type == EXPR_STRING, "wrong expression type: expected EXPR_STRING, got %d", ast->nodes[expr].type);
+    assertf(strcmp(ast_string(ast, ast->nodes[expr].lhs), expected) == 0, "wrong expression value: expected \"%s\", got %s", expected, ast_string(ast, ast->nodes[expr].lhs));
 }
 
 void test_string_expression_parsing() {
@@ -517,10 +522,9 @@ void test_string_expression_parsing() {
     assert_parser_errors(&parser);
     assert_program_size(program, 1);
 
-    struct statement stmt = program->statements[0];
-    assertf(stmt.token.type == TOKEN_STRING, "wroken token type: expected %s, got %s", token_type_to_str(TOKEN_STRING), stmt.token.type);
-    assertf (strcmp(stmt.token.literal, "hello world") == 0, "wrong token literal: expected %s, got %s", "hello world", stmt.token.literal);
-    test_string_literal(stmt.value, "hello world");
+    uint32_t expr = statement(program, 0);
+    assertf (token_equals(&program->ast, expr, "\"hello world\""), "wrong token literal: expected %s, got %.13s", "\"hello world\"", input + program->ast.nodes[expr].pos);
+    test_string_literal(&program->ast, expr, "hello world");
     free_program(program);
 }
 
@@ -532,15 +536,16 @@ void test_array_literal_parsing() {
     assert_parser_errors(&parser);
     assert_program_size(program, 1);
 
-    struct statement stmt = program->statements[0];
-    assertf(stmt.value->type == EXPR_ARRAY, "wrong expression type: expected EXPR_ARRAY, got %s", stmt.value->type);
+    struct ast *ast = &program->ast;
+    uint32_t expr = statement(program, 0);
+    assertf(ast->nodes[expr].type == EXPR_ARRAY, "wrong expression type: expected EXPR_ARRAY, got %d", ast->nodes[expr].type);
 
-    struct expression_list array = stmt.value->array;
-    assertf(array.size == 4, "wrong array size: expected 4, got %d", array.size);
+    uint32_t array = ast->nodes[expr].lhs;
+    assertf(ast_list_size(ast, array) == 4, "wrong array size: expected 4, got %d", ast_list_size(ast, array));
 
-    test_integer_expression(array.values[0], 1);
+    test_integer_expression(ast, ast_list_item(ast, array, 0), 1);
     // TODO: Test infix expressions as well
-    test_string_literal(array.values[3], "four");
+    test_string_literal(ast, ast_list_item(ast, array, 3), "four");
     free_program(program);
 }
 
@@ -553,16 +558,15 @@ void test_index_expression_parsing() {
     assert_parser_errors(&parser);
     assert_program_size(program, 1);
 
-    struct statement stmt = program->statements[0];
-    assertf(stmt.value->type == EXPR_INDEX, "wrong expression type: expected EXPR_INDEX, got %s", stmt.value->type);
-
-    struct index_expression expr = stmt.value->index;
-    test_identifier_expression(expr.left, "myArray");
+    struct ast *ast = &program->ast;
+    struct node expr = ast->nodes[statement(program, 0)];
+    assertf(expr.type == EXPR_INDEX, "wrong expression type: expected EXPR_INDEX, got %d", expr.type);
+    test_identifier_expression(ast, expr.lhs, "myArray");
 
     union expression_value left = {.int_value = 1};
     union expression_value right = {.int_value = 2};
 
-    test_infix_expression(expr.index, left, OP_ADD, right);
+    test_infix_expression(ast, expr.rhs, left, OP_ADD, right);
     free_program(program);
 }
 
@@ -576,19 +580,18 @@ void test_while_expression_parsing() {
     assert_parser_errors(&parser);
     assert_program_size(program, 1);
 
-    struct statement stmt = program->statements[0];
-    struct expression *expr = stmt.value;
-    assertf (expr->type == EXPR_WHILE, "invalid statement type: expected %d, got %d\n", EXPR_WHILE, stmt.type);
+    struct ast *ast = &program->ast;
+    struct node expr = ast->nodes[statement(program, 0)];
+    assertf (expr.type == EXPR_WHILE, "invalid statement type: expected %d, got %d\n", EXPR_WHILE, expr.type);
 
     union expression_value left = {.str_value = "x"};
     union expression_value right = {.str_value = "y"};
-    test_infix_expression(expr->whilst.condition, left, OP_LT, right);
+    test_infix_expression(ast, expr.lhs, left, OP_LT, right);
 
-    struct block_statement *body = expr->whilst.body;
-    assertf(!!body, "expected consequence block statement, got NULL\n");
-    assertf(body->size == 1, "invalid consequence size: expected %d, got %d\n", 1, body->size);
-    assertf(body->statements[0].type == STMT_EXPR, "statements[0] is not a statement expression, got %d\n", body->statements[0].type);
-    test_identifier_expression(body->statements[0].value, "x");
+    uint32_t body = expr.rhs;
+    assertf(body != AST_NONE, "expected body block statement, got AST_NONE\n");
+    assertf(block_size(ast, body) == 1, "invalid body size: expected %d, got %d\n", 1, block_size(ast, body));
+    test_identifier_expression(ast, block_statement(ast, body, 0), "x");
     free_program(program);
 }
 
@@ -602,16 +605,121 @@ void test_function_literal_with_name() {
     assert_parser_errors(&parser);
     assert_program_size(program, 1);
 
-    struct statement stmt = program->statements[0];
-    struct expression *expr = stmt.value;
-    assertf(expr->type == EXPR_FUNCTION, "invalid statement type: expected %d, got %d\n", EXPR_FUNCTION, stmt.type);
-    assertf(strcmp(expr->function.name, "myFunction") == 0, "wrong function name: expected myFunction, got %s", expr->function.name);
+    struct ast *ast = &program->ast;
+    uint32_t expr = ast->nodes[statement(program, 0)].rhs;
+    assertf(ast->nodes[expr].type == EXPR_FUNCTION, "invalid expression type: expected %d, got %d\n", EXPR_FUNCTION, ast->nodes[expr].type);
+    char *name = ast_string(ast, ast_function_name(ast, expr));
+    assertf(strcmp(name, "myFunction") == 0, "wrong function name: expected myFunction, got %s", name);
+    free_program(program);
+
+}
+
+void test_function_body_pre_parsing() {
+    TESTNAME(__FUNCTION__);
+
+    char *input = "let f = fn(x, y) { let g = fn(z) { z * (x + [1, 2][0]) }; g(\"}\") }; f(1, 2);";
+    struct lexer lexer = new_lexer(input);
+    struct parser parser = new_parser(&lexer);
+    parser.pre_parse = true;
+    struct program *program = parse_program(&parser);
+    assert_parser_errors(&parser);
+    assert_program_size(program, 2);
+
+    struct ast *ast = &program->ast;
+    uint32_t f = ast->nodes[statement(program, 0)].rhs;
+    uint32_t parameters = ast_function_parameters(ast, f);
+    assertf(ast_list_size(ast, parameters) == 2, "invalid param size: expected %d, got %d\n", 2, ast_list_size(ast, parameters));
+    assertf(ast->nodes[f].rhs == AST_NONE, "function body was parsed up front");
+    assertf(ast->strings_size == 4, "names in the body were interned up front: expected %d strings, got %d", 4, ast->strings_size);
+    uint32_t call = statement(program, 1);
+    assertf(ast->nodes[call].type == EXPR_CALL, "invalid expression type after function: expected EXPR_CALL, got %d", ast->nodes[call].type);
+
+    assertf(parse_function_body(ast, f) == 0, "function body has errors");
+    uint32_t body = ast->nodes[f].rhs;
+    assertf(block_size(ast, body) == 2, "invalid body size: expected %d, got %d\n", 2, block_size(ast, body));
+    uint32_t g = ast->nodes[block_statement(ast, body, 0)].rhs;
+    assertf(ast->nodes[g].type == EXPR_FUNCTION, "invalid expression type: expected EXPR_FUNCTION, got %d\n", ast->nodes[g].type);
+    assertf(ast->nodes[g].rhs == AST_NONE, "nested function body was parsed up front");
+    assertf(parse_function_body(ast, g) == 0, "nested function body has errors");
+    assertf(block_size(ast, ast->nodes[g].rhs) == 1, "invalid body size: expected %d, got %d\n", 1, block_size(ast, ast->nodes[g].rhs));
+
+    char str[256] = {'\0'};
+    node_to_str(str, ast, body);
+    assertf(strcmp(str, "let g = fn<g>(z) (z * (x + ([1, 2][0])));g(})") == 0, "wrong body: got %s", str);
+    free_program(program);
 
+    // bodies are checked for syntax errors up front, only their nodes wait until they are needed
+    char *invalid[] = {
+        "fn() { (1 + 2 }",
+        "fn() { 1 + 2",
+        "fn() { 1 # 2 }",
+        "fn() { let = 1; }",
+        "let f = fn(x) { x + }; 5;",
+        "fn() { let g = fn() { return; }; g() }",
+    };
+    for (int i=0; i < ARRAY_SIZE(invalid); i++) {
+        struct lexer lexer = new_lexer(invalid[i]);
+        struct parser parser = new_parser(&lexer);
+        parser.pre_parse = true;
+        struct program *program = parse_program(&parser);
+        assertf(parser.errors > 0, "expected parser errors for %s", invalid[i]);
+        free_program(program);
+    }
+}
+
+void test_long_block_statement() {
+    TESTNAME(__FUNCTION__);
+
+    // lists are collected on the parser's scratch stack, this block outgrows its first allocation
+    char input[4096] = "fn() { ";
+    for (int i=0; i < 100; i++) {
+        sprintf(input + strlen(input), "let %c%c = %d; ", 'a' + i / 26, 'a' + i % 26, i);
+    }
+    strcat(input, "at; }");
+
+    struct lexer lexer = new_lexer(input);
+    struct parser parser = new_parser(&lexer);
+    struct program *program = parse_program(&parser);
+    assert_parser_errors(&parser);
+    assert_program_size(program, 1);
+    struct ast *ast = &program->ast;
+    uint32_t body = ast->nodes[statement(program, 0)].rhs;
+    assertf(block_size(ast, body) == 101, "invalid body size: expected %d, got %d\n", 101, block_size(ast, body));
+    for (int i=0; i < 100; i++) {
+        char name[8];
+        sprintf(name, "%c%c", 'a' + i / 26, 'a' + i % 26);
+        struct node let = ast->nodes[block_statement(ast, body, i)];
+        test_identifier_expression(ast, let.lhs, name);
+        test_integer_expression(ast, let.rhs, i);
+    }
+    test_identifier_expression(ast, block_statement(ast, body, 100), "at");
+    free_program(program);
+}
+
+void test_string_interning() {
+    TESTNAME(__FUNCTION__);
+
+    // names are stored once per program and are not cut off at any length
+    char *input = "let aVeryLongNameThatUsedToBeTruncatedAfterThirtyOneCharacters = 1; aVeryLongNameThatUsedToBeTruncatedAfterThirtyOneCharacters + \"aVeryLongNameThatUsedToBeTruncatedAfterThirtyOneCharacters\";";
+    struct program *program = parse_program_str(input);
+    struct ast *ast = &program->ast;
+    assert_program_size(program, 2);
+
+    uint32_t let = statement(program, 0);
+    uint32_t infix = statement(program, 1);
+    uint32_t name = ast->nodes[let].lhs;
+    assertf(strcmp(ast_string(ast, name), "aVeryLongNameThatUsedToBeTruncatedAfterThirtyOneCharacters") == 0, "wrong name: got %s", ast_string(ast, name));
+    assertf(ast->nodes[ast->nodes[infix].lhs].lhs == name, "identifier was not interned");
+    assertf(ast->nodes[ast->nodes[infix].rhs].lhs == name, "string literal was not interned");
+    assertf(ast_intern(ast, "other", 5) != name, "different strings share an index");
+    assertf(ast_intern(ast, "", 0) == 0, "empty string is not index 0");
+    free_program(program);
 }
 
 int main() {
     test_let_statements();
     test_return_statements();
+    test_import_statements();
     test_program_string();
     test_identifier_expression_parsing();
     test_integer_expression_parsing();
@@ -628,5 +736,8 @@ int main() {
     test_index_expression_parsing();
     test_while_expression_parsing();
     test_function_literal_with_name();
+    test_function_body_pre_parsing();
+    test_long_block_statement();
+    test_string_interning();
     printf("\x1b[32mAll parsing tests passed!\033[0m\n");
 }
@@ -0,0 +1,176 @@
+#define _DEFAULT_SOURCE
+#include <stdbool.h>
+#include <unistd.h>
+#include "test_helpers.h"
+#include "vm.h"
+#include "compiler.h"
+#include "verifier.h"
+#include "project.h"
+
+struct object run_bytecode_test(struct compiler *c) {
+    struct bytecode *bc = get_bytecode(c);
+    struct vm *vm = vm_new(bc);
+    assertf(vm != NULL, "invalid bytecode: %s", verifier_error_str(verify_bytecode(bc)));
+    int err = vm_run(vm);
+    assertf(err == 0, "vm error: %d", err);
+    struct object obj = vm_stack_last_popped(vm);
+    free(bc);
+    vm_free(vm);
+    return obj;
+}
+
+/* compiles every input as a unit and links them in order, returns the first link error */
+int link_units(struct compiler *c, char **inputs, struct program **programs) {
+    int link_err = 0;
+    for (int i=0; inputs[i] != NULL; i++) {
+        struct compiler *unit = compiler_new_unit();
+        programs[i] = parse_program_str(inputs[i]);
+        int err = compile_program(unit, programs[i]);
+        assertf(err == 0, "compiler error in unit %d: %s", i, compiler_error_str(err));
+        if (!link_err) {
+            link_err = compiler_link(c, unit);
+        }
+        compiler_free(unit);
+    }
+    return link_err;
+}
+
+void test_linking() {
+    TESTNAME(__FUNCTION__);
+
+    // a unit with enough constants to push those of the next one out of the short form
+    char many_constants[8192] = "";
+    for (int i=0; i < 300; i++) {
+        sprintf(many_constants + strlen(many_constants), "let %c%c = %d;", 'a' + i / 26, 'a' + i % 26, 1000 + i);
+    }
+
+    struct {
+        char *inputs[4];
+        enum object_type type;
+        union object_value expected;
+    } tests[] = {
+        {{"let a = 1; let f = fn(x) { x + a };", "let b = f(2) * 10; b"}, OBJ_INT, {.integer = 30}},
+        {{"let double = fn(x) { x * 2 }; let y = double(21);", "y"}, OBJ_INT, {.integer = 42}},
+        {{"let s = \"mon\";", "let t = s + \"key\"; t"}, OBJ_STRING, {.string = "monkey"}},
+        {{"let x = 1;", "let y = x; let x = 5;", "y * 10 + x"}, OBJ_INT, {.integer = 15}},
+        {{"let f = fn() { g() + 1 };", "let g = fn() { 41 }; f()"}, OBJ_INT, {.integer = 42}},
+        {{"let f = fn(g) { g() }; let h = fn() { 1 };", "let k = fn() { 2 };", "f(h) + f(k) + f(h)"}, OBJ_INT, {.integer = 4}},
+        {{many_constants, "if (ln > 0) { \"big\" } else { \"small\" }"}, OBJ_STRING, {.string = "big"}},
+        {{"let n = 4;", "let fib = fn(n) { if (n < 2) { return n; } fib(n - 1) + fib(n - 2) }; fib(n + 6)"}, OBJ_INT, {.integer = 55}},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        struct program *programs[4];
+        struct compiler *c = compiler_new();
+        int err = link_units(c, tests[t].inputs, programs);
+        assertf(err == 0, "test %d: link error: %s", t, compiler_error_str(err));
+
+        struct object obj = run_bytecode_test(c);
+        assertf(obj.type == tests[t].type, "test %d: wrong type: expected %s, got %s", t, object_type_to_str(tests[t].type), object_type_to_str(obj.type));
+        if (obj.type == OBJ_INT) {
+            assertf(obj.value.integer == tests[t].expected.integer, "test %d: expected %ld, got %ld", t, tests[t].expected.integer, obj.value.integer);
+        } else {
+            assertf(strcmp(obj.value.string, tests[t].expected.string) == 0, "test %d: expected %s, got %s", t, tests[t].expected.string, obj.value.string);
+        }
+
+        compiler_free(c);
+        for (int i=0; tests[t].inputs[i] != NULL; i++) {
+            free_program(programs[i]);
+        }
+    }
+
+    // units only see the globals of the ones linked before them
+    char *errors[][3] = {
+        {"missing"},
+        {"let a = b;", "let b = 1;"},
+        {"let a = 1;", "let b = a + c;"},
+    };
+    for (int t=0; t < ARRAY_SIZE(errors); t++) {
+        struct program *programs[3];
+        struct compiler *c = compiler_new();
+        int err = link_units(c, errors[t], programs);
+        assertf(err == COMPILE_ERR_UNKNOWN_IDENTIFIER, "error test %d: expected %s, got %s", t, compiler_error_str(COMPILE_ERR_UNKNOWN_IDENTIFIER), compiler_error_str(err));
+        compiler_free(c);
+        for (int i=0; errors[t][i] != NULL; i++) {
+            free_program(programs[i]);
+        }
+    }
+}
+
+void test_project() {
+    TESTNAME(__FUNCTION__);
+
+    // a chain of files, each adding to the total of the one before
+    char *paths[24];
+    char content[256];
+    strcpy(content, "let ta = 0; let add = fn(a, b) { a + b };");
+    paths[0] = write_temp_file(content, strlen(content));
+    for (int i=1; i < ARRAY_SIZE(paths) - 1; i++) {
+        sprintf(content, "let t%c = add(t%c, %d); let get%c = fn() { t%c };", 'a' + i, 'a' + i - 1, i, 'a' + i, 'a' + i);
+        paths[i] = write_temp_file(content, strlen(content));
+    }
+    sprintf(content, "t%c", (int) ('a' + ARRAY_SIZE(paths) - 2));
+    paths[ARRAY_SIZE(paths) - 1] = write_temp_file(content, strlen(content));
+
+    unsigned int threads[] = {1, 4, 0};
+    for (int t=0; t < ARRAY_SIZE(threads); t++) {
+        struct project *p = project_new(paths, ARRAY_SIZE(paths));
+        struct compiler *c = compiler_new();
+        unsigned int failed;
+        int err = project_compile(p, c, threads[t], &failed);
+        assertf(err == 0, "[%d threads] project error %d in file %d", threads[t], err, failed);
+
+        struct object obj = run_bytecode_test(c);
+        assertf(obj.type == OBJ_INT && obj.value.integer == 253, "[%d threads] expected 253, got %s %ld", threads[t], object_type_to_str(obj.type), obj.value.integer);
+        assertf(compile_function_stubs(c) == 0, "[%d threads] could not compile functions", threads[t]);
+
+        compiler_free(c);
+        project_free(p);
+    }
+
+    // the first file that fails, in order, is reported
+    strcpy(content, "let = 1;");
+    char *broken = write_temp_file(content, strlen(content));
+    strcpy(content, "let x = nothing;");
+    char *unknown = write_temp_file(content, strlen(content));
+    strcpy(content, "let f = fn() { nowhere };");
+    char *unknown_in_function = write_temp_file(content, strlen(content));
+    struct {
+        char *paths[3];
+        int expected_err;
+        unsigned int expected_file;
+    } errors[] = {
+        {{paths[0], "/tmp/monkey_project_does_not_exist", broken}, PROJECT_ERR_IO, 1},
+        {{paths[0], broken, unknown}, PROJECT_ERR_PARSE, 1},
+        {{paths[0], unknown, broken}, PROJECT_ERR_LINK, 1},
+        {{unknown, paths[0], paths[1]}, PROJECT_ERR_LINK, 0},
+        {{paths[0], unknown_in_function, paths[1]}, PROJECT_ERR_LINK, 1},
+    };
+    for (int t=0; t < ARRAY_SIZE(errors); t++) {
+        struct project *p = project_new(errors[t].paths, 3);
+        struct compiler *c = compiler_new();
+        unsigned int failed;
+        int err = project_compile(p, c, 3, &failed);
+        assertf(err == errors[t].expected_err, "error test %d: expected error %d, got %d", t, errors[t].expected_err, err);
+        assertf(failed == errors[t].expected_file, "error test %d: expected file %d to fail, got %d", t, errors[t].expected_file, failed);
+        compiler_free(c);
+        project_free(p);
+    }
+
+    for (int i=0; i < ARRAY_SIZE(paths); i++) {
+        unlink(paths[i]);
+        free(paths[i]);
+    }
+    unlink(broken);
+    unlink(unknown);
+    unlink(unknown_in_function);
+    free(broken);
+    free(unknown);
+    free(unknown_in_function);
+}
+
+int main() {
+    test_linking();
+    test_project();
+    printf("\x1b[32mAll project tests passed!\033[0m\n");
+}
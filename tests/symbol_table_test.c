@@ -116,11 +116,64 @@ void test_shadowing_function_name() {
     assertf(s->scope == expected.scope, "wrong scope: expected %d, got %d", expected.scope, s->scope);
 }
 
+void test_many_symbols() {
+    TESTNAME(__FUNCTION__);
+
+    // names that do not start with a lowercase letter, and enough of them to make both tables grow
+    static char names[3000][8];
+    char first[] = "aZ_m";
+    for (int i=0; i < ARRAY_SIZE(names); i++) {
+        sprintf(names[i], "%c%d", first[i % 4], i);
+    }
+
+    struct symbol_table *global = symbol_table_new();
+    struct symbol_table *local = symbol_table_new_enclosed(global);
+    for (int i=0; i < ARRAY_SIZE(names); i++) {
+        symbol_table_define(i % 3 ? global : local, names[i]);
+    }
+
+    // redefining a name gives it a new index
+    char redefined[8];
+    strcpy(redefined, names[1]);
+    struct symbol *s = symbol_table_define(global, redefined);
+    assertf(s->index == global->size - 1, "wrong index: expected %d, got %d", global->size - 1, s->index);
+
+    // and remembers the index it had before
+    assertf(symbol_table_replaced(global, s->index) == 0, "wrong replaced index: expected %d, got %d", 0, symbol_table_replaced(global, s->index));
+    assertf(symbol_table_replaced(global, 0) == -1, "expected -1 for a symbol that replaced none, got %d", symbol_table_replaced(global, 0));
+
+    int globals = 0;
+    int locals = 0;
+    for (int i=0; i < ARRAY_SIZE(names); i++) {
+        struct symbol expected = { .name = names[i], .scope = i % 3 ? SCOPE_GLOBAL : SCOPE_LOCAL, .index = i % 3 ? globals++ : locals++ };
+        if (i == 1) {
+            expected.index = global->size - 1;
+        }
+
+        // look up by a copy of the name, not the pointer it was defined with
+        char name[8];
+        strcpy(name, names[i]);
+        s = symbol_table_resolve(local, name);
+        assertf(s != NULL, "expected symbol %s, got NULL", name);
+        assertf(strcmp(s->name, expected.name) == 0, "wrong name: expected %s, got %s", expected.name, s->name);
+        assertf(s->index == expected.index, "%s: wrong index: expected %d, got %d", name, expected.index, s->index);
+        assertf(s->scope == expected.scope, "%s: wrong scope: expected %d, got %d", name, expected.scope, s->scope);
+    }
+
+    assertf(symbol_table_resolve(local, "b1") == NULL, "expected NULL for undefined symbol");
+    assertf(global->size == globals + 1, "wrong size: expected %d, got %d", globals + 1, global->size);
+    assertf(local->size == locals, "wrong size: expected %d, got %d", locals, local->size);
+
+    symbol_table_free(local);
+    symbol_table_free(global);
+}
+
 int main() {
     test_define();
     test_resolve_global();
     test_resolve_local();
     test_define_and_resolve_function_name();
     test_shadowing_function_name();
+    test_many_symbols();
     printf("\x1b[32mAll symbol table tests passed!\033[0m\n");
 }
\ No newline at end of file
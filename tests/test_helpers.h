@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 
 #define assertf(assertion, fmt, ...) _assertf(assertion, __FILE__, __LINE__, __FUNCTION__, fmt, ##__VA_ARGS__)
@@ -32,4 +33,52 @@ void _assertf(int assertion, const char filename[64], const int line, const char
     exit(1);
 }
 
+// files need POSIX, tests using them define _DEFAULT_SOURCE before including anything
+#ifdef _DEFAULT_SOURCE
+#include <unistd.h>
+
+/* writes size bytes to the file at path, creating or truncating it */
+void write_file(char *path, const void *bytes, size_t size) {
+    FILE *f = fopen(path, "wb");
+    assertf(f != NULL, "could not create %s", path);
+    assertf(fwrite(bytes, 1, size, f) == size, "could not write %s", path);
+    fclose(f);
+}
+
+/* writes size bytes to a new temporary file and returns its malloc'd path, the caller has to unlink and free it */
+char *write_temp_file(const void *bytes, size_t size) {
+    char *path = strdup("/tmp/monkey_test_XXXXXX");
+    assertf(path != NULL, "out of memory");
+    int fd = mkstemp(path);
+    assertf(fd >= 0, "could not create temporary file");
+    close(fd);
+    write_file(path, bytes, size);
+    return path;
+}
+
+/* a valid file with one byte overwritten, or cut short if value is -1, and the error loading it should fail with */
+struct corrupt_file_test {
+    char *name;
+    unsigned int pos;   // byte to overwrite, or the size to truncate to
+    int value;
+    int expected_err;
+};
+
+/* writes the corrupted copy of the size bytes in valid to a temporary file, see write_temp_file */
+char *write_corrupt_file(const uint8_t *valid, size_t size, struct corrupt_file_test *t) {
+    uint8_t *buf = malloc(size);
+    assertf(buf != NULL, "out of memory");
+    memcpy(buf, valid, size);
+    if (t->value == -1) {
+        size = t->pos;
+    } else {
+        buf[t->pos] = t->value;
+    }
+
+    char *path = write_temp_file(buf, size);
+    free(buf);
+    return path;
+}
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include "test_helpers.h"
+#include "verifier.h"
+#include "vm.h"
+
+struct verifier_test_case {
+    struct instruction *instructions[16];
+    unsigned int instructions_size;
+    struct object *constants[4];
+    unsigned int constants_size;
+    unsigned int call_sites;
+    int expected_err;
+};
+
+void run_verifier_test(struct verifier_test_case t) {
+    struct bytecode bc = {
+        .instructions = flatten_instructions_array(t.instructions, t.instructions_size),
+        .constants = make_object_list(t.constants_size),
+        .call_sites = t.call_sites,
+    };
+    for (int i=0; i < t.constants_size; i++) {
+        object_list_append(bc.constants, t.constants[i]);
+    }
+
+    int err = verify_bytecode(&bc);
+    assertf(err == t.expected_err, "wrong error: expected \"%s\", got \"%s\"", verifier_error_str(t.expected_err), verifier_error_str(err));
+
+    free_instruction(bc.instructions);
+}
+
+void test_valid_bytecode() {
+    TESTNAME(__FUNCTION__);
+
+    // if (true) { 10 } else { 20 }; 1 + 2
+    struct verifier_test_case t = {
+        .instructions = {
+            make_instruction(OPCODE_TRUE),
+            make_instruction(OPCODE_JUMP_NOT_TRUE, 13),
+            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_JUMP, 15),
+            make_instruction(OPCODE_CONST, 1),
+            make_instruction(OPCODE_POP),
+            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_CONST, 1),
+            make_instruction(OPCODE_ADD),
+            make_instruction(OPCODE_POP),
+        }, 10,
+        .constants = {
+            make_integer_object(10),
+            make_integer_object(20),
+        }, 2,
+        .expected_err = 0,
+    };
+    run_verifier_test(t);
+
+    // the same program with short jumps
+    struct verifier_test_case short_jumps = {
+        .instructions = {
+            make_instruction(OPCODE_TRUE),
+            make_instruction(OPCODE_JUMP_NOT_TRUE_SHORT, 4),
+            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_JUMP_SHORT, 2),
+            make_instruction(OPCODE_CONST, 1),
+            make_instruction(OPCODE_POP),
+        }, 6,
+        .constants = {
+            make_integer_object(10),
+            make_integer_object(20),
+        }, 2,
+        .expected_err = 0,
+    };
+    run_verifier_test(short_jumps);
+}
+
+void test_function_calls() {
+    TESTNAME(__FUNCTION__);
+    struct instruction *fn_body[] = {
+        make_instruction(OPCODE_GET_LOCAL, 0),
+        make_instruction(OPCODE_GET_LOCAL, 1),
+        make_instruction(OPCODE_GET_LOCAL, 0),
+        make_instruction(OPCODE_MULTIPLY),
+        make_instruction(OPCODE_ADD),
+        make_instruction(OPCODE_RETURN_VALUE),
+    };
+    struct object *fn = make_compiled_function_object(flatten_instructions_array(fn_body, 6), 2);
+    fn->value.compiled_function.num_parameters = 2;
+
+    struct verifier_test_case t = {
+        .instructions = {
+            make_instruction(OPCODE_CONST, 1),
+            make_instruction(OPCODE_CONST, 1),
+            make_instruction(OPCODE_CALL_CONST, 0, 2),
+            make_instruction(OPCODE_POP),
+        }, 4,
+        .constants = { fn, make_integer_object(3) }, 2,
+        .expected_err = 0,
+    };
+    run_verifier_test(t);
+}
+
+void test_invalid_bytecode() {
+    TESTNAME(__FUNCTION__);
+    struct object *fn = make_compiled_function_object(make_instruction(OPCODE_RETURN), 0);
+
+    struct verifier_test_case tests[] = {
+        {
+            .instructions = { make_instruction(OPCODE_TRUE), make_instruction(OPCODE_JUMP_NOT_TRUE, 2) }, 2,
+            .expected_err = VERIFY_ERR_INVALID_JUMP,
+        },
+        {
+            .instructions = { make_instruction(OPCODE_JUMP, 100) }, 1,
+            .expected_err = VERIFY_ERR_INVALID_JUMP,
+        },
+        {
+            .instructions = { make_instruction(OPCODE_TRUE), make_instruction(OPCODE_JUMP_NOT_TRUE_SHORT, 1) }, 2,
+            .expected_err = VERIFY_ERR_INVALID_JUMP,
+        },
+        {
+            .instructions = { make_instruction(OPCODE_GET_GLOBAL, 3) }, 1,
+            .expected_err = VERIFY_ERR_INVALID_GLOBAL,
+        },
+        {
+            .instructions = { make_instruction(OPCODE_CONST, 1) }, 1,
+            .constants = { make_integer_object(1) }, 1,
+            .expected_err = VERIFY_ERR_INVALID_CONSTANT,
+        },
+        {
+            .instructions = { make_instruction(OPCODE_GET_GLOBAL, STACK_SIZE) }, 1,
+            .expected_err = VERIFY_ERR_INVALID_GLOBAL,
+        },
+        {
+            .instructions = { make_instruction(OPCODE_GET_LOCAL, 0) }, 1,
+            .expected_err = VERIFY_ERR_INVALID_LOCAL,
+        },
+        {
+            .instructions = { make_instruction(OPCODE_NULL), make_instruction(OPCODE_CALL, 0, 0) }, 2,
+            .expected_err = VERIFY_ERR_INVALID_CALL,
+        },
+        {
+            .instructions = { make_instruction(OPCODE_NULL), make_instruction(OPCODE_CALL_CONST, 0, 1) }, 2,
+            .constants = { fn }, 1,
+            .expected_err = VERIFY_ERR_INVALID_CALL,
+        },
+        {
+            .instructions = { make_instruction(OPCODE_TRUE), make_instruction(OPCODE_ADD) }, 2,
+            .expected_err = VERIFY_ERR_STACK_UNDERFLOW,
+        },
+        {
+            // only one branch pushes a value before the paths meet
+            .instructions = {
+                make_instruction(OPCODE_TRUE),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 7),
+                make_instruction(OPCODE_NULL),
+                make_instruction(OPCODE_NULL),
+            }, 4,
+            .expected_err = VERIFY_ERR_STACK_MISMATCH,
+        },
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        run_verifier_test(tests[t]);
+    }
+
+    // raw bytes that make_instruction would not produce
+    struct {
+        uint8_t bytes[8];
+        unsigned int size;
+        int expected_err;
+    } raw_tests[] = {
+        { {OPCODE_COUNT}, 1, VERIFY_ERR_INVALID_OPCODE },
+        { {OPCODE_CONST, 0}, 2, VERIFY_ERR_TRUNCATED_INSTRUCTION },
+        { {OPCODE_WIDE, OPCODE_ADD}, 2, VERIFY_ERR_INVALID_OPCODE },
+        { {OPCODE_WIDE, OPCODE_WIDE}, 2, VERIFY_ERR_INVALID_OPCODE },
+        { {OPCODE_WIDE, OPCODE_CONST, 0, 0}, 4, VERIFY_ERR_TRUNCATED_INSTRUCTION },
+        { {OPCODE_WIDE}, 1, VERIFY_ERR_TRUNCATED_INSTRUCTION },
+        { {OPCODE_WIDE, OPCODE_CONST, 128, 0, 0, 0}, 6, VERIFY_ERR_INVALID_OPERAND },
+    };
+
+    for (int t=0; t < ARRAY_SIZE(raw_tests); t++) {
+        struct instruction ins = {
+            .bytes = raw_tests[t].bytes,
+            .size = raw_tests[t].size,
+            .cap = raw_tests[t].size,
+        };
+        struct bytecode bc = {
+            .instructions = &ins,
+            .constants = make_object_list(0),
+        };
+        int err = verify_bytecode(&bc);
+        assertf(err == raw_tests[t].expected_err, "wrong error: expected \"%s\", got \"%s\"", verifier_error_str(raw_tests[t].expected_err), verifier_error_str(err));
+    }
+}
+
+int main() {
+    test_valid_bytecode();
+    test_function_calls();
+    test_invalid_bytecode();
+    printf("\x1b[32mAll verifier tests passed!\033[0m\n");
+}
@@ -1,7 +1,9 @@
 #include <stdbool.h>
+#include <stdarg.h>
 #include "test_helpers.h"
 #include "vm.h"
 #include "compiler.h"
+#include "verifier.h"
 
 void test_object(struct object obj, enum object_type type, union object_value value) {
     //assertf(obj != NULL, "expected object, got null");
@@ -24,14 +26,32 @@ void test_object(struct object obj, enum object_type type, union object_value va
     }
 }
 
+// set to compile the tests with compile_single_pass instead of going through the AST
+bool single_pass = false;
+
+struct program *compile_test_program(struct compiler *c, char *program_str) {
+    int err;
+    struct program *p;
+    if (single_pass) {
+        struct lexer lexer = new_lexer(program_str);
+        struct parser parser = new_parser(&lexer);
+        p = compile_single_pass(c, &parser, &err);
+        assertf(parser.errors == 0, "parser error: %s", parser.error_messages[0]);
+    } else {
+        p = parse_program_str(program_str);
+        err = compile_program(c, p);
+    }
+    assertf(err == 0, "compiler error%s: %s", single_pass ? " (single pass)" : "", compiler_error_str(err));
+    return p;
+}
+
 struct object run_vm_test(char *program_str) {
-    struct program *p = parse_program_str(program_str);
     struct compiler *c = compiler_new();
-    int err = compile_program(c, p);
-    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+    struct program *p = compile_test_program(c, program_str);
     struct bytecode *bc = get_bytecode(c);
     struct vm *vm = vm_new(bc);
-    err = vm_run(vm);
+    assertf(vm != NULL, "invalid bytecode: %s", verifier_error_str(verify_bytecode(bc)));
+    int err = vm_run(vm);
     assertf(err == 0, "vm error: %d", err);
     struct object obj = vm_stack_last_popped(vm);
 
@@ -300,6 +320,363 @@ void test_recursive_functions() {
      }
 }
 
+void test_constant_function_calls() {
+    TESTNAME(__FUNCTION__);
+    struct {
+        char *input;
+        int expected;
+    } tests[] = {
+        // folded at compile time
+        {"let fibonacci = fn(x) { if (x < 2) { return x; } fibonacci(x-1) + fibonacci(x-2) }; fibonacci(15);", 610},
+        {"let square = fn(x) { x * x }; let sumOfSquares = fn(a, b) { square(a) + square(b) }; sumOfSquares(3, -4);", 25},
+        {"let div = fn(a, b) { a / b }; div(7, 2);", 3},
+        // arguments are not constant
+        {"let fibonacci = fn(x) { if (x < 2) { return x; } fibonacci(x-1) + fibonacci(x-2) }; let n = 15; fibonacci(n);", 610},
+        {"let noReturn = fn(a) { }; let n = 1; noReturn(n); 5", 5},
+        // exceeds the compile-time step budget
+        {"let fibonacci = fn(x) { if (x < 2) { return x; } fibonacci(x-1) + fibonacci(x-2) }; fibonacci(25);", 75025},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        struct object obj = run_vm_test(tests[t].input);
+        test_object(obj, OBJ_INT, (union object_value) { .integer = tests[t].expected });
+     }
+}
+
+void test_direct_function_calls() {
+    TESTNAME(__FUNCTION__);
+    struct {
+        char *input;
+        int expected;
+    } tests[] = {
+        {"let n = 10; let sum = fn(a, b) { let c = a + b; c }; sum(n, sum(n, 1)) + n;", 31},
+        {"let n = 5; let countdown = fn(x) { if (x == 0) { return 0; } countdown(x - 1) }; countdown(n);", 0},
+        {"let n = 3; let inc = fn(x) { x + 1 }; let apply = fn(f, x) { f(x) }; apply(inc, n);", 4},
+        {"let n = 2; let outer = fn(x) { let inner = fn(y) { y * 2 }; inner(x) + 1 }; outer(n);", 5},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        struct object obj = run_vm_test(tests[t].input);
+        test_object(obj, OBJ_INT, (union object_value) { .integer = tests[t].expected });
+     }
+}
+
+void test_indirect_function_calls() {
+    TESTNAME(__FUNCTION__);
+    struct {
+        char *input;
+        int expected;
+    } tests[] = {
+        {"let n = 4; let apply = fn(f, x) { f(x) }; let inc = fn(x) { x + 1 }; let dbl = fn(x) { x * 2 }; apply(inc, n) + apply(dbl, n) + apply(inc, n);", 18},
+        {"let n = 3; let twice = fn(f, x) { f(f(x)) }; let sq = fn(x) { x * x }; twice(sq, n);", 81},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        struct object obj = run_vm_test(tests[t].input);
+        test_object(obj, OBJ_INT, (union object_value) { .integer = tests[t].expected });
+     }
+}
+
+void test_lazy_functions() {
+    TESTNAME(__FUNCTION__);
+    struct {
+        char *input;
+        int expected;
+    } tests[] = {
+        // functions are compiled on their first call, so a function may call one defined after it
+        {"let n = 11; let even = fn(x) { if (x == 0) { return true; } odd(x - 1) }; let odd = fn(x) { if (x == 0) { return false; } even(x - 1) }; if (odd(n)) { 1 } else { 0 }", 1},
+        // functions that are never called are never compiled
+        {"let unused = fn() { [1, 2] }; let n = 2; n * 21", 42},
+        // constants and call sites that only show up once a function is compiled
+        {"let n = 1; let apply = fn(f, x) { f(x) + 1000 }; let inc = fn(x) { x + 2000 }; apply(inc, n) + apply(fn(x) { x * 3000 }, n)", 7001},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        struct object obj = run_vm_test(tests[t].input);
+        test_object(obj, OBJ_INT, (union object_value) { .integer = tests[t].expected });
+    }
+}
+
+void test_functions_see_globals_bound_at_their_literal() {
+    TESTNAME(__FUNCTION__);
+    struct {
+        char *input;
+        int expected;
+    } tests[] = {
+        // names bound again after the literal keep referring to what they were bound to there, also for calls
+        {"let g = fn() { 1 }; let f = fn(x) { g() + x }; let h = f; let y = 0; let a = h(y); let g = fn() { 2 }; a", 1},
+        {"let x = 1; let f = fn() { x }; let h = f; let a = h(); let x = 2; a", 1},
+        {"let x = 1; let f = fn() { x }; let x = 2; let g = fn() { x }; let h = f; h() * 10 + g()", 12},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        struct object obj = run_vm_test(tests[t].input);
+        test_object(obj, OBJ_INT, (union object_value) { .integer = tests[t].expected });
+    }
+
+    // names that are not defined anywhere are reported for the whole program, even in functions that are never called
+    char *errors[] = {
+        "let f = fn() { undefined_name }; 1",
+        "let f = fn() { let g = fn(x) { x + undefined_name }; 1 }; 1",
+    };
+    for (int t=0; t < ARRAY_SIZE(errors); t++) {
+        struct compiler *c = compiler_new();
+        int err;
+        struct program *p;
+        if (single_pass) {
+            struct lexer lexer = new_lexer(errors[t]);
+            struct parser parser = new_parser(&lexer);
+            p = compile_single_pass(c, &parser, &err);
+        } else {
+            p = parse_program_str(errors[t]);
+            err = compile_program(c, p);
+        }
+        assertf(err == COMPILE_ERR_UNKNOWN_IDENTIFIER, "test %d: expected unknown identifier error, got %s", t, compiler_error_str(err));
+        compiler_free(c);
+        free_program(p);
+    }
+}
+
+void test_pre_parsed_functions() {
+    TESTNAME(__FUNCTION__);
+    struct {
+        char *input;
+        int expected;
+        int expected_err;
+    } tests[] = {
+        {"let unused = fn() { 1 }; let f = fn(x) { let g = fn(y) { y * 2 }; g(x) + 1 }; let n = 20; f(n);", 41, 0},
+        {"let broken = fn(x) { [x] }; let n = 1; broken(n);", 0, 6},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        struct lexer lexer = new_lexer(tests[t].input);
+        struct parser parser = new_parser(&lexer);
+        parser.pre_parse = true;
+        struct program *p = parse_program(&parser);
+        assertf(parser.errors == 0, "parser error: %s", parser.error_messages[0]);
+
+        struct compiler *c = compiler_new();
+        int err = compile_program(c, p);
+        assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+        struct bytecode *bc = get_bytecode(c);
+        struct vm *vm = vm_new(bc);
+        assertf(vm != NULL, "invalid bytecode: %s", verifier_error_str(verify_bytecode(bc)));
+        err = vm_run(vm);
+        assertf(err == tests[t].expected_err, "wrong vm error: expected %d, got %d", tests[t].expected_err, err);
+        if (err == 0) {
+            test_object(vm_stack_last_popped(vm), OBJ_INT, (union object_value) { .integer = tests[t].expected });
+        }
+
+        free(bc);
+        vm_free(vm);
+        compiler_free(c);
+        free_program(p);
+    }
+}
+
+int run_vm_error_test(char *program_str, unsigned int stack_limit) {
+    struct compiler *c = compiler_new();
+    struct program *p = compile_test_program(c, program_str);
+    struct bytecode *bc = get_bytecode(c);
+    struct vm *vm = vm_new(bc);
+    assertf(vm != NULL, "invalid bytecode: %s", verifier_error_str(verify_bytecode(bc)));
+    if (stack_limit > 0) {
+        vm_set_stack_limit(vm, stack_limit);
+    }
+    int err = vm_run(vm);
+
+    free(bc);
+    vm_free(vm);
+    compiler_free(c);
+    free_program(p);
+    return err;
+}
+
+void test_calling_functions_with_wrong_arguments() {
+    TESTNAME(__FUNCTION__);
+    char *tests[] = {
+        "fn() { 1; }(1);",
+        "fn(a) { a; }();",
+        "let n = 1; let apply = fn(f) { f(n) }; apply(fn(a, b) { a + b; });",
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        int err = run_vm_error_test(tests[t], 0);
+        assertf(err == 5, "expected wrong argument count error, got %d", err);
+     }
+}
+
+void test_calling_non_functions() {
+    TESTNAME(__FUNCTION__);
+    char *tests[] = {
+        "1();",
+        // 0 has the same bits as the empty key of a call site that was never used
+        "let apply = fn(f) { f() }; apply(0);",
+        "let n = 1; let apply = fn(f) { f() }; apply(fn() { 1 }); apply(n);",
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        int err = run_vm_error_test(tests[t], 0);
+        assertf(err == 1, "test %d: expected invalid operand type error, got %d", t, err);
+     }
+}
+
+void test_calling_functions_that_do_not_compile() {
+    TESTNAME(__FUNCTION__);
+    struct {
+        char *input;
+        char *function;
+    } tests[] = {
+        {"let n = 1; let f = fn(x) { [x] }; f(n);", "f"},
+        {"let n = 1; let apply = fn(f, x) { f(x) }; apply(fn(x) { [x] }, n);", NULL},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        struct compiler *c = compiler_new();
+        struct program *p = compile_test_program(c, tests[t].input);
+        struct bytecode *bc = get_bytecode(c);
+        struct vm *vm = vm_new(bc);
+        int err = vm_run(vm);
+        assertf(err == 6, "expected invalid function error, got %d", err);
+
+        // the VM keeps what the compiler had to say about the function
+        assertf(vm->compile_error == COMPILE_ERR_UNKNOWN_EXPR_TYPE, "expected unknown expression type error, got %s", compiler_error_str(vm->compile_error));
+        if (tests[t].function != NULL) {
+            assertf(vm->compile_error_function != NULL && strcmp(vm->compile_error_function, tests[t].function) == 0, "expected error in function %s, got %s", tests[t].function, vm->compile_error_function);
+        } else {
+            assertf(vm->compile_error_function == NULL, "expected error in anonymous function, got %s", vm->compile_error_function);
+        }
+
+        free(bc);
+        vm_free(vm);
+        compiler_free(c);
+        free_program(p);
+     }
+}
+
+void test_deep_recursion() {
+    TESTNAME(__FUNCTION__);
+    struct {
+        char *input;
+        int expected;
+    } tests[] = {
+        {"let n = 100000; let f = fn(x) { if (x == 0) { return 0; } 1 + f(x - 1) }; f(n);", 100000},
+        {"let n = 100000; let f = fn(g, x) { if (x == 0) { return 0; } 1 + g(g, x - 1) }; f(f, n);", 100000},
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        struct object obj = run_vm_test(tests[t].input);
+        test_object(obj, OBJ_INT, (union object_value) { .integer = tests[t].expected });
+     }
+}
+
+void test_stack_overflow() {
+    TESTNAME(__FUNCTION__);
+    char *tests[] = {
+        "let n = 100000; let f = fn(x) { if (x == 0) { return 0; } 1 + f(x - 1) }; f(n);",
+        "let n = 100000; let f = fn(g, x) { if (x == 0) { return 0; } 1 + g(g, x - 1) }; f(f, n);",
+        // runs out of frames before it uses up the value stack
+        "let f = fn() { f() }; f();",
+    };
+
+    for (int t=0; t < ARRAY_SIZE(tests); t++) {
+        int err = run_vm_error_test(tests[t], 10000);
+        assertf(err == 4, "expected stack overflow error, got %d", err);
+     }
+}
+
+// appends formatted text to a growing source buffer
+static void source_printf(char **buf, size_t *size, size_t *cap, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    if (*size + n + 1 > *cap) {
+        *cap = (*size + n + 1) * 2;
+        *buf = realloc(*buf, *cap);
+        assertf(*buf != NULL, "out of memory");
+    }
+
+    va_start(args, fmt);
+    vsnprintf(*buf + *size, n + 1, fmt, args);
+    va_end(args);
+    *size += n;
+}
+
+// identifiers can not contain digits, so spell out i in letters
+static char *letters(char *buf, int i) {
+    int n = 0;
+    do {
+        buf[n++] = 'a' + i % 26;
+        i /= 26;
+    } while (i > 0);
+    buf[n] = '\0';
+    return buf;
+}
+
+void test_wide_operands() {
+    TESTNAME(__FUNCTION__);
+    char *input = NULL;
+    size_t size = 0;
+    size_t cap = 0;
+    char name[8];
+
+    // more globals and constants than fit a 16-bit operand
+    for (int i = 0; i < 70000; i++) {
+        source_printf(&input, &size, &cap, "let g%s = %d; ", letters(name, i), i);
+    }
+    source_printf(&input, &size, &cap, "g%s + ", letters(name, 0));
+    source_printf(&input, &size, &cap, "g%s", letters(name, 69999));
+    struct object obj = run_vm_test(input);
+    test_object(obj, OBJ_INT, (union object_value) { .integer = 69999 });
+
+    // more locals than fit an 8-bit operand
+    size = 0;
+    source_printf(&input, &size, &cap, "let f = fn() { ");
+    for (int i = 0; i < 300; i++) {
+        source_printf(&input, &size, &cap, "let l%s = %d; ", letters(name, i), i);
+    }
+    int used[] = {0, 255, 256, 299};
+    for (int i = 0; i < ARRAY_SIZE(used); i++) {
+        source_printf(&input, &size, &cap, "l%s + ", letters(name, used[i]));
+    }
+    source_printf(&input, &size, &cap, "0 }; f();");
+    obj = run_vm_test(input);
+    test_object(obj, OBJ_INT, (union object_value) { .integer = 810 });
+
+    // jumps across more than 64KB of bytecode
+    size = 0;
+    source_printf(&input, &size, &cap, "let f = fn(x) { if (x) { ");
+    for (int i = 0; i < 20000; i++) {
+        source_printf(&input, &size, &cap, "%d; ", i);
+    }
+    source_printf(&input, &size, &cap, "1 } else { 2 } }; f(false) * 10 + f(true);");
+    obj = run_vm_test(input);
+    test_object(obj, OBJ_INT, (union object_value) { .integer = 21 });
+
+    free(input);
+}
+
+void test_jump_relaxation() {
+    TESTNAME(__FUNCTION__);
+    char *input = NULL;
+    size_t size = 0;
+    size_t cap = 0;
+
+    // the outer jumps span too many bytes for their short forms, the inner ones do not
+    source_printf(&input, &size, &cap, "let f = fn(x, y) { if (x) { let a = if (y) { 1 } else { 2 }; ");
+    for (int i = 0; i < 100; i++) {
+        source_printf(&input, &size, &cap, "y; ");
+    }
+    source_printf(&input, &size, &cap, "a } else { if (y) { 3 } else { 4 } } }; ");
+    source_printf(&input, &size, &cap, "f(true, true) * 1000 + f(true, false) * 100 + f(false, true) * 10 + f(false, false)");
+    struct object obj = run_vm_test(input);
+    test_object(obj, OBJ_INT, (union object_value) { .integer = 1234 });
+
+    free(input);
+}
+
 void test_string_expressions() {
     TESTNAME(__FUNCTION__);
 
@@ -320,18 +697,35 @@ void test_string_expressions() {
 }
 
 int main() {
-    test_integer_arithmetic();
-    test_boolean_expressions();
-    test_conditionals();
-    test_nulls();
-    test_global_let_statements();
-    test_function_calls();
-    test_functions_without_return_value();
-    test_first_class_functions();
-    test_function_calls_with_bindings();
-    test_function_calls_with_args_and_bindings();
-    test_recursive_functions();
-    test_fib();
-    test_string_expressions();
+    // the tests run once with the AST and once with the single-pass compiler
+    for (int i=0; i < 2; i++) {
+        single_pass = i == 1;
+        test_integer_arithmetic();
+        test_boolean_expressions();
+        test_conditionals();
+        test_nulls();
+        test_global_let_statements();
+        test_function_calls();
+        test_functions_without_return_value();
+        test_first_class_functions();
+        test_function_calls_with_bindings();
+        test_function_calls_with_args_and_bindings();
+        test_recursive_functions();
+        test_fib();
+        test_constant_function_calls();
+        test_direct_function_calls();
+        test_indirect_function_calls();
+        test_lazy_functions();
+        test_functions_see_globals_bound_at_their_literal();
+        test_calling_functions_with_wrong_arguments();
+        test_calling_non_functions();
+    test_calling_functions_that_do_not_compile();
+        test_deep_recursion();
+        test_stack_overflow();
+        test_wide_operands();
+        test_jump_relaxation();
+        test_string_expressions();
+    }
+    test_pre_parsed_functions();
     printf("\x1b[32mAll vm tests passed!\033[0m\n");
-}
\ No newline at end of file
+}